@@ -0,0 +1,146 @@
+#include "main.h"
+#include "database.h"
+
+// Insert throughput: per-batch prepare (previous code) vs. cached multi-row
+// handle, writing sensor_data directly (rollups included) and appending to
+// the staging table. The gateway folds staged rows while the writer is
+// idle, so the fold is timed on its own; "sustained" pays for both, as a
+// writer that never gets idle time would.
+//   Usage: db_bench [total_rows] [db_dir]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define DEFAULT_TOTAL_ROWS 100000
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_packets(sensor_packet_t *pkts, size_t count){
+    int64_t base = (int64_t)time(NULL) * 1000;
+    for(size_t i = 0; i < count; i++){
+        pkts[i].id = 1 + (i % 50);
+        pkts[i].type = 1 + (i % 3);
+        pkts[i].value = 15.0 + (rand() % 2000) / 100.0;
+        pkts[i].ts_ms = base + (int64_t)(i / 50);
+    }
+}
+
+// Previous implementation: prepare per batch, datetime() per row
+static int legacy_insert_batch(sqlite3 *db, sensor_packet_t *packets, size_t count){
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if(rc != SQLITE_OK) return rc;
+
+    sqlite3_stmt *stmt = NULL;
+    rc = sqlite3_prepare_v2(db,
+        "INSERT INTO sensor_data(id, type, value, ts) "
+        "VALUES (?1, ?2, ?3, datetime(?4, 'unixepoch'));", -1, &stmt, NULL);
+    if(rc != SQLITE_OK){
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return rc;
+    }
+
+    for(size_t i = 0; i < count; i++){
+        sqlite3_bind_int(stmt, 1, packets[i].id);
+        sqlite3_bind_int(stmt, 2, packets[i].type);
+        sqlite3_bind_double(stmt, 3, packets[i].value);
+        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)(packets[i].ts_ms / 1000));
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    return sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+}
+
+static double bench_legacy(const char *path, sensor_packet_t *pkts, size_t total, size_t batch){
+    unlink(path);
+    sqlite3 *db = NULL;
+    if(sqlite3_open(path, &db) != SQLITE_OK) return 0;
+    sqlite3_exec(db,
+        "CREATE TABLE IF NOT EXISTS sensor_data(id INTEGER, type INTEGER, value REAL, "
+        "ts DATETIME DEFAULT CURRENT_TIMESTAMP);"
+        "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;"
+        "PRAGMA cache_size=-64000; PRAGMA temp_store=MEMORY;", NULL, NULL, NULL);
+
+    double start = now_sec();
+    for(size_t done = 0; done < total; done += batch){
+        size_t n = (total - done < batch) ? total - done : batch;
+        if(legacy_insert_batch(db, pkts + done, n) != SQLITE_OK){
+            fprintf(stderr, "legacy insert failed: %s\n", sqlite3_errmsg(db));
+            break;
+        }
+    }
+    double elapsed = now_sec() - start;
+
+    sqlite3_close(db);
+    return total / elapsed;
+}
+
+// Returns rows/s of the inserts; *fold_sec gets the time db_close takes
+// to fold what is staged
+static double bench_handle(const char *path, sensor_packet_t *pkts, size_t total, size_t batch, size_t stage_rows,
+                           double *fold_sec){
+    unlink(path);
+    db_handle_t *h = NULL;
+    if(db_init_and_open(&h, path) != SQLITE_OK) return 0;
+    db_set_stage_rows(h, stage_rows);
+
+    double start = now_sec();
+    for(size_t done = 0; done < total; done += batch){
+        size_t n = (total - done < batch) ? total - done : batch;
+        if(db_insert_measures_batch(h, pkts + done, n) != SQLITE_OK){
+            fprintf(stderr, "handle insert failed\n");
+            break;
+        }
+    }
+    double elapsed = now_sec() - start;
+    db_close(h);
+    *fold_sec = now_sec() - start - elapsed;
+
+    return total / elapsed;
+}
+
+int main(int argc, char **argv){
+    size_t total = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_TOTAL_ROWS;
+    const char *dir = (argc > 2) ? argv[2] : "/tmp";
+    if(total == 0){
+        fprintf(stderr, "Usage: %s [total_rows] [db_dir]\n", argv[0]);
+        return 1;
+    }
+
+    sensor_packet_t *pkts = malloc(total * sizeof(*pkts));
+    if(!pkts){
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    fill_packets(pkts, total);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/db_bench.db", dir);
+
+    static const size_t batch_sizes[] = {10, 100, 1000};
+    printf("%-8s %14s %14s %14s %8s %12s %14s\n", "batch", "legacy rows/s", "direct rows/s", "staged rows/s",
+           "speedup", "fold us/row", "sustained/s");
+    for(size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++){
+        double fold_sec;
+        double legacy = bench_legacy(path, pkts, total, batch_sizes[i]);
+        double direct = bench_handle(path, pkts, total, batch_sizes[i], 0, &fold_sec);
+        // Nothing folds before close: all of it is timed as the fold
+        double staged = bench_handle(path, pkts, total, batch_sizes[i], total + 1, &fold_sec);
+        double sustained = (staged > 0) ? total / (total / staged + fold_sec) : 0.0;
+        printf("%-8zu %14.0f %14.0f %14.0f %7.2fx %12.2f %14.0f\n", batch_sizes[i], legacy, direct, staged,
+               legacy > 0 ? staged / legacy : 0.0, fold_sec * 1e6 / total, sustained);
+    }
+
+    unlink(path);
+    free(pkts);
+    return 0;
+}
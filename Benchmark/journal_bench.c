@@ -0,0 +1,101 @@
+#include "main.h"
+#include "journal.h"
+
+// Ingest journal throughput at several group-commit intervals.
+// Point work_dir at the SD card to measure the real medium.
+//   Usage: journal_bench [total_packets] [work_dir]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define DEFAULT_TOTAL_PACKETS 500000
+#define BENCH_THREADS 4
+
+// Stand-in for the sbuffer mutex that serialises appends in the gateway
+static pthread_mutex_t ingest_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct{
+    int id;
+    size_t count;
+} worker_arg_t;
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *append_worker(void *arg){
+    worker_arg_t *w = arg;
+    int64_t ts = (int64_t)time(NULL) * 1000;
+
+    for(size_t i = 0; i < w->count; i++){
+        sensor_packet_t pkt = {
+            .id = (uint8_t)(1 + w->id),
+            .type = 1,
+            .value = 20.0 + (double)(i % 500) / 100.0,
+            .ts_ms = ts + (int64_t)i
+        };
+        pthread_mutex_lock(&ingest_mutex);
+        journal_append(&pkt);
+        pthread_mutex_unlock(&ingest_mutex);
+    }
+    return NULL;
+}
+
+static void count_replay(void *ctx, sensor_packet_t *pkt){
+    (void)pkt;
+    (*(size_t *)ctx)++;
+}
+
+int main(int argc, char **argv){
+    size_t total = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_TOTAL_PACKETS;
+    const char *work = (argc > 2) ? argv[2] : "/tmp";
+    if(total < BENCH_THREADS) total = DEFAULT_TOTAL_PACKETS;
+
+    static const int intervals[] = { 10, 50, 200, 1000 };
+    char dir[512], cmd[600];
+    snprintf(dir, sizeof(dir), "%s/journal_bench.%d", work, (int)getpid());
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+
+    printf("%zu packets, %d appender threads, %s\n", total, BENCH_THREADS, work);
+    printf("%-10s %14s %14s %10s\n", "sync_ms", "append pkt/s", "durable pkt/s", "replayed");
+
+    for(size_t k = 0; k < sizeof(intervals) / sizeof(intervals[0]); k++){
+        if(system(cmd) != 0) return 1;
+        if(journal_open(dir, intervals[k]) != 0){
+            fprintf(stderr, "journal_open failed\n");
+            return 1;
+        }
+
+        pthread_t th[BENCH_THREADS];
+        worker_arg_t args[BENCH_THREADS];
+        double t0 = now_sec();
+        for(int i = 0; i < BENCH_THREADS; i++){
+            args[i].id = i;
+            args[i].count = total / BENCH_THREADS;
+            pthread_create(&th[i], NULL, append_worker, &args[i]);
+        }
+        for(int i = 0; i < BENCH_THREADS; i++){
+            pthread_join(th[i], NULL);
+        }
+        double t1 = now_sec();
+        journal_close();
+        double t2 = now_sec();
+
+        // Nothing was checkpointed, so every packet must come back
+        size_t replayed = 0;
+        journal_open(dir, intervals[k]);
+        journal_replay(count_replay, &replayed);
+        journal_close();
+
+        size_t written = (total / BENCH_THREADS) * BENCH_THREADS;
+        printf("%-10d %14.0f %14.0f %10zu%s\n", intervals[k], written / (t1 - t0), written / (t2 - t0),
+               replayed, replayed == written ? "" : "  MISMATCH");
+    }
+
+    if(system(cmd) != 0) return 1;
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "main.h"
+#include "logger.h"
+#include "binlog.h"
+
+// log_event cost per call with several threads logging at once: writing
+// to the FIFO directly (one lock and one write per line) against the
+// per-thread rings with either full-ring policy, each with text lines and
+// with binary records (log_format = binary). A child process stands in
+// for the logger and counts the lines or events that arrive; reader_delay_us
+// slows it down after every read, as a logger stuck on a slow SD card would be.
+// The last row runs the per-packet line with CLIENT below trace, the cost
+// of a filtered call.
+//   Usage: log_bench [threads] [lines_per_thread] [reader_delay_us]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = NULL;
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_LINES 200000
+#define BENCH_RING_BYTES (64 * 1024)
+
+typedef enum{ MODE_DIRECT, MODE_RING_DROP, MODE_RING_BLOCK, MODE_FILTERED } bench_mode_t;
+
+typedef struct{
+    int id;
+    size_t lines;
+    int packet_line;            // the client thread's per-packet line, else a constant one
+    double ns_per_call;
+} worker_arg_t;
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *log_worker(void *arg){
+    worker_arg_t *w = arg;
+    double start = now_sec();
+    if(w->packet_line){
+        for(size_t i = 0; i < w->lines; i++){
+            LOG_TRACE(CLIENT, "Received data ID %d type %d value %.2f from %s:%d", w->id, 1,
+                      20.0 + (double)(i % 500) / 100.0, "127.0.0.1", 40000 + w->id);
+        }
+    }
+    else{
+        for(size_t i = 0; i < w->lines; i++){
+            LOG_INFO(DATA, "Buffer drained, waiting for packets");
+        }
+    }
+    w->ns_per_call = (now_sec() - start) * 1e9 / (double)w->lines;
+    return NULL;
+}
+
+// Helper: the logger stand-in; counts lines (or EVENT records) until EOF
+// and reports them on result_fd
+static void run_reader(int ready_fd, int result_fd, int delay_us, int binary){
+    char ok = LOGGER_READY_BYTE;
+    write(ready_fd, &ok, 1);
+    close(ready_fd);
+
+    int fd = open(fifo_path, O_RDONLY);
+    if(fd < 0) _exit(EXIT_FAILURE);
+
+    static char buf[LOGGER_READ_MAX + BINLOG_RECORD_MAX];
+    unsigned long long lines = 0;
+    size_t have = 0;
+    ssize_t r;
+    while((r = read(fd, buf + have, LOGGER_READ_MAX)) > 0){
+        if(!binary){
+            for(ssize_t i = 0; i < r; i++) lines += (buf[i] == '\n');
+        }
+        else{
+            // Walk the record headers, a partial record waits for the next read
+            have += (size_t)r;
+            size_t at = 0;
+            int len;
+            while((len = binlog_record_length((uint8_t *)buf + at, have - at)) > 0){
+                lines += (buf[at + 2] == BINLOG_EVENT);
+                at += (size_t)len;
+            }
+            if(len < 0) _exit(EXIT_FAILURE);
+            memmove(buf, buf + at, have - at);
+            have -= at;
+        }
+        if(delay_us > 0) usleep(delay_us);
+    }
+    write(result_fd, &lines, sizeof(lines));
+    _exit(0);
+}
+
+static void run_case(bench_mode_t mode, int binary, int packet_line, int threads, size_t lines, int delay_us){
+    static const char *mode_names[] = { "direct", "ring/drop", "ring/block", "filtered" };
+    int ready[2], result[2];
+    if(pipe(ready) != 0 || pipe(result) != 0){
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if(pid == 0){
+        close(ready[0]);
+        close(result[0]);
+        run_reader(ready[1], result[1], delay_us, binary);
+    }
+    close(ready[1]);
+    close(result[1]);
+    if(logger_wait_ready(ready[0], LOGGER_READY_TIMEOUT_MS) != 0){
+        fprintf(stderr, "reader did not start\n");
+        exit(EXIT_FAILURE);
+    }
+    log_set_binary(binary);
+    log_levels_apply((mode == MODE_FILTERED) ? "CLIENT=info" : "CLIENT=trace");
+    if(mode == MODE_RING_DROP || mode == MODE_RING_BLOCK){
+        log_ring_start(BENCH_RING_BYTES, mode == MODE_RING_BLOCK);
+    }
+    unsigned long long dropped_before = log_ring_dropped();
+
+    pthread_t tid[threads];
+    worker_arg_t args[threads];
+    double start = now_sec();
+    for(int i = 0; i < threads; i++){
+        args[i] = (worker_arg_t){ .id = i + 1, .lines = lines, .packet_line = packet_line };
+        pthread_create(&tid[i], NULL, log_worker, &args[i]);
+    }
+    double ns = 0;
+    for(int i = 0; i < threads; i++){
+        pthread_join(tid[i], NULL);
+        ns += args[i].ns_per_call;
+    }
+    double calls_elapsed = now_sec() - start;
+
+    // Stops the drain after it emptied the rings, then EOF for the reader
+    close_logger_process();
+    double drained_elapsed = now_sec() - start;
+    unsigned long long delivered = 0;
+    read(result[0], &delivered, sizeof(delivered));
+    close(result[0]);
+    waitpid(pid, NULL, 0);
+
+    unsigned long long total = (unsigned long long)threads * lines;
+    printf("%-10s %-6s %-8s %10.0f %12.2f %12.2f %10llu %10llu\n", mode_names[mode], binary ? "binary" : "text",
+           packet_line ? "packet" : "const",
+           ns / threads, total / calls_elapsed / 1e6, total / drained_elapsed / 1e6, delivered,
+           log_ring_dropped() - dropped_before);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv){
+    int threads = (argc > 1) ? atoi(argv[1]) : DEFAULT_THREADS;
+    size_t lines = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_LINES;
+    int delay_us = (argc > 3) ? atoi(argv[3]) : 0;
+    if(threads < 1) threads = DEFAULT_THREADS;
+    if(lines == 0) lines = DEFAULT_LINES;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/log_bench.%d.fifo", (int)getpid());
+    if(mkfifo(path, 0600) != 0){
+        perror("mkfifo");
+        return 1;
+    }
+    fifo_path = path;
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d threads x %zu lines, reader delay %d us per read\n", threads, lines, delay_us);
+    printf("%-10s %-6s %-8s %10s %12s %12s %10s %10s\n", "mode", "format", "line", "ns/call", "Mcalls/s",
+           "Mlines/s", "delivered", "dropped");
+    for(int packet_line = 0; packet_line <= 1; packet_line++){
+        for(int binary = 0; binary <= 1; binary++){
+            run_case(MODE_DIRECT, binary, packet_line, threads, lines, delay_us);
+            run_case(MODE_RING_DROP, binary, packet_line, threads, lines, delay_us);
+            run_case(MODE_RING_BLOCK, binary, packet_line, threads, lines, delay_us);
+        }
+    }
+    run_case(MODE_FILTERED, 0, 1, threads, lines, delay_us);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "main.h"
+#include "binlog.h"
+
+// Renders a binary log (log_format = binfile) as text, one line per event
+// with microsecond timestamps; sessions are numbered from the start of
+// the file, one per gateway run.
+//   Usage: log_decode [-t] [file|-]       -t adds the thread id
+
+#define DECODE_READ_MAX 65536
+
+static int show_tid = 0;
+static unsigned long long events = 0;
+static unsigned long long bad = 0;
+
+// Helper: "YYYY-mm-dd HH:MM:SS.uuuuuu", local time
+static void format_ts(int64_t ts_us, char *out, size_t len){
+    time_t sec = (time_t)(ts_us / 1000000);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    size_t n = strftime(out, len, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(out + n, len - n, ".%06lld", (long long)(ts_us % 1000000));
+}
+
+static void print_entry(const binlog_entry_t *e, int session){
+    char ts[48];
+    format_ts(e->ts_us, ts, sizeof(ts));
+    if(e->kind == BINLOG_SESSION){
+        printf("=== session %d, gateway pid %u, logger started %s ===\n", session, e->pid, ts);
+    }
+    else if(e->kind == BINLOG_EVENT){
+        if(show_tid){
+            printf("%llu %s [TID:%u] %s\n", events, ts, e->tid, e->text);
+        }
+        else{
+            printf("%llu %s %s\n", events, ts, e->text);
+        }
+        events++;
+    }
+}
+
+int main(int argc, char **argv){
+    const char *path = LOG_BIN_FILE;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-t") == 0){
+            show_tid = 1;
+        }
+        else if(argv[i][0] == '-' && argv[i][1] != '\0'){
+            fprintf(stderr, "Usage: %s [-t] [file|-]\n", argv[0]);
+            return 1;
+        }
+        else{
+            path = argv[i];
+        }
+    }
+
+    int fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
+        return 1;
+    }
+
+    static uint8_t buf[DECODE_READ_MAX + BINLOG_RECORD_MAX];
+    static binlog_table_t table;
+    static binlog_entry_t entry;
+    binlog_table_reset(&table);
+    size_t have = 0;
+    int session = 0;
+    unsigned long long offset = 0;     // of buf[0] in the file
+
+    ssize_t r;
+    while((r = read(fd, buf + have, DECODE_READ_MAX)) > 0){
+        have += (size_t)r;
+        size_t at = 0;
+
+        while(at < have){
+            int len = binlog_record_length(buf + at, have - at);
+            if(len == 0) break;
+            if(len < 0){
+                // A torn write at a crash: resync on the next byte
+                bad++;
+                at++;
+                continue;
+            }
+            if(binlog_apply(&table, buf + at, (size_t)len, &entry) != 0){
+                fprintf(stderr, "offset %llu: undecodable record (kind %d, %d bytes)\n",
+                        offset + at, buf[at + 2], len);
+                bad++;
+            }
+            else{
+                if(entry.kind == BINLOG_SESSION) session++;
+                print_entry(&entry, session);
+            }
+            at += (size_t)len;
+        }
+        memmove(buf, buf + at, have - at);
+        have -= at;
+        offset += at;
+    }
+    if(r < 0) perror("read");
+    if(have > 0){
+        fprintf(stderr, "%zu bytes of a partial record at the end\n", have);
+    }
+    if(fd != STDIN_FILENO) close(fd);
+    binlog_table_reset(&table);
+
+    fprintf(stderr, "%llu events, %d sessions, %llu bad records\n", events, session, bad);
+    return (bad == 0 && r == 0) ? 0 : 2;
+}
@@ -0,0 +1,867 @@
+#include "main.h"
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <zlib.h>
+
+// Offline harness for the cloud path: a minimal MQTT 3.1.1 broker, a
+// subscriber for a real broker, and a publisher for load. Every PUBLISH
+// seen is checked (JSON, CBOR, or either one deflated) and counted, and
+// its age is taken from the first "ts" (ms) or "timestamp" (s) in it:
+// publish-to-receive for gateway stats and pub payloads, sample age for
+// raw windows. One line per interval, a summary at the end.
+//
+//   mqtt_bench serve [-p port] [-a ack_ms] [-j jitter_ms] [-r restart_every_s]
+//                    [-o down_s] [-t seconds] [-i interval_s]
+//       In-process broker. PUBACK after ack_ms (+ up to jitter_ms), so the
+//       gateway's publish window sees link latency. Every restart_every_s
+//       (or on SIGUSR1) all connections are dropped and the port stays
+//       closed for down_s, then the time to the first reconnect is shown.
+//       Publishes are forwarded to subscribers at QoS 0.
+//   mqtt_bench sub [-h host] [-p port] [-f filter] [-t seconds] [-i interval_s]
+//       Subscribe to a real broker, e.g. mosquitto -p 1884, and check
+//       what the gateway publishes there; reconnects if the broker restarts.
+//   mqtt_bench pub [-h host] [-p port] [-n msgs_per_s] [-s bytes] [-w window]
+//                  [-c topic] [-t seconds] [-i interval_s]
+//       QoS 1 load with at most window unacknowledged; ages are PUBACK
+//       round trips.
+//
+// Point the gateway at it with mqtt_host / mqtt_port in gateway.conf.
+
+#define MQTT_BENCH_PORT 1883
+#define MQTT_PACKET_MAX (4 << 20)       // larger packets close the connection
+#define MQTT_MAX_CONNS 128
+#define MQTT_MAX_FILTERS 8
+#define MQTT_ACK_MAX 1024               // delayed PUBACKs per connection
+#define MQTT_KEEPALIVE_S 30
+#define AGE_BUCKETS 10001               // 1 ms each, the last one is open ended
+#define INVALID_SHOWN 5
+#define INFLATE_MAX (16 << 20)
+
+enum{
+    MQTT_CONNECT = 1, MQTT_CONNACK, MQTT_PUBLISH, MQTT_PUBACK, MQTT_PUBREC, MQTT_PUBREL,
+    MQTT_PUBCOMP, MQTT_SUBSCRIBE, MQTT_SUBACK, MQTT_UNSUBSCRIBE, MQTT_UNSUBACK,
+    MQTT_PINGREQ, MQTT_PINGRESP, MQTT_DISCONNECT
+};
+
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t restart_now = 0;
+
+static void on_signal(int sig){
+    if(sig == SIGUSR1) restart_now = 1;
+    else stop = 1;
+}
+
+static int64_t mono_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t wall_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ===========================
+ *   Measurements
+ * =========================== */
+
+typedef struct{
+    unsigned long long msgs;
+    unsigned long long bytes;
+    unsigned long long invalid;
+    unsigned long long dups;
+    unsigned long long aged;
+    unsigned long long age[AGE_BUCKETS];
+} meter_t;
+
+static meter_t interval_m, total_m;
+static uint8_t *inflate_buf = NULL;
+
+static void meter_add(meter_t *m, size_t bytes, int valid, int dup, int64_t age){
+    m->msgs++;
+    m->bytes += bytes;
+    m->invalid += !valid;
+    m->dups += dup;
+    if(age >= 0){
+        m->age[(age < AGE_BUCKETS - 1) ? age : AGE_BUCKETS - 1]++;
+        m->aged++;
+    }
+}
+
+static long age_pct(const meter_t *m, double p){
+    if(m->aged == 0) return -1;
+    unsigned long long want = (unsigned long long)(p * m->aged);
+    if(want >= m->aged) want = m->aged - 1;
+    unsigned long long seen = 0;
+    for(long b = 0; b < AGE_BUCKETS; b++){
+        seen += m->age[b];
+        if(seen > want) return b;
+    }
+    return AGE_BUCKETS - 1;
+}
+
+static long age_max(const meter_t *m){
+    for(long b = AGE_BUCKETS - 1; b >= 0; b--){
+        if(m->age[b]) return b;
+    }
+    return -1;
+}
+
+static void meter_print(const char *label, const meter_t *m, double secs, int conns){
+    printf("%-8s %9.1f %11.1f %8llu %6llu %5d %7ld %7ld %7ld\n", label, m->msgs / secs, m->bytes / secs,
+           m->invalid, m->dups, conns, age_pct(m, 0.5), age_pct(m, 0.99), age_max(m));
+    fflush(stdout);
+}
+
+static void meter_header(void){
+    printf("%-8s %9s %11s %8s %6s %5s %7s %7s %7s\n", "time_s", "msgs/s", "bytes/s", "invalid", "dup",
+           "conns", "age_p50", "age_p99", "age_max");
+}
+
+// Helper: a JSON document that closes where the payload ends
+static int json_ok(const uint8_t *p, size_t n){
+    if(n == 0 || p[0] != '{') return 0;
+    int depth = 0, in_str = 0;
+    for(size_t i = 0; i < n; i++){
+        uint8_t c = p[i];
+        if(in_str){
+            if(c == '\\') i++;
+            else if(c == '"') in_str = 0;
+            continue;
+        }
+        if(c == '"') in_str = 1;
+        else if(c == '{' || c == '[') depth++;
+        else if(c == '}' || c == ']'){
+            if(--depth == 0) return i == n - 1;
+        }
+    }
+    return 0;
+}
+
+// Helper: first "ts" (ms) or "timestamp" (s) in a JSON payload, -1 if none
+static int64_t json_stamp(const uint8_t *p, size_t n){
+    static const struct{ const char *key; int scale; } keys[] = { { "\"ts\":", 1 }, { "\"timestamp\":", 1000 } };
+    for(size_t k = 0; k < 2; k++){
+        size_t kl = strlen(keys[k].key);
+        for(size_t i = 0; i + kl < n; i++){
+            if(memcmp(p + i, keys[k].key, kl) != 0) continue;
+            int64_t v = 0;
+            size_t j = i + kl;
+            if(j >= n || p[j] < '0' || p[j] > '9') break;
+            while(j < n && p[j] >= '0' && p[j] <= '9') v = v * 10 + (p[j++] - '0');
+            return v * keys[k].scale;
+        }
+    }
+    return -1;
+}
+
+// Check and count one received payload; age_ms given, or -1 to read it
+// from the payload
+static void account(const char *topic, const uint8_t *p, size_t n, int dup, int64_t age_ms){
+    const uint8_t *body = p;
+    size_t body_len = n;
+    int valid;
+
+    if(n > 0 && p[0] == 0x78){
+        uLongf out = INFLATE_MAX;
+        valid = (inflate_buf && uncompress(inflate_buf, &out, p, (uLong)n) == Z_OK);
+        if(valid){
+            body = inflate_buf;
+            body_len = out;
+        }
+    }
+    if(body_len > 0 && body[0] == 0xbf){
+        valid = (body[body_len - 1] == 0xff);
+    }
+    else{
+        valid = json_ok(body, body_len);
+        if(valid && age_ms < 0){
+            int64_t ts = json_stamp(body, body_len);
+            if(ts > 0) age_ms = (wall_ms() > ts) ? wall_ms() - ts : 0;
+        }
+    }
+
+    if(!valid && total_m.invalid < INVALID_SHOWN){
+        printf("invalid payload on %s, %zu bytes:", topic, n);
+        for(size_t i = 0; i < n && i < 32; i++) printf(" %02x", p[i]);
+        printf("\n");
+    }
+    meter_add(&interval_m, n, valid, dup, age_ms);
+    meter_add(&total_m, n, valid, dup, age_ms);
+}
+
+/* ===========================
+ *   Packets
+ * =========================== */
+
+typedef struct{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} bytes_t;
+
+static int bytes_put(bytes_t *b, const void *src, size_t n){
+    if(b->len + n > b->cap){
+        size_t ncap = b->cap ? b->cap : 4096;
+        while(ncap < b->len + n) ncap *= 2;
+        uint8_t *g = realloc(b->data, ncap);
+        if(!g) return -1;
+        b->data = g;
+        b->cap = ncap;
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+    return 0;
+}
+
+static void bytes_consume(bytes_t *b, size_t n){
+    memmove(b->data, b->data + n, b->len - n);
+    b->len -= n;
+}
+
+// Helper: fixed header with the remaining length
+static void put_header(bytes_t *b, uint8_t first, size_t remaining){
+    uint8_t h[5];
+    size_t n = 0;
+    h[n++] = first;
+    do{
+        uint8_t d = remaining % 128;
+        remaining /= 128;
+        h[n++] = d | (remaining ? 0x80 : 0);
+    }while(remaining && n < 5);
+    bytes_put(b, h, n);
+}
+
+static void put_u16(bytes_t *b, unsigned v){
+    uint8_t x[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    bytes_put(b, x, 2);
+}
+
+static void put_str(bytes_t *b, const char *s){
+    put_u16(b, (unsigned)strlen(s));
+    bytes_put(b, s, strlen(s));
+}
+
+// Helper: complete packet at the front of in; 1 with type, flags, body and
+// total length, 0 if more bytes are needed, -1 if malformed or too large
+static int next_packet(const bytes_t *in, uint8_t *type, uint8_t *flags, const uint8_t **body,
+                       size_t *body_len, size_t *total){
+    if(in->len < 2) return 0;
+    size_t rem = 0, mult = 1, i = 1;
+    for(;;){
+        if(i >= in->len) return 0;
+        uint8_t d = in->data[i++];
+        rem += (d & 0x7f) * mult;
+        if(!(d & 0x80)) break;
+        mult *= 128;
+        if(i > 4) return -1;
+    }
+    if(rem > MQTT_PACKET_MAX) return -1;
+    if(in->len < i + rem) return 0;
+    *type = in->data[0] >> 4;
+    *flags = in->data[0] & 0x0f;
+    *body = in->data + i;
+    *body_len = rem;
+    *total = i + rem;
+    return 1;
+}
+
+static unsigned get_u16(const uint8_t *p){
+    return (unsigned)p[0] << 8 | p[1];
+}
+
+// Helper: topic, packet id and payload of a PUBLISH body; -1 if malformed
+static int parse_publish(uint8_t flags, const uint8_t *b, size_t n, char *topic, size_t topic_max,
+                         unsigned *id, const uint8_t **payload, size_t *payload_len){
+    if(n < 2) return -1;
+    size_t tl = get_u16(b);
+    size_t pos = 2 + tl;
+    if(pos > n) return -1;
+    snprintf(topic, topic_max, "%.*s", (int)tl, (const char *)b + 2);
+    *id = 0;
+    if((flags >> 1) & 3){
+        if(pos + 2 > n) return -1;
+        *id = get_u16(b + pos);
+        pos += 2;
+    }
+    *payload = b + pos;
+    *payload_len = n - pos;
+    return 0;
+}
+
+// Helper: MQTT topic filter match with + and #
+static int topic_match(const char *filter, const char *topic){
+    while(*filter){
+        if(*filter == '#') return 1;
+        if(*filter == '+'){
+            while(*topic && *topic != '/') topic++;
+            filter++;
+            continue;
+        }
+        if(*filter != *topic) return 0;
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+// Helper: write all of b, blocking; -1 if the peer is gone
+static int send_all(int fd, bytes_t *b){
+    size_t off = 0;
+    while(off < b->len){
+        ssize_t w = send(fd, b->data + off, b->len - off, MSG_NOSIGNAL);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0) return -1;
+        off += (size_t)w;
+    }
+    b->len = 0;
+    return 0;
+}
+
+/* ===========================
+ *   Broker stand-in
+ * =========================== */
+
+typedef struct{
+    int64_t due_ms;
+    uint16_t id;
+    uint8_t type;                       // PUBACK or PUBREC
+} delayed_ack_t;
+
+typedef struct{
+    int fd;
+    uint8_t connected;
+    bytes_t in;
+    bytes_t out;                        // not yet written, the socket is non-blocking
+    char filters[MQTT_MAX_FILTERS][128];
+    int n_filters;
+    delayed_ack_t acks[MQTT_ACK_MAX];
+    int n_acks;
+} conn_t;
+
+static struct{
+    int port;
+    int ack_ms;
+    int jitter_ms;
+    int restart_every_s;
+    int down_s;
+    int listen_fd;
+    conn_t *conns[MQTT_MAX_CONNS];
+    int n_conns;
+    int restarts;
+    int64_t reopened_ms;                // waiting for the first CONNECT after a restart
+} br = { .port = MQTT_BENCH_PORT, .listen_fd = -1 };
+
+static int broker_listen(void){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)br.port),
+                             .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if(bind(fd, (struct sockaddr *)&a, sizeof(a)) != 0 || listen(fd, 64) != 0){
+        perror("mqtt_bench: listen");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static void conn_close(int i){
+    conn_t *c = br.conns[i];
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+    br.conns[i] = br.conns[--br.n_conns];
+}
+
+static void conn_flush(conn_t *c){
+    while(c->out.len > 0){
+        ssize_t w = send(c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
+        if(w <= 0) return;
+        bytes_consume(&c->out, (size_t)w);
+    }
+}
+
+static void queue_ack(conn_t *c, uint8_t type, unsigned id, int64_t now){
+    int delay = br.ack_ms + (br.jitter_ms > 0 ? rand() % (br.jitter_ms + 1) : 0);
+    if(delay == 0 || c->n_acks == MQTT_ACK_MAX){
+        put_header(&c->out, (uint8_t)(type << 4), 2);
+        put_u16(&c->out, id);
+        return;
+    }
+    c->acks[c->n_acks++] = (delayed_ack_t){ .due_ms = now + delay, .id = (uint16_t)id, .type = type };
+}
+
+static void forward(const char *topic, const uint8_t *payload, size_t len){
+    for(int i = 0; i < br.n_conns; i++){
+        conn_t *s = br.conns[i];
+        for(int f = 0; f < s->n_filters; f++){
+            if(!topic_match(s->filters[f], topic)) continue;
+            put_header(&s->out, MQTT_PUBLISH << 4, 2 + strlen(topic) + len);
+            put_str(&s->out, topic);
+            bytes_put(&s->out, payload, len);
+            break;
+        }
+    }
+}
+
+// Helper: handle every complete packet of one connection; -1 to drop it
+static int conn_process(conn_t *c, int64_t now){
+    uint8_t type, flags;
+    const uint8_t *b;
+    size_t n, total;
+    int rc;
+    while((rc = next_packet(&c->in, &type, &flags, &b, &n, &total)) == 1){
+        switch(type){
+            case MQTT_CONNECT:{
+                static const uint8_t connack[4] = { MQTT_CONNACK << 4, 2, 0, 0 };
+                bytes_put(&c->out, connack, sizeof(connack));
+                c->connected = 1;
+                if(br.reopened_ms){
+                    printf("restart %d: first CONNECT %lld ms after the port reopened\n", br.restarts,
+                           (long long)(now - br.reopened_ms));
+                    br.reopened_ms = 0;
+                }
+                break;
+            }
+            case MQTT_PUBLISH:{
+                char topic[256];
+                unsigned id;
+                const uint8_t *payload;
+                size_t len;
+                if(parse_publish(flags, b, n, topic, sizeof(topic), &id, &payload, &len) != 0) return -1;
+                account(topic, payload, len, (flags >> 3) & 1, -1);
+                forward(topic, payload, len);
+                int qos = (flags >> 1) & 3;
+                if(qos == 1) queue_ack(c, MQTT_PUBACK, id, now);
+                else if(qos == 2) queue_ack(c, MQTT_PUBREC, id, now);
+                break;
+            }
+            case MQTT_PUBREL:
+                if(n < 2) return -1;
+                put_header(&c->out, MQTT_PUBCOMP << 4, 2);
+                put_u16(&c->out, get_u16(b));
+                break;
+            case MQTT_SUBSCRIBE:{
+                if(n < 2) return -1;
+                unsigned id = get_u16(b);
+                size_t pos = 2;
+                uint8_t granted[MQTT_MAX_FILTERS];
+                int k = 0;
+                while(pos + 2 <= n && k < MQTT_MAX_FILTERS){
+                    size_t fl = get_u16(b + pos);
+                    if(pos + 2 + fl + 1 > n) return -1;
+                    if(c->n_filters < MQTT_MAX_FILTERS){
+                        snprintf(c->filters[c->n_filters++], sizeof(c->filters[0]), "%.*s", (int)fl,
+                                 (const char *)b + pos + 2);
+                    }
+                    pos += 2 + fl + 1;
+                    granted[k++] = 0;
+                }
+                put_header(&c->out, MQTT_SUBACK << 4, 2 + (size_t)k);
+                put_u16(&c->out, id);
+                bytes_put(&c->out, granted, (size_t)k);
+                break;
+            }
+            case MQTT_PINGREQ:{
+                static const uint8_t pingresp[2] = { MQTT_PINGRESP << 4, 0 };
+                bytes_put(&c->out, pingresp, sizeof(pingresp));
+                break;
+            }
+            case MQTT_DISCONNECT:
+                return -1;
+            default:
+                break;                  // PUBACK etc. from subscribers: nothing is sent above QoS 0
+        }
+        bytes_consume(&c->in, total);
+    }
+    return rc;
+}
+
+// Helper: send the acks that are due; returns ms until the next one, or limit
+static int64_t acks_due(int64_t now, int64_t limit){
+    int64_t next = limit;
+    for(int i = 0; i < br.n_conns; i++){
+        conn_t *c = br.conns[i];
+        for(int k = 0; k < c->n_acks;){
+            if(c->acks[k].due_ms <= now){
+                put_header(&c->out, (uint8_t)(c->acks[k].type << 4), 2);
+                put_u16(&c->out, c->acks[k].id);
+                c->acks[k] = c->acks[--c->n_acks];
+                continue;
+            }
+            if(c->acks[k].due_ms - now < next) next = c->acks[k].due_ms - now;
+            k++;
+        }
+    }
+    return next;
+}
+
+static void broker_restart(int64_t now){
+    br.restarts++;
+    int dropped = br.n_conns;
+    while(br.n_conns > 0) conn_close(br.n_conns - 1);
+    if(br.listen_fd >= 0) close(br.listen_fd);
+    br.listen_fd = -1;
+    br.reopened_ms = 0;
+    printf("restart %d: %d connections dropped, port closed for %d s\n", br.restarts, dropped, br.down_s);
+    fflush(stdout);
+    (void)now;
+}
+
+static int run_serve(int seconds, int interval_s){
+    br.listen_fd = broker_listen();
+    if(br.listen_fd < 0) return 1;
+    printf("broker on port %d, ack %d ms (+%d jitter), restart every %d s for %d s\n", br.port, br.ack_ms,
+           br.jitter_ms, br.restart_every_s, br.down_s);
+    meter_header();
+
+    int64_t start = mono_ms(), last_report = start;
+    int64_t next_restart = br.restart_every_s ? start + br.restart_every_s * 1000LL : INT64_MAX;
+    int64_t reopen_at = 0;
+    while(!stop && (seconds == 0 || mono_ms() - start < seconds * 1000LL)){
+        int64_t now = mono_ms();
+        if((restart_now || now >= next_restart) && br.listen_fd >= 0){
+            restart_now = 0;
+            broker_restart(now);
+            reopen_at = now + br.down_s * 1000LL;
+            if(br.restart_every_s) next_restart = now + br.restart_every_s * 1000LL;
+        }
+        if(br.listen_fd < 0 && now >= reopen_at){
+            br.listen_fd = broker_listen();
+            br.reopened_ms = now;
+        }
+
+        struct pollfd pfd[MQTT_MAX_CONNS + 1];
+        int np = 0;
+        if(br.listen_fd >= 0) pfd[np++] = (struct pollfd){ .fd = br.listen_fd, .events = POLLIN };
+        for(int i = 0; i < br.n_conns; i++){
+            pfd[np++] = (struct pollfd){ .fd = br.conns[i]->fd,
+                                         .events = POLLIN | (br.conns[i]->out.len ? POLLOUT : 0) };
+        }
+        int64_t wait = acks_due(now, 100);
+        poll(pfd, (nfds_t)np, (int)wait);
+        now = mono_ms();
+
+        int base = (br.listen_fd >= 0) ? 1 : 0;
+        // Walk backwards, conn_close moves the last connection into the hole
+        for(int i = br.n_conns - 1; i >= 0; i--){
+            conn_t *c = br.conns[i];
+            short re = pfd[base + i].revents;
+            if(re & (POLLIN | POLLERR | POLLHUP)){
+                uint8_t tmp[65536];
+                ssize_t r = recv(c->fd, tmp, sizeof(tmp), 0);
+                if(r <= 0 || bytes_put(&c->in, tmp, (size_t)r) != 0 || conn_process(c, now) < 0){
+                    conn_close(i);
+                    continue;
+                }
+            }
+            conn_flush(c);
+        }
+        if(base && (pfd[0].revents & POLLIN)){
+            int fd;
+            while((fd = accept(br.listen_fd, NULL, NULL)) >= 0){
+                conn_t *c = (br.n_conns < MQTT_MAX_CONNS) ? calloc(1, sizeof(*c)) : NULL;
+                if(!c){
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                c->fd = fd;
+                br.conns[br.n_conns++] = c;
+            }
+        }
+
+        if(now - last_report >= interval_s * 1000LL){
+            char label[16];
+            snprintf(label, sizeof(label), "%.1f", (now - start) / 1000.0);
+            meter_print(label, &interval_m, (now - last_report) / 1000.0, br.n_conns);
+            memset(&interval_m, 0, sizeof(interval_m));
+            last_report = now;
+        }
+    }
+
+    double secs = (mono_ms() - start) / 1000.0;
+    meter_print("total", &total_m, secs, br.n_conns);
+    printf("%llu messages, %llu bytes, %llu invalid, %llu duplicates, %d restarts in %.1f s\n",
+           total_m.msgs, total_m.bytes, total_m.invalid, total_m.dups, br.restarts, secs);
+    while(br.n_conns > 0) conn_close(br.n_conns - 1);
+    if(br.listen_fd >= 0) close(br.listen_fd);
+    return total_m.invalid ? 2 : 0;
+}
+
+/* ===========================
+ *   Client side
+ * =========================== */
+
+static int client_connect(const char *host, int port, const char *client_id){
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    if(getaddrinfo(host, portstr, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for(struct addrinfo *a = res; a; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        if(fd >= 0) close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if(fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // CONNECT, clean session, then wait for CONNACK
+    bytes_t b = { 0 };
+    put_header(&b, MQTT_CONNECT << 4, 10 + 2 + strlen(client_id));
+    put_str(&b, "MQTT");
+    static const uint8_t level_flags[2] = { 4, 0x02 };
+    bytes_put(&b, level_flags, 2);
+    put_u16(&b, MQTT_KEEPALIVE_S);
+    put_str(&b, client_id);
+    uint8_t ack[4];
+    if(send_all(fd, &b) != 0 || recv(fd, ack, 4, MSG_WAITALL) != 4 || ack[0] != MQTT_CONNACK << 4 || ack[3] != 0){
+        close(fd);
+        fd = -1;
+    }
+    free(b.data);
+    return fd;
+}
+
+// Helper: read what is there into in; -1 when the connection is gone
+static int client_read(int fd, bytes_t *in, int timeout_ms){
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    if(poll(&p, 1, timeout_ms) <= 0) return 0;
+    uint8_t tmp[65536];
+    ssize_t r = recv(fd, tmp, sizeof(tmp), 0);
+    if(r <= 0) return -1;
+    return bytes_put(in, tmp, (size_t)r);
+}
+
+static void report_tick(int64_t start, int64_t *last_report, int interval_s, int conns){
+    int64_t now = mono_ms();
+    if(now - *last_report < interval_s * 1000LL) return;
+    char label[16];
+    snprintf(label, sizeof(label), "%.1f", (now - start) / 1000.0);
+    meter_print(label, &interval_m, (now - *last_report) / 1000.0, conns);
+    memset(&interval_m, 0, sizeof(interval_m));
+    *last_report = now;
+}
+
+static int run_sub(const char *host, int port, const char *filter, int seconds, int interval_s){
+    char id[32];
+    snprintf(id, sizeof(id), "mqtt_bench_sub_%d", (int)getpid());
+    meter_header();
+
+    int64_t start = mono_ms(), last_report = start;
+    int reconnects = 0;
+    while(!stop && (seconds == 0 || mono_ms() - start < seconds * 1000LL)){
+        int fd = client_connect(host, port, id);
+        if(fd < 0){
+            report_tick(start, &last_report, interval_s, 0);
+            usleep(200000);
+            continue;
+        }
+        reconnects++;
+        bytes_t out = { 0 }, in = { 0 };
+        put_header(&out, MQTT_SUBSCRIBE << 4 | 0x02, 2 + 2 + strlen(filter) + 1);
+        put_u16(&out, 1);
+        put_str(&out, filter);
+        uint8_t qos0 = 0;
+        bytes_put(&out, &qos0, 1);
+        int64_t last_ping = mono_ms();
+        int alive = (send_all(fd, &out) == 0);
+
+        while(alive && !stop && (seconds == 0 || mono_ms() - start < seconds * 1000LL)){
+            if(client_read(fd, &in, 100) < 0) break;
+            uint8_t type, flags;
+            const uint8_t *b;
+            size_t n, total;
+            int rc;
+            while((rc = next_packet(&in, &type, &flags, &b, &n, &total)) == 1){
+                if(type == MQTT_PUBLISH){
+                    char topic[256];
+                    unsigned pid;
+                    const uint8_t *payload;
+                    size_t len;
+                    if(parse_publish(flags, b, n, topic, sizeof(topic), &pid, &payload, &len) == 0){
+                        account(topic, payload, len, (flags >> 3) & 1, -1);
+                    }
+                }
+                bytes_consume(&in, total);
+            }
+            if(rc < 0) break;
+            if(mono_ms() - last_ping >= MQTT_KEEPALIVE_S * 500LL){
+                static const uint8_t ping[2] = { MQTT_PINGREQ << 4, 0 };
+                bytes_put(&out, ping, 2);
+                alive = (send_all(fd, &out) == 0);
+                last_ping = mono_ms();
+            }
+            report_tick(start, &last_report, interval_s, 1);
+        }
+        close(fd);
+        free(in.data);
+        free(out.data);
+    }
+
+    double secs = (mono_ms() - start) / 1000.0;
+    meter_print("total", &total_m, secs, 0);
+    printf("%llu messages, %llu bytes, %llu invalid, %d connects in %.1f s\n", total_m.msgs, total_m.bytes,
+           total_m.invalid, reconnects, secs);
+    return total_m.invalid ? 2 : 0;
+}
+
+typedef struct{
+    uint16_t id;
+    int64_t sent_ms;
+} inflight_t;
+
+static int run_pub(const char *host, int port, const char *topic, int rate, int size, int window,
+                   int seconds, int interval_s){
+    char id[32];
+    snprintf(id, sizeof(id), "mqtt_bench_pub_%d", (int)getpid());
+    inflight_t *inflight = calloc((size_t)window, sizeof(*inflight));
+    char *payload = malloc((size_t)size + 64);
+    if(!inflight || !payload) return 1;
+    meter_header();
+
+    int64_t start = mono_ms(), last_report = start;
+    unsigned long long seq = 0, lost = 0, sent = 0;
+    double tokens = 0;
+    uint16_t next_id = 1;
+    while(!stop && (seconds == 0 || mono_ms() - start < seconds * 1000LL)){
+        int fd = client_connect(host, port, id);
+        if(fd < 0){
+            report_tick(start, &last_report, interval_s, 0);
+            usleep(200000);
+            continue;
+        }
+        bytes_t out = { 0 }, in = { 0 };
+        int n_inflight = 0;
+        int64_t last_ms = mono_ms();
+
+        while(!stop && (seconds == 0 || mono_ms() - start < seconds * 1000LL)){
+            int64_t now = mono_ms();
+            tokens += (now - last_ms) * rate / 1000.0;
+            if(tokens > rate) tokens = rate;
+            last_ms = now;
+
+            // {"ts":<ms>,"seq":<n>,"pad":"xxx"} padded to about size bytes
+            while(tokens >= 1.0 && n_inflight < window){
+                int len = snprintf(payload, 64, "{\"ts\":%lld,\"seq\":%llu,\"pad\":\"", (long long)wall_ms(), seq++);
+                while(len < size - 2) payload[len++] = 'x';
+                payload[len++] = '"';
+                payload[len++] = '}';
+                put_header(&out, MQTT_PUBLISH << 4 | 0x02, 2 + strlen(topic) + 2 + (size_t)len);
+                put_str(&out, topic);
+                put_u16(&out, next_id);
+                bytes_put(&out, payload, (size_t)len);
+                inflight[n_inflight++] = (inflight_t){ .id = next_id, .sent_ms = now };
+                next_id = (next_id == 65535) ? 1 : next_id + 1;
+                tokens -= 1.0;
+                sent++;
+            }
+            if(out.len && send_all(fd, &out) != 0) break;
+
+            if(client_read(fd, &in, 10) < 0) break;
+            uint8_t type, flags;
+            const uint8_t *b;
+            size_t n, total;
+            int rc;
+            while((rc = next_packet(&in, &type, &flags, &b, &n, &total)) == 1){
+                if(type == MQTT_PUBACK && n >= 2){
+                    unsigned ack = get_u16(b);
+                    for(int k = 0; k < n_inflight; k++){
+                        if(inflight[k].id != ack) continue;
+                        int64_t rtt = mono_ms() - inflight[k].sent_ms;
+                        meter_add(&interval_m, (size_t)size, 1, 0, rtt);
+                        meter_add(&total_m, (size_t)size, 1, 0, rtt);
+                        inflight[k] = inflight[--n_inflight];
+                        break;
+                    }
+                }
+                bytes_consume(&in, total);
+            }
+            if(rc < 0) break;
+            report_tick(start, &last_report, interval_s, 1);
+        }
+        lost += (unsigned long long)n_inflight;
+        close(fd);
+        free(in.data);
+        free(out.data);
+    }
+
+    double secs = (mono_ms() - start) / 1000.0;
+    meter_print("total", &total_m, secs, 0);
+    printf("%llu sent, %llu acknowledged, %llu unacknowledged at a disconnect in %.1f s\n", sent, total_m.msgs,
+           lost, secs);
+    free(inflight);
+    free(payload);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(argc < 2 || (strcmp(argv[1], "serve") && strcmp(argv[1], "sub") && strcmp(argv[1], "pub"))){
+        fprintf(stderr, "Usage: %s serve|sub|pub [options], see the top of Benchmark/mqtt_bench.c\n", argv[0]);
+        return 1;
+    }
+    const char *mode = argv[1];
+    const char *host = "127.0.0.1";
+    const char *filter = "#";
+    const char *topic = "v1/devices/me/telemetry";
+    int port = MQTT_BENCH_PORT, seconds = 0, interval_s = 1;
+    int rate = 100, size = 128, window = 20;
+
+    int opt;
+    optind = 2;
+    while((opt = getopt(argc, argv, "p:a:j:r:o:t:i:h:f:n:s:w:c:")) != -1){
+        switch(opt){
+            case 'p': port = atoi(optarg); break;
+            case 'a': br.ack_ms = atoi(optarg); break;
+            case 'j': br.jitter_ms = atoi(optarg); break;
+            case 'r': br.restart_every_s = atoi(optarg); break;
+            case 'o': br.down_s = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'i': interval_s = atoi(optarg); break;
+            case 'h': host = optarg; break;
+            case 'f': filter = optarg; break;
+            case 'n': rate = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'c': topic = optarg; break;
+            default: return 1;
+        }
+    }
+    if(interval_s < 1) interval_s = 1;
+    if(size < 48) size = 48;
+    if(window < 1) window = 1;
+    if(rate < 1) rate = 1;
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    inflate_buf = malloc(INFLATE_MAX);
+    srand((unsigned)getpid());
+
+    int rc;
+    if(strcmp(mode, "serve") == 0){
+        br.port = port;
+        rc = run_serve(seconds, interval_s);
+    }
+    else if(strcmp(mode, "sub") == 0){
+        rc = run_sub(host, port, filter, seconds, interval_s);
+    }
+    else{
+        rc = run_pub(host, port, topic, rate, size, window, seconds, interval_s);
+    }
+    free(inflate_buf);
+    return rc;
+}
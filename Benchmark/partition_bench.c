@@ -0,0 +1,141 @@
+#include "main.h"
+#include "database.h"
+#include "storage_backend.h"
+#include "partition.h"
+#include "config.h"
+
+// One growing SQLite file vs. per-day partitions:
+// insert rate as history accumulates, then the cost of dropping old days
+//   Usage: partition_bench [days] [rows_per_day] [work_dir]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define BENCH_SENSORS 50
+#define BENCH_BATCH 500
+#define DAY_MS (86400LL * 1000)
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Helper: write 'days' days of data, print the insert rate of each day
+static int fill(storage_backend_t *sb, int64_t base, int days, int rows_per_day, double *first, double *last){
+    sensor_packet_t batch[BENCH_BATCH];
+    int64_t step = DAY_MS / (rows_per_day / BENCH_SENSORS);
+
+    for(int d = 0; d < days; d++){
+        double t0 = now_sec();
+        for(int r = 0; r < rows_per_day; r += BENCH_BATCH){
+            for(int i = 0; i < BENCH_BATCH; i++){
+                int n = r + i;
+                batch[i].id = 1 + n % BENCH_SENSORS;
+                batch[i].type = 1 + (n % BENCH_SENSORS) % 3;
+                batch[i].value = 15.0 + (rand() % 2000) / 100.0;
+                batch[i].ts_ms = base + d * DAY_MS + (int64_t)(n / BENCH_SENSORS) * step;
+            }
+            if(storage_backend_write(sb, batch, BENCH_BATCH) != 0 || storage_backend_flush(sb) != 0){
+                fprintf(stderr, "write failed\n");
+                return -1;
+            }
+        }
+        double rate = rows_per_day / (now_sec() - t0);
+        if(d == 0) *first = rate;
+        *last = rate;
+    }
+    return 0;
+}
+
+static void run_single(const char *dir, int64_t base, int days, int rows_per_day, int drop_days){
+    char path[256];
+    snprintf(path, sizeof(path), "%s/partition_bench.db", dir);
+    unlink(path);
+
+    snprintf(g_config.partition_span, sizeof(g_config.partition_span), "none");
+    storage_backend_t *sb = NULL;
+    if(storage_backend_open(&sb, "sqlite", path) != 0) return;
+
+    double first = 0, last = 0;
+    if(fill(sb, base, days, rows_per_day, &first, &last) != 0) return;
+    storage_backend_close(sb);
+
+    // Retention the old way: chunked deletes, then give the pages back
+    db_handle_t *db = NULL;
+    db_init_and_open(&db, path);
+    uint8_t ids[BENCH_SENSORS * 3], types[BENCH_SENSORS * 3];
+    int64_t cutoff = base + drop_days * DAY_MS;
+    double t0 = now_sec();
+    unsigned long long deleted = 0;
+    int n = db_list_sensors(db, ids, types, BENCH_SENSORS * 3);
+    for(int i = 0; i < n; i++){
+        int rc;
+        while((rc = db_retention_delete(db, ids[i], types[i], cutoff, 500)) > 0) deleted += rc;
+    }
+    double t_delete = now_sec() - t0;
+    while(db_incremental_vacuum(db, 1024) > 0);
+    double t_total = now_sec() - t0;
+    db_close(db);
+
+    printf("single file   insert day 1: %8.0f rows/s  day %d: %8.0f rows/s\n", first, days, last);
+    printf("              retention %d days: %llu rows deleted in %.2f s, %.2f s with vacuum\n",
+           drop_days, deleted, t_delete, t_total);
+
+    char side[300];
+    unlink(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+}
+
+static void run_partitioned(const char *dir, int64_t base, int days, int rows_per_day, int drop_days){
+    char path[256], cmd[300];
+    snprintf(path, sizeof(path), "%s/partition_bench.parts", dir);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+    if(system(cmd) != 0) return;
+
+    snprintf(g_config.partition_span, sizeof(g_config.partition_span), "day");
+    storage_backend_t *sb = NULL;
+    if(storage_backend_open(&sb, "sqlite", path) != 0) return;
+
+    double first = 0, last = 0;
+    if(fill(sb, base, days, rows_per_day, &first, &last) != 0) return;
+    storage_backend_close(sb);
+
+    uint64_t freed = 0;
+    double t0 = now_sec();
+    int dropped = partition_drop_before(path, "sqlite", ".db", DAY_MS, base + drop_days * DAY_MS, &freed);
+    double t_drop = now_sec() - t0;
+
+    printf("partitioned   insert day 1: %8.0f rows/s  day %d: %8.0f rows/s\n", first, days, last);
+    printf("              retention %d days: %d partitions dropped (%llu bytes) in %.4f s\n",
+           drop_days, dropped, (unsigned long long)freed, t_drop);
+
+    if(system(cmd) != 0) fprintf(stderr, "failed to remove %s\n", path);
+}
+
+int main(int argc, char **argv){
+    int days = (argc > 1) ? atoi(argv[1]) : 14;
+    int rows_per_day = (argc > 2) ? atoi(argv[2]) : 50000;
+    const char *dir = (argc > 3) ? argv[3] : "/tmp";
+    if(days < 2) days = 14;
+    if(rows_per_day < BENCH_BATCH) rows_per_day = 50000;
+    rows_per_day -= rows_per_day % BENCH_BATCH;
+
+    // Autocheckpoint inside the writer, no maintenance thread here
+    g_config.maint_checkpoint_s = 0;
+
+    int64_t base = partition_start((int64_t)time(NULL) * 1000, DAY_MS) - days * DAY_MS;
+    int drop_days = days / 2;
+
+    printf("%d days x %d rows, dropping the oldest %d days\n", days, rows_per_day, drop_days);
+    srand(1);
+    run_single(dir, base, days, rows_per_day, drop_days);
+    srand(1);
+    run_partitioned(dir, base, days, rows_per_day, drop_days);
+    return 0;
+}
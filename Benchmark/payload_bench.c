@@ -0,0 +1,336 @@
+#include "main.h"
+#include "payload.h"
+#include "raw_window.h"
+#include <math.h>
+
+// Cloud payload encoding cost and size: the snprintf path against the
+// streaming encoder, one record per message (device mode) and 100 devices
+// per message (gateway mode), with and without deflate. Then raw uploads:
+// one message per sample against delta-encoded windows, at rising sample
+// rates.
+//   Usage: payload_bench [records]
+
+#define DEFAULT_RECORDS 1000000
+#define BATCH_DEVICES 100
+#define CHECK_VALUES 2000000
+#define RAW_DEVICES 100
+#define RAW_SECONDS 60
+#define RAW_WINDOW_S 10
+
+typedef struct{
+    int id;
+    int type;
+    double avg;
+    unsigned long count;
+    long ts;
+    long last;
+    double min, max, recent_last;
+} bench_rec_t;
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *type_key(int type){
+    static const char *keys[] = { "type0", "temperature", "humidity", "light" };
+    return keys[type & 3];
+}
+
+/* ===========================
+ *   Previous snprintf encoders
+ * =========================== */
+
+static int snprintf_record(const bench_rec_t *r, char *out, size_t len){
+    char recent[128];
+    snprintf(recent, sizeof(recent), ",\"recent\":{\"window_s\":%d,\"n\":%zu,\"min\":%.2f,\"max\":%.2f,\"last\":%.2f}",
+             300, (size_t)600, r->min, r->max, r->recent_last);
+    return snprintf(out, len, "{\"sensor_id\":%d,\"type\":%d,\"avg\":%.2f,\"count\":%lu,\"timestamp\":%ld,\"last_upload\":%ld%s}",
+                    r->id, r->type, r->avg, r->count, r->ts, r->last, recent);
+}
+
+static int snprintf_entry(const bench_rec_t *r, char *out, size_t len){
+    const char *k = type_key(r->type);
+    return snprintf(out, len, "\"Sensor %d\":[{\"ts\":%lld,\"values\":{\"%s\":%.2f,\"%s_count\":%lu,"
+                    "\"%s_min\":%.2f,\"%s_max\":%.2f,\"%s_last\":%.2f}}]",
+                    r->id, (long long)r->ts * 1000, k, r->avg, k, r->count, k, r->min, k, r->max, k, r->recent_last);
+}
+
+/* ===========================
+ *   Streaming encoders
+ * =========================== */
+
+static void writer_record(payload_writer_t *w, const bench_rec_t *r){
+    payload_map_open(w);
+    payload_key(w, "sensor_id");
+    payload_int(w, r->id);
+    payload_key(w, "type");
+    payload_int(w, r->type);
+    payload_key(w, "avg");
+    payload_fixed2(w, r->avg);
+    payload_key(w, "count");
+    payload_int(w, (int64_t)r->count);
+    payload_key(w, "timestamp");
+    payload_int(w, r->ts);
+    payload_key(w, "last_upload");
+    payload_int(w, r->last);
+    payload_key(w, "recent");
+    payload_map_open(w);
+    payload_key(w, "window_s");
+    payload_int(w, 300);
+    payload_key(w, "n");
+    payload_int(w, 600);
+    payload_key(w, "min");
+    payload_fixed2(w, r->min);
+    payload_key(w, "max");
+    payload_fixed2(w, r->max);
+    payload_key(w, "last");
+    payload_fixed2(w, r->recent_last);
+    payload_map_close(w);
+    payload_map_close(w);
+}
+
+static void writer_entry(payload_writer_t *w, const bench_rec_t *r){
+    char name[32], field[32];
+    const char *k = type_key(r->type);
+    snprintf(name, sizeof(name), "Sensor %d", r->id);
+    payload_key(w, name);
+    payload_array_open(w);
+    payload_map_open(w);
+    payload_key(w, "ts");
+    payload_int(w, (int64_t)r->ts * 1000);
+    payload_key(w, "values");
+    payload_map_open(w);
+    payload_key(w, k);
+    payload_fixed2(w, r->avg);
+    snprintf(field, sizeof(field), "%s_count", k);
+    payload_key(w, field);
+    payload_int(w, (int64_t)r->count);
+    snprintf(field, sizeof(field), "%s_min", k);
+    payload_key(w, field);
+    payload_fixed2(w, r->min);
+    snprintf(field, sizeof(field), "%s_max", k);
+    payload_key(w, field);
+    payload_fixed2(w, r->max);
+    snprintf(field, sizeof(field), "%s_last", k);
+    payload_key(w, field);
+    payload_fixed2(w, r->recent_last);
+    payload_map_close(w);
+    payload_map_close(w);
+    payload_array_close(w);
+}
+
+/* ===========================
+ *   Runs
+ * =========================== */
+
+static void report(const char *name, double secs, size_t records, size_t bytes){
+    printf("%-34s %10.1f %12.1f\n", name, secs * 1e9 / records, (double)bytes / records);
+}
+
+// Compression cost does not depend on how the text was produced, so the
+// snprintf path is measured uncompressed only
+static void run_snprintf(const bench_rec_t *recs, size_t n, int batched){
+    static char payload[16384];
+    char buf[512];
+    size_t bytes = 0;
+
+    double t0 = now_sec();
+    for(size_t i = 0; i < n;){
+        if(batched){
+            // Previous gateway path: each entry formatted, then copied in
+            int len = 1;
+            payload[0] = '{';
+            for(size_t d = 0; d < BATCH_DEVICES && i < n; d++, i++){
+                int elen = snprintf_entry(&recs[i], buf, sizeof(buf));
+                if(d > 0) payload[len++] = ',';
+                memcpy(payload + len, buf, elen);
+                len += elen;
+            }
+            payload[len++] = '}';
+            bytes += len;
+        }
+        else{
+            bytes += snprintf_record(&recs[i++], payload, sizeof(payload));
+        }
+    }
+    double secs = now_sec() - t0;
+
+    report(batched ? "snprintf batch" : "snprintf single", secs, n, bytes);
+}
+
+static void run_writer(const bench_rec_t *recs, size_t n, payload_format_t fmt, int batched, size_t compress_min){
+    payload_buf_t msg, zip;
+    payload_buf_init(&msg);
+    payload_buf_init(&zip);
+    payload_writer_t w;
+    size_t bytes = 0;
+
+    double t0 = now_sec();
+    for(size_t i = 0; i < n;){
+        payload_buf_reset(&msg);
+        payload_begin(&w, &msg, fmt);
+        if(batched){
+            payload_map_open(&w);
+            for(size_t d = 0; d < BATCH_DEVICES && i < n; d++) writer_entry(&w, &recs[i++]);
+            payload_map_close(&w);
+        }
+        else{
+            writer_record(&w, &recs[i++]);
+        }
+        payload_compress(&msg, compress_min, &zip);
+        bytes += msg.len;
+    }
+    double secs = now_sec() - t0;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %s%s", fmt == PAYLOAD_CBOR ? "cbor" : "json",
+             batched ? "batch" : "single", compress_min ? " +deflate" : "");
+    report(name, secs, n, bytes);
+    payload_buf_free(&msg);
+    payload_buf_free(&zip);
+}
+
+// Raw samples for RAW_SECONDS from RAW_DEVICES devices at hz each, a slow
+// random walk with a little timing jitter. Per-sample messages against
+// windows, messages per second to the broker and bytes per sample.
+static void run_raw(int hz, payload_format_t fmt, size_t compress_min){
+    raw_windows_t raw;
+    raw_windows_init(&raw, RAW_WINDOW_S, 1 << 20, 100);
+    payload_buf_t msg, zip;
+    payload_buf_init(&msg);
+    payload_buf_init(&zip);
+    payload_writer_t w;
+    double value[RAW_DEVICES];
+    for(int d = 0; d < RAW_DEVICES; d++) value[d] = 20.0 + d % 10;
+
+    size_t samples = 0, single_bytes = 0, window_bytes = 0, messages = 0;
+    int64_t step_ms = 1000 / hz;
+    int64_t start = 1700000000000LL;
+    double t0 = now_sec();
+    for(int64_t t = 0; t <= (int64_t)RAW_SECONDS * 1000; t += step_ms){
+        for(int d = 0; d < RAW_DEVICES; d++){
+            value[d] += (rand() % 21 - 10) / 100.0;
+            sensor_packet_t pkt = { .id = (uint8_t)d, .type = 1, .value = value[d],
+                                    .ts_ms = start + t + rand() % 3, .seq = samples };
+            samples++;
+
+            // One message per sample, as the stats path would send it
+            payload_buf_reset(&msg);
+            payload_begin(&w, &msg, fmt);
+            payload_map_open(&w);
+            payload_key(&w, "ts");
+            payload_int(&w, pkt.ts_ms);
+            payload_key(&w, "values");
+            payload_map_open(&w);
+            payload_key(&w, "temperature");
+            payload_fixed2(&w, pkt.value);
+            payload_map_close(&w);
+            payload_map_close(&w);
+            single_bytes += msg.len;
+
+            raw_windows_add(&raw, &pkt, start + t);
+        }
+        raw_window_t *win;
+        while((win = raw_windows_next_due(&raw, start + t, t == (int64_t)RAW_SECONDS * 1000)) != NULL){
+            payload_buf_reset(&msg);
+            payload_begin(&w, &msg, fmt);
+            raw_window_encode(win, raw.scale, &w);
+            payload_compress(&msg, compress_min, &zip);
+            window_bytes += msg.len;
+            messages++;
+            raw_window_reset(&raw, win);
+        }
+    }
+    double secs = now_sec() - t0;
+
+    char name[64];
+    snprintf(name, sizeof(name), "raw %3d Hz %s%s", hz, fmt == PAYLOAD_CBOR ? "cbor" : "json",
+             compress_min ? " +deflate" : "");
+    printf("%-28s %8.1f %10.1f %10.1f %10.1f %10.1f\n", name, (double)samples / RAW_SECONDS,
+           (double)messages / RAW_SECONDS, (double)single_bytes / samples, (double)window_bytes / samples,
+           secs * 1e9 / samples);
+    payload_buf_free(&msg);
+    payload_buf_free(&zip);
+    raw_windows_free(&raw);
+}
+
+// Fixed-point text must match "%.2f" byte for byte
+static size_t check_fixed2(void){
+    payload_buf_t b;
+    payload_buf_init(&b);
+    payload_writer_t w;
+    size_t mismatches = 0;
+    char ref[64];
+
+    for(size_t i = 0; i < CHECK_VALUES; i++){
+        double v;
+        switch(i % 4){
+            case 0: v = (double)(rand() % 2000001 - 1000000) / 1000.0; break;     // 3 decimals, ties
+            case 1: v = ((double)rand() / RAND_MAX - 0.5) * 2e6; break;
+            case 2: v = (double)(rand() % 100000) / 100.0 + 0.005; break;         // x.xx5
+            default: v = ((double)rand() / RAND_MAX - 0.5) * 1e-2; break;         // around zero
+        }
+        payload_buf_reset(&b);
+        payload_begin(&w, &b, PAYLOAD_JSON);
+        payload_fixed2(&w, v);
+        int n = snprintf(ref, sizeof(ref), "%.2f", v);
+        if((size_t)n != b.len || memcmp(ref, b.data, b.len) != 0){
+            if(mismatches < 5) printf("  mismatch: %.17g -> %.*s, printf %s\n", v, (int)b.len, (char *)b.data, ref);
+            mismatches++;
+        }
+    }
+    payload_buf_free(&b);
+    return mismatches;
+}
+
+int main(int argc, char **argv){
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+    if(n == 0) n = DEFAULT_RECORDS;
+
+    bench_rec_t *recs = malloc(n * sizeof(*recs));
+    if(!recs){
+        perror("malloc");
+        return 1;
+    }
+    srand(11);
+    long ts = (long)time(NULL);
+    for(size_t i = 0; i < n; i++){
+        recs[i].id = 1 + (int)(i % 250);
+        recs[i].type = 1 + (int)(i % 3);
+        recs[i].avg = 20.0 + (rand() % 100000) / 1000.0;
+        recs[i].count = 1000 + (unsigned long)(rand() % 100000);
+        recs[i].ts = ts + (long)i / 250;
+        recs[i].last = recs[i].ts - 5;
+        recs[i].min = recs[i].avg - (rand() % 500) / 100.0;
+        recs[i].max = recs[i].avg + (rand() % 500) / 100.0;
+        recs[i].recent_last = recs[i].avg + (rand() % 200 - 100) / 100.0;
+    }
+
+    printf("%zu records\n", n);
+    printf("%-34s %10s %12s\n", "encoder", "ns/record", "bytes/record");
+    run_snprintf(recs, n, 0);
+    run_writer(recs, n, PAYLOAD_JSON, 0, 0);
+    run_writer(recs, n, PAYLOAD_CBOR, 0, 0);
+    run_snprintf(recs, n, 1);
+    run_writer(recs, n, PAYLOAD_JSON, 1, 0);
+    run_writer(recs, n, PAYLOAD_CBOR, 1, 0);
+    run_writer(recs, n, PAYLOAD_JSON, 1, 256);
+    run_writer(recs, n, PAYLOAD_CBOR, 1, 256);
+
+    printf("\n%d devices, %d s windows\n", RAW_DEVICES, RAW_WINDOW_S);
+    printf("%-28s %8s %10s %10s %10s %10s\n", "raw upload", "samp/s", "msg/s", "B/single", "B/window", "ns/samp");
+    static const int rates[] = { 1, 10, 100 };
+    for(size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++){
+        run_raw(rates[r], PAYLOAD_JSON, 0);
+        run_raw(rates[r], PAYLOAD_CBOR, 0);
+        run_raw(rates[r], PAYLOAD_CBOR, 256);
+    }
+
+    size_t bad = check_fixed2();
+    printf("fixed2 vs %%.2f: %zu/%d mismatches\n", bad, CHECK_VALUES);
+
+    free(recs);
+    return bad ? 1 : 0;
+}
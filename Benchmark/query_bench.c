@@ -0,0 +1,268 @@
+#include "main.h"
+#include "database.h"
+#include "config.h"
+#include "query_service.h"
+#include "hot_cache.h"
+#include "storage_manager.h"
+#include <sys/un.h>
+
+// Query service under load: ingest rate alone, then ingest rate and
+// queries/s with client threads hammering the query socket, first over
+// random history windows (SQLite), then over the latest window (hot-tail cache)
+//   Usage: query_bench [clients] [seconds] [work_dir]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+// No storage manager or cloud outbox in this process
+size_t storage_batch_stats_format(char *out, size_t len){
+    if(len > 0) out[0] = '\0';
+    return 0;
+}
+
+size_t outbox_stats_format(char *out, size_t len){
+    if(len > 0) out[0] = '\0';
+    return 0;
+}
+
+#define BENCH_SENSORS 50
+#define BENCH_BATCH 100
+#define BENCH_STEP_MS 10            // timestamp spacing per sensor
+#define BENCH_WINDOW_MS 10000       // queried range
+#define BENCH_MAX_CLIENTS 32
+#define BENCH_HOT_SAMPLES 1024      // per sensor, covers the recent window
+
+static volatile int ingest_stop = 0;
+static volatile int clients_stop = 0;
+static int query_recent = 0;
+static volatile int64_t ingest_rounds = 0;
+static int64_t base_ts;
+static char db_path[100];
+static char sock_path[100];     // sun_path limit
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ===========================
+ *   Ingest
+ * =========================== */
+
+static unsigned long long ingest_rows = 0;
+
+static void *ingest_thread(void *arg){
+    db_handle_t *db = arg;
+    sensor_packet_t batch[BENCH_BATCH];
+    int64_t round = 0;
+    int sensor = 0;
+
+    while(!ingest_stop){
+        for(size_t i = 0; i < BENCH_BATCH; i++){
+            batch[i].id = 1 + sensor;
+            batch[i].type = 1 + (sensor % 3);
+            batch[i].value = 15.0 + (rand() % 2000) / 100.0;
+            batch[i].ts_ms = base_ts + round * BENCH_STEP_MS;
+            if(++sensor == BENCH_SENSORS){
+                sensor = 0;
+                round++;
+            }
+        }
+        if(db_insert_measures_batch(db, batch, BENCH_BATCH) != SQLITE_OK){
+            fprintf(stderr, "ingest failed\n");
+            break;
+        }
+        // Stands in for the data stage
+        for(size_t i = 0; i < BENCH_BATCH; i++) hot_cache_append(&batch[i]);
+        __atomic_store_n(&ingest_rounds, round, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ingest_rows, BENCH_BATCH, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* ===========================
+ *   Query clients
+ * =========================== */
+
+typedef struct{
+    unsigned seed;
+    unsigned long long queries;
+    unsigned long long rows;
+    unsigned long long errors;
+} client_t;
+
+// Helper: read exactly len bytes
+static int read_full(int fd, void *buf, size_t len){
+    uint8_t *p = buf;
+    while(len > 0){
+        ssize_t n = recv(fd, p, len, 0);
+        if(n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int client_connect(void){
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    memcpy(addr.sun_path, sock_path, strlen(sock_path) + 1);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// One binary query: status line, then frames until n = 0
+static int client_query(int fd, client_t *c){
+    int64_t rounds = __atomic_load_n(&ingest_rounds, __ATOMIC_RELAXED);
+    int64_t span = rounds * BENCH_STEP_MS;
+    int64_t from = base_ts + (span > BENCH_WINDOW_MS ? rand_r(&c->seed) % (span - BENCH_WINDOW_MS) : 0);
+    if(query_recent){
+        from = base_ts + (span > BENCH_WINDOW_MS ? span - BENCH_WINDOW_MS : 0);
+    }
+    int sensor = rand_r(&c->seed) % BENCH_SENSORS;
+    // Every fourth query is downsampled to 1 s buckets
+    int64_t bucket = (c->queries % 4 == 3) ? 1000 : 0;
+    size_t rec_size = bucket ? sizeof(query_agg_rec_t) : sizeof(query_raw_rec_t);
+
+    char req[128];
+    int len = snprintf(req, sizeof(req), "RANGE %d %d %lld %lld %lld bin\n", 1 + sensor, 1 + (sensor % 3),
+                       (long long)from, (long long)(from + BENCH_WINDOW_MS), (long long)bucket);
+    if(send(fd, req, len, MSG_NOSIGNAL) != len) return -1;
+
+    char status[3];
+    if(read_full(fd, status, sizeof(status)) != 0 || memcmp(status, "OK\n", 3) != 0) return -1;
+
+    static __thread uint8_t frame[QUERY_OUT_BUF_SIZE];
+    while(1){
+        uint32_t n;
+        if(read_full(fd, &n, sizeof(n)) != 0) return -1;
+        if(n == 0) break;
+        if(n * rec_size > sizeof(frame) || read_full(fd, frame, n * rec_size) != 0) return -1;
+        c->rows += n;
+    }
+    c->queries++;
+    return 0;
+}
+
+static void *client_thread(void *arg){
+    client_t *c = arg;
+    int fd = client_connect();
+
+    while(!clients_stop){
+        if(fd < 0 || client_query(fd, c) != 0){
+            c->errors++;
+            if(fd >= 0) close(fd);
+            usleep(1000);
+            fd = client_connect();
+        }
+    }
+    if(fd >= 0) close(fd);
+    return NULL;
+}
+
+/* ===========================
+ *   Main
+ * =========================== */
+
+static double run_ingest(db_handle_t *db, int seconds, int clients, client_t *cl, double *qps, double *rows_per_query){
+    pthread_t ing, th[BENCH_MAX_CLIENTS];
+    ingest_stop = 0;
+    clients_stop = 0;
+    unsigned long long start_rows = ingest_rows;
+
+    pthread_create(&ing, NULL, ingest_thread, db);
+    for(int i = 0; i < clients; i++){
+        cl[i] = (client_t){ .seed = 1234 + i };
+        pthread_create(&th[i], NULL, client_thread, &cl[i]);
+    }
+
+    double t0 = now_sec();
+    sleep(seconds);
+    double elapsed = now_sec() - t0;
+    unsigned long long rows = ingest_rows - start_rows;
+
+    clients_stop = 1;
+    unsigned long long queries = 0, qrows = 0;
+    for(int i = 0; i < clients; i++){
+        pthread_join(th[i], NULL);
+        queries += cl[i].queries;
+        qrows += cl[i].rows;
+    }
+    ingest_stop = 1;
+    pthread_join(ing, NULL);
+
+    *qps = queries / elapsed;
+    *rows_per_query = queries ? (double)qrows / queries : 0.0;
+    return rows / elapsed;
+}
+
+int main(int argc, char **argv){
+    int clients = (argc > 1) ? atoi(argv[1]) : 4;
+    int seconds = (argc > 2) ? atoi(argv[2]) : 5;
+    const char *dir = (argc > 3) ? argv[3] : "/tmp";
+    if(clients < 1 || clients > BENCH_MAX_CLIENTS) clients = 4;
+    if(seconds < 1) seconds = 5;
+
+    snprintf(db_path, sizeof(db_path), "%s/query_bench.db", dir);
+    snprintf(sock_path, sizeof(sock_path), "%s/query_bench.sock", dir);
+    unlink(db_path);
+    base_ts = (int64_t)time(NULL) * 1000;
+
+    db_handle_t *db = NULL;
+    if(db_init_and_open(&db, db_path) != SQLITE_OK){
+        fprintf(stderr, "open failed\n");
+        return 1;
+    }
+
+    // Query service reads the same database through its own connections
+    snprintf(g_config.storage_backend, sizeof(g_config.storage_backend), "sqlite");
+    snprintf(g_config.storage_path, sizeof(g_config.storage_path), "%s", db_path);
+    snprintf(g_config.query_socket, sizeof(g_config.query_socket), "%s", sock_path);
+    g_config.query_workers = clients < QUERY_MAX_WORKERS ? clients : QUERY_MAX_WORKERS;
+
+    hot_cache_init(BENCH_SENSORS, BENCH_HOT_SAMPLES);
+
+    pthread_t service;
+    pthread_create(&service, NULL, query_service_thread, NULL);
+    usleep(200000);
+
+    client_t cl[BENCH_MAX_CLIENTS];
+    double qps, rpq;
+    double alone = run_ingest(db, seconds, 0, cl, &qps, &rpq);
+    printf("Ingest only:           %10.0f rows/s\n", alone);
+
+    double loaded = run_ingest(db, seconds, clients, cl, &qps, &rpq);
+    unsigned long long errors = 0;
+    for(int i = 0; i < clients; i++) errors += cl[i].errors;
+    printf("Ingest with %2d clients: %10.0f rows/s (%.1f%% of ingest only)\n", clients, loaded, 100.0 * loaded / alone);
+    printf("History queries:       %10.0f queries/s, %.0f rows/query, %llu errors\n", qps, rpq, errors);
+
+    unsigned long long hits0, misses0, hits, misses;
+    hot_cache_stats(&hits0, &misses0);
+    query_recent = 1;
+    loaded = run_ingest(db, seconds, clients, cl, &qps, &rpq);
+    hot_cache_stats(&hits, &misses);
+    errors = 0;
+    for(int i = 0; i < clients; i++) errors += cl[i].errors;
+    printf("Ingest with %2d clients: %10.0f rows/s (%.1f%% of ingest only)\n", clients, loaded, 100.0 * loaded / alone);
+    printf("Recent queries:        %10.0f queries/s, %.0f rows/query, %llu errors, cache %llu hits / %llu misses\n",
+           qps, rpq, errors, hits - hits0, misses - misses0);
+
+    stop_flag = 1;
+    pthread_join(service, NULL);
+    db_close(db);
+    hot_cache_free();
+    unlink(db_path);
+    char wal[128];
+    snprintf(wal, sizeof(wal), "%s-wal", db_path);
+    unlink(wal);
+    snprintf(wal, sizeof(wal), "%s-shm", db_path);
+    unlink(wal);
+    return 0;
+}
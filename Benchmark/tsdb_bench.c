@@ -0,0 +1,131 @@
+#include "main.h"
+#include "database.h"
+#include "tsdb.h"
+
+// Insert throughput and footprint: SQLite handle vs. native segment store
+//   Usage: tsdb_bench [total_rows] [work_dir]
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define DEFAULT_TOTAL_ROWS 200000
+#define BENCH_SENSORS 50
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sensors report about once a second with a few ms of jitter,
+// values drift in 0.01 steps like the client's readings
+static void fill_packets(sensor_packet_t *pkts, size_t count){
+    double level[BENCH_SENSORS];
+    int64_t next_ts[BENCH_SENSORS];
+    int64_t base = (int64_t)time(NULL) * 1000;
+
+    srand(42);
+    for(int s = 0; s < BENCH_SENSORS; s++){
+        level[s] = 15.0 + (rand() % 2000) / 100.0;
+        next_ts[s] = base + s * 7;
+    }
+    for(size_t i = 0; i < count; i++){
+        int s = i % BENCH_SENSORS;
+        level[s] += ((rand() % 21) - 10) / 100.0;
+        pkts[i].id = 1 + s;
+        pkts[i].type = 1 + (s % 3);
+        pkts[i].value = (double)(long)(level[s] * 100.0) / 100.0;
+        pkts[i].ts_ms = next_ts[s];
+        next_ts[s] += 1000 + (rand() % 7) - 3;
+    }
+}
+
+static uint64_t file_size(const char *path){
+    struct stat st;
+    return (stat(path, &st) == 0) ? (uint64_t)st.st_size : 0;
+}
+
+static double bench_sqlite(const char *dir, sensor_packet_t *pkts, size_t total, size_t batch, uint64_t *bytes){
+    char path[512];
+    snprintf(path, sizeof(path), "%s/tsdb_bench.db", dir);
+    unlink(path);
+
+    db_handle_t *h = NULL;
+    if(db_init_and_open(&h, path) != SQLITE_OK) return 0;
+
+    fill_packets(pkts, total);
+    double start = now_sec();
+    for(size_t done = 0; done < total; done += batch){
+        size_t n = (total - done < batch) ? total - done : batch;
+        db_insert_measures_batch(h, pkts + done, n);
+    }
+    double elapsed = now_sec() - start;
+
+    db_close(h);
+    *bytes = file_size(path);
+    unlink(path);
+    return total / elapsed;
+}
+
+static void remove_dir(const char *dir){
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if(system(cmd) != 0){
+        fprintf(stderr, "failed to remove %s\n", dir);
+    }
+}
+
+static double bench_tsdb(const char *dir, sensor_packet_t *pkts, size_t total, size_t batch, uint64_t *bytes){
+    char path[512];
+    snprintf(path, sizeof(path), "%s/tsdb_bench.tsdb", dir);
+    remove_dir(path);
+
+    tsdb_t *t = NULL;
+    if(tsdb_open(&t, path) != 0) return 0;
+
+    fill_packets(pkts, total);
+    double start = now_sec();
+    for(size_t done = 0; done < total; done += batch){
+        size_t n = (total - done < batch) ? total - done : batch;
+        tsdb_write_batch(t, pkts + done, n);
+    }
+    tsdb_flush(t);
+    double elapsed = now_sec() - start;
+
+    *bytes = tsdb_disk_bytes(t);
+    tsdb_close(t);
+    remove_dir(path);
+    return total / elapsed;
+}
+
+int main(int argc, char **argv){
+    size_t total = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_TOTAL_ROWS;
+    const char *dir = (argc > 2) ? argv[2] : "/tmp";
+    if(total == 0){
+        fprintf(stderr, "Usage: %s [total_rows] [work_dir]\n", argv[0]);
+        return 1;
+    }
+
+    sensor_packet_t *pkts = malloc(total * sizeof(*pkts));
+    if(!pkts){
+        perror("malloc");
+        return 1;
+    }
+
+    static const size_t batch_sizes[] = {10, 100, 1000};
+    printf("%zu rows, %d sensors\n", total, BENCH_SENSORS);
+    printf("%-8s %14s %14s %8s %12s %12s\n", "batch", "sqlite rows/s", "tsdb rows/s", "speedup", "sqlite B/row", "tsdb B/row");
+    for(size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++){
+        uint64_t sqlite_bytes = 0, tsdb_bytes = 0;
+        double sqlite_rate = bench_sqlite(dir, pkts, total, batch_sizes[i], &sqlite_bytes);
+        double tsdb_rate = bench_tsdb(dir, pkts, total, batch_sizes[i], &tsdb_bytes);
+        printf("%-8zu %14.0f %14.0f %7.1fx %12.2f %12.2f\n", batch_sizes[i], sqlite_rate, tsdb_rate,
+               sqlite_rate > 0 ? tsdb_rate / sqlite_rate : 0.0,
+               (double)sqlite_bytes / total, (double)tsdb_bytes / total);
+    }
+
+    free(pkts);
+    return 0;
+}
@@ -0,0 +1,322 @@
+#include "main.h"
+#include "tsdb.h"
+#include <dirent.h>
+#include <math.h>
+
+// Native store verification
+//   tsdb_verify <tsdb_dir>              check every block of every segment
+//   tsdb_verify --roundtrip [rows] [dir] write, reopen, read back and compare
+
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *fifo_path = "/dev/null";
+volatile sig_atomic_t stop_flag = 0;
+sbuffer_t sbuffer;
+
+#define ROUNDTRIP_SENSORS 20
+#define DEFAULT_ROUNDTRIP_ROWS 100000
+
+/* ===========================
+ *   Directory check
+ * =========================== */
+
+typedef struct{
+    uint64_t blocks;
+    uint64_t rows;
+    int64_t min_ts;
+    int64_t max_ts;
+    int bad_range;
+} seg_stats_t;
+
+static int check_block(void *ctx, const tsdb_block_hdr_t *hdr, const tsdb_sample_t *samples){
+    seg_stats_t *st = ctx;
+    for(uint16_t i = 0; i < hdr->count; i++){
+        if(samples[i].ts_ms < hdr->min_ts || samples[i].ts_ms > hdr->max_ts) st->bad_range = 1;
+    }
+    if(st->rows == 0 || hdr->min_ts < st->min_ts) st->min_ts = hdr->min_ts;
+    if(st->rows == 0 || hdr->max_ts > st->max_ts) st->max_ts = hdr->max_ts;
+    st->blocks++;
+    st->rows += hdr->count;
+    return 0;
+}
+
+static int verify_dir(const char *dir){
+    DIR *d = opendir(dir);
+    if(!d){
+        perror(dir);
+        return 1;
+    }
+
+    int failures = 0;
+    uint64_t total_rows = 0, total_bytes = 0;
+    struct dirent *de;
+    while((de = readdir(d)) != NULL){
+        unsigned id, type, seq;
+        if(sscanf(de->d_name, "s%u_%u_%u.seg", &id, &type, &seq) != 3) continue;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        struct stat sb;
+        stat(path, &sb);
+
+        seg_stats_t st = {0};
+        uint64_t valid = 0;
+        int rc = tsdb_scan_file(path, check_block, &st, &valid);
+        const char *status = (rc == 0 && !st.bad_range) ? "OK" : (rc < 0 ? "IO-ERROR" : "CORRUPT");
+        if(strcmp(status, "OK") != 0) failures++;
+
+        printf("%-28s %-8s blocks=%-6llu rows=%-8llu bytes=%llu/%llu ts=[%lld, %lld]\n",
+               de->d_name, status, (unsigned long long)st.blocks, (unsigned long long)st.rows,
+               (unsigned long long)valid, (unsigned long long)sb.st_size, (long long)st.min_ts, (long long)st.max_ts);
+        total_rows += st.rows;
+        total_bytes += valid;
+    }
+    closedir(d);
+
+    printf("Total: %llu rows, %llu bytes (%.2f B/row), %d bad segment(s)\n",
+           (unsigned long long)total_rows, (unsigned long long)total_bytes,
+           total_rows ? (double)total_bytes / total_rows : 0.0, failures);
+    return failures ? 1 : 0;
+}
+
+/* ===========================
+ *   Round trip
+ * =========================== */
+
+typedef struct{
+    sensor_packet_t *out;
+    size_t count;
+    size_t cap;
+} collect_t;
+
+static int collect_row(void *ctx, const sensor_packet_t *pkt){
+    collect_t *c = ctx;
+    if(c->count < c->cap) c->out[c->count] = *pkt;
+    c->count++;
+    return 0;
+}
+
+static int cmp_packet(const void *a, const void *b){
+    const sensor_packet_t *x = a, *y = b;
+    if(x->id != y->id) return (x->id < y->id) ? -1 : 1;
+    if(x->type != y->type) return (x->type < y->type) ? -1 : 1;
+    if(x->ts_ms != y->ts_ms) return (x->ts_ms < y->ts_ms) ? -1 : 1;
+    return 0;
+}
+
+// Mix of realistic drift, jumps and IEEE special values
+static double sample_value(int s, size_t i, double *level){
+    switch(rand() % 50){
+        case 0: return 0.0;
+        case 1: return -0.0;
+        case 2: return INFINITY;
+        case 3: return NAN;
+        case 4: return 1e-300 * (rand() % 1000);
+        case 5: return (double)rand() * 1e6;
+        default:
+            level[s] += ((rand() % 21) - 10) / 100.0;
+            return (double)(long)(level[s] * 100.0) / 100.0 + (i % 97 == 0 ? 0.001 : 0.0);
+    }
+}
+
+// Helper: one series written in 'appends' single-sample batches, then the
+// header slot of the last commit torn; the other slot must still give
+// the first appends - 1 samples back. Returns rows read, -1 on error
+static long torn_slot_case(const char *dir, int appends){
+    char path[512], cmd[600];
+    snprintf(path, sizeof(path), "%s/tsdb_verify_slot.tsdb", dir);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+    if(system(cmd) != 0) return -1;
+
+    tsdb_t *t = NULL;
+    if(tsdb_open(&t, path) != 0) return -1;
+    for(int i = 0; i < appends; i++){
+        sensor_packet_t pkt = { .id = 9, .type = 1, .ts_ms = 1700000000000LL + i * 1000, .value = 20.0 + i };
+        if(tsdb_write_batch(t, &pkt, 1) != 0 || tsdb_flush(t) != 0){
+            tsdb_close(t);
+            return -1;
+        }
+    }
+    tsdb_close(t);
+
+    DIR *d = opendir(path);
+    struct dirent *de;
+    char seg[1024] = "";
+    while(d && (de = readdir(d)) != NULL){
+        if(strncmp(de->d_name, "s9_1_", 5) == 0) snprintf(seg, sizeof(seg), "%s/%s", path, de->d_name);
+    }
+    if(d) closedir(d);
+    int fd = seg[0] ? open(seg, O_RDWR) : -1;
+    if(fd < 0) return -1;
+
+    // Tear the newest slot: a header write that stopped halfway
+    tsdb_block_hdr_t slots[2];
+    if(pread(fd, slots, sizeof(slots), 0) != (ssize_t)sizeof(slots)){
+        close(fd);
+        return -1;
+    }
+    int newest = (slots[1].commit > slots[0].commit) ? 1 : 0;
+    slots[newest].crc ^= 0xFFFFFFFFu;
+    slots[newest].count = 0xFFFF;
+    int rc = (pwrite(fd, &slots[newest], sizeof(slots[newest]), newest * sizeof(slots[0])) == (ssize_t)sizeof(slots[0]));
+    close(fd);
+    if(!rc) return -1;
+
+    if(tsdb_open(&t, path) != 0) return -1;
+    collect_t c = { NULL, 0, 0 };
+    tsdb_query_range(t, 9, 1, INT64_MIN, INT64_MAX, collect_row, &c);
+    tsdb_close(t);
+    if(system(cmd) != 0) fprintf(stderr, "failed to remove %s\n", path);
+    return (long)c.count;
+}
+
+static int roundtrip(size_t total, const char *dir){
+    char path[512], cmd[600];
+    snprintf(path, sizeof(path), "%s/tsdb_verify.tsdb", dir);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+    if(system(cmd) != 0) return 1;
+
+    sensor_packet_t *expect = malloc(total * sizeof(*expect));
+    sensor_packet_t *work = malloc(total * sizeof(*work));
+    sensor_packet_t *got = malloc(total * sizeof(*got));
+    if(!expect || !work || !got){
+        perror("malloc");
+        return 1;
+    }
+
+    // Jittery, occasionally out-of-order timestamps
+    srand(7);
+    double level[ROUNDTRIP_SENSORS];
+    int64_t ts[ROUNDTRIP_SENSORS];
+    for(int s = 0; s < ROUNDTRIP_SENSORS; s++){
+        level[s] = 20.0;
+        ts[s] = 1700000000000LL + s;
+    }
+    for(size_t i = 0; i < total; i++){
+        int s = rand() % ROUNDTRIP_SENSORS;
+        int64_t step = (rand() % 100 == 0) ? -(rand() % 5000) - 1 : 1000 + (rand() % 200) - 100;
+        if(rand() % 500 == 0) step = (int64_t)(rand() % 100000) * 1000;
+        ts[s] += step;
+        expect[i].id = 1 + s;
+        expect[i].type = 1 + (s % 3);
+        expect[i].ts_ms = ts[s];
+        expect[i].value = sample_value(s, i, level);
+    }
+    // Unique (id, type, ts) per row, as the gateway guarantees
+    qsort(expect, total, sizeof(*expect), cmp_packet);
+    for(size_t i = 1; i < total; i++){
+        if(cmp_packet(&expect[i - 1], &expect[i]) >= 0) expect[i].ts_ms = expect[i - 1].ts_ms + 1;
+    }
+    // Write in arrival-like order with varying batch sizes
+    memcpy(work, expect, total * sizeof(*work));
+    for(size_t i = total - 1; i > 0; i--){
+        size_t j = rand() % (i + 1);
+        sensor_packet_t tmp = work[i];
+        work[i] = work[j];
+        work[j] = tmp;
+    }
+
+    tsdb_t *t = NULL;
+    if(tsdb_open(&t, path) != 0){
+        fprintf(stderr, "open failed\n");
+        return 1;
+    }
+    for(size_t done = 0; done < total;){
+        size_t n = 1 + rand() % 1500;
+        if(n > total - done) n = total - done;
+        if(tsdb_write_batch(t, work + done, n) != 0){
+            fprintf(stderr, "write failed\n");
+            return 1;
+        }
+        done += n;
+    }
+    uint64_t bytes = tsdb_disk_bytes(t);
+    tsdb_close(t);
+
+    // Simulate torn appends: a half-written new block on sensor 1 segments,
+    // payload bytes whose header slot never landed on sensor 2 segments
+    DIR *d = opendir(path);
+    struct dirent *de;
+    int torn = 0;
+    while(d && (de = readdir(d)) != NULL){
+        int new_block = (strncmp(de->d_name, "s1_", 3) == 0);
+        if(!new_block && strncmp(de->d_name, "s2_", 3) != 0) continue;
+        char seg[1024];
+        snprintf(seg, sizeof(seg), "%s/%s", path, de->d_name);
+        int fd = open(seg, O_WRONLY | O_APPEND);
+        if(fd < 0) continue;
+        if(new_block){
+            tsdb_block_hdr_t junk = { .magic = TSDB_BLOCK_MAGIC, .commit = 1, .count = 5, .payload_len = 100 };
+            if(write(fd, &junk, sizeof(junk)) == (ssize_t)sizeof(junk)) torn++;
+        }
+        else{
+            uint8_t junk[13];
+            for(size_t k = 0; k < sizeof(junk); k++) junk[k] = (uint8_t)rand();
+            if(write(fd, junk, sizeof(junk)) == (ssize_t)sizeof(junk)) torn++;
+        }
+        close(fd);
+    }
+    if(d) closedir(d);
+
+    // Reopen (recovers torn tails) and read everything back
+    if(tsdb_open(&t, path) != 0){
+        fprintf(stderr, "reopen failed\n");
+        return 1;
+    }
+    collect_t c = { got, 0, total };
+    for(int id = 1; id <= 255; id++){
+        for(int type = 1; type <= 3; type++){
+            tsdb_query_range(t, id, type, INT64_MIN, INT64_MAX, collect_row, &c);
+        }
+    }
+    tsdb_close(t);
+
+    int ok = (c.count == total);
+    if(ok){
+        qsort(got, total, sizeof(*got), cmp_packet);
+        for(size_t i = 0; i < total && ok; i++){
+            if(got[i].id != expect[i].id || got[i].type != expect[i].type || got[i].ts_ms != expect[i].ts_ms ||
+               memcmp(&got[i].value, &expect[i].value, sizeof(double)) != 0){
+                fprintf(stderr, "mismatch at row %zu: sensor %d/%d ts %lld value %.17g vs %.17g\n", i,
+                        expect[i].id, expect[i].type, (long long)expect[i].ts_ms, expect[i].value, got[i].value);
+                ok = 0;
+            }
+        }
+    }
+    else{
+        fprintf(stderr, "row count mismatch: wrote %zu, read %zu\n", total, c.count);
+    }
+
+    printf("Round trip %s: %zu rows, %d torn tails recovered, %llu bytes (%.2f B/row)\n",
+           ok ? "PASSED" : "FAILED", total, torn, (unsigned long long)bytes, (double)bytes / total);
+
+    // Torn header slot after 2..4 appends to one open block
+    for(int appends = 2; appends <= 4; appends++){
+        long rows = torn_slot_case(dir, appends);
+        int slot_ok = (rows == appends - 1);
+        printf("Torn header slot after %d appends %s: %ld of %d synced rows read back\n",
+               appends, slot_ok ? "PASSED" : "FAILED", rows, appends - 1);
+        if(!slot_ok) ok = 0;
+    }
+
+    if(ok){
+        if(system(cmd) != 0) fprintf(stderr, "failed to remove %s\n", path);
+    }
+    free(expect);
+    free(work);
+    free(got);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv){
+    if(argc < 2){
+        fprintf(stderr, "Usage: %s <tsdb_dir> | --roundtrip [rows] [work_dir]\n", argv[0]);
+        return 1;
+    }
+    if(strcmp(argv[1], "--roundtrip") == 0){
+        size_t rows = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_ROUNDTRIP_ROWS;
+        const char *dir = (argc > 3) ? argv[3] : "/tmp";
+        if(rows == 0) rows = DEFAULT_ROUNDTRIP_ROWS;
+        return roundtrip(rows, dir);
+    }
+    return verify_dir(argv[1]);
+}
@@ -1,5 +1,8 @@
 #include "cloud_manager.h"
+#include "outbox.h"
 #include "logger.h"
+#include "config.h"
+#include "startup.h"
 
 // Callback: When connect
 static void on_connect(struct mosquitto *mosq, void *userdata, int rc){
@@ -8,10 +11,11 @@ static void on_connect(struct mosquitto *mosq, void *userdata, int rc){
     
     if(rc == 0){
         c->connected = 1;
-        log_event("[MQTT] Sensor %d connected to ThingsBoard broker", c->id);
+        LOG_INFO(MQTT, "Sensor %d connected to ThingsBoard broker", c->id);
+        startup_ready(STARTUP_BROKER);
     } 
     else{
-        log_event("[MQTT] Sensor %d connection failed: %s", c->id, mosquitto_connack_string(rc));
+        LOG_WARN(MQTT, "Sensor %d connection failed: %s", c->id, mosquitto_connack_string(rc));
     }
 }
 
@@ -22,111 +26,462 @@ static void on_disconnect(struct mosquitto *mosq, void *userdata, int rc){
     cloud_client_t *c = (cloud_client_t*)userdata;
     
     c->connected = 0;
-    log_event("[MQTT] Sensor %d disconnected", c->id);
+    LOG_WARN(MQTT, "Sensor %d disconnected", c->id);
 }
 
-// Callback: When publish complete
+// Callback: When publish complete (PUBACK for QoS 1)
 static void on_publish(struct mosquitto *mosq, void *userdata, int mid){
     (void)mosq;
-    (void)mid;
     cloud_client_t *c = (cloud_client_t*)userdata;
-    log_event("[MQTT] Sensor %d message published successfully (mid=%d)", c->id, mid);
+    pub_tracker_ack(&c->tracker, mid);
+    LOG_TRACE(MQTT, "Sensor %d message published successfully (mid=%d)", c->id, mid);
+}
+
+/* ===========================
+ *   Device registry and clients
+ * =========================== */
+
+// Helper: broker password, NULL when none is configured (ThingsBoard
+// authenticates with the access token as user name alone)
+static const char *mqtt_password(void){
+    return g_config.mqtt_password[0] ? g_config.mqtt_password : NULL;
+}
+
+// Only the cloud thread reads or swaps the registry, so lookups need no
+// lock. Clients are separate allocations and survive registry swaps.
+static device_registry_t *registry = NULL;
+static cloud_client_t *retiring = NULL;
+static int clients_enabled = 0;         // device mode opens one client per device
+
+// Helper: create and connect one device client, NULL on failure
+static cloud_client_t *client_open(const device_entry_t *e){
+    cloud_client_t *c = calloc(1, sizeof(*c));
+    if(!c){
+        LOG_ERROR(MQTT, "Failed to allocate client for sensor %d", e->id);
+        return NULL;
+    }
+    c->id = e->id;
+    snprintf(c->token, sizeof(c->token), "%s", e->token);
+
+    char name[32];
+    snprintf(name, sizeof(name), "Sensor %d", c->id);
+    if(pub_tracker_init(&c->tracker, name, g_config.cloud_inflight_max) != 0){
+        free(c);
+        return NULL;
+    }
+
+    // Create mosquitto client
+    c->mosq = mosquitto_new(NULL, true, c);
+    if(!c->mosq){
+        LOG_ERROR(MQTT, "Failed to create client for sensor %d", c->id);
+        pub_tracker_destroy(&c->tracker);
+        free(c);
+        return NULL;
+    }
+    // Same window in the library, so nothing queues behind it unseen
+    mosquitto_max_inflight_messages_set(c->mosq, (unsigned int)g_config.cloud_inflight_max);
+
+    // Set callbacks
+    mosquitto_connect_callback_set(c->mosq, on_connect);
+    mosquitto_disconnect_callback_set(c->mosq, on_disconnect);
+    mosquitto_publish_callback_set(c->mosq, on_publish);
+
+    // Set authentication
+    int rc = mosquitto_username_pw_set(c->mosq, c->token, mqtt_password());
+    if(rc != MOSQ_ERR_SUCCESS){
+        LOG_ERROR(MQTT, "Sensor %d failed to set credentials: %s", c->id, mosquitto_strerror(rc));
+        mosquitto_destroy(c->mosq);
+        c->mosq = NULL;
+        return c;
+    }
+
+    // Start connecting; the handshake completes on the loop thread, so
+    // clients come up side by side. A client that cannot start (no route,
+    // no DNS) is kept, its loop thread retries with the reconnect delay
+    mosquitto_reconnect_delay_set(c->mosq, MQTT_RECONNECT_DELAY_SEC, MQTT_RECONNECT_DELAY_MAX_SEC, true);
+    rc = mosquitto_connect_async(c->mosq, g_config.mqtt_host, g_config.mqtt_port, g_config.mqtt_keepalive);
+    if(rc != MOSQ_ERR_SUCCESS){
+        LOG_WARN(MQTT, "Sensor %d connect failed: %s, will retry", c->id, mosquitto_strerror(rc));
+    }
+
+    // Start network loop
+    rc = mosquitto_loop_start(c->mosq);
+    if(rc != MOSQ_ERR_SUCCESS){
+        LOG_ERROR(MQTT, "Sensor %d failed to start loop: %s", c->id, mosquitto_strerror(rc));
+        mosquitto_loop_stop(c->mosq, true);
+        mosquitto_disconnect(c->mosq);
+        mosquitto_destroy(c->mosq);
+        c->mosq = NULL;
+        return c;
+    }
+
+    LOG_DEBUG(MQTT, "Sensor %d initialization started", c->id);
+    return c;
+}
+
+// Helper: stop, disconnect and free one client
+static void client_close(cloud_client_t *c){
+    if(c->mosq){
+        LOG_DEBUG(MQTT, "Cleaning up client (ID=%d, connected=%d)", c->id, c->connected);
+
+        // Stop the background loop thread
+        mosquitto_loop_stop(c->mosq, true);
+
+        // Disconnect if connected
+        if(c->connected){
+            mosquitto_disconnect(c->mosq);
+        }
+
+        // Destroy client
+        mosquitto_destroy(c->mosq);
+        c->mosq = NULL;
+        c->connected = 0;
+    }
+    // No more acks after the loop stopped; what is left goes back to the scheduler
+    if(c->tracker.sent > 0){
+        char line[512];
+        pub_tracker_format(&c->tracker, line, sizeof(line));
+        LOG_INFO(MQTT, "Closed %s", line);
+    }
+    pub_tracker_destroy(&c->tracker);
+    free(c);
+}
+
+// Load the registry file and swap it in. Devices whose token did not change
+// keep their client and any publishes in flight on it; replaced clients
+// drain on the retiring list. A bad file keeps the current registry.
+int cloud_registry_reload(void){
+    device_registry_t *next = device_registry_load(g_config.device_registry);
+    if(!next){
+        LOG_WARN(MQTT, "Device registry not loaded, keeping %zu devices", registry ? registry->count : 0);
+        return -1;
+    }
+
+    size_t kept = 0, opened = 0, retired = 0;
+    for(size_t i = 0; i < next->count; i++){
+        device_entry_t *e = &next->entries[i];
+        device_entry_t *old = device_registry_find(registry, e->id);
+        if(old && old->client && strcmp(old->token, e->token) == 0){
+            e->client = old->client;
+            old->client = NULL;
+            kept++;
+        }
+        else if(clients_enabled && e->rule.policy != UPLOAD_OFF){
+            e->client = client_open(e);
+            opened += (e->client != NULL);
+        }
+    }
+
+    for(size_t i = 0; registry && i < registry->count; i++){
+        cloud_client_t *c = registry->entries[i].client;
+        if(!c) continue;
+        c->retired_at = time(NULL);
+        c->next = retiring;
+        retiring = c;
+        retired++;
+    }
+
+    device_registry_free(registry);
+    registry = next;
+    LOG_INFO(MQTT, "Device registry active: %zu devices, %zu clients kept, %zu opened, %zu retiring",
+              registry->count, kept, opened, retired);
+    return 0;
+}
+
+// Free retired clients once their publishes are acknowledged, or after the
+// grace period; force frees them all
+void cloud_clients_reap(int force){
+    time_t now = time(NULL);
+    cloud_client_t **pp = &retiring;
+    while(*pp){
+        cloud_client_t *c = *pp;
+        int inflight = pub_tracker_inflight(&c->tracker);
+        if(force || inflight <= 0 || now - c->retired_at >= CLOUD_RETIRE_GRACE_SEC){
+            if(inflight > 0){
+                LOG_WARN(MQTT, "Retired client %d closed with %d publishes unacknowledged", c->id, inflight);
+            }
+            *pp = c->next;
+            client_close(c);
+        }
+        else{
+            pp = &c->next;
+        }
+    }
+}
+
+device_entry_t *cloud_device_find(int id){
+    return device_registry_find(registry, id);
+}
+
+cloud_client_t *find_client_by_id(int id){
+    device_entry_t *e = device_registry_find(registry, id);
+    return e ? e->client : NULL;
+}
+
+// Helper: publish on a connection whose tracker has room; the slot is
+// reserved before the call, PUBACK may arrive before it returns
+static int tracked_publish(struct mosquitto *m, pub_tracker_t *t, const char *topic, const char *payload, int len,
+                           const upload_due_t *items, size_t n, uint64_t outbox_seq, int *rc){
+    int slot = pub_tracker_reserve(t);
+    if(slot < 0) return CLOUD_PUBLISH_BUSY;
+
+    int mid = 0;
+    *rc = mosquitto_publish(m, &mid, topic, len, payload, MQTT_QOS, false);
+    if(*rc != MOSQ_ERR_SUCCESS){
+        pub_tracker_cancel(t, slot);
+        return -1;
+    }
+    pub_tracker_sent(t, slot, mid, items, n, outbox_seq, (size_t)len);
+    return 0;
+}
+
+int cloud_client_publish(cloud_client_t *client, const char *topic, const char *payload, int len,
+                         const upload_due_t *items, size_t n){
+    int rc = MOSQ_ERR_SUCCESS;
+    int result = tracked_publish(client->mosq, &client->tracker, topic, payload, len, items, n, 0, &rc);
+    if(result < 0){
+        LOG_WARN(CLOUD, "Publish failed for sensor %d: %s", client->id, mosquitto_strerror(rc));
+    }
+    return result;
 }
 
 void cloud_clients_init(void){
     int rc = mosquitto_lib_init();
     if(rc != MOSQ_ERR_SUCCESS){
-        log_event("[MQTT] Failed to initialize mosquitto library: %s", mosquitto_strerror(rc));
+        LOG_ERROR(MQTT, "Failed to initialize mosquitto library: %s", mosquitto_strerror(rc));
         return;
     }
-    
-    log_event("[MQTT] Initializing %d cloud clients", NUM_CLIENTS);
-    
-    size_t success_count = 0;
-    
-    for(size_t i = 0; i < NUM_CLIENTS; i++){
-        // Create mosquitto client
-        clients[i].mosq = mosquitto_new(NULL, true, &clients[i]);
-        if(!clients[i].mosq){
-            log_event("[MQTT] Failed to create client for sensor %d", clients[i].id);
+
+    clients_enabled = 1;
+    cloud_registry_reload();
+}
+
+void cloud_clients_cleanup(void){
+    LOG_INFO(MQTT, "Cleaning up cloud clients (%zu devices)", registry ? registry->count : 0);
+
+    for(size_t i = 0; registry && i < registry->count; i++){
+        if(registry->entries[i].client){
+            client_close(registry->entries[i].client);
+            registry->entries[i].client = NULL;
+        }
+    }
+    cloud_clients_reap(1);
+    device_registry_free(registry);
+    registry = NULL;
+
+    // Cleanup library
+    mosquitto_lib_cleanup();
+
+    LOG_INFO(MQTT, "Cloud clients cleanup complete");
+}
+
+/* ===========================
+ *   Gateway session pool
+ * =========================== */
+
+static cloud_session_t sessions[CLOUD_MAX_SESSIONS];
+static int num_sessions = 0;
+static int next_session = 0;
+
+static void on_session_connect(struct mosquitto *mosq, void *userdata, int rc){
+    (void)mosq;
+    cloud_session_t *s = (cloud_session_t*)userdata;
+
+    if(rc == 0){
+        s->connected = 1;
+        LOG_INFO(MQTT, "Gateway session %d connected", s->index);
+        startup_ready(STARTUP_BROKER);
+    }
+    else{
+        LOG_WARN(MQTT, "Gateway session %d connection failed: %s", s->index, mosquitto_connack_string(rc));
+    }
+}
+
+static void on_session_disconnect(struct mosquitto *mosq, void *userdata, int rc){
+    (void)mosq;
+    (void)rc;
+    cloud_session_t *s = (cloud_session_t*)userdata;
+
+    s->connected = 0;
+    LOG_WARN(MQTT, "Gateway session %d disconnected", s->index);
+}
+
+static void on_session_publish(struct mosquitto *mosq, void *userdata, int mid){
+    (void)mosq;
+    cloud_session_t *s = (cloud_session_t*)userdata;
+    pub_tracker_ack(&s->tracker, mid);
+}
+
+// Sessions stay open for the gateway's lifetime; their count does not
+// depend on how many sensors report
+int cloud_sessions_init(void){
+    int rc = mosquitto_lib_init();
+    if(rc != MOSQ_ERR_SUCCESS){
+        LOG_ERROR(MQTT, "Failed to initialize mosquitto library: %s", mosquitto_strerror(rc));
+        return -1;
+    }
+    if(g_config.cloud_gateway_token[0] == '\0'){
+        LOG_ERROR(MQTT, "Gateway mode needs cloud_gateway_token, uploads disabled");
+        return -1;
+    }
+    // Names and upload policy only, devices share the gateway's sessions
+    clients_enabled = 0;
+    cloud_registry_reload();
+
+    num_sessions = g_config.cloud_sessions;
+    int started = 0;
+    for(int i = 0; i < num_sessions; i++){
+        cloud_session_t *s = &sessions[i];
+        *s = (cloud_session_t){ .index = i };
+
+        char name[32];
+        snprintf(name, sizeof(name), "Gateway session %d", i);
+        if(pub_tracker_init(&s->tracker, name, g_config.cloud_inflight_max) != 0){
             continue;
         }
-        
-        // Set callbacks
-        mosquitto_connect_callback_set(clients[i].mosq, on_connect);
-        mosquitto_disconnect_callback_set(clients[i].mosq, on_disconnect);
-        mosquitto_publish_callback_set(clients[i].mosq, on_publish);
-        
-        // Set authentication
-        rc = mosquitto_username_pw_set(clients[i].mosq, clients[i].token, NULL);
-        if(rc != MOSQ_ERR_SUCCESS){
-            log_event("[MQTT] Sensor %d failed to set credentials: %s", clients[i].id, mosquitto_strerror(rc));
-            mosquitto_destroy(clients[i].mosq);
-            clients[i].mosq = NULL;
+        s->mosq = mosquitto_new(NULL, true, s);
+        if(!s->mosq){
+            LOG_ERROR(MQTT, "Failed to create gateway session %d", i);
+            pub_tracker_destroy(&s->tracker);
             continue;
         }
-        
-        // Connect to broker
-        rc = mosquitto_connect(clients[i].mosq, MQTT_BROKER, MQTT_PORT, MQTT_KEEPALIVE);
+        mosquitto_connect_callback_set(s->mosq, on_session_connect);
+        mosquitto_disconnect_callback_set(s->mosq, on_session_disconnect);
+        mosquitto_publish_callback_set(s->mosq, on_session_publish);
+        mosquitto_max_inflight_messages_set(s->mosq, (unsigned int)g_config.cloud_inflight_max);
+
+        mosquitto_reconnect_delay_set(s->mosq, MQTT_RECONNECT_DELAY_SEC, MQTT_RECONNECT_DELAY_MAX_SEC, true);
+
+        rc = mosquitto_username_pw_set(s->mosq, g_config.cloud_gateway_token, mqtt_password());
         if(rc != MOSQ_ERR_SUCCESS){
-            log_event("[MQTT] Sensor %d connect failed: %s", clients[i].id, mosquitto_strerror(rc));
-            mosquitto_destroy(clients[i].mosq);
-            clients[i].mosq = NULL;
+            LOG_ERROR(MQTT, "Gateway session %d failed to set credentials: %s", i, mosquitto_strerror(rc));
             continue;
         }
-        
-        // Start network loop
-        rc = mosquitto_loop_start(clients[i].mosq);
+        // A failed first connect is retried by the loop thread, like a lost one
+        rc = mosquitto_connect_async(s->mosq, g_config.mqtt_host, g_config.mqtt_port, g_config.mqtt_keepalive);
         if(rc != MOSQ_ERR_SUCCESS){
-            log_event("[MQTT] Sensor %d failed to start loop: %s", clients[i].id, mosquitto_strerror(rc));
-            mosquitto_loop_stop(clients[i].mosq, true);
-            mosquitto_disconnect(clients[i].mosq);
-            mosquitto_destroy(clients[i].mosq);
-            clients[i].mosq = NULL;
+            LOG_WARN(MQTT, "Gateway session %d connect failed: %s, will retry", i, mosquitto_strerror(rc));
+        }
+        rc = mosquitto_loop_start(s->mosq);
+        if(rc != MOSQ_ERR_SUCCESS){
+            LOG_ERROR(MQTT, "Gateway session %d failed to start loop: %s", i, mosquitto_strerror(rc));
             continue;
         }
-        
-        success_count++;
-        log_event("[MQTT] Sensor %d initialization started", clients[i].id);
+        started++;
     }
-    
-    log_event("[MQTT] Cloud clients initialization complete: %zu/%d successful", success_count, NUM_CLIENTS);
+
+    LOG_INFO(MQTT, "Gateway mode: %d/%d sessions started", started, num_sessions);
+    return 0;
 }
 
-void cloud_clients_cleanup(void){
-    log_event("[MQTT] Cleaning up cloud clients (NUM_CLIENTS=%zu)", NUM_CLIENTS);
-    
-    for(size_t i = 0; i < NUM_CLIENTS; i++){
-        if(clients[i].mosq){
-            log_event("[MQTT] Cleaning up client %zu (ID=%d, connected=%d)", i, clients[i].id, clients[i].connected);
-            
-            // Stop the background loop thread
-            int rc = mosquitto_loop_stop(clients[i].mosq, true);
-            log_event("[MQTT] mosquitto_loop_stop returned: %d", rc);
-            
-            // Disconnect if connected
-            if(clients[i].connected){
-                mosquitto_disconnect(clients[i].mosq);
-            }
-            
-            // Destroy client
-            mosquitto_destroy(clients[i].mosq);
-            clients[i].mosq = NULL;
-            clients[i].connected = 0;
-            
-            log_event("[MQTT] Sensor %d cleaned up", clients[i].id);
-        } 
-        else{
-            log_event("[MQTT] Client %zu was NULL, skipping", i);
+void cloud_sessions_cleanup(void){
+    for(int i = 0; i < num_sessions; i++){
+        cloud_session_t *s = &sessions[i];
+        if(!s->mosq) continue;
+
+        mosquitto_loop_stop(s->mosq, true);
+        if(s->connected){
+            mosquitto_disconnect(s->mosq);
         }
-        
-        // Fix memory leak when interruption happends while initializing connection
-        clients[i].mosq = NULL;
-        clients[i].connected = 0;
+        mosquitto_destroy(s->mosq);
+
+        char line[512];
+        pub_tracker_format(&s->tracker, line, sizeof(line));
+        LOG_INFO(MQTT, "Closed %s failed=%llu", line, s->failed);
+        pub_tracker_destroy(&s->tracker);
+        s->mosq = NULL;
+        s->connected = 0;
     }
-    
-    // Cleanup library
+    num_sessions = 0;
+    device_registry_free(registry);
+    registry = NULL;
     mosquitto_lib_cleanup();
-    
-    log_event("[MQTT] Cloud clients cleanup complete");
-}
\ No newline at end of file
+}
+
+// Round robin over connected sessions with room in their publish window,
+// else any connected one (its publish reports busy). Sessions that are
+// down are skipped, their loop threads reconnect them.
+cloud_session_t *cloud_session_next(void){
+    cloud_session_t *full = NULL;
+    for(int tries = 0; tries < num_sessions; tries++){
+        cloud_session_t *s = &sessions[next_session];
+        next_session = (next_session + 1) % num_sessions;
+        if(!s->mosq || !s->connected) continue;
+        if(pub_tracker_inflight(&s->tracker) < s->tracker.window) return s;
+        if(!full) full = s;
+    }
+    return full;
+}
+
+int cloud_session_publish(cloud_session_t *s, const char *topic, const char *payload, int len,
+                          const upload_due_t *items, size_t n){
+    int rc = MOSQ_ERR_SUCCESS;
+    int result = tracked_publish(s->mosq, &s->tracker, topic, payload, len, items, n, 0, &rc);
+    if(result < 0){
+        s->failed++;
+        LOG_WARN(MQTT, "Gateway session %d publish failed: %s", s->index, mosquitto_strerror(rc));
+    }
+    return result;
+}
+
+/* ===========================
+ *   Outbox drain
+ * =========================== */
+
+// Publish one spooled payload on the connection its route names.
+// 0 = sent, CLOUD_PUBLISH_BUSY = connection down or window full (retry
+// later), -1 = it can never be sent from this configuration
+int cloud_outbox_publish(const outbox_msg_t *msg){
+    struct mosquitto *m = NULL;
+    pub_tracker_t *t = NULL;
+    const char *topic;
+    cloud_session_t *s = NULL;
+
+    if(msg->route == OUTBOX_ROUTE_GATEWAY){
+        if(num_sessions == 0) return -1;
+        s = cloud_session_next();
+        if(!s) return CLOUD_PUBLISH_BUSY;
+        m = s->mosq;
+        t = &s->tracker;
+        topic = MQTT_GATEWAY_TOPIC;
+    }
+    else{
+        if(!clients_enabled) return -1;
+        // Payloads drain in order, so one waits for its device to come back
+        cloud_client_t *c = find_client_by_id(msg->device);
+        if(!c) return -1;
+        if(!c->mosq || !c->connected) return CLOUD_PUBLISH_BUSY;
+        m = c->mosq;
+        t = &c->tracker;
+        topic = MQTT_TOPIC;
+    }
+
+    int rc = MOSQ_ERR_SUCCESS;
+    int result = tracked_publish(m, t, topic, (const char *)msg->data, (int)msg->len, NULL, 0, msg->seq, &rc);
+    if(result < 0){
+        // Connection trouble, not the payload's fault
+        if(s) s->failed++;
+        LOG_WARN(OUTBOX, "Resend of payload %llu failed: %s", (unsigned long long)msg->seq, mosquitto_strerror(rc));
+        return CLOUD_PUBLISH_BUSY;
+    }
+    return result;
+}
+
+// Window and ack latency of every connection, one line each
+void cloud_publish_stats_log(void){
+    char line[512];
+    for(int i = 0; i < num_sessions; i++){
+        if(!sessions[i].mosq) continue;
+        pub_tracker_format(&sessions[i].tracker, line, sizeof(line));
+        LOG_INFO(MQTT, "%s", line);
+    }
+    for(size_t i = 0; registry && i < registry->count; i++){
+        cloud_client_t *c = registry->entries[i].client;
+        if(!c || c->tracker.sent == 0) continue;
+        pub_tracker_format(&c->tracker, line, sizeof(line));
+        LOG_INFO(MQTT, "%s", line);
+    }
+    outbox_stats_format(line, sizeof(line));
+    line[strcspn(line, "\n")] = '\0';
+    LOG_INFO(OUTBOX, "%s", line);
+}
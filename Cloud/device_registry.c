@@ -0,0 +1,243 @@
+#include "device_registry.h"
+#include "cloud_manager.h"
+#include "logger.h"
+#include "config.h"
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+
+// Helper: spread sequential ids over the index
+static inline size_t registry_hash(int id){
+    return (size_t)((uint32_t)id * 2654435761u);
+}
+
+// Helper: next whitespace separated field, double quotes allow spaces;
+// NULL at end of line
+static char *next_field(char **cursor){
+    char *s = *cursor;
+    while(isspace((unsigned char)*s)) s++;
+    if(*s == '\0') return NULL;
+
+    char *start = s;
+    if(*s == '"'){
+        start = ++s;
+        while(*s && *s != '"') s++;
+    }
+    else{
+        while(*s && !isspace((unsigned char)*s)) s++;
+    }
+    if(*s) *s++ = '\0';
+    *cursor = s;
+    return start;
+}
+
+// Helper: seconds in 1..86400 up to stop (':' or end), -1 if malformed
+static int parse_seconds(const char *num, const char **rest){
+    char *end;
+    long v = strtol(num, &end, 10);
+    if(end == num || (*end != '\0' && *end != ':') || v < 1 || v > 86400) return -1;
+    *rest = end;
+    return (int)v;
+}
+
+int deadband_parse(const char *text, double *band, uint8_t *pct){
+    char *end;
+    double v = strtod(text, &end);
+    if(end == text || !isfinite(v) || v < 0) return -1;
+    *pct = (*end == '%');
+    if(*pct) end++;
+    if(*end != '\0') return -1;
+    *band = v;
+    return 0;
+}
+
+// Helper: "band[:<d>[%][:<min>[:<max>]]]" after "band"
+static int parse_band(const char *p, upload_rule_t *r){
+    r->policy = UPLOAD_DEADBAND;
+    r->min_interval_s = 1;
+    r->max_interval_s = 0;
+    r->deadband = -1;
+    r->deadband_pct = 0;
+    if(*p == '\0') return 0;
+    if(*p++ != ':') return -1;
+
+    // Deadband up to the next ':'
+    char band[32];
+    size_t n = strcspn(p, ":");
+    if(n >= sizeof(band)) return -1;
+    memcpy(band, p, n);
+    band[n] = '\0';
+    p += n;
+    if(strcmp(band, "*") != 0 && deadband_parse(band, &r->deadband, &r->deadband_pct) != 0) return -1;
+
+    if(*p == '\0') return 0;
+    if((r->min_interval_s = parse_seconds(p + 1, &p)) < 0) return -1;
+    if(*p == '\0') return 0;
+    if((r->max_interval_s = parse_seconds(p + 1, &p)) < 0 || *p != '\0') return -1;
+    return (r->max_interval_s >= r->min_interval_s) ? 0 : -1;
+}
+
+// "off", "<s>", "every:<s>", "change[:<s>]", "alarm[:<s>]" or "band..."
+int upload_rule_parse(const char *policy, upload_rule_t *r){
+    upload_rule_t parsed = { .policy = UPLOAD_EVERY, .min_interval_s = UPLOAD_INTERVAL_SEC, .deadband = -1 };
+    const char *num = policy;
+    const char *rest;
+
+    if(strcmp(policy, "off") == 0){
+        parsed.policy = UPLOAD_OFF;
+        *r = parsed;
+        return 0;
+    }
+    if(strncmp(policy, "band", 4) == 0){
+        if(parse_band(policy + 4, &parsed) != 0) return -1;
+        *r = parsed;
+        return 0;
+    }
+    if(strncmp(policy, "every:", 6) == 0){
+        num = policy + 6;
+    }
+    else if(strncmp(policy, "change", 6) == 0 || strncmp(policy, "alarm", 5) == 0){
+        parsed.policy = (policy[0] == 'c') ? UPLOAD_ON_CHANGE : UPLOAD_ON_ALARM;
+        parsed.min_interval_s = 1;
+        num = policy + ((policy[0] == 'c') ? 6 : 5);
+        if(*num == '\0'){
+            *r = parsed;
+            return 0;
+        }
+        if(*num++ != ':') return -1;
+    }
+
+    if((parsed.min_interval_s = parse_seconds(num, &rest)) < 0 || *rest != '\0') return -1;
+    *r = parsed;
+    return 0;
+}
+
+void upload_rule_default(upload_rule_t *r){
+    if(upload_rule_parse(g_config.cloud_default_policy, r) != 0){
+        *r = (upload_rule_t){ .policy = UPLOAD_EVERY, .min_interval_s = UPLOAD_INTERVAL_SEC, .deadband = -1 };
+    }
+}
+
+// Helper: parse one line into e, 1 if it holds a device, -1 if malformed
+static int parse_line(char *line, device_entry_t *e){
+    char *hash = strchr(line, '#');
+    if(hash) *hash = '\0';
+
+    char *cur = line;
+    char *id = next_field(&cur);
+    if(!id) return 0;
+    char *token = next_field(&cur);
+    char *name = next_field(&cur);
+    char *policy = next_field(&cur);
+    if(!token || next_field(&cur)) return -1;
+
+    char *end;
+    long v = strtol(id, &end, 10);
+    if(*end != '\0' || v < 0 || v > INT_MAX) return -1;
+    if(strlen(token) >= DEVICE_TOKEN_MAX) return -1;
+
+    memset(e, 0, sizeof(*e));
+    e->id = (int)v;
+    upload_rule_default(&e->rule);
+    snprintf(e->token, sizeof(e->token), "%s", token);
+    if(name && name[0]){
+        // Names go into JSON payloads unescaped
+        if(strlen(name) >= DEVICE_NAME_MAX || strpbrk(name, "\\\"")) return -1;
+        snprintf(e->name, sizeof(e->name), "%s", name);
+    }
+    else{
+        snprintf(e->name, sizeof(e->name), "Sensor %d", e->id);
+    }
+
+    if(policy && upload_rule_parse(policy, &e->rule) != 0) return -1;
+    return 1;
+}
+
+// Helper: build the hash index, half full at most. -1 on a duplicate id.
+static int build_index(device_registry_t *reg){
+    size_t size = 16;
+    while(size < reg->count * 2) size <<= 1;
+
+    reg->index = malloc(size * sizeof(*reg->index));
+    if(!reg->index) return -1;
+    memset(reg->index, 0xff, size * sizeof(*reg->index));
+    reg->index_mask = size - 1;
+
+    for(size_t i = 0; i < reg->count; i++){
+        size_t slot = registry_hash(reg->entries[i].id) & reg->index_mask;
+        while(reg->index[slot] >= 0){
+            if(reg->entries[reg->index[slot]].id == reg->entries[i].id){
+                LOG_WARN(REGISTRY, "Duplicate device id %d", reg->entries[i].id);
+                return -1;
+            }
+            slot = (slot + 1) & reg->index_mask;
+        }
+        reg->index[slot] = (int32_t)i;
+    }
+    return 0;
+}
+
+// The whole file is rejected on any error, so a bad edit never replaces
+// a working registry
+device_registry_t *device_registry_load(const char *path){
+    FILE *f = fopen(path, "r");
+    if(!f){
+        LOG_ERROR(REGISTRY, "Cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    device_registry_t *reg = calloc(1, sizeof(*reg));
+    size_t cap = 0;
+    char line[512];
+    int lineno = 0, errors = 0;
+    while(reg && fgets(line, sizeof(line), f)){
+        lineno++;
+        device_entry_t e;
+        int rc = parse_line(line, &e);
+        if(rc < 0){
+            LOG_WARN(REGISTRY, "%s:%d: malformed device line", path, lineno);
+            errors++;
+            continue;
+        }
+        if(rc == 0) continue;
+
+        if(reg->count == cap){
+            size_t ncap = cap ? cap * 2 : 64;
+            device_entry_t *n = (ncap <= DEVICE_REGISTRY_MAX) ? realloc(reg->entries, ncap * sizeof(*n)) : NULL;
+            if(!n){
+                LOG_WARN(REGISTRY, "%s: too many devices", path);
+                errors++;
+                break;
+            }
+            reg->entries = n;
+            cap = ncap;
+        }
+        reg->entries[reg->count++] = e;
+    }
+    fclose(f);
+
+    if(!reg || errors || build_index(reg) != 0){
+        device_registry_free(reg);
+        return NULL;
+    }
+    LOG_INFO(REGISTRY, "Loaded %zu devices from %s (index %zu slots)", reg->count, path, reg->index_mask + 1);
+    return reg;
+}
+
+void device_registry_free(device_registry_t *reg){
+    if(!reg) return;
+    free(reg->entries);
+    free(reg->index);
+    free(reg);
+}
+
+device_entry_t *device_registry_find(const device_registry_t *reg, int id){
+    if(!reg || !reg->index) return NULL;
+    size_t slot = registry_hash(id) & reg->index_mask;
+    while(reg->index[slot] >= 0){
+        device_entry_t *e = &reg->entries[reg->index[slot]];
+        if(e->id == id) return e;
+        slot = (slot + 1) & reg->index_mask;
+    }
+    return NULL;
+}
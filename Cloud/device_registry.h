@@ -0,0 +1,74 @@
+#ifndef DEVICE_REGISTRY_H
+#define DEVICE_REGISTRY_H
+
+#include "main.h"
+
+// Device registry: sensor id -> cloud credentials, device name and upload
+// policy, loaded from a text file and swapped as a whole on reload.
+// One line per device:
+//   <id> <token> ["device name"] [policy]
+// '#' starts a comment. The name defaults to "Sensor <id>". Policies:
+//   <s> | every:<s>   new data, at most every s seconds (default UPLOAD_INTERVAL_SEC)
+//   change[:<s>]      the average changed, at most every s seconds (default 1)
+//   alarm[:<s>]       a threshold alarm was raised, at most every s seconds (default 1)
+//   band[:<d>[%][:<min>[:<max>]]]
+//                     report by exception: the average moved more than d (or
+//                     d percent) from the last reported value, at most every
+//                     min seconds (default 1); an alarm raised or cleared goes
+//                     at once; at least every max seconds while data arrives
+//                     (default cloud_report_max_s). d = "*" or no d takes the
+//                     sensor type's default deadband from the configuration.
+//   off               registered, never uploaded
+// Lines without a policy take cloud_default_policy.
+
+#define DEVICE_REGISTRY_FILE "../devices.conf"
+#define DEVICE_TOKEN_MAX 64
+#define DEVICE_NAME_MAX 64
+#define DEVICE_REGISTRY_MAX 65536
+
+typedef struct cloud_client cloud_client_t;
+
+typedef enum{
+    UPLOAD_EVERY,
+    UPLOAD_ON_CHANGE,
+    UPLOAD_ON_ALARM,
+    UPLOAD_DEADBAND,
+    UPLOAD_OFF
+} upload_policy_t;
+
+typedef struct{
+    upload_policy_t policy;
+    int min_interval_s;         // minimum spacing between uploads
+    int max_interval_s;         // band: longest silence while data arrives, 0 = configured default
+    double deadband;            // band: < 0 = the sensor type's default
+    uint8_t deadband_pct;       // band: deadband is a percentage of the last reported value
+} upload_rule_t;
+
+typedef struct{
+    int id;
+    char token[DEVICE_TOKEN_MAX];
+    char name[DEVICE_NAME_MAX];
+    upload_rule_t rule;
+    cloud_client_t *client;     // device mode connection, owned by the uploader
+} device_entry_t;
+
+// Immutable once loaded, apart from the client pointers
+typedef struct{
+    device_entry_t *entries;
+    size_t count;
+    int32_t *index;             // open addressing, entry position or -1
+    size_t index_mask;          // index size - 1, size is a power of two
+} device_registry_t;
+
+device_registry_t *device_registry_load(const char *path);
+void device_registry_free(device_registry_t *reg);
+device_entry_t *device_registry_find(const device_registry_t *reg, int id);
+
+// Policy text as above into r, -1 if malformed
+int upload_rule_parse(const char *text, upload_rule_t *r);
+// cloud_default_policy, every UPLOAD_INTERVAL_SEC if that does not parse
+void upload_rule_default(upload_rule_t *r);
+// Deadband "<d>" or "<d>%", -1 if malformed
+int deadband_parse(const char *text, double *band, uint8_t *pct);
+
+#endif
@@ -0,0 +1,621 @@
+#include "outbox.h"
+#include "logger.h"
+#include "utilities.h"
+#include <dirent.h>
+#include <sys/uio.h>
+
+// One segment file covering [first_seq, last_seq]; last_seq = first_seq - 1 while empty
+typedef struct{
+    uint64_t first_seq;
+    uint64_t last_seq;
+    size_t bytes;
+} outbox_segment_t;
+
+static struct{
+    int enabled;
+    char dir[256];
+    size_t max_bytes;
+    size_t segment_max;
+    int evict_oldest;
+
+    // Oldest first; while write_fd is open the last one is being written
+    outbox_segment_t segs[OUTBOX_MAX_SEGMENTS];
+    size_t num_segs;
+    size_t total_bytes;
+    int write_fd;
+    int dirty;
+
+    uint64_t next_seq;
+    uint64_t read_seq;              // next payload to drain
+    uint64_t committed;             // every seq up to here acknowledged or evicted
+    uint64_t committed_saved;       // on disk
+    int64_t saved_ms;
+    uint64_t inflight[OUTBOX_INFLIGHT_MAX];
+    size_t num_inflight;
+
+    // Reader: read_fd is positioned at the record read_fd_seq
+    int read_fd;
+    uint64_t read_fd_seq;
+    int peeked;                     // buf holds the payload of read_seq
+    outbox_record_t peek_hdr;
+    uint8_t *buf;
+    size_t buf_cap;
+
+    // Statistics
+    unsigned long long appended;
+    unsigned long long drained;
+    unsigned long long acked;
+    unsigned long long resent;
+    unsigned long long evicted;     // dropped unsent to stay under max_bytes
+    unsigned long long rejected;    // not spooled: over max_bytes or write error
+    unsigned long long discarded;   // unroutable or unreadable
+    int64_t rate_start_ms;
+    unsigned long long rate_start_acked;
+    double drain_rate;              // acked per second over the last window
+
+    pthread_mutex_t mutex;
+} ob = {
+    .write_fd = -1,
+    .read_fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint32_t record_crc(const outbox_record_t *h, const void *payload, size_t len){
+    outbox_record_t tmp = *h;
+    tmp.crc = 0;
+    return crc32_update(crc32_update(0, &tmp, sizeof(tmp)), payload, len);
+}
+
+static void segment_path(uint64_t first_seq, char *out, size_t len){
+    snprintf(out, len, "%s/obx_%020llu.seg", ob.dir, (unsigned long long)first_seq);
+}
+
+// Helper: room for len payload bytes in the read buffer
+static int buf_reserve(size_t len){
+    if(len <= ob.buf_cap) return 0;
+    uint8_t *n = realloc(ob.buf, len);
+    if(!n) return -1;
+    ob.buf = n;
+    ob.buf_cap = len;
+    return 0;
+}
+
+// Helper: read exactly len bytes, 0 on success
+static int read_full(int fd, void *dst, size_t len){
+    uint8_t *p = dst;
+    size_t done = 0;
+    while(done < len){
+        ssize_t r = read(fd, p + done, len - done);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) return -1;
+        done += r;
+    }
+    return 0;
+}
+
+/* ===========================
+ *   Cursor file
+ * =========================== */
+
+static uint64_t cursor_load(void){
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", ob.dir, OUTBOX_CURSOR_FILE);
+
+    uint64_t c[2];
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    int ok = (read_full(fd, c, sizeof(c)) == 0);
+    close(fd);
+
+    if(!ok || c[1] != (crc32_update(0, &c[0], sizeof(c[0])) ^ OUTBOX_MAGIC)){
+        LOG_WARN(OUTBOX, "Cursor file unreadable, resending whole outbox");
+        return 0;
+    }
+    return c[0];
+}
+
+// Helper: write-temp-then-rename so a crash leaves the old or the new cursor
+static int cursor_save(uint64_t seq){
+    char path[320], tmp[330];
+    snprintf(path, sizeof(path), "%s/%s", ob.dir, OUTBOX_CURSOR_FILE);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    uint64_t c[2] = { seq, crc32_update(0, &seq, sizeof(seq)) ^ OUTBOX_MAGIC };
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return -1;
+    int ok = (write(fd, c, sizeof(c)) == (ssize_t)sizeof(c) && fdatasync(fd) == 0);
+    close(fd);
+    if(!ok || rename(tmp, path) != 0) return -1;
+
+    int dfd = open(ob.dir, O_RDONLY | O_DIRECTORY);
+    if(dfd >= 0){
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+
+/* ===========================
+ *   Segments
+ * =========================== */
+
+// Helper: last valid seq and valid bytes of one segment; a torn append
+// only damages the tail
+static void segment_scan(outbox_segment_t *s){
+    char path[320];
+    segment_path(s->first_seq, path, sizeof(path));
+    s->last_seq = s->first_seq - 1;
+    s->bytes = 0;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return;
+    outbox_record_t h;
+    while(read_full(fd, &h, sizeof(h)) == 0){
+        if(h.magic != OUTBOX_MAGIC || h.seq != s->last_seq + 1 || buf_reserve(h.len) != 0) break;
+        if(read_full(fd, ob.buf, h.len) != 0 || record_crc(&h, ob.buf, h.len) != h.crc) break;
+        s->last_seq = h.seq;
+        s->bytes += sizeof(h) + h.len;
+    }
+    close(fd);
+}
+
+static int cmp_segment(const void *a, const void *b){
+    const outbox_segment_t *x = a, *y = b;
+    return (x->first_seq > y->first_seq) - (x->first_seq < y->first_seq);
+}
+
+// Helper: the written segment, if any, is never removed
+static size_t closed_segments(void){
+    return (ob.write_fd >= 0) ? ob.num_segs - 1 : ob.num_segs;
+}
+
+// Helper: drop segment 0 from disk and the list
+static void segment_remove_first(void){
+    char path[320];
+    segment_path(ob.segs[0].first_seq, path, sizeof(path));
+    unlink(path);
+    ob.total_bytes -= ob.segs[0].bytes;
+    ob.num_segs--;
+    memmove(&ob.segs[0], &ob.segs[1], ob.num_segs * sizeof(ob.segs[0]));
+}
+
+// Helper: committed = one before the oldest payload not yet acknowledged
+static void cursor_update(void){
+    uint64_t lowest = ob.read_seq;
+    for(size_t i = 0; i < ob.num_inflight; i++){
+        if(ob.inflight[i] < lowest) lowest = ob.inflight[i];
+    }
+    if(lowest - 1 > ob.committed) ob.committed = lowest - 1;
+}
+
+// Helper: remove seq from the in-flight set, 1 if it was there
+static int inflight_remove(uint64_t seq){
+    for(size_t i = 0; i < ob.num_inflight; i++){
+        if(ob.inflight[i] == seq){
+            ob.inflight[i] = ob.inflight[--ob.num_inflight];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Helper: evict the oldest closed segment, acknowledged or not
+static void segment_evict_oldest(void){
+    outbox_segment_t s = ob.segs[0];
+    uint64_t from = (ob.committed >= s.first_seq) ? ob.committed + 1 : s.first_seq;
+    if(s.last_seq >= from) ob.evicted += s.last_seq - from + 1;
+    segment_remove_first();
+
+    if(s.last_seq > ob.committed) ob.committed = s.last_seq;
+    if(ob.read_seq <= s.last_seq){
+        ob.read_seq = s.last_seq + 1;
+        ob.peeked = 0;
+        if(ob.read_fd >= 0) close(ob.read_fd);
+        ob.read_fd = -1;
+    }
+    for(size_t i = 0; i < ob.num_inflight;){
+        if(ob.inflight[i] <= s.last_seq) ob.inflight[i] = ob.inflight[--ob.num_inflight];
+        else i++;
+    }
+}
+
+// Helper: delete closed segments whose payloads are all acknowledged
+static void segment_trim(void){
+    while(closed_segments() > 0 && ob.segs[0].last_seq <= ob.committed_saved){
+        segment_remove_first();
+    }
+}
+
+// Helper: start a new segment at next_seq
+static int segment_start(void){
+    if(ob.write_fd >= 0){
+        fdatasync(ob.write_fd);
+        close(ob.write_fd);
+        ob.write_fd = -1;
+        ob.dirty = 0;
+    }
+    if(ob.num_segs == OUTBOX_MAX_SEGMENTS){
+        if(!ob.evict_oldest) return -1;
+        segment_evict_oldest();
+    }
+
+    char path[320];
+    segment_path(ob.next_seq, path, sizeof(path));
+    ob.write_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(ob.write_fd < 0){
+        LOG_ERROR(OUTBOX, "Failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    ob.segs[ob.num_segs++] = (outbox_segment_t){ ob.next_seq, ob.next_seq - 1, 0 };
+    return 0;
+}
+
+/* ===========================
+ *   Reader
+ * =========================== */
+
+// Helper: move read_seq past a segment that is missing or damaged
+static void reader_skip_segment(void){
+    uint64_t next = ob.next_seq;
+    for(size_t i = 0; i < ob.num_segs; i++){
+        if(ob.segs[i].first_seq > ob.read_seq){
+            next = ob.segs[i].first_seq;
+            break;
+        }
+    }
+    LOG_WARN(OUTBOX, "Payloads %llu..%llu unreadable, skipped",
+              (unsigned long long)ob.read_seq, (unsigned long long)next - 1);
+    ob.discarded += next - ob.read_seq;
+    ob.read_seq = next;
+    if(ob.read_fd >= 0) close(ob.read_fd);
+    ob.read_fd = -1;
+}
+
+// Helper: position read_fd at read_seq; -1 if its segment cannot be read
+static int reader_seek(void){
+    if(ob.read_fd >= 0 && ob.read_fd_seq == ob.read_seq) return 0;
+    if(ob.read_fd >= 0) close(ob.read_fd);
+    ob.read_fd = -1;
+
+    const outbox_segment_t *s = NULL;
+    for(size_t i = 0; i < ob.num_segs; i++){
+        if(ob.segs[i].first_seq <= ob.read_seq && ob.read_seq <= ob.segs[i].last_seq){
+            s = &ob.segs[i];
+            break;
+        }
+    }
+    if(!s) return -1;
+
+    char path[320];
+    segment_path(s->first_seq, path, sizeof(path));
+    ob.read_fd = open(path, O_RDONLY);
+    if(ob.read_fd < 0) return -1;
+
+    // Records are variable length: walk the headers up to read_seq
+    ob.read_fd_seq = s->first_seq;
+    outbox_record_t h;
+    while(ob.read_fd_seq < ob.read_seq){
+        if(read_full(ob.read_fd, &h, sizeof(h)) != 0 || h.seq != ob.read_fd_seq ||
+           lseek(ob.read_fd, h.len, SEEK_CUR) < 0){
+            close(ob.read_fd);
+            ob.read_fd = -1;
+            return -1;
+        }
+        ob.read_fd_seq++;
+    }
+    return 0;
+}
+
+/* ===========================
+ *   API
+ * =========================== */
+
+// Loads the cursor and existing segments; payloads after the cursor are
+// drained again
+int outbox_open(const char *dir, size_t max_bytes, int evict_oldest){
+    pthread_mutex_lock(&ob.mutex);
+    snprintf(ob.dir, sizeof(ob.dir), "%s", dir);
+    ob.max_bytes = max_bytes;
+    ob.evict_oldest = evict_oldest;
+    ob.segment_max = max_bytes / 4;
+    if(ob.segment_max > OUTBOX_SEGMENT_MAX) ob.segment_max = OUTBOX_SEGMENT_MAX;
+    ob.num_segs = ob.total_bytes = ob.num_inflight = 0;
+    ob.write_fd = ob.read_fd = -1;
+    ob.peeked = ob.dirty = 0;
+    ob.enabled = 0;
+
+    if(max_bytes == 0){
+        pthread_mutex_unlock(&ob.mutex);
+        return 0;
+    }
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+        LOG_ERROR(OUTBOX, "Failed to create %s: %s", dir, strerror(errno));
+        pthread_mutex_unlock(&ob.mutex);
+        return -1;
+    }
+
+    ob.committed = ob.committed_saved = cursor_load();
+
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    while(d && (de = readdir(d)) != NULL){
+        unsigned long long first;
+        if(sscanf(de->d_name, "obx_%llu.seg", &first) != 1 || first == 0) continue;
+        if(ob.num_segs == OUTBOX_MAX_SEGMENTS){
+            LOG_WARN(OUTBOX, "Too many segments in %s, ignoring %s", dir, de->d_name);
+            continue;
+        }
+        ob.segs[ob.num_segs++] = (outbox_segment_t){ first, 0, 0 };
+    }
+    if(d) closedir(d);
+    qsort(ob.segs, ob.num_segs, sizeof(ob.segs[0]), cmp_segment);
+
+    // Acknowledged or empty segments go, the rest is the backlog
+    uint64_t last = ob.committed;
+    size_t kept = 0;
+    for(size_t i = 0; i < ob.num_segs; i++){
+        outbox_segment_t s = ob.segs[i];
+        segment_scan(&s);
+        if(s.last_seq < s.first_seq || s.last_seq <= ob.committed){
+            char path[320];
+            segment_path(s.first_seq, path, sizeof(path));
+            unlink(path);
+            continue;
+        }
+        ob.segs[kept++] = s;
+        ob.total_bytes += s.bytes;
+        if(s.last_seq > last) last = s.last_seq;
+    }
+    ob.num_segs = kept;
+    ob.next_seq = last + 1;
+    ob.read_seq = ob.committed + 1;
+    ob.saved_ms = ob.rate_start_ms = time_now_ms();
+    ob.rate_start_acked = ob.acked;
+    ob.enabled = 1;
+
+    LOG_INFO(OUTBOX, "Opened %s: %llu payloads pending in %zu segments (%zu bytes, max %zu, evict %s)",
+              dir, (unsigned long long)(ob.next_seq - 1 - ob.committed), ob.num_segs, ob.total_bytes,
+              ob.max_bytes, ob.evict_oldest ? "oldest" : "newest");
+    pthread_mutex_unlock(&ob.mutex);
+    return 0;
+}
+
+int outbox_append(outbox_route_t route, int device, const void *payload, size_t len){
+    size_t need = sizeof(outbox_record_t) + len;
+
+    pthread_mutex_lock(&ob.mutex);
+    if(!ob.enabled){
+        pthread_mutex_unlock(&ob.mutex);
+        return -1;
+    }
+
+    // Bounded disk use: make room or refuse
+    while(ob.total_bytes + need > ob.max_bytes && ob.evict_oldest && closed_segments() > 0){
+        segment_evict_oldest();
+    }
+    if(ob.total_bytes + need > ob.max_bytes){
+        ob.rejected++;
+        pthread_mutex_unlock(&ob.mutex);
+        return -1;
+    }
+    if(ob.write_fd < 0 || (ob.segs[ob.num_segs - 1].bytes > 0 && ob.segs[ob.num_segs - 1].bytes + need > ob.segment_max)){
+        if(segment_start() != 0){
+            ob.rejected++;
+            pthread_mutex_unlock(&ob.mutex);
+            return -1;
+        }
+    }
+
+    outbox_record_t h = {
+        .magic = OUTBOX_MAGIC,
+        .seq = ob.next_seq,
+        .created_ms = time_now_ms(),
+        .len = (uint32_t)len,
+        .device = (uint16_t)device,
+        .route = (uint8_t)route,
+    };
+    h.crc = record_crc(&h, payload, len);
+
+    struct iovec iov[2] = { { &h, sizeof(h) }, { (void *)payload, len } };
+    ssize_t w;
+    do{
+        w = writev(ob.write_fd, iov, 2);
+    } while(w < 0 && errno == EINTR);
+    if(w != (ssize_t)need){
+        // The partial record ends this segment; the next append starts another
+        LOG_ERROR(OUTBOX, "Write failed: %s", (w < 0) ? strerror(errno) : "short write");
+        close(ob.write_fd);
+        ob.write_fd = -1;
+        ob.rejected++;
+        pthread_mutex_unlock(&ob.mutex);
+        return -1;
+    }
+
+    outbox_segment_t *s = &ob.segs[ob.num_segs - 1];
+    s->last_seq = ob.next_seq++;
+    s->bytes += need;
+    ob.total_bytes += need;
+    ob.appended++;
+    ob.dirty = 1;
+    pthread_mutex_unlock(&ob.mutex);
+    return 0;
+}
+
+// Helper: caller holds the mutex
+static void outbox_sync_locked(int force){
+    if(ob.dirty && ob.write_fd >= 0){
+        if(fdatasync(ob.write_fd) != 0){
+            LOG_ERROR(OUTBOX, "Sync failed: %s", strerror(errno));
+        }
+        ob.dirty = 0;
+    }
+
+    int64_t now = time_now_ms();
+    if(ob.committed > ob.committed_saved && (force || now - ob.saved_ms >= OUTBOX_CURSOR_SAVE_MS)){
+        if(cursor_save(ob.committed) == 0){
+            ob.committed_saved = ob.committed;
+            ob.saved_ms = now;
+            segment_trim();
+        }
+        else{
+            LOG_ERROR(OUTBOX, "Failed to save cursor: %s", strerror(errno));
+        }
+    }
+
+    if(now - ob.rate_start_ms >= OUTBOX_RATE_WINDOW_SEC * 1000){
+        ob.drain_rate = (double)(ob.acked - ob.rate_start_acked) * 1000.0 / (double)(now - ob.rate_start_ms);
+        ob.rate_start_ms = now;
+        ob.rate_start_acked = ob.acked;
+    }
+}
+
+void outbox_sync(void){
+    pthread_mutex_lock(&ob.mutex);
+    if(ob.enabled) outbox_sync_locked(0);
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+int outbox_peek(outbox_msg_t *msg){
+    pthread_mutex_lock(&ob.mutex);
+    while(ob.enabled && !ob.peeked && ob.read_seq < ob.next_seq){
+        if(ob.num_inflight == OUTBOX_INFLIGHT_MAX) break;
+        if(reader_seek() != 0){
+            reader_skip_segment();
+            continue;
+        }
+
+        outbox_record_t h;
+        if(read_full(ob.read_fd, &h, sizeof(h)) != 0 || h.magic != OUTBOX_MAGIC || h.seq != ob.read_seq ||
+           buf_reserve(h.len) != 0 || read_full(ob.read_fd, ob.buf, h.len) != 0 ||
+           record_crc(&h, ob.buf, h.len) != h.crc){
+            reader_skip_segment();
+            continue;
+        }
+        ob.read_fd_seq = h.seq + 1;
+        ob.peek_hdr = h;
+        ob.peeked = 1;
+    }
+
+    int got = ob.enabled && ob.peeked;
+    if(got){
+        *msg = (outbox_msg_t){
+            .seq = ob.peek_hdr.seq,
+            .created_ms = ob.peek_hdr.created_ms,
+            .route = (outbox_route_t)ob.peek_hdr.route,
+            .device = ob.peek_hdr.device,
+            .data = ob.buf,
+            .len = ob.peek_hdr.len,
+        };
+    }
+    cursor_update();
+    pthread_mutex_unlock(&ob.mutex);
+    return got;
+}
+
+void outbox_taken(uint64_t seq){
+    pthread_mutex_lock(&ob.mutex);
+    if(ob.peeked && seq == ob.read_seq && ob.num_inflight < OUTBOX_INFLIGHT_MAX){
+        ob.inflight[ob.num_inflight++] = seq;
+        ob.read_seq++;
+        ob.peeked = 0;
+        ob.drained++;
+    }
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+void outbox_untake(uint64_t seq){
+    pthread_mutex_lock(&ob.mutex);
+    if(inflight_remove(seq)){
+        ob.drained--;
+        // The read buffer still holds it, unless a nack rewound past it
+        if(ob.read_seq == seq + 1){
+            ob.read_seq = seq;
+            ob.peeked = 1;
+        }
+    }
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+void outbox_discard(uint64_t seq){
+    pthread_mutex_lock(&ob.mutex);
+    if(ob.peeked && seq == ob.read_seq){
+        ob.read_seq++;
+        ob.peeked = 0;
+        ob.discarded++;
+        cursor_update();
+    }
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+void outbox_ack(uint64_t seq){
+    pthread_mutex_lock(&ob.mutex);
+    if(inflight_remove(seq)){
+        ob.acked++;
+        cursor_update();
+    }
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+// Everything from seq on is drained again; payloads after it that are
+// still in flight may be delivered twice
+void outbox_nack(uint64_t seq){
+    pthread_mutex_lock(&ob.mutex);
+    if(inflight_remove(seq)){
+        ob.resent++;
+        if(seq < ob.read_seq){
+            ob.read_seq = seq;
+            ob.peeked = 0;
+        }
+    }
+    pthread_mutex_unlock(&ob.mutex);
+}
+
+size_t outbox_backlog(void){
+    pthread_mutex_lock(&ob.mutex);
+    size_t n = ob.enabled ? (size_t)(ob.next_seq - 1 - ob.committed) : 0;
+    pthread_mutex_unlock(&ob.mutex);
+    return n;
+}
+
+size_t outbox_stats_format(char *out, size_t len){
+    pthread_mutex_lock(&ob.mutex);
+    int n;
+    if(!ob.enabled){
+        n = snprintf(out, len, "outbox off\n");
+    }
+    else{
+        n = snprintf(out, len, "outbox backlog=%llu inflight=%zu segments=%zu bytes=%zu/%zu appended=%llu drained=%llu "
+                     "acked=%llu resent=%llu evicted=%llu rejected=%llu discarded=%llu drain_rate=%.1f/s\n",
+                     (unsigned long long)(ob.next_seq - 1 - ob.committed), ob.num_inflight, ob.num_segs,
+                     ob.total_bytes, ob.max_bytes, ob.appended, ob.drained, ob.acked, ob.resent,
+                     ob.evicted, ob.rejected, ob.discarded, ob.drain_rate);
+    }
+    pthread_mutex_unlock(&ob.mutex);
+    if(n < 0) return 0;
+    return ((size_t)n < len) ? (size_t)n : len - 1;
+}
+
+// Final sync and cursor save; the backlog stays on disk for the next start
+void outbox_close(void){
+    pthread_mutex_lock(&ob.mutex);
+    if(!ob.enabled){
+        pthread_mutex_unlock(&ob.mutex);
+        return;
+    }
+    // Unacknowledged in-flight payloads are resent after a restart
+    ob.num_inflight = 0;
+    outbox_sync_locked(1);
+    if(ob.write_fd >= 0) close(ob.write_fd);
+    if(ob.read_fd >= 0) close(ob.read_fd);
+    ob.write_fd = ob.read_fd = -1;
+    ob.enabled = 0;
+
+    LOG_INFO(OUTBOX, "Closed: %llu appended, %llu drained, %llu acked, %llu resent, %llu evicted, %llu rejected, "
+              "%llu pending", ob.appended, ob.drained, ob.acked, ob.resent, ob.evicted, ob.rejected,
+              (unsigned long long)(ob.next_seq - 1 - ob.committed));
+
+    free(ob.buf);
+    ob.buf = NULL;
+    ob.buf_cap = 0;
+    pthread_mutex_unlock(&ob.mutex);
+}
@@ -0,0 +1,74 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include "main.h"
+
+// Store-and-forward queue for cloud payloads.
+// A payload that cannot be published (broker down, session lost) is
+// appended to segment files on disk instead of being dropped, and the
+// sensors count as delivered. The cloud thread drains the queue at a
+// bounded rate next to live uploads. The ack cursor moves only on PUBACK
+// and is saved with write-temp-then-rename, so a restart resends from the
+// first unacknowledged payload (at least once). Disk use is bounded;
+// past the bound either the oldest segments or the new payloads are dropped.
+
+#define OUTBOX_DIR "../Database/outbox"
+#define OUTBOX_CURSOR_FILE "cursor"
+#define OUTBOX_MAGIC 0x3158424Fu        // "OBX1"
+#define OUTBOX_SEGMENT_MAX (1024 * 1024)
+#define OUTBOX_MAX_SEGMENTS 1024
+#define OUTBOX_INFLIGHT_MAX 256         // drained, awaiting PUBACK
+#define OUTBOX_CURSOR_SAVE_MS 1000
+#define OUTBOX_RATE_WINDOW_SEC 10       // drain rate metric
+
+typedef enum{
+    OUTBOX_ROUTE_DEVICE = 1,            // v1/devices/me/telemetry on the device's client
+    OUTBOX_ROUTE_GATEWAY = 2            // v1/gateway/telemetry on any session
+} outbox_route_t;
+
+typedef struct{
+    uint32_t magic;
+    uint32_t crc;                       // CRC-32 of the header with crc = 0, then the payload
+    uint64_t seq;
+    int64_t created_ms;                 // wall clock when spooled
+    uint32_t len;
+    uint16_t device;                    // sensor id for OUTBOX_ROUTE_DEVICE
+    uint8_t route;
+    uint8_t reserved;
+} outbox_record_t;
+
+// Next payload to drain; data stays valid until the next outbox call
+typedef struct{
+    uint64_t seq;
+    int64_t created_ms;
+    outbox_route_t route;
+    int device;
+    const uint8_t *data;
+    size_t len;
+} outbox_msg_t;
+
+// max_bytes 0 keeps the outbox closed: appends fail, nothing is drained
+int outbox_open(const char *dir, size_t max_bytes, int evict_oldest);
+void outbox_close(void);
+
+int outbox_append(outbox_route_t route, int device, const void *payload, size_t len);
+// Make appends durable and save the ack cursor if it moved
+void outbox_sync(void);
+
+// Drain side: peek the next payload and mark it taken before publishing
+// (its PUBACK may come before the publish call returns); untake it if
+// the publish did not go out
+int outbox_peek(outbox_msg_t *msg);
+void outbox_taken(uint64_t seq);
+void outbox_untake(uint64_t seq);
+// Skip a payload that can never be sent (its route or device is gone)
+void outbox_discard(uint64_t seq);
+// PUBACK, or the publish was lost and is resent from seq
+void outbox_ack(uint64_t seq);
+void outbox_nack(uint64_t seq);
+
+size_t outbox_backlog(void);
+// Backlog, disk use, counters and drain rate, one line
+size_t outbox_stats_format(char *out, size_t len);
+
+#endif
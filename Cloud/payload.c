@@ -0,0 +1,334 @@
+#include "payload.h"
+#include <math.h>
+#include <zlib.h>
+
+/* ===========================
+ *   Buffer
+ * =========================== */
+
+void payload_buf_init(payload_buf_t *b){
+    b->data = NULL;
+    b->len = b->cap = 0;
+    b->oom = 0;
+}
+
+void payload_buf_free(payload_buf_t *b){
+    free(b->data);
+    payload_buf_init(b);
+}
+
+void payload_buf_reset(payload_buf_t *b){
+    b->len = 0;
+    b->oom = 0;
+}
+
+// Helper: room for extra more bytes, 0 on success
+static int buf_reserve(payload_buf_t *b, size_t extra){
+    if(b->len + extra <= b->cap) return 0;
+
+    size_t ncap = b->cap ? b->cap : PAYLOAD_INITIAL_CAP;
+    while(ncap < b->len + extra) ncap *= 2;
+    uint8_t *n = realloc(b->data, ncap);
+    if(!n){
+        b->oom = 1;
+        return -1;
+    }
+    b->data = n;
+    b->cap = ncap;
+    return 0;
+}
+
+static inline void put(payload_buf_t *b, const void *src, size_t n){
+    if(buf_reserve(b, n) != 0) return;
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+}
+
+static inline void put_byte(payload_buf_t *b, uint8_t c){
+    if(buf_reserve(b, 1) != 0) return;
+    b->data[b->len++] = c;
+}
+
+/* ===========================
+ *   Number formatting
+ * =========================== */
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Helper: decimal digits of v, two at a time from the back; returns the length
+static size_t format_u64(uint64_t v, char *out){
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while(v >= 100){
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if(v >= 10){
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    }
+    else{
+        *--p = (char)('0' + v);
+    }
+    size_t n = (size_t)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, n);
+    return n;
+}
+
+static void json_int(payload_buf_t *b, int64_t v){
+    char s[21];
+    size_t n = 0;
+    uint64_t u = (uint64_t)v;
+    if(v < 0){
+        s[n++] = '-';
+        u = 0 - u;
+    }
+    n += format_u64(u, s + n);
+    put(b, s, n);
+}
+
+// Helper: |v| in hundredths, rounded like printf does: on the exact
+// binary value, ties to even. v * 100 alone may round across a tie, so
+// the side of the tie is taken from an fma, whose single rounding keeps
+// the sign of the exact difference.
+static uint64_t hundredths(double v){
+    double a = fabs(v);
+    double fl = floor(a * 100.0);
+    double t = fma(a, 100.0, -(fl + 0.5));
+    uint64_t r = (uint64_t)fl;
+    if(t > 0 || (t == 0 && (r & 1))) r++;
+    return r;
+}
+
+// Same text as "%.2f" for finite values below 1e15
+static void json_fixed2(payload_buf_t *b, double v){
+    if(!isfinite(v)){
+        put(b, "null", 4);
+        return;
+    }
+    if(fabs(v) >= 1e15){
+        char s[64];
+        int n = snprintf(s, sizeof(s), "%.2f", v);
+        put(b, s, (size_t)n);
+        return;
+    }
+
+    char s[24];
+    size_t n = 0;
+    uint64_t r = hundredths(v);
+    if(signbit(v)) s[n++] = '-';
+    n += format_u64(r / 100, s + n);
+    s[n++] = '.';
+    memcpy(s + n, &digit_pairs[(r % 100) * 2], 2);
+    put(b, s, n + 2);
+}
+
+static void json_string(payload_buf_t *b, const char *str){
+    put_byte(b, '"');
+    for(const char *c = str; *c; c++){
+        if(*c == '"' || *c == '\\'){
+            put_byte(b, '\\');
+            put_byte(b, (uint8_t)*c);
+        }
+        else if((unsigned char)*c < 0x20){
+            char esc[7];
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*c);
+            put(b, esc, 6);
+        }
+        else{
+            put_byte(b, (uint8_t)*c);
+        }
+    }
+    put_byte(b, '"');
+}
+
+/* ===========================
+ *   CBOR
+ * =========================== */
+
+// Helper: major type with its argument in the shortest form
+static void cbor_head(payload_buf_t *b, uint8_t major, uint64_t arg){
+    uint8_t h[9];
+    size_t n;
+    if(arg < 24){
+        h[0] = (uint8_t)(major << 5 | arg);
+        n = 1;
+    }
+    else if(arg <= 0xff){
+        h[0] = (uint8_t)(major << 5 | 24);
+        h[1] = (uint8_t)arg;
+        n = 2;
+    }
+    else if(arg <= 0xffff){
+        h[0] = (uint8_t)(major << 5 | 25);
+        h[1] = (uint8_t)(arg >> 8);
+        h[2] = (uint8_t)arg;
+        n = 3;
+    }
+    else if(arg <= 0xffffffffULL){
+        h[0] = (uint8_t)(major << 5 | 26);
+        for(int i = 0; i < 4; i++) h[1 + i] = (uint8_t)(arg >> (24 - 8 * i));
+        n = 5;
+    }
+    else{
+        h[0] = (uint8_t)(major << 5 | 27);
+        for(int i = 0; i < 8; i++) h[1 + i] = (uint8_t)(arg >> (56 - 8 * i));
+        n = 9;
+    }
+    put(b, h, n);
+}
+
+static void cbor_int(payload_buf_t *b, int64_t v){
+    if(v >= 0) cbor_head(b, 0, (uint64_t)v);
+    else cbor_head(b, 1, (uint64_t)(-(v + 1)));
+}
+
+static void cbor_string(payload_buf_t *b, const char *s){
+    size_t n = strlen(s);
+    cbor_head(b, 3, n);
+    put(b, s, n);
+}
+
+/* ===========================
+ *   Writer
+ * =========================== */
+
+void payload_begin(payload_writer_t *w, payload_buf_t *b, payload_format_t format){
+    w->buf = b;
+    w->format = format;
+    w->depth = 0;
+    w->nonempty[0] = 0;
+    w->in_key = 0;
+}
+
+// Helper: JSON comma before an item, unless it is the value of a key
+static void json_sep(payload_writer_t *w){
+    if(w->in_key){
+        w->in_key = 0;
+        return;
+    }
+    if(w->nonempty[w->depth]) put_byte(w->buf, ',');
+    w->nonempty[w->depth] = 1;
+}
+
+static void open_level(payload_writer_t *w, uint8_t json_c, uint8_t cbor_c){
+    if(w->format == PAYLOAD_JSON){
+        json_sep(w);
+        put_byte(w->buf, json_c);
+    }
+    else{
+        put_byte(w->buf, cbor_c);
+    }
+    if(w->depth + 1 < PAYLOAD_MAX_DEPTH){
+        w->depth++;
+        w->nonempty[w->depth] = 0;
+    }
+    else{
+        w->buf->oom = 1;
+    }
+}
+
+static void close_level(payload_writer_t *w, uint8_t json_c){
+    put_byte(w->buf, (w->format == PAYLOAD_JSON) ? json_c : 0xff);
+    if(w->depth > 0) w->depth--;
+}
+
+void payload_map_open(payload_writer_t *w){
+    open_level(w, '{', 0xbf);
+}
+
+void payload_map_close(payload_writer_t *w){
+    close_level(w, '}');
+}
+
+void payload_array_open(payload_writer_t *w){
+    open_level(w, '[', 0x9f);
+}
+
+void payload_array_close(payload_writer_t *w){
+    close_level(w, ']');
+}
+
+void payload_key(payload_writer_t *w, const char *key){
+    if(w->format == PAYLOAD_JSON){
+        json_sep(w);
+        json_string(w->buf, key);
+        put_byte(w->buf, ':');
+        w->in_key = 1;
+    }
+    else{
+        cbor_string(w->buf, key);
+    }
+}
+
+void payload_int(payload_writer_t *w, int64_t v){
+    if(w->format == PAYLOAD_JSON){
+        json_sep(w);
+        json_int(w->buf, v);
+    }
+    else{
+        cbor_int(w->buf, v);
+    }
+}
+
+void payload_fixed2(payload_writer_t *w, double v){
+    if(w->format == PAYLOAD_JSON){
+        json_sep(w);
+        json_fixed2(w->buf, v);
+    }
+    else if(!isfinite(v) || fabs(v) >= 1e15){
+        put_byte(w->buf, isfinite(v) ? 0xfb : 0xf6);
+        if(isfinite(v)){
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            for(int i = 0; i < 8; i++) put_byte(w->buf, (uint8_t)(bits >> (56 - 8 * i)));
+        }
+    }
+    else{
+        // Decimal fraction: tag 4, [exponent -2, mantissa]
+        static const uint8_t head[3] = { 0xc4, 0x82, 0x21 };
+        put(w->buf, head, sizeof(head));
+        int64_t m = (int64_t)hundredths(v);
+        cbor_int(w->buf, signbit(v) ? -m : m);
+    }
+}
+
+void payload_string(payload_writer_t *w, const char *s){
+    if(w->format == PAYLOAD_JSON){
+        json_sep(w);
+        json_string(w->buf, s);
+    }
+    else{
+        cbor_string(w->buf, s);
+    }
+}
+
+/* ===========================
+ *   Compression
+ * =========================== */
+
+// The result is swapped into b, so both buffers keep their capacity
+int payload_compress(payload_buf_t *b, size_t min_bytes, payload_buf_t *scratch){
+    if(min_bytes == 0 || b->len < min_bytes || b->oom) return 0;
+
+    uLongf out_len = compressBound((uLong)b->len);
+    payload_buf_reset(scratch);
+    if(buf_reserve(scratch, out_len) != 0) return -1;
+    if(compress2(scratch->data, &out_len, b->data, (uLong)b->len, Z_BEST_SPEED) != Z_OK) return -1;
+    if(out_len >= b->len) return 0;
+    scratch->len = out_len;
+
+    payload_buf_t tmp = *b;
+    *b = *scratch;
+    *scratch = tmp;
+    return 1;
+}
+
+payload_format_t payload_format_parse(const char *name){
+    return (strcmp(name, "cbor") == 0) ? PAYLOAD_CBOR : PAYLOAD_JSON;
+}
@@ -0,0 +1,58 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include "main.h"
+
+// Streaming payload encoder for cloud uploads.
+// One writer API produces either JSON text or CBOR (RFC 8949, indefinite
+// length maps and arrays so nothing is counted up front). Output goes into
+// a growable buffer that is reset, not freed, between messages, so the
+// steady state does no allocation. Fixed-point values are written with
+// two decimals: "25.37" in JSON, a decimal fraction (tag 4) in CBOR.
+// Payloads above a size threshold can be deflated; a zlib stream starts
+// with 0x78, which tells it apart from JSON ('{') and CBOR (0xbf).
+
+#define PAYLOAD_MAX_DEPTH 12          // gateway raw windows nest 9 deep
+#define PAYLOAD_INITIAL_CAP 1024
+
+typedef enum{
+    PAYLOAD_JSON,
+    PAYLOAD_CBOR
+} payload_format_t;
+
+typedef struct{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int oom;                    // an append failed, the content is incomplete
+} payload_buf_t;
+
+typedef struct{
+    payload_buf_t *buf;
+    payload_format_t format;
+    int depth;
+    uint8_t nonempty[PAYLOAD_MAX_DEPTH];    // JSON: level already has an item
+    uint8_t in_key;                         // JSON: a key was written, value comes next
+} payload_writer_t;
+
+void payload_buf_init(payload_buf_t *b);
+void payload_buf_free(payload_buf_t *b);
+void payload_buf_reset(payload_buf_t *b);
+
+void payload_begin(payload_writer_t *w, payload_buf_t *b, payload_format_t format);
+void payload_map_open(payload_writer_t *w);
+void payload_map_close(payload_writer_t *w);
+void payload_array_open(payload_writer_t *w);
+void payload_array_close(payload_writer_t *w);
+void payload_key(payload_writer_t *w, const char *key);
+void payload_int(payload_writer_t *w, int64_t v);
+void payload_fixed2(payload_writer_t *w, double v);    // non-finite -> null
+void payload_string(payload_writer_t *w, const char *s);
+
+// Deflate b in place when it is at least min_bytes long (0 = never);
+// 1 if compressed, 0 if left as is, -1 on error (b unchanged)
+int payload_compress(payload_buf_t *b, size_t min_bytes, payload_buf_t *scratch);
+
+payload_format_t payload_format_parse(const char *name);
+
+#endif
@@ -0,0 +1,264 @@
+#include "publish_tracker.h"
+#include "outbox.h"
+#include "logger.h"
+
+// Trackers with publishes in flight, cloud thread only
+static pub_tracker_t *active_head = NULL;
+
+// Helper: take a finished slot out of matching; caller holds the mutex.
+// It stays reserved, with its items, until slot_finish has reported it
+static void slot_close(pub_slot_t *s, upload_result_t result){
+    s->closing = 1;
+    s->result = result;
+    s->mid = 0;
+}
+
+// Helper: report a closed slot's sensors to the scheduler, or its payload
+// to the outbox, then free it; called without the mutex, so the network
+// thread never holds it across those locks
+static void slot_finish(pub_tracker_t *t, pub_slot_t *s){
+    for(size_t i = 0; i < s->n_items; i++){
+        upload_sched_done(&s->items[i], s->result);
+    }
+    if(s->outbox_seq){
+        if(s->result == UPLOAD_ACKED) outbox_ack(s->outbox_seq);
+        else outbox_nack(s->outbox_seq);
+    }
+
+    pthread_mutex_lock(&t->mutex);
+    s->used = 0;
+    s->closing = 0;
+    s->n_items = 0;
+    s->outbox_seq = 0;
+    t->inflight--;
+    pthread_mutex_unlock(&t->mutex);
+}
+
+static void active_unlink(pub_tracker_t *t){
+    for(pub_tracker_t **pp = &active_head; *pp; pp = &(*pp)->next_active){
+        if(*pp == t){
+            *pp = t->next_active;
+            break;
+        }
+    }
+    t->next_active = NULL;
+    t->active = 0;
+}
+
+/* ===========================
+ *   API
+ * =========================== */
+
+int pub_tracker_init(pub_tracker_t *t, const char *name, int window){
+    memset(t, 0, sizeof(*t));
+    if(window < 1) window = 1;
+    if(window > PUB_TRACKER_WINDOW_MAX) window = PUB_TRACKER_WINDOW_MAX;
+
+    t->slots = calloc((size_t)window, sizeof(*t->slots));
+    if(!t->slots){
+        LOG_ERROR(MQTT, "Failed to allocate publish window for %s", name);
+        return -1;
+    }
+    pthread_mutex_init(&t->mutex, NULL);
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->window = window;
+    return 0;
+}
+
+void pub_tracker_destroy(pub_tracker_t *t){
+    if(!t->slots) return;
+    if(t->active) active_unlink(t);
+
+    // The network thread has stopped, nothing else finishes slots now
+    pthread_mutex_lock(&t->mutex);
+    for(int i = 0; i < t->window; i++){
+        pub_slot_t *s = &t->slots[i];
+        if(!s->used || s->closing) continue;
+        t->dropped++;
+        slot_close(s, UPLOAD_FAILED);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    for(int i = 0; i < t->window; i++){
+        if(t->slots[i].closing) slot_finish(t, &t->slots[i]);
+    }
+
+    for(int i = 0; i < t->window; i++){
+        free(t->slots[i].items);
+    }
+    free(t->slots);
+    t->slots = NULL;
+    pthread_mutex_destroy(&t->mutex);
+}
+
+int pub_tracker_reserve(pub_tracker_t *t){
+    if(!t->slots) return -1;
+
+    int slot = -1;
+    pthread_mutex_lock(&t->mutex);
+    if(t->inflight < t->window){
+        for(int i = 0; i < t->window; i++){
+            if(!t->slots[i].used){
+                slot = i;
+                break;
+            }
+        }
+    }
+    if(slot >= 0){
+        pub_slot_t *s = &t->slots[slot];
+        s->used = 1;
+        s->closing = 0;
+        s->late = 0;
+        s->mid = 0;
+        s->n_items = 0;
+        s->outbox_seq = 0;
+        t->inflight++;
+    }
+    else{
+        t->busy++;
+    }
+    pthread_mutex_unlock(&t->mutex);
+
+    if(slot >= 0 && !t->active){
+        t->active = 1;
+        t->next_active = active_head;
+        active_head = t;
+    }
+    return slot;
+}
+
+int pub_tracker_sent(pub_tracker_t *t, int slot, int mid, const upload_due_t *items, size_t n,
+                     uint64_t outbox_seq, size_t bytes){
+    pub_slot_t *s = &t->slots[slot];
+
+    pthread_mutex_lock(&t->mutex);
+    if(n > s->cap_items){
+        upload_due_t *grown = realloc(s->items, n * sizeof(*grown));
+        if(!grown){
+            // Untracked, so treated as failed rather than left taken;
+            // its PUBACK, if any, lands in the early ring
+            s->outbox_seq = outbox_seq;
+            slot_close(s, UPLOAD_FAILED);
+            pthread_mutex_unlock(&t->mutex);
+            slot_finish(t, s);
+            for(size_t i = 0; i < n; i++) upload_sched_done(&items[i], UPLOAD_FAILED);
+            LOG_WARN(MQTT, "%s: no memory to track mid %d, its sensors are requeued", t->name, mid);
+            return -1;
+        }
+        s->items = grown;
+        s->cap_items = n;
+    }
+    if(n > 0) memcpy(s->items, items, n * sizeof(*items));
+    s->n_items = n;
+    s->outbox_seq = outbox_seq;
+    s->bytes = bytes;
+    s->sent_ms = time_mono_ms();
+    s->mid = mid;
+    t->sent++;
+
+    // PUBACK may have arrived before mosquitto_publish returned
+    for(int i = 0; i < PUB_TRACKER_EARLY_MAX; i++){
+        if(t->early[i] == mid){
+            t->early[i] = 0;
+            t->acked++;
+            log2_hist_add(&t->ack_ms, 0);
+            slot_close(s, UPLOAD_ACKED);
+            break;
+        }
+    }
+    int acked = s->closing;
+    pthread_mutex_unlock(&t->mutex);
+    if(acked) slot_finish(t, s);
+    return 0;
+}
+
+void pub_tracker_cancel(pub_tracker_t *t, int slot){
+    pthread_mutex_lock(&t->mutex);
+    slot_close(&t->slots[slot], UPLOAD_FAILED);
+    pthread_mutex_unlock(&t->mutex);
+    slot_finish(t, &t->slots[slot]);
+}
+
+void pub_tracker_ack(pub_tracker_t *t, int mid){
+    if(!t->slots) return;
+
+    pthread_mutex_lock(&t->mutex);
+    pub_slot_t *match = NULL;
+    for(int i = 0; i < t->window; i++){
+        if(t->slots[i].used && t->slots[i].mid == mid){
+            match = &t->slots[i];
+            break;
+        }
+    }
+    if(match){
+        int64_t ms = time_mono_ms() - match->sent_ms;
+        log2_hist_add(&t->ack_ms, (unsigned long long)(ms > 0 ? ms : 0));
+        t->acked++;
+        if(match->late) t->late++;
+        slot_close(match, UPLOAD_ACKED);
+    }
+    else{
+        // Not recorded yet, or already dropped; the next expiry pass clears it
+        t->early[t->early_next] = mid;
+        t->early_next = (t->early_next + 1) % PUB_TRACKER_EARLY_MAX;
+    }
+    pthread_mutex_unlock(&t->mutex);
+    if(match) slot_finish(t, match);
+}
+
+void pub_tracker_expire_all(int timeout_ms){
+    int64_t now = time_mono_ms();
+    pub_tracker_t **pp = &active_head;
+    while(*pp){
+        pub_tracker_t *t = *pp;
+        size_t expired = 0;
+
+        // libmosquitto still holds these and resends them after a
+        // reconnect, so they keep their slot until the PUBACK arrives
+        pthread_mutex_lock(&t->mutex);
+        for(int i = 0; i < t->window; i++){
+            pub_slot_t *s = &t->slots[i];
+            if(!s->used || s->mid == 0 || s->late || now - s->sent_ms < timeout_ms) continue;
+            s->late = 1;
+            t->expired++;
+            expired++;
+        }
+        // Early acks are claimed by pub_tracker_sent right after the publish
+        // call on this thread, so anything left is stale; once mids wrap it
+        // would match an unrelated message
+        memset(t->early, 0, sizeof(t->early));
+        t->early_next = 0;
+        int idle = (t->inflight == 0);
+        pthread_mutex_unlock(&t->mutex);
+
+        if(expired > 0){
+            LOG_WARN(MQTT, "%s: %zu publishes not acknowledged within %d ms, still awaiting PUBACK",
+                      t->name, expired, timeout_ms);
+        }
+        if(idle){
+            *pp = t->next_active;
+            t->next_active = NULL;
+            t->active = 0;
+        }
+        else{
+            pp = &t->next_active;
+        }
+    }
+}
+
+int pub_tracker_inflight(pub_tracker_t *t){
+    pthread_mutex_lock(&t->mutex);
+    int n = t->inflight;
+    pthread_mutex_unlock(&t->mutex);
+    return n;
+}
+
+// "name sent=.. acked=.. expired=.. late=.. dropped=.. busy=.. inflight=../window
+//  ack_ms n=.. mean=.. max=.. <1:.. <2:.."
+size_t pub_tracker_format(pub_tracker_t *t, char *out, size_t len){
+    pthread_mutex_lock(&t->mutex);
+    size_t used = snprintf(out, len, "%s sent=%llu acked=%llu expired=%llu late=%llu dropped=%llu busy=%llu inflight=%d/%d ",
+                           t->name, t->sent, t->acked, t->expired, t->late, t->dropped, t->busy, t->inflight, t->window);
+    if(used < len - 1) used += log2_hist_format(&t->ack_ms, "ack_ms", out + used, len - used);
+    pthread_mutex_unlock(&t->mutex);
+    return (used < len) ? used : len - 1;
+}
@@ -0,0 +1,83 @@
+#ifndef PUBLISH_TRACKER_H
+#define PUBLISH_TRACKER_H
+
+#include "main.h"
+#include "upload_scheduler.h"
+#include "utilities.h"
+
+// QoS 1 publishes awaiting PUBACK on one MQTT connection.
+// Each slot holds the message id, send time, payload size and what the
+// message carries: live sensors or one outbox payload. Their upload
+// watermark or the outbox cursor moves only when the broker acknowledges;
+// a message whose connection is closed hands its sensors back to the
+// scheduler or its payload back to the outbox.
+// The window bounds how many messages one connection has outstanding.
+// libmosquitto itself resends unacknowledged messages after a reconnect,
+// so a message past the ack timeout is only marked late: requeuing it
+// would upload it twice, and freeing its slot would let the window run
+// ahead of the library's own inflight limit.
+//
+// Threads: the cloud thread reserves, sends, cancels and expires; the
+// connection's network thread acknowledges. Scheduler and outbox calls for
+// a finished slot run after the tracker mutex is released.
+
+#define PUB_TRACKER_WINDOW_MAX 256
+#define PUB_TRACKER_EARLY_MAX 16        // acks seen before their mid was recorded
+
+typedef struct{
+    uint8_t used;
+    uint8_t closing;                    // finished, reported outside the mutex
+    uint8_t late;                       // past the ack timeout, still awaiting PUBACK
+    upload_result_t result;
+    int mid;                            // 0 while the publish call is in progress
+    int64_t sent_ms;
+    size_t bytes;
+    upload_due_t *items;                // grown on demand, kept for reuse
+    size_t n_items;
+    size_t cap_items;
+    uint64_t outbox_seq;                // 0 = live message
+} pub_slot_t;
+
+typedef struct pub_tracker{
+    pthread_mutex_t mutex;
+    char name[32];
+    int window;
+    int inflight;
+    pub_slot_t *slots;
+    int early[PUB_TRACKER_EARLY_MAX];
+    int early_next;
+
+    unsigned long long sent;
+    unsigned long long acked;
+    unsigned long long expired;         // ack timeout passed, slot kept
+    unsigned long long late;            // acknowledged after the ack timeout
+    unsigned long long dropped;         // connection closed while in flight
+    unsigned long long busy;            // window full when a publish was due
+    log2_hist_t ack_ms;                 // PUBACK latency
+
+    // Cloud thread only: list of trackers with publishes in flight
+    struct pub_tracker *next_active;
+    uint8_t active;
+} pub_tracker_t;
+
+int pub_tracker_init(pub_tracker_t *t, const char *name, int window);
+// Requeues whatever is still in flight
+void pub_tracker_destroy(pub_tracker_t *t);
+
+// Free slot for the next publish, -1 when the window is full
+int pub_tracker_reserve(pub_tracker_t *t);
+// The publish call succeeded with this mid; items are copied
+int pub_tracker_sent(pub_tracker_t *t, int slot, int mid, const upload_due_t *items, size_t n,
+                     uint64_t outbox_seq, size_t bytes);
+// The publish call failed
+void pub_tracker_cancel(pub_tracker_t *t, int slot);
+// PUBACK, from the network thread
+void pub_tracker_ack(pub_tracker_t *t, int mid);
+// Mark publishes older than timeout_ms late on every tracker
+void pub_tracker_expire_all(int timeout_ms);
+
+int pub_tracker_inflight(pub_tracker_t *t);
+// Counters and ack latency histogram, one line
+size_t pub_tracker_format(pub_tracker_t *t, char *out, size_t len);
+
+#endif
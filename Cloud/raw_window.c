@@ -0,0 +1,152 @@
+#include "raw_window.h"
+#include <math.h>
+
+void raw_windows_init(raw_windows_t *w, int window_s, size_t max_samples, int scale){
+    memset(w, 0, sizeof(*w));
+    for(int i = 0; i < RAW_WINDOW_DEVICES; i++){
+        w->win[i].id = i;
+    }
+    w->window_ms = (int64_t)window_s * 1000;
+    w->max_samples = max_samples;
+    w->scale = (scale > 0) ? scale : 1;
+}
+
+void raw_windows_free(raw_windows_t *w){
+    for(int i = 0; i < RAW_WINDOW_DEVICES; i++){
+        raw_window_t *win = &w->win[i];
+        for(size_t s = 0; s < win->cap_series; s++){
+            free(win->series[s].samples);
+        }
+        free(win->series);
+    }
+    memset(w, 0, sizeof(*w));
+}
+
+// Helper: the window's series for type, created on first use
+static raw_series_t *series_for(raw_window_t *win, uint8_t type){
+    for(size_t i = 0; i < win->n_series; i++){
+        if(win->series[i].type == type) return &win->series[i];
+    }
+    if(win->n_series == win->cap_series){
+        size_t ncap = win->cap_series ? win->cap_series * 2 : 2;
+        raw_series_t *grown = realloc(win->series, ncap * sizeof(*grown));
+        if(!grown) return NULL;
+        memset(grown + win->cap_series, 0, (ncap - win->cap_series) * sizeof(*grown));
+        win->series = grown;
+        win->cap_series = ncap;
+    }
+    // Slots past n_series keep the sample arrays of earlier windows
+    raw_series_t *s = &win->series[win->n_series++];
+    s->type = type;
+    s->n = 0;
+    return s;
+}
+
+raw_window_t *raw_windows_add(raw_windows_t *w, const sensor_packet_t *pkt, int64_t now_ms){
+    double scaled = pkt->value * w->scale;
+    if(!isfinite(scaled) || fabs(scaled) >= 9e15){
+        w->dropped++;
+        return NULL;
+    }
+
+    raw_window_t *win = &w->win[pkt->id];
+    raw_series_t *s = series_for(win, pkt->type);
+    if(s && s->n == s->cap){
+        size_t ncap = s->cap ? s->cap * 2 : RAW_WINDOW_INITIAL_CAP;
+        raw_sample_t *grown = realloc(s->samples, ncap * sizeof(*grown));
+        if(grown){
+            s->samples = grown;
+            s->cap = ncap;
+        }
+    }
+    if(!s || s->n == s->cap){
+        w->dropped++;
+        return NULL;
+    }
+
+    s->samples[s->n].ts_ms = pkt->ts_ms;
+    s->samples[s->n].q = llround(scaled);
+    s->n++;
+
+    if(!win->open){
+        win->open = 1;
+        win->opened_ms = now_ms;
+        win->t0_ms = pkt->ts_ms;
+        w->open++;
+    }
+    else if(pkt->ts_ms < win->t0_ms){
+        win->t0_ms = pkt->ts_ms;
+    }
+    win->samples++;
+    return (win->samples >= w->max_samples) ? win : NULL;
+}
+
+raw_window_t *raw_windows_next_due(raw_windows_t *w, int64_t now_ms, int force){
+    if(w->open == 0) return NULL;
+    for(int i = 0; i < RAW_WINDOW_DEVICES; i++){
+        raw_window_t *win = &w->win[i];
+        if(win->open && (force || now_ms - win->opened_ms >= w->window_ms)) return win;
+    }
+    return NULL;
+}
+
+int64_t raw_windows_wait_ms(const raw_windows_t *w, int64_t now_ms){
+    if(w->open == 0) return -1;
+    int64_t wait = w->window_ms;
+    for(int i = 0; i < RAW_WINDOW_DEVICES; i++){
+        const raw_window_t *win = &w->win[i];
+        if(!win->open) continue;
+        int64_t left = win->opened_ms + w->window_ms - now_ms;
+        if(left < wait) wait = left;
+    }
+    return (wait > 0) ? wait : 0;
+}
+
+void raw_window_encode(const raw_window_t *win, int scale, payload_writer_t *pw){
+    payload_map_open(pw);
+    payload_key(pw, "t0");
+    payload_int(pw, win->t0_ms);
+    payload_key(pw, "scale");
+    payload_int(pw, scale);
+    payload_key(pw, "series");
+    payload_array_open(pw);
+    for(size_t i = 0; i < win->n_series; i++){
+        const raw_series_t *s = &win->series[i];
+        if(s->n == 0) continue;
+
+        payload_map_open(pw);
+        payload_key(pw, "type");
+        payload_int(pw, s->type);
+        payload_key(pw, "n");
+        payload_int(pw, (int64_t)s->n);
+
+        payload_key(pw, "dt");
+        payload_array_open(pw);
+        int64_t prev = win->t0_ms;
+        for(size_t k = 0; k < s->n; k++){
+            payload_int(pw, s->samples[k].ts_ms - prev);
+            prev = s->samples[k].ts_ms;
+        }
+        payload_array_close(pw);
+
+        payload_key(pw, "v");
+        payload_array_open(pw);
+        int64_t prev_q = 0;
+        for(size_t k = 0; k < s->n; k++){
+            payload_int(pw, s->samples[k].q - prev_q);
+            prev_q = s->samples[k].q;
+        }
+        payload_array_close(pw);
+        payload_map_close(pw);
+    }
+    payload_array_close(pw);
+    payload_map_close(pw);
+}
+
+void raw_window_reset(raw_windows_t *w, raw_window_t *win){
+    if(!win->open) return;
+    win->open = 0;
+    win->samples = 0;
+    win->n_series = 0;
+    w->open--;
+}
@@ -0,0 +1,72 @@
+#ifndef RAW_WINDOW_H
+#define RAW_WINDOW_H
+
+#include "main.h"
+#include "payload.h"
+
+// Raw sample windows for cloud uploads.
+// Every packet is collected per device for a fixed window of wall time
+// and the whole window goes out as one message, so the message rate per
+// device stays at one per window however fast the sensors sample; only
+// the message size grows. A window holds one series per sensor type:
+//
+//   {"t0":<first ts, ms>,"scale":S,"series":[
+//      {"type":T,"n":N,"dt":[ms since previous sample, first since t0],
+//       "v":[first value * S, then differences]}]}
+//
+// Values are rounded to 1/S before the differences are taken, so they add
+// back up exactly. Small integers are short in JSON and one or two bytes
+// in CBOR, and repeat well under deflate.
+
+#define RAW_WINDOW_DEVICES 256          // sensor ids are one byte
+#define RAW_WINDOW_INITIAL_CAP 64       // samples per series before growing
+
+typedef struct{
+    int64_t ts_ms;
+    int64_t q;                          // value * scale, rounded
+} raw_sample_t;
+
+typedef struct{
+    uint8_t type;
+    raw_sample_t *samples;
+    size_t n;
+    size_t cap;
+} raw_series_t;
+
+typedef struct{
+    int id;
+    uint8_t open;
+    int64_t opened_ms;                  // wall clock at the first sample
+    int64_t t0_ms;                      // earliest sample timestamp
+    size_t samples;
+    raw_series_t *series;               // kept across windows for reuse
+    size_t n_series;
+    size_t cap_series;
+} raw_window_t;
+
+typedef struct{
+    raw_window_t win[RAW_WINDOW_DEVICES];
+    int64_t window_ms;
+    size_t max_samples;
+    int scale;
+    size_t open;                        // windows holding samples
+    unsigned long long dropped;         // non-finite or out of memory
+} raw_windows_t;
+
+void raw_windows_init(raw_windows_t *w, int window_s, size_t max_samples, int scale);
+void raw_windows_free(raw_windows_t *w);
+
+// Add one packet; returns its window when it just reached max_samples and
+// must be flushed now, else NULL
+raw_window_t *raw_windows_add(raw_windows_t *w, const sensor_packet_t *pkt, int64_t now_ms);
+// Next window open for window_ms by now_ms (any open one when force), NULL if none
+raw_window_t *raw_windows_next_due(raw_windows_t *w, int64_t now_ms, int force);
+// Milliseconds until the earliest open window is due, -1 if none is open
+int64_t raw_windows_wait_ms(const raw_windows_t *w, int64_t now_ms);
+
+// The window map above, as the next value of the writer
+void raw_window_encode(const raw_window_t *win, int scale, payload_writer_t *pw);
+// Empty the window after it was published or spooled
+void raw_window_reset(raw_windows_t *w, raw_window_t *win);
+
+#endif
@@ -0,0 +1,375 @@
+#include "upload_scheduler.h"
+#include "cloud_manager.h"
+#include "logger.h"
+#include <math.h>
+
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    uint8_t known;              // policy below comes from the registry
+    uint8_t taken;              // handed to the cloud thread, not in the heap
+    uint8_t alarm_state;        // average past a threshold on the last update
+    upload_policy_t policy;
+    int spacing_ms;
+    int max_ms;                 // deadband: heartbeat while data arrives
+    double deadband;
+    uint8_t deadband_pct;
+    int heap_pos;               // -1 when not scheduled
+    int64_t deadline_ms;
+    int64_t next_ok_ms;         // earliest next upload
+    int64_t hold_ms;            // failed or busy: earliest retry, even for alarms
+    int64_t sent_ms;            // last acknowledged upload
+    int alarms;                 // raised since the last upload
+    int transitions;            // raised or cleared since the last upload
+    double avg;
+    double last_avg;            // as last uploaded
+    unsigned long count;
+    unsigned long last_count;
+    time_t last_uploaded;
+} sched_entry_t;
+
+static struct{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // CLOCK_MONOTONIC
+    sched_entry_t **by_key;     // (id << 8 | type) -> entry
+    sched_entry_t **heap;       // min-heap on deadline_ms
+    size_t heap_len;
+    size_t heap_cap;
+    size_t sensors;
+    int closed;
+    unsigned long long band_changed;    // deadband uploads by reason
+    unsigned long long band_alarms;
+    unsigned long long band_heartbeats;
+    unsigned long long band_suppressed; // updates inside the deadband
+} us = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* ===========================
+ *   Heap
+ * =========================== */
+
+static void heap_set(size_t pos, sched_entry_t *e){
+    us.heap[pos] = e;
+    e->heap_pos = (int)pos;
+}
+
+static void heap_up(size_t pos){
+    sched_entry_t *e = us.heap[pos];
+    while(pos > 0){
+        size_t parent = (pos - 1) / 2;
+        if(us.heap[parent]->deadline_ms <= e->deadline_ms) break;
+        heap_set(pos, us.heap[parent]);
+        pos = parent;
+    }
+    heap_set(pos, e);
+}
+
+static void heap_down(size_t pos){
+    sched_entry_t *e = us.heap[pos];
+    for(;;){
+        size_t child = 2 * pos + 1;
+        if(child >= us.heap_len) break;
+        if(child + 1 < us.heap_len && us.heap[child + 1]->deadline_ms < us.heap[child]->deadline_ms) child++;
+        if(e->deadline_ms <= us.heap[child]->deadline_ms) break;
+        heap_set(pos, us.heap[child]);
+        pos = child;
+    }
+    heap_set(pos, e);
+}
+
+static int heap_push(sched_entry_t *e){
+    if(us.heap_len == us.heap_cap){
+        size_t ncap = us.heap_cap ? us.heap_cap * 2 : 64;
+        sched_entry_t **n = realloc(us.heap, ncap * sizeof(*n));
+        if(!n) return -1;
+        us.heap = n;
+        us.heap_cap = ncap;
+    }
+    us.heap[us.heap_len] = e;
+    heap_up(us.heap_len++);
+    return 0;
+}
+
+static sched_entry_t *heap_pop(void){
+    sched_entry_t *top = us.heap[0];
+    if(--us.heap_len > 0){
+        heap_set(0, us.heap[us.heap_len]);
+        heap_down(0);
+    }
+    top->heap_pos = -1;
+    return top;
+}
+
+/* ===========================
+ *   Policy
+ * =========================== */
+
+// Helper: the average moved past the deadband since the last upload
+static int band_exceeded(const sched_entry_t *e){
+    double band = e->deadband_pct ? fabs(e->last_avg) * e->deadband / 100.0 : e->deadband;
+    return fabs(e->avg - e->last_avg) > band;
+}
+
+enum{ BAND_NONE, BAND_CHANGED, BAND_ALARM, BAND_HEARTBEAT };
+
+// Helper: why a deadband sensor would upload; the first upload counts as changed
+static int band_reason(const sched_entry_t *e){
+    if(e->transitions > 0) return BAND_ALARM;
+    if(e->last_uploaded == 0 || band_exceeded(e)) return BAND_CHANGED;
+    return BAND_HEARTBEAT;
+}
+
+// Helper: earliest time the entry should upload, -1 if not before its next
+// update
+static int64_t sched_due_ms(const sched_entry_t *e){
+    if(e->count == e->last_count) return -1;
+    if(!e->known) return e->next_ok_ms;     // the cloud thread resolves the policy
+    switch(e->policy){
+        case UPLOAD_EVERY:     return e->next_ok_ms;
+        case UPLOAD_ON_CHANGE: return (e->avg != e->last_avg) ? e->next_ok_ms : -1;
+        case UPLOAD_ON_ALARM:  return (e->alarms > 0) ? e->next_ok_ms : -1;
+        case UPLOAD_DEADBAND:
+            switch(band_reason(e)){
+                case BAND_ALARM:   return e->hold_ms;
+                case BAND_CHANGED: return e->next_ok_ms;
+                default:{
+                    int64_t beat = e->sent_ms + e->max_ms;
+                    return (beat > e->next_ok_ms) ? beat : e->next_ok_ms;
+                }
+            }
+        default:               return -1;
+    }
+}
+
+// Helper: enter the heap, or move a queued deadline forward, unless taken
+// or nothing is due; wakes the cloud thread when this becomes the earliest
+// deadline. A later deadline is left for admit to re-evaluate.
+static void sched_arm(sched_entry_t *e, int64_t now){
+    if(e->taken) return;
+    int64_t due = sched_due_ms(e);
+    if(due < 0) return;
+    if(due < now) due = now;
+
+    if(e->heap_pos >= 0){
+        if(due >= e->deadline_ms) return;
+        e->deadline_ms = due;
+        heap_up((size_t)e->heap_pos);
+    }
+    else{
+        e->deadline_ms = due;
+        if(heap_push(e) != 0){
+            LOG_ERROR(SCHED, "Heap allocation failed, sensor %d type %d not scheduled", e->id, e->type);
+            return;
+        }
+    }
+    if(e->heap_pos == 0){
+        pthread_cond_signal(&us.cond);
+    }
+}
+
+/* ===========================
+ *   API
+ * =========================== */
+
+int upload_sched_init(void){
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&us.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    us.by_key = calloc(UPLOAD_SCHED_KEYS, sizeof(*us.by_key));
+    if(!us.by_key){
+        LOG_ERROR(SCHED, "Failed to allocate sensor table");
+        return -1;
+    }
+    us.closed = 0;
+    return 0;
+}
+
+void upload_sched_free(void){
+    pthread_mutex_lock(&us.mutex);
+    for(size_t k = 0; us.by_key && k < UPLOAD_SCHED_KEYS; k++){
+        free(us.by_key[k]);
+    }
+    free(us.by_key);
+    free(us.heap);
+    us.by_key = NULL;
+    us.heap = NULL;
+    us.heap_len = us.heap_cap = us.sensors = 0;
+    pthread_mutex_unlock(&us.mutex);
+    pthread_cond_destroy(&us.cond);
+}
+
+void upload_sched_notify(int id, int type, double avg, unsigned long count, int alarm){
+    size_t key = ((size_t)(id & 0xff) << 8) | (size_t)(type & 0xff);
+
+    pthread_mutex_lock(&us.mutex);
+    if(!us.by_key){
+        pthread_mutex_unlock(&us.mutex);
+        return;
+    }
+
+    sched_entry_t *e = us.by_key[key];
+    if(!e){
+        e = calloc(1, sizeof(*e));
+        if(!e){
+            pthread_mutex_unlock(&us.mutex);
+            LOG_ERROR(SCHED, "Failed to allocate entry for sensor %d type %d", id, type);
+            return;
+        }
+        e->id = (uint8_t)id;
+        e->type = (uint8_t)type;
+        e->heap_pos = -1;
+        us.by_key[key] = e;
+        us.sensors++;
+    }
+
+    e->avg = avg;
+    e->count = count;
+    if(alarm) e->alarms++;
+    if((alarm != 0) != e->alarm_state){
+        e->alarm_state = (alarm != 0);
+        e->transitions++;
+    }
+    if(e->known && e->policy == UPLOAD_DEADBAND && band_reason(e) == BAND_HEARTBEAT){
+        us.band_suppressed++;
+    }
+    sched_arm(e, time_mono_ms());
+    pthread_mutex_unlock(&us.mutex);
+}
+
+void upload_sched_close(void){
+    pthread_mutex_lock(&us.mutex);
+    us.closed = 1;
+    pthread_cond_broadcast(&us.cond);
+    pthread_mutex_unlock(&us.mutex);
+}
+
+size_t upload_sched_wait(upload_due_t *out, size_t max, int max_wait_ms){
+    size_t n = 0;
+    pthread_mutex_lock(&us.mutex);
+
+    int64_t limit = time_mono_ms() + max_wait_ms;
+    while(!us.closed){
+        int64_t now = time_mono_ms();
+        if(us.heap_len > 0 && us.heap[0]->deadline_ms <= now){
+            while(n < max && us.heap_len > 0 && us.heap[0]->deadline_ms <= now){
+                sched_entry_t *e = heap_pop();
+                e->taken = 1;
+                out[n].stat = (sensor_stat_t){
+                    .id = e->id, .type = e->type, .avg = e->avg, .count = e->count,
+                    .last_uploaded = e->last_uploaded, .last_uploaded_count = e->last_count,
+                };
+                out[n].alarm = e->alarms;
+                out[n].transitions = e->transitions;
+                n++;
+            }
+            break;
+        }
+        if(now >= limit) break;
+
+        // Sleep exactly until the earliest deadline, a new earliest
+        // deadline, or the caller's housekeeping limit
+        int64_t wake = limit;
+        if(us.heap_len > 0 && us.heap[0]->deadline_ms < wake) wake = us.heap[0]->deadline_ms;
+        struct timespec ts = { .tv_sec = wake / 1000, .tv_nsec = (wake % 1000) * 1000000L };
+        pthread_cond_timedwait(&us.cond, &us.mutex, &ts);
+    }
+
+    pthread_mutex_unlock(&us.mutex);
+    return n;
+}
+
+int upload_sched_admit(upload_due_t *d, const upload_rule_t *rule){
+    size_t key = ((size_t)d->stat.id << 8) | d->stat.type;
+
+    pthread_mutex_lock(&us.mutex);
+    sched_entry_t *e = us.by_key[key];
+    e->policy = rule->policy;
+    e->spacing_ms = rule->min_interval_s * 1000;
+    e->max_ms = rule->max_interval_s * 1000;
+    e->deadband = rule->deadband;
+    e->deadband_pct = rule->deadband_pct;
+    e->known = 1;
+
+    int64_t now = time_mono_ms();
+    int64_t due = sched_due_ms(e);
+    int go = (due >= 0 && due <= now);
+    if(go){
+        // The newest values, not the ones seen when it was taken
+        d->stat.avg = e->avg;
+        d->stat.count = e->count;
+        d->alarm = e->alarms;
+        d->transitions = e->transitions;
+        if(e->policy == UPLOAD_DEADBAND){
+            int reason = band_reason(e);
+            if(reason == BAND_ALARM) us.band_alarms++;
+            else if(reason == BAND_CHANGED) us.band_changed++;
+            else us.band_heartbeats++;
+        }
+    }
+    else{
+        e->taken = 0;
+        sched_arm(e, now);
+    }
+    pthread_mutex_unlock(&us.mutex);
+    return go;
+}
+
+void upload_sched_done(const upload_due_t *d, upload_result_t result){
+    size_t key = ((size_t)d->stat.id << 8) | d->stat.type;
+
+    pthread_mutex_lock(&us.mutex);
+    sched_entry_t *e = us.by_key[key];
+    int64_t now = time_mono_ms();
+    e->taken = 0;
+    if(result == UPLOAD_ACKED || result == UPLOAD_SPOOLED){
+        e->last_avg = d->stat.avg;
+        e->last_count = d->stat.count;
+        e->alarms -= d->alarm;
+        e->transitions -= d->transitions;
+        e->last_uploaded = time(NULL);
+        e->sent_ms = now;
+        e->next_ok_ms = now + e->spacing_ms;
+        e->hold_ms = 0;
+    }
+    else if(result == UPLOAD_BUSY){
+        e->next_ok_ms = e->hold_ms = now + UPLOAD_BUSY_RETRY_MS;
+    }
+    else{
+        // Retry no sooner than the regular interval
+        int retry_ms = (e->spacing_ms > UPLOAD_INTERVAL_SEC * 1000) ? e->spacing_ms : UPLOAD_INTERVAL_SEC * 1000;
+        e->next_ok_ms = e->hold_ms = now + retry_ms;
+    }
+    sched_arm(e, now);
+    pthread_mutex_unlock(&us.mutex);
+}
+
+void upload_sched_invalidate(void){
+    pthread_mutex_lock(&us.mutex);
+    int64_t now = time_mono_ms();
+    for(size_t k = 0; us.by_key && k < UPLOAD_SCHED_KEYS; k++){
+        sched_entry_t *e = us.by_key[k];
+        if(!e) continue;
+        e->known = 0;
+        sched_arm(e, now);
+    }
+    pthread_mutex_unlock(&us.mutex);
+}
+
+void upload_sched_stats(size_t *sensors, size_t *scheduled){
+    pthread_mutex_lock(&us.mutex);
+    *sensors = us.sensors;
+    *scheduled = us.heap_len;
+    pthread_mutex_unlock(&us.mutex);
+}
+
+void upload_sched_band_stats(unsigned long long *changed, unsigned long long *alarms,
+                             unsigned long long *heartbeats, unsigned long long *suppressed){
+    pthread_mutex_lock(&us.mutex);
+    *changed = us.band_changed;
+    *alarms = us.band_alarms;
+    *heartbeats = us.band_heartbeats;
+    *suppressed = us.band_suppressed;
+    pthread_mutex_unlock(&us.mutex);
+}
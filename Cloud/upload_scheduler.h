@@ -0,0 +1,59 @@
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+#include "main.h"
+#include "device_registry.h"
+
+// Per-sensor upload deadlines in a min-heap.
+// The data stage notifies every stats update. A sensor enters the heap only
+// when its policy makes it eligible, with the earliest time its spacing
+// allows, so the cloud thread sleeps until the first deadline and touches
+// only the sensors it uploads. Each update re-evaluates the policy and can
+// only move a queued deadline forward: under a deadband policy a sensor
+// waits for its heartbeat, and a change past the deadband or an alarm
+// transition pulls it in.
+
+#define UPLOAD_SCHED_KEYS 65536         // id and type are 8 bits each
+#define UPLOAD_BUSY_RETRY_MS 100        // publish window was full
+
+typedef struct{
+    sensor_stat_t stat;                 // id, type, avg, count, last upload
+    int alarm;                          // alarm raised since the last upload
+    int transitions;                    // alarm raised or cleared since the last upload
+} upload_due_t;
+
+typedef enum{
+    UPLOAD_FAILED,                      // retry no sooner than the regular interval
+    UPLOAD_ACKED,                       // broker confirmed, advance the watermark
+    UPLOAD_SPOOLED,                     // in the outbox, which delivers it; same as acked
+    UPLOAD_BUSY                         // not sent, publish window full
+} upload_result_t;
+
+int upload_sched_init(void);
+void upload_sched_free(void);
+
+// Data stage: latest average and count of one sensor, alarm if the average
+// is past a threshold on this update
+void upload_sched_notify(int id, int type, double avg, unsigned long count, int alarm);
+// Wake the waiter for good, shutdown only
+void upload_sched_close(void);
+
+// Cloud thread: wait up to max_wait_ms for due sensors and take up to max
+// of them; 0 on timeout or close
+size_t upload_sched_wait(upload_due_t *out, size_t max, int max_wait_ms);
+// Apply the device policy to a taken sensor, deadband and max interval
+// already resolved; 1 = upload it now and report with upload_sched_done,
+// 0 = rescheduled or dropped by the scheduler
+int upload_sched_admit(upload_due_t *d, const upload_rule_t *rule);
+// A taken sensor stays out of the heap until this is called, which for a
+// QoS 1 publish is when its PUBACK arrives; any thread
+void upload_sched_done(const upload_due_t *d, upload_result_t result);
+// Registry reloaded: re-evaluate every sensor's policy on its next update
+void upload_sched_invalidate(void);
+
+void upload_sched_stats(size_t *sensors, size_t *scheduled);
+// Deadband uploads by reason and updates that stayed inside the deadband
+void upload_sched_band_stats(unsigned long long *changed, unsigned long long *alarms,
+                             unsigned long long *heartbeats, unsigned long long *suppressed);
+
+#endif
@@ -0,0 +1,222 @@
+#include "config.h"
+#include "logger.h"
+#include "journal.h"
+#include "database.h"
+#include "query_service.h"
+#include "cloud_manager.h"
+#include <ctype.h>
+
+gateway_config_t g_config = {
+    .storage_backend = "sqlite",
+    .storage_path = "",
+    .partition_span = "none",
+    .journal_enabled = 1,
+    .journal_sync_ms = 200,
+    .journal_dir = JOURNAL_DIR,
+    .maint_checkpoint_s = 30,
+    .maint_wal_max_kb = 4096,
+    .db_stage_rows = DB_STAGE_ROWS_DEFAULT,
+    .retention_days = 30,
+    .retention_interval_s = 3600,
+    .retention_chunk = 500,
+    .vacuum_pages = 256,
+    .query_socket = QUERY_SOCKET_PATH,
+    .query_workers = 4,
+    .hot_cache_sensors = 64,
+    .hot_cache_samples = 600,
+    .batch_min = 10,
+    .batch_max = 4096,
+    .batch_max_latency_ms = 500,
+    .batch_commit_goal_ms = 50,
+    .mqtt_host = MQTT_BROKER,
+    .mqtt_port = MQTT_PORT,
+    .mqtt_password = "",
+    .mqtt_keepalive = MQTT_KEEPALIVE,
+    .cloud_mode = "device",
+    .cloud_upload = "stats",
+    .cloud_raw_window_s = 10,
+    .cloud_raw_max_samples = 4096,
+    .cloud_raw_scale = 100,
+    .cloud_default_policy = "5",
+    .cloud_report_max_s = 900,
+    .cloud_deadband_temperature = "0.2",
+    .cloud_deadband_humidity = "1",
+    .cloud_deadband_light = "5%",
+    .device_registry = DEVICE_REGISTRY_FILE,
+    .cloud_gateway_token = "",
+    .cloud_sessions = 1,
+    .cloud_batch_max = 100,
+    .cloud_encoding = "json",
+    .cloud_compress_min = 0,
+    .cloud_inflight_max = 20,
+    .cloud_ack_timeout_ms = 10000,
+    .outbox_dir = OUTBOX_DIR,
+    .outbox_max_mb = 64,
+    .outbox_evict = "oldest",
+    .outbox_drain_rate = 20,
+    .log_ring_kb = 64,
+    .log_ring_full = "drop",
+    .log_format = "text",
+    .log_level = "info",
+    .log_levels = "",
+};
+
+typedef enum{
+    CFG_STR,
+    CFG_INT
+} config_kind_t;
+
+typedef struct{
+    const char *key;
+    config_kind_t kind;
+    void *dst;
+    long min;
+    long max;
+} config_key_t;
+
+static const config_key_t config_keys[] = {
+    { "storage_backend", CFG_STR, g_config.storage_backend, 0, 0 },
+    { "storage_path",    CFG_STR, g_config.storage_path,    0, 0 },
+    { "partition_span",  CFG_STR, g_config.partition_span,  0, 0 },
+    { "journal_enabled", CFG_INT, &g_config.journal_enabled, 0, 1 },
+    { "journal_sync_ms", CFG_INT, &g_config.journal_sync_ms, 1, 60000 },
+    { "journal_dir",     CFG_STR, g_config.journal_dir,     0, 0 },
+    { "maint_checkpoint_s",   CFG_INT, &g_config.maint_checkpoint_s,   0, 86400 },
+    { "maint_wal_max_kb",     CFG_INT, &g_config.maint_wal_max_kb,     64, 1048576 },
+    { "db_stage_rows",        CFG_INT, &g_config.db_stage_rows,        0, 1000000 },
+    { "retention_days",       CFG_INT, &g_config.retention_days,       0, 36500 },
+    { "retention_interval_s", CFG_INT, &g_config.retention_interval_s, 1, 86400 },
+    { "retention_chunk",      CFG_INT, &g_config.retention_chunk,      1, 100000 },
+    { "vacuum_pages",         CFG_INT, &g_config.vacuum_pages,         1, 1000000 },
+    { "query_socket",  CFG_STR, g_config.query_socket,   0, 0 },
+    { "query_workers", CFG_INT, &g_config.query_workers, 1, QUERY_MAX_WORKERS },
+    { "hot_cache_sensors", CFG_INT, &g_config.hot_cache_sensors, 0, 4096 },
+    { "hot_cache_samples", CFG_INT, &g_config.hot_cache_samples, 0, 1000000 },
+    { "batch_min",            CFG_INT, &g_config.batch_min,            1, 100000 },
+    { "batch_max",            CFG_INT, &g_config.batch_max,            1, 100000 },
+    { "batch_max_latency_ms", CFG_INT, &g_config.batch_max_latency_ms, 1, 60000 },
+    { "batch_commit_goal_ms", CFG_INT, &g_config.batch_commit_goal_ms, 1, 10000 },
+    { "mqtt_host",      CFG_STR, g_config.mqtt_host,       0, 0 },
+    { "mqtt_port",      CFG_INT, &g_config.mqtt_port,      1, 65535 },
+    { "mqtt_password",  CFG_STR, g_config.mqtt_password,   0, 0 },
+    { "mqtt_keepalive", CFG_INT, &g_config.mqtt_keepalive, 5, 3600 },
+    { "cloud_mode",            CFG_STR, g_config.cloud_mode,             0, 0 },
+    { "cloud_upload",          CFG_STR, g_config.cloud_upload,           0, 0 },
+    { "cloud_raw_window_s",    CFG_INT, &g_config.cloud_raw_window_s,    1, 3600 },
+    { "cloud_raw_max_samples", CFG_INT, &g_config.cloud_raw_max_samples, 16, 1 << 20 },
+    { "cloud_raw_scale",       CFG_INT, &g_config.cloud_raw_scale,       1, 1000000 },
+    { "cloud_default_policy",       CFG_STR, g_config.cloud_default_policy,       0, 0 },
+    { "cloud_report_max_s",         CFG_INT, &g_config.cloud_report_max_s,        1, 86400 },
+    { "cloud_deadband_temperature", CFG_STR, g_config.cloud_deadband_temperature, 0, 0 },
+    { "cloud_deadband_humidity",    CFG_STR, g_config.cloud_deadband_humidity,    0, 0 },
+    { "cloud_deadband_light",       CFG_STR, g_config.cloud_deadband_light,       0, 0 },
+    { "device_registry",       CFG_STR, g_config.device_registry,        0, 0 },
+    { "cloud_gateway_token",   CFG_STR, g_config.cloud_gateway_token,    0, 0 },
+    { "cloud_sessions",        CFG_INT, &g_config.cloud_sessions,        1, CLOUD_MAX_SESSIONS },
+    { "cloud_batch_max",       CFG_INT, &g_config.cloud_batch_max,       1, 10000 },
+    { "cloud_encoding",        CFG_STR, g_config.cloud_encoding,         0, 0 },
+    { "cloud_compress_min",    CFG_INT, &g_config.cloud_compress_min,    0, 1 << 20 },
+    { "cloud_inflight_max",    CFG_INT, &g_config.cloud_inflight_max,    1, PUB_TRACKER_WINDOW_MAX },
+    { "cloud_ack_timeout_ms",  CFG_INT, &g_config.cloud_ack_timeout_ms,  100, 600000 },
+    { "outbox_dir",        CFG_STR, g_config.outbox_dir,         0, 0 },
+    { "outbox_max_mb",     CFG_INT, &g_config.outbox_max_mb,     0, 1 << 20 },
+    { "outbox_evict",      CFG_STR, g_config.outbox_evict,       0, 0 },
+    { "outbox_drain_rate", CFG_INT, &g_config.outbox_drain_rate, 1, 100000 },
+    { "log_ring_kb",   CFG_INT, &g_config.log_ring_kb,  4, 16384 },
+    { "log_ring_full", CFG_STR, g_config.log_ring_full, 0, 0 },
+    { "log_format",    CFG_STR, g_config.log_format,    0, 0 },
+    { "log_level",     CFG_STR, g_config.log_level,     0, 0 },
+    { "log_levels",    CFG_STR, g_config.log_levels,    0, 0 },
+};
+
+#define CONFIG_NUM_KEYS (sizeof(config_keys) / sizeof(config_keys[0]))
+
+// Helper: strip leading and trailing whitespace in place
+static char *config_trim(char *s){
+    while(isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+// Helper: store one value, 0 on success
+static int config_set(const config_key_t *k, const char *value){
+    if(k->kind == CFG_STR){
+        snprintf((char *)k->dst, CONFIG_STR_MAX, "%s", value);
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if(errno != 0 || end == value || *end != '\0' || v < k->min || v > k->max){
+        return -1;
+    }
+    *(int *)k->dst = (int)v;
+    return 0;
+}
+
+// Missing file keeps the defaults. Problems are reported on stderr
+// since this runs before the logger process exists.
+int config_load(const char *path){
+    FILE *f = fopen(path, "r");
+    if(!f){
+        if(errno != ENOENT){
+            fprintf(stderr, "[CONFIG] Cannot open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    char line[512];
+    int lineno = 0, errors = 0;
+    while(fgets(line, sizeof(line), f)){
+        lineno++;
+        char *hash = strchr(line, '#');
+        if(hash) *hash = '\0';
+
+        char *s = config_trim(line);
+        if(*s == '\0') continue;
+
+        char *eq = strchr(s, '=');
+        if(!eq){
+            fprintf(stderr, "[CONFIG] %s:%d: expected key = value\n", path, lineno);
+            errors++;
+            continue;
+        }
+        *eq = '\0';
+        char *key = config_trim(s);
+        char *value = config_trim(eq + 1);
+
+        size_t i;
+        for(i = 0; i < CONFIG_NUM_KEYS; i++){
+            if(strcmp(config_keys[i].key, key) == 0) break;
+        }
+        if(i == CONFIG_NUM_KEYS){
+            fprintf(stderr, "[CONFIG] %s:%d: unknown key '%s'\n", path, lineno, key);
+            errors++;
+        }
+        else if(config_set(&config_keys[i], value) != 0){
+            fprintf(stderr, "[CONFIG] %s:%d: invalid value '%s' for %s\n", path, lineno, value, key);
+            errors++;
+        }
+    }
+    fclose(f);
+    return errors ? -1 : 0;
+}
+
+void config_log(void){
+    for(size_t i = 0; i < CONFIG_NUM_KEYS; i++){
+        const config_key_t *k = &config_keys[i];
+        if(k->kind == CFG_STR){
+            // Credentials stay out of the log
+            const char *v = k->dst;
+            if(v[0] && (strstr(k->key, "password") || strstr(k->key, "token"))) v = "(set)";
+            LOG_INFO(CONFIG, "%s = %s", k->key, v);
+        }
+        else{
+            LOG_INFO(CONFIG, "%s = %d", k->key, *(const int *)k->dst);
+        }
+    }
+}
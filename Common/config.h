@@ -0,0 +1,70 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "main.h"
+
+#define CONFIG_FILE "../gateway.conf"
+#define CONFIG_STR_MAX 128
+
+// Runtime settings, loaded once at startup from key = value lines
+typedef struct{
+    char storage_backend[CONFIG_STR_MAX];   // sqlite | tsdb | log | null
+    char storage_path[CONFIG_STR_MAX];      // empty = backend default
+    char partition_span[CONFIG_STR_MAX];    // none | day | hour
+    int journal_enabled;
+    int journal_sync_ms;                    // group commit interval
+    char journal_dir[CONFIG_STR_MAX];
+    int maint_checkpoint_s;                 // 0 = SQLite auto-checkpoint in the writer
+    int maint_wal_max_kb;                   // checkpoint early past this WAL size
+    int db_stage_rows;                      // sqlite: staged rows folded without waiting for idle time, 0 = direct
+    int retention_days;                     // 0 = keep raw data forever
+    int retention_interval_s;
+    int retention_chunk;                    // rows per delete transaction
+    int vacuum_pages;                       // pages per incremental vacuum step
+    char query_socket[CONFIG_STR_MAX];      // empty = query service off
+    int query_workers;
+    int hot_cache_sensors;                  // 0 = hot-tail cache off
+    int hot_cache_samples;                  // per sensor
+    int batch_min;                          // storage batch target bounds, rows
+    int batch_max;
+    int batch_max_latency_ms;               // oldest packet waits at most this long
+    int batch_commit_goal_ms;               // target commit time
+    char mqtt_host[CONFIG_STR_MAX];         // broker
+    int mqtt_port;
+    char mqtt_password[CONFIG_STR_MAX];     // sent with the token as user name, empty = none
+    int mqtt_keepalive;                     // seconds
+    char cloud_mode[CONFIG_STR_MAX];        // device | gateway
+    char cloud_upload[CONFIG_STR_MAX];      // stats | raw | both
+    int cloud_raw_window_s;                 // raw samples per device per message
+    int cloud_raw_max_samples;              // a window this full is sent early
+    int cloud_raw_scale;                    // raw values are rounded to 1/scale
+    char cloud_default_policy[CONFIG_STR_MAX];  // devices without a policy of their own
+    int cloud_report_max_s;                 // band policy: longest silence while data arrives
+    char cloud_deadband_temperature[CONFIG_STR_MAX];    // band policy defaults, "<d>" or "<d>%"
+    char cloud_deadband_humidity[CONFIG_STR_MAX];
+    char cloud_deadband_light[CONFIG_STR_MAX];
+    char device_registry[CONFIG_STR_MAX];   // device credentials file, reloaded on SIGHUP
+    char cloud_gateway_token[CONFIG_STR_MAX];
+    int cloud_sessions;                     // gateway mode MQTT connections
+    int cloud_batch_max;                    // devices per gateway message
+    char cloud_encoding[CONFIG_STR_MAX];    // json | cbor
+    int cloud_compress_min;                 // deflate payloads from this size, 0 = off
+    int cloud_inflight_max;                 // QoS 1 publishes awaiting PUBACK per connection
+    int cloud_ack_timeout_ms;               // unacknowledged past this, counted as late
+    char outbox_dir[CONFIG_STR_MAX];        // payloads kept while the broker is unreachable
+    int outbox_max_mb;                      // disk bound, 0 = outbox off
+    char outbox_evict[CONFIG_STR_MAX];      // oldest | newest, dropped past the bound
+    int outbox_drain_rate;                  // catch-up payloads per second
+    int log_ring_kb;                        // per-thread log buffer
+    char log_ring_full[CONFIG_STR_MAX];     // drop | block, when a thread's log buffer is full
+    char log_format[CONFIG_STR_MAX];        // text | binary | binfile, see logger.h
+    char log_level[CONFIG_STR_MAX];         // off | error | warn | info | debug | trace, every module
+    char log_levels[CONFIG_STR_MAX];        // per-module overrides, "CLIENT=trace,MQTT=warn"
+} gateway_config_t;
+
+extern gateway_config_t g_config;
+
+int config_load(const char *path);
+void config_log(void);
+
+#endif
@@ -0,0 +1,138 @@
+#include "hot_cache.h"
+#include "logger.h"
+
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    uint64_t head;              // samples ever written, published last
+    hot_sample_t *samples;
+} hot_ring_t;
+
+static struct{
+    size_t max_sensors;
+    size_t capacity;            // samples per ring
+    size_t used;                // rings handed out, writer only
+    hot_ring_t *rings;
+    hot_sample_t *arena;
+    int16_t slot[256][HOT_CACHE_MAX_TYPES];     // -1 = not cached
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long untracked;               // samples of sensors past max_sensors
+} hc;
+
+int hot_cache_init(size_t max_sensors, size_t samples_per_sensor){
+    memset(&hc, 0, sizeof(hc));
+    memset(hc.slot, 0xff, sizeof(hc.slot));
+    if(max_sensors == 0 || samples_per_sensor == 0){
+        LOG_INFO(HOTCACHE, "Hot-tail cache disabled");
+        return 0;
+    }
+
+    hc.rings = calloc(max_sensors, sizeof(hot_ring_t));
+    hc.arena = calloc(max_sensors * samples_per_sensor, sizeof(hot_sample_t));
+    if(!hc.rings || !hc.arena){
+        free(hc.rings);
+        free(hc.arena);
+        hc.rings = NULL;
+        hc.arena = NULL;
+        LOG_ERROR(HOTCACHE, "Unable to allocate arena, cache disabled");
+        return -1;
+    }
+    hc.max_sensors = max_sensors;
+    hc.capacity = samples_per_sensor;
+
+    LOG_INFO(HOTCACHE, "Caching last %zu samples of up to %zu sensors (%zu KiB)",
+              samples_per_sensor, max_sensors, max_sensors * samples_per_sensor * sizeof(hot_sample_t) / 1024);
+    return 0;
+}
+
+void hot_cache_free(void){
+    if(hc.rings){
+        LOG_INFO(HOTCACHE, "%zu sensors cached, %llu hits, %llu misses, %llu samples not cached",
+                  hc.used, hc.hits, hc.misses, hc.untracked);
+    }
+    free(hc.rings);
+    free(hc.arena);
+    hc.rings = NULL;
+    hc.arena = NULL;
+    hc.capacity = 0;
+}
+
+size_t hot_cache_capacity(void){
+    return hc.capacity;
+}
+
+// Helper: ring of a sensor, or NULL when it is not cached
+static hot_ring_t *hot_cache_find(int id, int type){
+    if(!hc.rings || id < 0 || id > 255 || type < 0 || type >= HOT_CACHE_MAX_TYPES) return NULL;
+    int16_t s = __atomic_load_n(&hc.slot[id][type], __ATOMIC_ACQUIRE);
+    return (s < 0) ? NULL : &hc.rings[s];
+}
+
+void hot_cache_append(const sensor_packet_t *pkt){
+    if(!hc.rings || pkt->type >= HOT_CACHE_MAX_TYPES) return;
+
+    hot_ring_t *r = hot_cache_find(pkt->id, pkt->type);
+    if(!r){
+        if(hc.used == hc.max_sensors){
+            hc.untracked++;
+            return;
+        }
+        r = &hc.rings[hc.used];
+        r->id = pkt->id;
+        r->type = pkt->type;
+        r->samples = hc.arena + hc.used * hc.capacity;
+        // Ring is ready before readers can find it
+        __atomic_store_n(&hc.slot[pkt->id][pkt->type], (int16_t)hc.used, __ATOMIC_RELEASE);
+        hc.used++;
+    }
+
+    uint64_t h = r->head;
+    hot_sample_t *s = &r->samples[h % hc.capacity];
+    s->ts_ms = pkt->ts_ms;
+    s->value = pkt->value;
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+int hot_cache_snapshot(int id, int type, int64_t from_ms, hot_sample_t *out, size_t *count){
+    *count = 0;
+    hot_ring_t *r = hot_cache_find(id, type);
+    if(!r){
+        __atomic_add_fetch(&hc.misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    uint64_t h1 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t start = (h1 > hc.capacity) ? h1 - hc.capacity : 0;
+    for(uint64_t i = start; i < h1; i++){
+        out[i - start] = r->samples[i % hc.capacity];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t h2 = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    // Slots at or below h2 - capacity may have been rewritten during the copy
+    uint64_t valid = start;
+    if(h2 >= hc.capacity && h2 - hc.capacity + 1 > valid) valid = h2 - hc.capacity + 1;
+    if(valid >= h1){
+        __atomic_add_fetch(&hc.misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    hot_sample_t *first = out + (valid - start);
+    int covered = (first->ts_ms <= from_ms);
+
+    size_t n = 0;
+    for(uint64_t i = valid; i < h1; i++){
+        hot_sample_t s = out[i - start];
+        if(s.ts_ms >= from_ms) out[n++] = s;
+    }
+    *count = n;
+
+    __atomic_add_fetch(covered ? &hc.hits : &hc.misses, 1, __ATOMIC_RELAXED);
+    return covered;
+}
+
+void hot_cache_stats(unsigned long long *hits, unsigned long long *misses){
+    *hits = __atomic_load_n(&hc.hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&hc.misses, __ATOMIC_RELAXED);
+}
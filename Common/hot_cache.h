@@ -0,0 +1,33 @@
+#ifndef HOT_CACHE_H
+#define HOT_CACHE_H
+
+#include "main.h"
+
+// In-memory tail of the most recent raw samples per sensor.
+// One preallocated arena holds a fixed ring per sensor. The data stage is
+// the only writer; readers copy a ring out without locks and drop any
+// slot the writer may have overwritten meanwhile (the ring's sample
+// counter works as the sequence of a seqlock).
+
+#define HOT_CACHE_MAX_TYPES 4       // sensor types 0..3
+
+typedef struct{
+    int64_t ts_ms;
+    double value;
+} hot_sample_t;
+
+// 0 sensors or samples disables the cache
+int hot_cache_init(size_t max_sensors, size_t samples_per_sensor);
+void hot_cache_free(void);
+size_t hot_cache_capacity(void);
+
+// Writer side, data stage only
+void hot_cache_append(const sensor_packet_t *pkt);
+
+// Copy the samples of one sensor with ts >= from_ms, in arrival order.
+// Returns 1 when the ring reaches back to from_ms (the result is complete),
+// 0 on a miss; out must hold hot_cache_capacity() samples.
+int hot_cache_snapshot(int id, int type, int64_t from_ms, hot_sample_t *out, size_t *count);
+void hot_cache_stats(unsigned long long *hits, unsigned long long *misses);
+
+#endif
@@ -0,0 +1,423 @@
+#include "journal.h"
+#include "logger.h"
+#include "utilities.h"
+#include <dirent.h>
+
+// One closed journal file, covering [first_seq, last_seq]
+typedef struct{
+    uint64_t first_seq;
+    uint64_t last_seq;
+} journal_file_t;
+
+static struct{
+    int enabled;
+    char dir[256];
+    int sync_ms;
+    int closing;
+
+    // Appenders fill 'active'; the flusher swaps it with 'spare' and writes outside the lock
+    journal_record_t *active;
+    journal_record_t *spare;
+    size_t active_count;
+    uint64_t next_seq;
+    uint64_t checkpoint;            // reported by storage
+    uint64_t checkpoint_saved;      // on disk
+
+    // Flusher-only state
+    int fd;
+    uint64_t file_first_seq;
+    uint64_t file_last_seq;
+    size_t file_bytes;
+    journal_file_t *files;          // grown on demand, oldest first
+    size_t num_files;
+    size_t cap_files;
+
+    // Statistics
+    unsigned long long records;
+    unsigned long long syncs;
+    unsigned long long max_sync_us;
+    unsigned long long full_waits;
+
+    pthread_t flusher;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;            // flusher
+    pthread_cond_t space;           // appenders waiting for a free buffer
+} jr = {
+    .fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+};
+
+// Helper: checksum of a record with its crc field zeroed
+static uint32_t record_crc(const journal_record_t *r){
+    journal_record_t tmp = *r;
+    tmp.crc = 0;
+    return crc32_update(0, &tmp, sizeof(tmp));
+}
+
+static void journal_file_path(uint64_t first_seq, char *out, size_t len){
+    snprintf(out, len, "%s/jrnl_%020llu.log", jr.dir, (unsigned long long)first_seq);
+}
+
+/* ===========================
+ *   Checkpoint file
+ * =========================== */
+
+static uint64_t checkpoint_load(void){
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", jr.dir, JOURNAL_CHECKPOINT_FILE);
+
+    journal_checkpoint_t c;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    ssize_t r = read(fd, &c, sizeof(c));
+    close(fd);
+
+    if(r != (ssize_t)sizeof(c) || c.magic != JOURNAL_MAGIC || c.crc != crc32_update(0, &c.seq, sizeof(c.seq))){
+        LOG_WARN(JOURNAL, "Checkpoint file unreadable, replaying whole journal");
+        return 0;
+    }
+    return c.seq;
+}
+
+// Helper: write-temp-then-rename so a crash leaves the old or the new checkpoint
+static int checkpoint_save(uint64_t seq){
+    char path[320], tmp[330];
+    snprintf(path, sizeof(path), "%s/%s", jr.dir, JOURNAL_CHECKPOINT_FILE);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    journal_checkpoint_t c = { JOURNAL_MAGIC, crc32_update(0, &seq, sizeof(seq)), seq };
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return -1;
+    int ok = (write(fd, &c, sizeof(c)) == (ssize_t)sizeof(c) && fdatasync(fd) == 0);
+    close(fd);
+    if(!ok || rename(tmp, path) != 0) return -1;
+
+    int dfd = open(jr.dir, O_RDONLY | O_DIRECTORY);
+    if(dfd >= 0){
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+
+// Helper: append to the file table, 0 on success
+static int journal_file_add(uint64_t first_seq, uint64_t last_seq){
+    if(jr.num_files == jr.cap_files){
+        size_t cap = jr.cap_files ? jr.cap_files * 2 : 64;
+        journal_file_t *grown = realloc(jr.files, cap * sizeof(*grown));
+        if(!grown) return -1;
+        jr.files = grown;
+        jr.cap_files = cap;
+    }
+    jr.files[jr.num_files++] = (journal_file_t){ first_seq, last_seq };
+    if(jr.num_files % JOURNAL_FILES_WARN == 0){
+        LOG_WARN(JOURNAL, "%zu journal files waiting for checkpoint, storage is not keeping up", jr.num_files);
+    }
+    return 0;
+}
+
+// Helper: delete closed files that storage has fully committed
+static void journal_trim(void){
+    size_t kept = 0;
+    for(size_t i = 0; i < jr.num_files; i++){
+        if(jr.files[i].last_seq <= jr.checkpoint_saved){
+            char path[320];
+            journal_file_path(jr.files[i].first_seq, path, sizeof(path));
+            unlink(path);
+        }
+        else{
+            jr.files[kept++] = jr.files[i];
+        }
+    }
+    jr.num_files = kept;
+}
+
+/* ===========================
+ *   Scanning
+ * =========================== */
+
+// Helper: call cb for each valid record of one file, returns the last seq seen
+static uint64_t journal_scan_file(uint64_t first_seq, uint64_t after, journal_replay_cb cb, void *ctx, size_t *replayed){
+    char path[320];
+    journal_file_path(first_seq, path, sizeof(path));
+
+    FILE *f = fopen(path, "rb");
+    if(!f) return 0;
+
+    uint64_t last = 0;
+    journal_record_t r;
+    while(fread(&r, sizeof(r), 1, f) == 1){
+        // A torn group commit only damages the tail
+        if(record_crc(&r) != r.crc || r.seq <= last) break;
+        last = r.seq;
+        if(cb && r.seq > after){
+            sensor_packet_t pkt = {
+                .id = r.id,
+                .type = r.type,
+                .value = r.value,
+                .ts_ms = r.ts_ms,
+                .seq = r.seq
+            };
+            cb(ctx, &pkt);
+            (*replayed)++;
+        }
+    }
+    fclose(f);
+    return last;
+}
+
+static int cmp_file(const void *a, const void *b){
+    const journal_file_t *x = a, *y = b;
+    return (x->first_seq > y->first_seq) - (x->first_seq < y->first_seq);
+}
+
+/* ===========================
+ *   Flusher thread
+ * =========================== */
+
+// Helper: append records to the current file, rotating when it is full
+static int journal_write(const journal_record_t *recs, size_t n){
+    // Rotate once the file is full and can be tracked; without memory for
+    // the table the current file keeps growing rather than being forgotten
+    if(jr.fd >= 0 && jr.file_bytes >= JOURNAL_FILE_MAX &&
+       journal_file_add(jr.file_first_seq, jr.file_last_seq) == 0){
+        close(jr.fd);
+        jr.fd = -1;
+    }
+
+    if(jr.fd < 0){
+        char path[320];
+        jr.file_first_seq = recs[0].seq;
+        jr.file_bytes = 0;
+        journal_file_path(jr.file_first_seq, path, sizeof(path));
+        jr.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(jr.fd < 0){
+            LOG_ERROR(JOURNAL, "Failed to open %s: %s", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    const uint8_t *p = (const uint8_t *)recs;
+    size_t len = n * sizeof(*recs), done = 0;
+    while(done < len){
+        ssize_t w = write(jr.fd, p + done, len - done);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0){
+            LOG_ERROR(JOURNAL, "Write failed: %s", strerror(errno));
+            return -1;
+        }
+        done += w;
+    }
+    jr.file_bytes += len;
+    jr.file_last_seq = recs[n - 1].seq;
+    return fdatasync(jr.fd);
+}
+
+static void *journal_flusher_thread(void *arg){
+    (void)arg;
+
+    pthread_mutex_lock(&jr.mutex);
+    while(1){
+        if(!jr.closing && jr.active_count < JOURNAL_BUF_RECORDS / 2){
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += jr.sync_ms / 1000;
+            ts.tv_nsec += (long)(jr.sync_ms % 1000) * 1000000L;
+            if(ts.tv_nsec >= 1000000000L){
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&jr.wake, &jr.mutex, &ts);
+        }
+
+        // Group commit: take everything appended since the last sync
+        journal_record_t *recs = jr.active;
+        size_t n = jr.active_count;
+        jr.active = jr.spare;
+        jr.spare = recs;
+        jr.active_count = 0;
+        uint64_t checkpoint = jr.checkpoint;
+        int closing = jr.closing;
+        pthread_cond_broadcast(&jr.space);
+        pthread_mutex_unlock(&jr.mutex);
+
+        if(n > 0){
+            uint64_t start = time_mono_us();
+            if(journal_write(recs, n) != 0){
+                LOG_ERROR(JOURNAL, "%zu records not made durable", n);
+            }
+            unsigned long long us = time_mono_us() - start;
+            jr.records += n;
+            jr.syncs++;
+            if(us > jr.max_sync_us) jr.max_sync_us = us;
+        }
+
+        if(checkpoint > jr.checkpoint_saved){
+            if(checkpoint_save(checkpoint) == 0){
+                jr.checkpoint_saved = checkpoint;
+                journal_trim();
+            }
+            else{
+                LOG_ERROR(JOURNAL, "Failed to save checkpoint: %s", strerror(errno));
+            }
+        }
+
+        pthread_mutex_lock(&jr.mutex);
+        if(closing && jr.active_count == 0){
+            jr.enabled = 0;     // later appends are not journaled
+            break;
+        }
+    }
+    pthread_mutex_unlock(&jr.mutex);
+    return NULL;
+}
+
+/* ===========================
+ *   Public API
+ * =========================== */
+
+// Loads the checkpoint and existing files; call journal_replay next
+int journal_open(const char *dir, int sync_ms){
+    snprintf(jr.dir, sizeof(jr.dir), "%s", dir);
+    jr.sync_ms = (sync_ms > 0) ? sync_ms : 1;
+    jr.closing = 0;
+    jr.active_count = 0;
+    jr.num_files = 0;
+    jr.fd = -1;
+    jr.records = jr.syncs = jr.max_sync_us = jr.full_waits = 0;
+
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+        LOG_ERROR(JOURNAL, "Failed to create %s: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    jr.active = malloc(JOURNAL_BUF_RECORDS * sizeof(journal_record_t));
+    jr.spare = malloc(JOURNAL_BUF_RECORDS * sizeof(journal_record_t));
+    if(!jr.active || !jr.spare){
+        free(jr.active);
+        free(jr.spare);
+        LOG_ERROR(JOURNAL, "Failed to allocate buffers");
+        return -1;
+    }
+
+    jr.checkpoint = jr.checkpoint_saved = checkpoint_load();
+
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    while(d && (de = readdir(d)) != NULL){
+        unsigned long long first;
+        if(sscanf(de->d_name, "jrnl_%llu.log", &first) != 1) continue;
+        if(journal_file_add(first, 0) != 0){
+            LOG_ERROR(JOURNAL, "Out of memory listing %s", dir);
+            closedir(d);
+            free(jr.active);
+            free(jr.spare);
+            jr.active = jr.spare = NULL;
+            return -1;
+        }
+    }
+    if(d) closedir(d);
+    if(jr.num_files > 1) qsort(jr.files, jr.num_files, sizeof(jr.files[0]), cmp_file);
+
+    uint64_t last = jr.checkpoint;
+    for(size_t i = 0; i < jr.num_files; i++){
+        jr.files[i].last_seq = journal_scan_file(jr.files[i].first_seq, 0, NULL, NULL, NULL);
+        if(jr.files[i].last_seq > last) last = jr.files[i].last_seq;
+    }
+    jr.next_seq = last + 1;
+    if(last == 0){
+        jr.next_seq = (uint64_t)time_now_ms() * 1000;
+    }
+    journal_trim();
+
+    jr.enabled = 1;
+    int rc = pthread_create(&jr.flusher, NULL, journal_flusher_thread, NULL);
+    if(rc != 0){
+        jr.enabled = 0;
+        LOG_ERROR(JOURNAL, "Failed to start flusher thread: %s", strerror(rc));
+        return -1;
+    }
+
+    LOG_INFO(JOURNAL, "Opened %s: checkpoint %llu, next seq %llu, group commit every %d ms",
+              dir, (unsigned long long)jr.checkpoint, (unsigned long long)jr.next_seq, jr.sync_ms);
+    return 0;
+}
+
+// Feed records newer than the checkpoint back into the pipeline, in seq order
+size_t journal_replay(journal_replay_cb cb, void *ctx){
+    size_t replayed = 0;
+    for(size_t i = 0; i < jr.num_files; i++){
+        journal_scan_file(jr.files[i].first_seq, jr.checkpoint_saved, cb, ctx, &replayed);
+    }
+    if(replayed > 0){
+        LOG_INFO(JOURNAL, "Replayed %zu uncommitted packets", replayed);
+    }
+    return replayed;
+}
+
+// Assigns pkt->seq. Callers serialise appends (sbuffer mutex) so that
+// sequence order matches sbuffer order.
+void journal_append(sensor_packet_t *pkt){
+    pthread_mutex_lock(&jr.mutex);
+    if(!jr.enabled){
+        pthread_mutex_unlock(&jr.mutex);
+        return;
+    }
+    if(jr.active_count == JOURNAL_BUF_RECORDS){
+        jr.full_waits++;
+        pthread_cond_signal(&jr.wake);
+        while(jr.active_count == JOURNAL_BUF_RECORDS){
+            pthread_cond_wait(&jr.space, &jr.mutex);
+        }
+    }
+
+    journal_record_t *r = &jr.active[jr.active_count++];
+    memset(r, 0, sizeof(*r));
+    r->seq = jr.next_seq++;
+    r->ts_ms = pkt->ts_ms;
+    r->value = pkt->value;
+    r->id = pkt->id;
+    r->type = pkt->type;
+    r->crc = record_crc(r);
+    pkt->seq = r->seq;
+
+    if(jr.active_count == JOURNAL_BUF_RECORDS / 2){
+        pthread_cond_signal(&jr.wake);
+    }
+    pthread_mutex_unlock(&jr.mutex);
+}
+
+// Everything up to and including seq is committed to the storage backend
+void journal_checkpoint(uint64_t seq){
+    pthread_mutex_lock(&jr.mutex);
+    if(seq > jr.checkpoint) jr.checkpoint = seq;
+    pthread_mutex_unlock(&jr.mutex);
+}
+
+// Final group commit and checkpoint
+void journal_close(void){
+    pthread_mutex_lock(&jr.mutex);
+    if(!jr.enabled){
+        pthread_mutex_unlock(&jr.mutex);
+        return;
+    }
+    jr.closing = 1;
+    pthread_cond_signal(&jr.wake);
+    pthread_mutex_unlock(&jr.mutex);
+    pthread_join(jr.flusher, NULL);
+
+    if(jr.fd >= 0) close(jr.fd);
+    jr.fd = -1;
+
+    LOG_INFO(JOURNAL, "Closed: %llu records in %llu syncs (max %llu us), %llu waits on full buffer, checkpoint %llu",
+              jr.records, jr.syncs, jr.max_sync_us, jr.full_waits, (unsigned long long)jr.checkpoint_saved);
+
+    free(jr.active);
+    free(jr.spare);
+    free(jr.files);
+    jr.active = jr.spare = NULL;
+    jr.files = NULL;
+    jr.cap_files = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "main.h"
+
+// Crash-safe ingest journal.
+// Every packet entering the sbuffer is appended with a sequence number and
+// made durable by a group-commit flusher thread every journal_sync_ms.
+// Storage checkpoints the highest sequence committed to the backend;
+// on startup the records after the checkpoint are replayed.
+//
+// Replay is at-least-once: the checkpoint is saved with the next group
+// commit, so packets committed just before a crash come back. Backends
+// drop them by sequence: tsdb and the append-log store it with the data
+// and skip anything at or below it, SQLite rewrites the same keys and
+// leaves the rollups alone. A fresh journal starts at the wall clock in
+// microseconds so its sequences stay above those of an earlier journal.
+
+#define JOURNAL_DIR "../Database/journal"
+#define JOURNAL_CHECKPOINT_FILE "checkpoint"
+#define JOURNAL_MAGIC 0x314E524Au       // "JRN1"
+#define JOURNAL_BUF_RECORDS 16384       // per buffer, two buffers
+#ifndef JOURNAL_FILE_MAX
+#define JOURNAL_FILE_MAX (4 * 1024 * 1024)
+#endif
+#define JOURNAL_FILES_WARN 256         // closed files behind the checkpoint worth a warning
+
+typedef struct{
+    uint64_t seq;
+    int64_t ts_ms;
+    double value;
+    uint8_t id;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t crc;           // CRC-32 of the record with crc = 0
+} journal_record_t;
+
+typedef struct{
+    uint32_t magic;
+    uint32_t crc;           // CRC-32 of seq
+    uint64_t seq;
+} journal_checkpoint_t;
+
+// Replay callback, packet carries its original seq
+typedef void (*journal_replay_cb)(void *ctx, sensor_packet_t *pkt);
+
+int journal_open(const char *dir, int sync_ms);
+size_t journal_replay(journal_replay_cb cb, void *ctx);
+void journal_append(sensor_packet_t *pkt);
+void journal_checkpoint(uint64_t seq);
+void journal_close(void);
+
+#endif
@@ -1,8 +1,11 @@
 #include "sbuffer.h"
 #include "logger.h"
+#include "journal.h"
 
 void sbuffer_init(sbuffer_t *b){
     b->head = b->tail = NULL;
+    b->cloud_consumer = 0;
+    b->cloud_off = 0;
     pthread_mutex_init(&b->mutex, NULL);
     pthread_cond_init(&b->cond, NULL);
 }
@@ -10,11 +13,16 @@ void sbuffer_init(sbuffer_t *b){
 void sbuffer_free_all(sbuffer_t *b){
     pthread_mutex_lock(&b->mutex);
     sbuffer_node_t *n = b->head;
+    size_t unstored = 0;
     while(n){
         sbuffer_node_t *nx = n->next;
+        if(!n->processed_by_storage) unstored++;
         free(n);
         n = nx;
     }
+    if(unstored > 0){
+        LOG_WARN(SBUFFER, "%zu packets not stored at shutdown, left in journal for replay", unstored);
+    }
     b->head = b->tail = NULL;
     pthread_mutex_unlock(&b->mutex);
     
@@ -23,18 +31,23 @@ void sbuffer_free_all(sbuffer_t *b){
 }
 
 // Helper: wait until buffer has data or stop_flag is set
-static inline int sbuffer_wait_until_data(sbuffer_t *b) {
+static inline int sbuffer_wait_until_data(sbuffer_t *b, int timeout_ms) {
     struct timespec ts;
     // Take the present time
     clock_gettime(CLOCK_REALTIME, &ts);
-    // Set time out for 5s
-    ts.tv_sec += 5;
+    // Set time out
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
 
     while(b->head == NULL && !stop_flag){
         int rc = pthread_cond_timedwait(&b->cond, &b->mutex, &ts);
         
         if (rc == ETIMEDOUT) {
-            // if waiting time is over, no packet is arrived for 5s
+            // if waiting time is over, no packet is arrived within timeout
             //printf("Time out for hanging\n");
             return -1; 
         }
@@ -49,19 +62,24 @@ void sbuffer_insert(sbuffer_t *b, sensor_packet_t *pkt){
 
     sbuffer_node_t *n = malloc(sizeof(*n));
     if(!n){
-        log_event("[SBUFFER] malloc failed");
+        LOG_ERROR(SBUFFER, "malloc failed");
         return;
     }
 
     n->pkt = *pkt;
     //n->pkt.ts = time(NULL);
-    n->refcount = 2;  // data + storage
     n->processed_by_data = 0;
     n->processed_by_storage = 0;
-    //n->processed_by_cloud = 0;
     n->next = NULL;
 
     pthread_mutex_lock(&b->mutex);
+    n->refcount = 2 + b->cloud_consumer;  // data + storage (+ raw cloud uploads)
+    n->processed_by_cloud = !b->cloud_consumer;
+    // Journal sequence follows list order, so storage can checkpoint per batch.
+    // Replayed packets already carry their sequence.
+    if(n->pkt.seq == 0){
+        journal_append(&n->pkt);
+    }
     if(b->tail){
         b->tail->next = n;
     } 
@@ -78,10 +96,10 @@ void sbuffer_insert(sbuffer_t *b, sensor_packet_t *pkt){
  *   Find node functions
  * =========================== */
 
-static sbuffer_node_t *sbuffer_find_generic(sbuffer_t *b, int (*predicate)(sbuffer_node_t *)){
+static sbuffer_node_t *sbuffer_find_generic(sbuffer_t *b, int (*predicate)(sbuffer_node_t *), int timeout_ms){
     pthread_mutex_lock(&b->mutex);
     // Wait until data arrives or stop_flag
-    if(sbuffer_wait_until_data(b)){
+    if(sbuffer_wait_until_data(b, timeout_ms)){
         pthread_mutex_unlock(&b->mutex);
         return NULL;
     }
@@ -107,22 +125,33 @@ static int need_storage(sbuffer_node_t *n){
     return n->processed_by_data && !n->processed_by_storage;
 }
 
-// static int need_cloud(sbuffer_node_t *n){
-//     return n->processed_by_data && n->processed_by_storage && !n->processed_by_cloud;
-// }
+// Raw uploads do not wait for the other consumers
+static int need_cloud(sbuffer_node_t *n){
+    return !n->processed_by_cloud;
+}
 
 // Wrappers
 sbuffer_node_t* sbuffer_find_for_data(sbuffer_t *b){
-    return sbuffer_find_generic(b, need_data);
+    return sbuffer_find_generic(b, need_data, SBUFFER_WAIT_MS);
+}
+
+// Storage passes its own bound so a partial batch can meet its deadline
+sbuffer_node_t* sbuffer_find_for_storage(sbuffer_t *b, int timeout_ms){
+    return sbuffer_find_generic(b, need_storage, timeout_ms);
 }
 
-sbuffer_node_t* sbuffer_find_for_storage(sbuffer_t *b){
-    return sbuffer_find_generic(b, need_storage);
+// The cloud thread polls between upload rounds
+sbuffer_node_t* sbuffer_find_for_cloud(sbuffer_t *b){
+    return sbuffer_find_generic(b, need_cloud, 0);
 }
 
-// sbuffer_node_t* sbuffer_find_for_cloud(sbuffer_t *b){
-//     return sbuffer_find_generic(b, need_cloud);
-// }
+// Packets inserted from now on are also held for the cloud consumer,
+// unless the cloud thread already gave up
+void sbuffer_enable_cloud(sbuffer_t *b){
+    pthread_mutex_lock(&b->mutex);
+    b->cloud_consumer = !b->cloud_off;
+    pthread_mutex_unlock(&b->mutex);
+}
 
 /* ===========================
  *   Mark functions
@@ -179,15 +208,35 @@ void sbuffer_mark_storage_done(sbuffer_t *b, sbuffer_node_t *node){
     pthread_mutex_unlock(&b->mutex);
 }
 
-// void sbuffer_mark_upcloud_done(sbuffer_t *b, sbuffer_node_t *node){
-//     pthread_mutex_lock(&b->mutex);
-//     if(node->processed_by_data && node->processed_by_storage && 
-//         !node->processed_by_cloud){
-//         node->processed_by_cloud = 1;
-//         if(--node->refcount == 0){
-//             sbuffer_try_cleanup(b, node);
-//         }
-//         pthread_cond_broadcast(&b->cond);
-//     }
-//     pthread_mutex_unlock(&b->mutex);
-// }
\ No newline at end of file
+// The cloud thread will not collect: stop holding new packets for it and
+// release the ones already waiting. Sticky, a later enable is ignored.
+void sbuffer_disable_cloud(sbuffer_t *b){
+    pthread_mutex_lock(&b->mutex);
+    b->cloud_off = 1;
+    b->cloud_consumer = 0;
+    sbuffer_node_t *cur = b->head;
+    while(cur){
+        sbuffer_node_t *next = cur->next;
+        if(!cur->processed_by_cloud){
+            cur->processed_by_cloud = 1;
+            if(--cur->refcount == 0){
+                sbuffer_try_cleanup(b, cur);
+            }
+        }
+        cur = next;
+    }
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+void sbuffer_mark_upcloud_done(sbuffer_t *b, sbuffer_node_t *node){
+    pthread_mutex_lock(&b->mutex);
+    if(!node->processed_by_cloud){
+        node->processed_by_cloud = 1;
+        if(--node->refcount == 0){
+            sbuffer_try_cleanup(b, node);
+        }
+        pthread_cond_broadcast(&b->cond);
+    }
+    pthread_mutex_unlock(&b->mutex);
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "startup.h"
+#include "logger.h"
+#include "utilities.h"
+
+static const char *stage_names[STARTUP_STAGES] = {
+    "logger", "buffer", "ingest", "storage", "cloud", "broker"
+};
+
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startup_cond = PTHREAD_COND_INITIALIZER;
+static int64_t start_ms = 0;
+static int64_t ready_ms[STARTUP_STAGES];    // since start, -1 until ready
+static int64_t first_packet_ms = -1;
+static int first_packet_seen = 0;
+static int complete_logged = 0;
+
+void startup_begin(void){
+    pthread_mutex_lock(&startup_lock);
+    start_ms = time_mono_ms();
+    for(int i = 0; i < STARTUP_STAGES; i++){
+        ready_ms[i] = -1;
+    }
+    first_packet_ms = -1;
+    first_packet_seen = 0;
+    complete_logged = 0;
+    pthread_mutex_unlock(&startup_lock);
+}
+
+void startup_ready(startup_stage_t stage){
+    pthread_mutex_lock(&startup_lock);
+    if(ready_ms[stage] >= 0){
+        pthread_mutex_unlock(&startup_lock);
+        return;
+    }
+    int64_t at = time_mono_ms() - start_ms;
+    ready_ms[stage] = at;
+    // Logged before waiters run, so the log keeps the order of the stages
+    LOG_INFO(STARTUP, "%s ready after %lld ms", stage_names[stage], (long long)at);
+    pthread_cond_broadcast(&startup_cond);
+
+    // The broker may stay unreachable, startup is complete without it
+    int complete = !complete_logged;
+    for(int i = 0; i < STARTUP_BROKER && complete; i++){
+        if(ready_ms[i] < 0) complete = 0;
+    }
+    if(complete) complete_logged = 1;
+    pthread_mutex_unlock(&startup_lock);
+
+    if(complete){
+        char line[256];
+        startup_format(line, sizeof(line));
+        line[strcspn(line, "\n")] = '\0';
+        LOG_INFO(STARTUP, "Startup complete after %lld ms (%s)", (long long)at, line);
+    }
+}
+
+int startup_wait(startup_stage_t stage, int timeout_ms){
+    int64_t deadline = (timeout_ms < 0) ? INT64_MAX : time_mono_ms() + timeout_ms;
+
+    pthread_mutex_lock(&startup_lock);
+    // Timed in slices, a signal handler cannot wake the condition
+    while(ready_ms[stage] < 0 && !stop_flag){
+        int64_t left = deadline - time_mono_ms();
+        if(left <= 0) break;
+        if(left > STARTUP_WAIT_SLICE_MS) left = STARTUP_WAIT_SLICE_MS;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)(left % 1000) * 1000000;
+        ts.tv_sec += left / 1000 + ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&startup_cond, &startup_lock, &ts);
+    }
+    int rc = (ready_ms[stage] >= 0) ? 0 : -1;
+    pthread_mutex_unlock(&startup_lock);
+    return rc;
+}
+
+void startup_packet_accepted(void){
+    if(__atomic_load_n(&first_packet_seen, __ATOMIC_RELAXED)) return;
+    if(__atomic_exchange_n(&first_packet_seen, 1, __ATOMIC_ACQ_REL)) return;
+
+    pthread_mutex_lock(&startup_lock);
+    first_packet_ms = time_mono_ms() - start_ms;
+    int64_t ingest = ready_ms[STARTUP_INGEST];
+    pthread_mutex_unlock(&startup_lock);
+
+    LOG_INFO(STARTUP, "First packet accepted %lld ms after start (ingest ready at %lld ms)",
+              (long long)first_packet_ms, (long long)ingest);
+}
+
+size_t startup_format(char *out, size_t len){
+    pthread_mutex_lock(&startup_lock);
+    size_t used = snprintf(out, len, "startup_ms");
+    for(int i = 0; i < STARTUP_STAGES && used < len; i++){
+        if(ready_ms[i] >= 0){
+            used += snprintf(out + used, len - used, " %s=%lld", stage_names[i], (long long)ready_ms[i]);
+        }
+        else{
+            used += snprintf(out + used, len - used, " %s=-", stage_names[i]);
+        }
+    }
+    if(used < len){
+        if(first_packet_ms >= 0){
+            used += snprintf(out + used, len - used, " first_packet=%lld\n", (long long)first_packet_ms);
+        }
+        else{
+            used += snprintf(out + used, len - used, " first_packet=-\n");
+        }
+    }
+    pthread_mutex_unlock(&startup_lock);
+    return (used < len) ? used : len - 1;
+}
@@ -0,0 +1,36 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "main.h"
+
+// Startup readiness.
+// Subsystems start at the same time and each marks its stage ready once;
+// a thread that needs another stage waits for it here instead of sleeping.
+// Every stage is logged with its time since process start, and so is the
+// first packet accepted from a sensor.
+
+#define STARTUP_WAIT_SLICE_MS 100   // stop_flag is checked at least this often
+
+typedef enum{
+    STARTUP_LOGGER,                 // logger process has the log file open
+    STARTUP_BUFFER,                 // sbuffer up and journal replayed
+    STARTUP_INGEST,                 // sensor port accepting
+    STARTUP_STORAGE,                // storage backend open
+    STARTUP_CLOUD,                  // broker connections started, not necessarily up
+    STARTUP_BROKER,                 // first broker connection acknowledged
+    STARTUP_STAGES
+} startup_stage_t;
+
+// Process start, the zero of all times below
+void startup_begin(void);
+// Idempotent, callable from any thread
+void startup_ready(startup_stage_t stage);
+// 0 once the stage is ready, -1 on timeout or stop_flag; timeout_ms < 0 waits without limit
+int startup_wait(startup_stage_t stage, int timeout_ms);
+// Ingest calls this for every packet, only the first one is recorded
+void startup_packet_accepted(void);
+
+// Stage times in ms since start ("-" if not reached), one line
+size_t startup_format(char *out, size_t len);
+
+#endif
@@ -10,18 +10,23 @@ void sigint_handler(int sig){
         usleep(10000);
     }
 
-    int fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
-    if(fd >= 0){
-        static const char msg[] = "shutdown\n";
-        write(fd, msg, sizeof(msg) - 1); // Ignore errors in signal handler
-        close(fd);
-    }
+    // Nothing written to the FIFO here: it would land in the middle of a
+    // batch or a binary record; main logs the stop once the threads see it
 
     // Use write() instead of fprintf in signal handler (async-signal-safe)
     static const char shutdown_msg[] = "\n[MAIN] SIGINT received — shutting down gracefully...\n";
     write(STDERR_FILENO, shutdown_msg, sizeof(shutdown_msg) - 1);
 }
 
+// Each SIGHUP bumps the generation; threads owning reloadable state
+// compare it with the last one they handled
+volatile sig_atomic_t reload_generation = 0;
+
+void sighup_handler(int sig){
+    (void)sig;
+    reload_generation++;
+}
+
 void ensure_fifo_exists(void){
     struct stat st;
 
@@ -40,4 +45,83 @@ void ensure_fifo_exists(void){
             perror("mkfifo");
         }
     }
-}
\ No newline at end of file
+}
+
+int64_t time_now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t time_mono_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t time_mono_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* ===========================
+ *   Log2 histogram
+ * =========================== */
+
+void log2_hist_add(log2_hist_t *h, unsigned long long v){
+    int b = 0;
+    while(b < HIST_BUCKETS - 1 && (v >> b) != 0) b++;
+    __atomic_add_fetch(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, v, __ATOMIC_RELAXED);
+    if(v > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+// "name n=.. mean=.. max=.. <1:.. <2:.. ... >=16384:..", no newline
+size_t log2_hist_format(const log2_hist_t *h, const char *name, char *out, size_t len){
+    unsigned long long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    unsigned long long sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    size_t used = snprintf(out, len, "%s n=%llu mean=%.1f max=%llu", name, count,
+                           count ? (double)sum / count : 0.0, __atomic_load_n(&h->max, __ATOMIC_RELAXED));
+    for(int b = 0; b < HIST_BUCKETS && used < len; b++){
+        unsigned long long n = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if(n == 0) continue;
+        if(b == HIST_BUCKETS - 1){
+            used += snprintf(out + used, len - used, " >=%llu:%llu", 1ULL << (b - 1), n);
+        }
+        else{
+            used += snprintf(out + used, len - used, " <%llu:%llu", 1ULL << b, n);
+        }
+    }
+    return (used < len) ? used : len - 1;
+}
+
+/* ===========================
+ *   CRC-32 (IEEE)
+ * =========================== */
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void){
+    for(uint32_t i = 0; i < 256; i++){
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++){
+            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        }
+        crc_table[i] = c;
+    }
+}
+
+// Chainable: crc32_update(crc32_update(0, a, n), b, m) covers a then b
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len){
+    pthread_once(&crc_once, crc_init);
+
+    const uint8_t *p = data;
+    crc = ~crc;
+    while(len--){
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -7,8 +7,27 @@ extern pthread_mutex_t log_mutex;
 extern const char *fifo_path;
 extern sbuffer_t sbuffer;
 extern volatile sig_atomic_t stop_flag;
+extern volatile sig_atomic_t reload_generation;
+
+#define HIST_BUCKETS 16     // log2 buckets, the last one is open ended
+
+// Log2 histogram: bucket i counts values in [2^(i-1), 2^i), bucket 0 counts 0.
+// Relaxed atomics, so one thread may add while others format.
+typedef struct{
+    unsigned long long buckets[HIST_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+} log2_hist_t;
 
 void sigint_handler(int sig);
+void sighup_handler(int sig);
 void ensure_fifo_exists(void);
+int64_t time_now_ms(void);           // wall clock, for timestamps
+int64_t time_mono_ms(void);          // monotonic, for intervals and deadlines
+uint64_t time_mono_us(void);
+void log2_hist_add(log2_hist_t *h, unsigned long long v);
+size_t log2_hist_format(const log2_hist_t *h, const char *name, char *out, size_t len);
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
 
 #endif
\ No newline at end of file
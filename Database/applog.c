@@ -0,0 +1,188 @@
+#include "applog.h"
+#include "logger.h"
+#include "utilities.h"
+
+struct applog{
+    int fd;
+    uint64_t bytes;
+    uint64_t last_seq;      // journal sequence of the last record
+    applog_record_t *buf;
+    size_t buf_cap;
+};
+
+// Helper: checksum of a record with its crc field zeroed
+static uint32_t record_crc(const applog_record_t *r){
+    applog_record_t tmp = *r;
+    tmp.crc = 0;
+    return crc32_update(0, &tmp, sizeof(tmp));
+}
+
+// Helper: drop a partial or corrupt tail left by a crash mid-append
+static int applog_recover(applog_t *l, uint64_t size){
+    uint64_t valid = sizeof(applog_file_hdr_t) +
+                     (size - sizeof(applog_file_hdr_t)) / sizeof(applog_record_t) * sizeof(applog_record_t);
+
+    // Torn writes only hit the end, so walk back to the last good record
+    applog_record_t r;
+    while(valid > sizeof(applog_file_hdr_t)){
+        if(pread(l->fd, &r, sizeof(r), (off_t)(valid - sizeof(r))) != (ssize_t)sizeof(r)) return -1;
+        if(record_crc(&r) == r.crc) break;
+        valid -= sizeof(r);
+    }
+
+    if(valid != size){
+        LOG_WARN(APPLOG, "Truncating %llu torn bytes", (unsigned long long)(size - valid));
+        if(ftruncate(l->fd, (off_t)valid) != 0) return -1;
+    }
+    l->bytes = valid;
+    if(valid > sizeof(applog_file_hdr_t)) l->last_seq = r.seq;
+    return 0;
+}
+
+int applog_open(applog_t **out, const char *path){
+    if(!out || !path) return -1;
+
+    applog_t *l = calloc(1, sizeof(*l));
+    if(!l) return -1;
+
+    l->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(l->fd < 0){
+        LOG_ERROR(APPLOG, "Failed to open %s: %s", path, strerror(errno));
+        free(l);
+        return -1;
+    }
+
+    struct stat st;
+    fstat(l->fd, &st);
+
+    applog_file_hdr_t hdr;
+    if((size_t)st.st_size < sizeof(hdr)){
+        hdr.magic = APPLOG_MAGIC;
+        hdr.version = APPLOG_VERSION;
+        if(ftruncate(l->fd, 0) != 0 || write(l->fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)){
+            LOG_ERROR(APPLOG, "Failed to initialise %s: %s", path, strerror(errno));
+            applog_close(l);
+            return -1;
+        }
+        l->bytes = sizeof(hdr);
+    }
+    else if(pread(l->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            hdr.magic != APPLOG_MAGIC || hdr.version != APPLOG_VERSION){
+        LOG_ERROR(APPLOG, "%s is not a version %d append-log", path, APPLOG_VERSION);
+        applog_close(l);
+        return -1;
+    }
+    else if(applog_recover(l, (uint64_t)st.st_size) != 0){
+        LOG_ERROR(APPLOG, "Failed to recover %s: %s", path, strerror(errno));
+        applog_close(l);
+        return -1;
+    }
+
+    *out = l;
+    return 0;
+}
+
+void applog_close(applog_t *l){
+    if(!l) return;
+
+    if(l->fd >= 0){
+        fdatasync(l->fd);
+        close(l->fd);
+    }
+    free(l->buf);
+    free(l);
+}
+
+// Whole batch goes out in one write(), in packet order. Packets whose
+// journal sequence is already in the file are skipped.
+int applog_write_batch(applog_t *l, const sensor_packet_t *packets, size_t count){
+    if(!l || !packets) return -1;
+    if(count == 0) return 0;
+
+    if(count > l->buf_cap){
+        applog_record_t *nb = realloc(l->buf, count * sizeof(*nb));
+        if(!nb) return -1;
+        l->buf = nb;
+        l->buf_cap = count;
+    }
+
+    size_t n = 0;
+    uint64_t last_seq = l->last_seq;
+    for(size_t i = 0; i < count; i++){
+        if(packets[i].seq != 0 && packets[i].seq <= last_seq) continue;
+        applog_record_t *r = &l->buf[n++];
+        memset(r, 0, sizeof(*r));
+        r->ts_ms = packets[i].ts_ms;
+        r->value = packets[i].value;
+        r->seq = packets[i].seq;
+        r->id = packets[i].id;
+        r->type = packets[i].type;
+        r->crc = record_crc(r);
+        if(r->seq > last_seq) last_seq = r->seq;
+    }
+    if(n < count){
+        LOG_DEBUG(APPLOG, "Skipped %zu stored packets", count - n);
+    }
+    if(n == 0) return 0;
+
+    size_t len = n * sizeof(applog_record_t);
+    const uint8_t *p = (const uint8_t *)l->buf;
+    size_t done = 0;
+    while(done < len){
+        ssize_t w = write(l->fd, p + done, len - done);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0){
+            LOG_ERROR(APPLOG, "Write failed: %s", strerror(errno));
+            // Drop the partial batch so the file stays record aligned
+            if(ftruncate(l->fd, (off_t)l->bytes) != 0){
+                LOG_ERROR(APPLOG, "ftruncate after failed write: %s", strerror(errno));
+            }
+            return -1;
+        }
+        done += w;
+    }
+    l->bytes += len;
+    l->last_seq = last_seq;
+    return 0;
+}
+
+int applog_flush(applog_t *l){
+    if(!l) return -1;
+    return fdatasync(l->fd);
+}
+
+uint64_t applog_rows(applog_t *l){
+    if(!l) return 0;
+    return (l->bytes - sizeof(applog_file_hdr_t)) / sizeof(applog_record_t);
+}
+
+uint64_t applog_disk_bytes(applog_t *l){
+    return l ? l->bytes : 0;
+}
+
+// Read every valid record in file order, stopping at the first bad one
+int applog_scan(const char *path, applog_row_cb cb, void *ctx){
+    FILE *f = fopen(path, "rb");
+    if(!f) return -1;
+
+    applog_file_hdr_t hdr;
+    if(fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != APPLOG_MAGIC || hdr.version != APPLOG_VERSION){
+        fclose(f);
+        return -1;
+    }
+
+    applog_record_t r;
+    while(fread(&r, sizeof(r), 1, f) == 1){
+        if(record_crc(&r) != r.crc) break;
+        sensor_packet_t pkt = {
+            .id = r.id,
+            .type = r.type,
+            .value = r.value,
+            .ts_ms = r.ts_ms,
+            .seq = r.seq
+        };
+        if(cb(ctx, &pkt) != 0) break;
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef APPLOG_H
+#define APPLOG_H
+
+#include "main.h"
+
+// Binary append-log: a file header followed by fixed-size packet records.
+// No index, no in-place updates; readers scan from the start.
+// Records keep their journal sequence, so the last record is the durable
+// watermark and replayed or retried packets at or below it are skipped.
+
+#define APPLOG_FILE "../Database/sensors.log"
+#define APPLOG_MAGIC 0x314C4153u   // "SAL1"
+#define APPLOG_VERSION 2
+
+typedef struct{
+    uint32_t magic;
+    uint32_t version;
+} applog_file_hdr_t;
+
+typedef struct{
+    int64_t ts_ms;
+    double value;
+    uint64_t seq;           // journal sequence, 0 without journal
+    uint8_t id;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t crc;           // CRC-32 of the record with crc = 0
+} applog_record_t;
+
+typedef struct applog applog_t;
+
+// Scan callback, return non-zero to stop
+typedef int (*applog_row_cb)(void *ctx, const sensor_packet_t *pkt);
+
+int applog_open(applog_t **out, const char *path);
+void applog_close(applog_t *l);
+int applog_write_batch(applog_t *l, const sensor_packet_t *packets, size_t count);
+int applog_flush(applog_t *l);
+uint64_t applog_rows(applog_t *l);
+uint64_t applog_disk_bytes(applog_t *l);
+int applog_scan(const char *path, applog_row_cb cb, void *ctx);
+
+#endif
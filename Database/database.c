@@ -4,146 +4,1290 @@
 sensor_packet_t *data_copy_buffer = NULL; 
 size_t data_copy_count = 0;
 
-int db_init_and_open(sqlite3 **out_db){
-    if(!out_db) return SQLITE_ERROR;
-    
-    sqlite3 *db = NULL;
-    int rc = sqlite3_open(DB_FILE, &db);
+/* ===========================
+ *   Schema
+ * =========================== */
+
+// v2: integer epoch-ms timestamps, clustered on (id, type, ts) so that a
+// per-sensor time range is a single index seek and the table is its own
+// covering index
+static const char *schema_v2_sql =
+    "CREATE TABLE IF NOT EXISTS sensor_data("
+    "id INTEGER NOT NULL, "
+    "type INTEGER NOT NULL, "
+    "ts INTEGER NOT NULL, "
+    "value REAL, "
+    "PRIMARY KEY(id, type, ts)"
+    ") WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS schema_version("
+    "version INTEGER NOT NULL"
+    ");";
+
+// v5: live rows are appended to a rowid table with no key, the layout
+// the original schema wrote. Rows clustered by sensor dirty one b-tree
+// leaf per sensor per commit, appended here they dirty one or two.
+// db_fold_staged moves them into sensor_data and the rollups in large
+// key-sorted chunks. Only rows newer than anything stored for their
+// sensor are staged, so a key is in at most one of the two tables.
+static const char *schema_v5_stage_sql =
+    "CREATE TABLE IF NOT EXISTS sensor_data_recent("
+    "id INTEGER NOT NULL, "
+    "type INTEGER NOT NULL, "
+    "ts INTEGER NOT NULL, "
+    "value REAL"
+    ");";
+
+// The v4 staging table was keyed, and its rows already counted in the rollups
+static const char *schema_v5_from_v4_sql =
+    "INSERT OR REPLACE INTO sensor_data(id, type, ts, value) "
+    "SELECT id, type, ts, value FROM sensor_data_recent ORDER BY id, type, ts;"
+    "DROP TABLE sensor_data_recent;";
+
+// Raw rows of one sensor in [?3, ?4] from both tables, oldest first
+static const char *range_sql =
+    "SELECT id, type, ts, value FROM sensor_data "
+    "WHERE id = ?1 AND type = ?2 AND ts BETWEEN ?3 AND ?4 "
+    "UNION ALL SELECT id, type, ts, value FROM sensor_data_recent "
+    "WHERE id = ?1 AND type = ?2 AND ts BETWEEN ?3 AND ?4 ORDER BY ts;";
+
+// Rollup tables, indexed by db_rollup_res_t
+static const struct{
+    const char *name;
+    int64_t bucket_ms;
+} rollup_tables[DB_ROLLUP_COUNT] = {
+    [DB_ROLLUP_MINUTE] = {"sensor_rollup_1m", 60LL * 1000},
+    [DB_ROLLUP_HOUR]   = {"sensor_rollup_1h", 3600LL * 1000},
+};
+
+// v3: count/sum/min/max/last per sensor per bucket
+static const char *schema_v3_rollup_sql =
+    "CREATE TABLE IF NOT EXISTS %s("
+    "id INTEGER NOT NULL, "
+    "type INTEGER NOT NULL, "
+    "bucket INTEGER NOT NULL, "
+    "count INTEGER NOT NULL, "
+    "sum REAL NOT NULL, "
+    "min REAL NOT NULL, "
+    "max REAL NOT NULL, "
+    "last REAL NOT NULL, "
+    "last_ts INTEGER NOT NULL, "
+    "PRIMARY KEY(id, type, bucket)"
+    ") WITHOUT ROWID;";
+
+static const char *rollup_backfill_sql =
+    "INSERT OR REPLACE INTO %s(id, type, bucket, count, sum, min, max, last, last_ts) "
+    "SELECT id, type, ts - ts %% %lld AS b, COUNT(*), SUM(value), MIN(value), MAX(value), 0, MAX(ts) "
+    "FROM sensor_data GROUP BY id, type, ts - ts %% %lld;"
+    "UPDATE %s SET last = (SELECT value FROM sensor_data d "
+    "WHERE d.id = %s.id AND d.type = %s.type AND d.ts = %s.last_ts);";
+
+// Merge a batch bucket into the stored one
+static const char *rollup_upsert_sql =
+    "INSERT INTO %s(id, type, bucket, count, sum, min, max, last, last_ts) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9) "
+    "ON CONFLICT(id, type, bucket) DO UPDATE SET "
+    "count = count + excluded.count, "
+    "sum = sum + excluded.sum, "
+    "min = MIN(min, excluded.min), "
+    "max = MAX(max, excluded.max), "
+    "last = CASE WHEN excluded.last_ts >= last_ts THEN excluded.last ELSE last END, "
+    "last_ts = MAX(last_ts, excluded.last_ts);";
+
+// Recompute one bucket from the raw rows, for readings whose value changed
+static const char *rollup_rebuild_sql =
+    "WITH raw AS ("
+    "SELECT ts, value FROM sensor_data WHERE id = ?1 AND type = ?2 AND ts >= ?3 AND ts < ?4 "
+    "UNION ALL SELECT ts, value FROM sensor_data_recent WHERE id = ?1 AND type = ?2 AND ts >= ?3 AND ts < ?4) "
+    "INSERT OR REPLACE INTO %s(id, type, bucket, count, sum, min, max, last, last_ts) "
+    "SELECT ?1, ?2, ?3, COUNT(*), SUM(value), MIN(value), MAX(value), "
+    "(SELECT value FROM raw ORDER BY ts DESC LIMIT 1), MAX(ts) "
+    "FROM raw HAVING COUNT(*) > 0;";
+
+static const char *rollup_range_sql =
+    "SELECT id, type, bucket, count, sum, min, max, last, last_ts FROM %s "
+    "WHERE id = ?1 AND type = ?2 AND bucket BETWEEN ?3 AND ?4 ORDER BY bucket;";
+
+// Staged rows of one sensor, not in the rollups until they are folded
+static const char *staged_range_sql =
+    "SELECT ts, value FROM sensor_data_recent "
+    "WHERE id = ?1 AND type = ?2 AND ts BETWEEN ?3 AND ?4 ORDER BY ts;";
+
+// Helper: check whether a table exists
+static int db_table_exists(sqlite3 *db, const char *name){
+    sqlite3_stmt *stmt = NULL;
+    if(sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?1;", -1, &stmt, NULL) != SQLITE_OK){
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    int exists = (sqlite3_step(stmt) == SQLITE_ROW);
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+// Helper: on-disk schema version (0 = empty database, 1 = original table)
+static int db_schema_version(sqlite3 *db){
+    if(db_table_exists(db, "schema_version")){
+        sqlite3_stmt *stmt = NULL;
+        int version = 0;
+        if(sqlite3_prepare_v2(db, "SELECT MAX(version) FROM schema_version;", -1, &stmt, NULL) == SQLITE_OK){
+            if(sqlite3_step(stmt) == SQLITE_ROW){
+                version = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+        return version;
+    }
+    return db_table_exists(db, "sensor_data") ? 1 : 0;
+}
+
+// Helper: run SQL during schema upgrade, logging failures
+static int db_exec_logged(sqlite3 *db, const char *sql){
+    char *errmsg = NULL;
+    int rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
     if(rc != SQLITE_OK){
-        if(db) sqlite3_close(db);
-        log_event("[SQL] Failed to open database: %s", sqlite3_errstr(rc));
-        return rc;
+        LOG_ERROR(SQL, "Schema upgrade failed: %s", errmsg ? errmsg : "unknown");
+        sqlite3_free(errmsg);
     }
+    return rc;
+}
+
+// Helper: bring the schema up to DB_SCHEMA_VERSION in one transaction.
+// Upgrading from v1 only renames the old table, its rows are moved over
+// in small chunks by db_migrate_step while the gateway keeps writing.
+static int db_schema_upgrade(db_handle_t *h){
+    int version = db_schema_version(h->db);
     
-    // Create table if not exists
-    const char *sql = 
-        "CREATE TABLE IF NOT EXISTS sensor_data("
-        "id INTEGER, "
-        "type INTEGER, "
-        "value REAL, "
-        "ts DATETIME DEFAULT CURRENT_TIMESTAMP"
-        ");";
+    if(version > DB_SCHEMA_VERSION){
+        LOG_ERROR(SQL, "Database schema v%d is newer than supported v%d", version, DB_SCHEMA_VERSION);
+        return SQLITE_ERROR;
+    }
+
+    if(version < DB_SCHEMA_VERSION){
+        char sql[1024];
+        int rc = db_exec_logged(h->db, "BEGIN IMMEDIATE;");
+
+        if(rc == SQLITE_OK && version == 1){
+            rc = db_exec_logged(h->db, "ALTER TABLE sensor_data RENAME TO sensor_data_v1;");
+        }
+        if(rc == SQLITE_OK && version < 2){
+            rc = db_exec_logged(h->db, schema_v2_sql);
+        }
+        if(rc == SQLITE_OK && version < 3){
+            // Rollup tables, backfilled from rows already in sensor_data
+            for(int r = 0; r < DB_ROLLUP_COUNT && rc == SQLITE_OK; r++){
+                snprintf(sql, sizeof(sql), schema_v3_rollup_sql, rollup_tables[r].name);
+                rc = db_exec_logged(h->db, sql);
+                if(rc == SQLITE_OK){
+                    snprintf(sql, sizeof(sql), rollup_backfill_sql,
+                        rollup_tables[r].name, (long long)rollup_tables[r].bucket_ms, (long long)rollup_tables[r].bucket_ms,
+                        rollup_tables[r].name, rollup_tables[r].name, rollup_tables[r].name, rollup_tables[r].name);
+                    rc = db_exec_logged(h->db, sql);
+                }
+            }
+        }
+        if(rc == SQLITE_OK && version == 4){
+            rc = db_exec_logged(h->db, schema_v5_from_v4_sql);
+        }
+        if(rc == SQLITE_OK && version < 5){
+            rc = db_exec_logged(h->db, schema_v5_stage_sql);
+        }
+        if(rc == SQLITE_OK){
+            snprintf(sql, sizeof(sql),
+                "DELETE FROM schema_version;"
+                "INSERT INTO schema_version(version) VALUES (%d);"
+                "COMMIT;", DB_SCHEMA_VERSION);
+            rc = db_exec_logged(h->db, sql);
+        }
+
+        if(rc != SQLITE_OK){
+            LOG_ERROR(SQL, "Schema upgrade v%d -> v%d rolled back", version, DB_SCHEMA_VERSION);
+            sqlite3_exec(h->db, "ROLLBACK;", NULL, NULL, NULL);
+            return rc;
+        }
+        LOG_INFO(SQL, "Schema upgraded v%d -> v%d", version, DB_SCHEMA_VERSION);
+    }
+
+    h->migrate_pending = db_table_exists(h->db, "sensor_data_v1");
+    if(h->migrate_pending){
+        LOG_WARN(SQL, "v1 rows pending migration, continuing online");
+    }
+    return SQLITE_OK;
+}
+
+/* ===========================
+ *   Statement helpers
+ * =========================== */
+
+// Helper: prepare a statement that lives as long as the handle
+static int db_prepare(db_handle_t *h, const char *sql, sqlite3_stmt **out){
+    int rc = sqlite3_prepare_v3(h->db, sql, -1, SQLITE_PREPARE_PERSISTENT, out, NULL);
+    if(rc != SQLITE_OK){
+        LOG_ERROR(SQL, "Failed to prepare statement: %s", sqlite3_errmsg(h->db));
+    }
+    return rc;
+}
+
+// Helper: run a cached statement that returns no rows
+static int db_step_reset(sqlite3_stmt *stmt){
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+// Helper: get the INSERT statement for exactly 'rows' rows into
+// sensor_data or, with 'staged', into the staging table
+static sqlite3_stmt *db_insert_stmt(db_handle_t *h, size_t rows, int staged){
+    if(rows == 0 || rows > DB_MULTI_ROW_MAX) return NULL;
+    sqlite3_stmt **out = staged ? &h->insert_staged[rows] : &h->insert_rows[rows];
+    if(*out) return *out;
+
+    // "INSERT ... VALUES (?,?,?,?),(?,?,?,?),..."
+    // Same (id, type, ts) means the same reading, so replaying it is
+    // harmless; staged rows are new by construction and have no key
+    static const char direct[] = "INSERT OR REPLACE INTO sensor_data(id, type, ts, value) VALUES ";
+    static const char stage[] = "INSERT INTO sensor_data_recent(id, type, ts, value) VALUES ";
+    static const char row[] = "(?,?,?,?),";
+    char sql[sizeof(direct) + DB_MULTI_ROW_MAX * (sizeof(row) - 1)];
+
+    const char *head = staged ? stage : direct;
+    size_t len = strlen(head);
+    memcpy(sql, head, len);
+    for(size_t i = 0; i < rows; i++){
+        memcpy(sql + len, row, sizeof(row) - 1);
+        len += sizeof(row) - 1;
+    }
+    sql[len - 1] = '\0'; // Drop trailing comma
+
+    if(db_prepare(h, sql, out) != SQLITE_OK){
+        *out = NULL;
+    }
+    return *out;
+}
+
+// Helper: bind and run one multi-row INSERT
+static int db_insert_rows(db_handle_t *h, const sensor_packet_t *packets, size_t rows, int staged){
+    sqlite3_stmt *stmt = db_insert_stmt(h, rows, staged);
+    if(!stmt) return SQLITE_ERROR;
+
+    int p = 1;
+    for(size_t i = 0; i < rows; i++){
+        sqlite3_bind_int(stmt, p++, packets[i].id);
+        sqlite3_bind_int(stmt, p++, packets[i].type);
+        sqlite3_bind_int64(stmt, p++, (sqlite3_int64)packets[i].ts_ms);
+        sqlite3_bind_double(stmt, p++, packets[i].value);
+    }
+    return db_step_reset(stmt);
+}
+
+// Helper: order rows by primary key
+static int db_cmp_key(const void *a, const void *b){
+    const sensor_packet_t *x = a, *y = b;
+    if(x->id != y->id) return (x->id < y->id) ? -1 : 1;
+    if(x->type != y->type) return (x->type < y->type) ? -1 : 1;
+    if(x->ts_ms != y->ts_ms) return (x->ts_ms < y->ts_ms) ? -1 : 1;
+    return 0;
+}
+
+/* ===========================
+ *   Rollups
+ * =========================== */
+
+// How a row of the batch relates to what is already stored
+enum{
+    DB_ROW_NEW = 0,         // counted into the rollups
+    DB_ROW_SEEN,            // same reading already stored (replay, retry)
+    DB_ROW_CHANGED          // same key, other value: its buckets are rebuilt
+};
+
+// Helper: cached newest timestamp of a sensor, loaded on first use.
+// NULL when the table is full; every row is then checked.
+static db_newest_t *db_newest_get(db_handle_t *h, uint8_t id, uint8_t type){
+    size_t slot = ((size_t)id * 31 + type) % DB_NEWEST_SLOTS;
+    for(size_t n = 0; n < DB_NEWEST_SLOTS; n++){
+        db_newest_t *e = &h->newest[(slot + n) % DB_NEWEST_SLOTS];
+        if(e->used && e->id == id && e->type == type) return e;
+        if(e->used) continue;
+
+        sqlite3_bind_int(h->stmt_newest, 1, id);
+        sqlite3_bind_int(h->stmt_newest, 2, type);
+        int rc = sqlite3_step(h->stmt_newest);
+        int known = (rc == SQLITE_ROW);
+        int64_t ts = INT64_MIN;
+        if(known && sqlite3_column_type(h->stmt_newest, 0) != SQLITE_NULL){
+            ts = sqlite3_column_int64(h->stmt_newest, 0);
+        }
+        sqlite3_reset(h->stmt_newest);
+        if(!known) return NULL;
+
+        e->id = id;
+        e->type = type;
+        e->ts_ms = ts;
+        e->used = 1;
+        return e;
+    }
+    return NULL;
+}
+
+// Helper: mark the rows of one sensor's run that are already stored.
+// Only runs reaching back to the newest stored timestamp look at the table,
+// so live ingest costs a lookup in the cache.
+static int db_classify_run(db_handle_t *h, const sensor_packet_t *run, uint8_t *state, size_t n){
+    db_newest_t *newest = db_newest_get(h, run[0].id, run[0].type);
+    if(!newest || run[0].ts_ms <= newest->ts_ms){
+        sqlite3_stmt *stmt = h->stmt_range;
+        sqlite3_bind_int(stmt, 1, run[0].id);
+        sqlite3_bind_int(stmt, 2, run[0].type);
+        sqlite3_bind_int64(stmt, 3, (sqlite3_int64)run[0].ts_ms);
+        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)run[n - 1].ts_ms);
+
+        // Both sides in ts order: one merge pass
+        size_t i = 0;
+        int rc = SQLITE_DONE;
+        while(i < n && (rc = sqlite3_step(stmt)) == SQLITE_ROW){
+            int64_t ts = sqlite3_column_int64(stmt, 2);
+            double value = sqlite3_column_double(stmt, 3);
+            while(i < n && run[i].ts_ms < ts) i++;
+            for(; i < n && run[i].ts_ms == ts; i++){
+                state[i] = (run[i].value == value) ? DB_ROW_SEEN : DB_ROW_CHANGED;
+            }
+        }
+        if(i < n && rc != SQLITE_DONE){
+            LOG_ERROR(SQL, "Failed to check stored rows: %s", sqlite3_errmsg(h->db));
+            sqlite3_reset(stmt);
+            return rc;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    // The same key twice in the batch: the later row replaces the earlier one
+    for(size_t i = 1; i < n; i++){
+        if(run[i].ts_ms == run[i - 1].ts_ms && state[i] == DB_ROW_NEW){
+            state[i] = (run[i].value == run[i - 1].value) ? DB_ROW_SEEN : DB_ROW_CHANGED;
+        }
+    }
+
+    // Raised before commit: a rollback only costs later runs a lookup
+    if(newest && run[n - 1].ts_ms > newest->ts_ms){
+        newest->ts_ms = run[n - 1].ts_ms;
+    }
+    return SQLITE_OK;
+}
+
+// Helper: room for 'count' row states, all DB_ROW_NEW
+static int db_row_state_reset(db_handle_t *h, size_t count){
+    if(count > h->row_state_cap){
+        uint8_t *grown = realloc(h->row_state, count);
+        if(!grown) return SQLITE_NOMEM;
+        h->row_state = grown;
+        h->row_state_cap = count;
+    }
+    memset(h->row_state, DB_ROW_NEW, count);
+    return SQLITE_OK;
+}
+
+// Helper: classify a key-sorted batch into h->row_state before it is written
+static int db_classify_rows(db_handle_t *h, const sensor_packet_t *packets, size_t count){
+    int rc = db_row_state_reset(h, count);
+    if(rc != SQLITE_OK) return rc;
+
+    size_t i = 0;
+    while(i < count){
+        size_t end = i + 1;
+        while(end < count && packets[end].id == packets[i].id && packets[end].type == packets[i].type) end++;
+        rc = db_classify_run(h, packets + i, h->row_state + i, end - i);
+        if(rc != SQLITE_OK) return rc;
+        i = end;
+    }
+    return SQLITE_OK;
+}
+
+// Helper: whether a key-sorted batch can go to the staging table as it is:
+// every row newer than anything stored for its sensor, no key twice. Live
+// ingest passes on cached timestamps alone; replayed and late rows do not.
+static int db_rows_stageable(db_handle_t *h, const sensor_packet_t *packets, size_t count){
+    for(size_t i = 0; i < count; i++){
+        const sensor_packet_t *p = &packets[i];
+        if(i > 0 && p->id == p[-1].id && p->type == p[-1].type){
+            if(p->ts_ms == p[-1].ts_ms) return 0;
+            continue;
+        }
+        db_newest_t *newest = db_newest_get(h, p->id, p->type);
+        if(!newest || p->ts_ms <= newest->ts_ms) return 0;
+    }
+
+    // Raised before commit: a rollback only costs later runs a lookup
+    for(size_t i = 0; i < count; i++){
+        const sensor_packet_t *p = &packets[i];
+        if(i + 1 < count && p[1].id == p->id && p[1].type == p->type) continue;
+        db_newest_t *newest = db_newest_get(h, p->id, p->type);
+        if(newest) newest->ts_ms = p->ts_ms;
+    }
+    return 1;
+}
+
+// Helper: recompute the buckets of every changed row once the raw rows are in
+static int db_rebuild_rollups(db_handle_t *h, const sensor_packet_t *packets, size_t count){
+    for(int r = 0; r < DB_ROLLUP_COUNT; r++){
+        int64_t width = rollup_tables[r].bucket_ms;
+        int64_t done_bucket = INT64_MIN;
+        int done_id = -1, done_type = -1;
+
+        for(size_t i = 0; i < count; i++){
+            if(h->row_state[i] != DB_ROW_CHANGED) continue;
+            const sensor_packet_t *p = &packets[i];
+            int64_t bucket = p->ts_ms - p->ts_ms % width;
+            if(p->id == done_id && p->type == done_type && bucket == done_bucket) continue;
+
+            if(!h->stmt_rollup_rebuild[r]){
+                char sql[768];
+                snprintf(sql, sizeof(sql), rollup_rebuild_sql, rollup_tables[r].name);
+                if(db_prepare(h, sql, &h->stmt_rollup_rebuild[r]) != SQLITE_OK){
+                    h->stmt_rollup_rebuild[r] = NULL;
+                    return SQLITE_ERROR;
+                }
+            }
+            sqlite3_stmt *stmt = h->stmt_rollup_rebuild[r];
+            sqlite3_bind_int(stmt, 1, p->id);
+            sqlite3_bind_int(stmt, 2, p->type);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)bucket);
+            sqlite3_bind_int64(stmt, 4, (sqlite3_int64)(bucket + width));
+            int rc = db_step_reset(stmt);
+            if(rc != SQLITE_OK){
+                LOG_ERROR(SQL, "Failed to rebuild %s: %s", rollup_tables[r].name, sqlite3_errmsg(h->db));
+                return rc;
+            }
+            done_id = p->id;
+            done_type = p->type;
+            done_bucket = bucket;
+        }
+    }
+    return SQLITE_OK;
+}
+
+// Helper: fold the new rows of a key-sorted batch into per-bucket
+// aggregates and merge them into each rollup table (same transaction as
+// the raw rows). Rows classified as already stored are skipped, so a
+// replayed or retried batch is not counted twice.
+static int db_write_rollups(db_handle_t *h, const sensor_packet_t *packets, size_t count){
+    const uint8_t *state = h->row_state;
+    for(int r = 0; r < DB_ROLLUP_COUNT; r++){
+        int64_t width = rollup_tables[r].bucket_ms;
+        sqlite3_stmt *stmt = h->stmt_rollup_upsert[r];
+
+        size_t i = 0;
+        while(i < count){
+            if(state[i] != DB_ROW_NEW){
+                i++;
+                continue;
+            }
+            const sensor_packet_t *p = &packets[i];
+            db_rollup_t acc = {
+                .id = p->id,
+                .type = p->type,
+                .bucket_ms = p->ts_ms - p->ts_ms % width,
+                .count = 0,
+                .sum = 0.0,
+                .min = p->value,
+                .max = p->value,
+            };
+
+            // Sorted input: one bucket is a run of consecutive packets
+            for(; i < count; i++){
+                p = &packets[i];
+                if(p->id != acc.id || p->type != acc.type || p->ts_ms - p->ts_ms % width != acc.bucket_ms){
+                    break;
+                }
+                if(state[i] != DB_ROW_NEW) continue;
+                acc.count++;
+                acc.sum += p->value;
+                if(p->value < acc.min) acc.min = p->value;
+                if(p->value > acc.max) acc.max = p->value;
+                acc.last = p->value;
+                acc.last_ts_ms = p->ts_ms;
+            }
+
+            sqlite3_bind_int(stmt, 1, acc.id);
+            sqlite3_bind_int(stmt, 2, acc.type);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)acc.bucket_ms);
+            sqlite3_bind_int64(stmt, 4, (sqlite3_int64)acc.count);
+            sqlite3_bind_double(stmt, 5, acc.sum);
+            sqlite3_bind_double(stmt, 6, acc.min);
+            sqlite3_bind_double(stmt, 7, acc.max);
+            sqlite3_bind_double(stmt, 8, acc.last);
+            sqlite3_bind_int64(stmt, 9, (sqlite3_int64)acc.last_ts_ms);
+
+            int rc = db_step_reset(stmt);
+            if(rc != SQLITE_OK){
+                LOG_ERROR(SQL, "Failed to update %s: %s", rollup_tables[r].name, sqlite3_errmsg(h->db));
+                return rc;
+            }
+        }
+    }
+    return SQLITE_OK;
+}
+
+// Helper: write key-sorted rows to sensor_data and the rollups inside an
+// open transaction. Full-size chunks first, then one tail statement for
+// the remainder.
+static int db_write_rows(db_handle_t *h, sensor_packet_t *packets, size_t count){
+    // Before the INSERT OR REPLACE hides which keys were there already
+    int rc = db_classify_rows(h, packets, count);
+    if(rc != SQLITE_OK) return rc;
+
+    // Rows already stored as they are are not written again
+    size_t done = 0;
+    while(done < count){
+        if(h->row_state[done] == DB_ROW_SEEN){
+            done++;
+            continue;
+        }
+        size_t rows = 1;
+        while(done + rows < count && rows < DB_MULTI_ROW_MAX && h->row_state[done + rows] != DB_ROW_SEEN) rows++;
+
+        rc = db_insert_rows(h, packets + done, rows, 0);
+        if(rc != SQLITE_OK){
+            LOG_ERROR(SQL, "Failed to insert %zu rows: %s", rows, sqlite3_errmsg(h->db));
+            return rc;
+        }
+        done += rows;
+    }
+
+    rc = db_write_rollups(h, packets, count);
+    if(rc != SQLITE_OK) return rc;
+    return db_rebuild_rollups(h, packets, count);
+}
+
+// Helper: append rows to the staging table inside an open transaction;
+// their rollups are written when they are folded
+static int db_write_staged(db_handle_t *h, const sensor_packet_t *packets, size_t count){
+    for(size_t done = 0; done < count;){
+        size_t rows = (count - done < DB_MULTI_ROW_MAX) ? count - done : DB_MULTI_ROW_MAX;
+        int rc = db_insert_rows(h, packets + done, rows, 1);
+        if(rc != SQLITE_OK){
+            LOG_ERROR(SQL, "Failed to stage %zu rows: %s", rows, sqlite3_errmsg(h->db));
+            return rc;
+        }
+        done += rows;
+    }
+    return SQLITE_OK;
+}
+
+// Helper: fold the staging table after a commit once it holds stage_rows
+// rows, which only happens when the writer gets no idle time to fold in
+static void db_fold_if_due(db_handle_t *h){
+    if(h->stage_rows && h->staged >= h->stage_rows && db_fold_staged(h) != SQLITE_OK){
+        // Rows stay staged and readable; retried after the next commit
+        LOG_WARN(SQL, "%zu rows left staged", h->staged);
+    }
+}
+
+/* ===========================
+ *   Public API
+ * =========================== */
+
+int db_init_and_open(db_handle_t **out_db, const char *path){
+    if(!out_db || !path) return SQLITE_ERROR;
     
-    char *errmsg = NULL;
-    rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+    db_handle_t *h = calloc(1, sizeof(*h));
+    if(!h){
+        LOG_ERROR(SQL, "Failed to allocate database handle");
+        return SQLITE_NOMEM;
+    }
+
+    int rc = sqlite3_open(path, &h->db);
     if(rc != SQLITE_OK){
-        log_event("[SQL] Create table error: %s", errmsg ? errmsg : "unknown");
-        sqlite3_free(errmsg);
-        sqlite3_close(db);
+        LOG_ERROR(SQL, "Failed to open database: %s", sqlite3_errstr(rc));
+        db_close(h);
         return rc;
     }
     
+    // Writer and maintenance connections share the file
+    sqlite3_busy_timeout(h->db, DB_BUSY_TIMEOUT_MS);
+    h->stage_rows = DB_STAGE_ROWS_DEFAULT;
+
+    // Only takes effect on a new database; retention frees pages to the
+    // freelist, incremental vacuum hands them back to the filesystem
+    sqlite3_exec(h->db, "PRAGMA auto_vacuum=INCREMENTAL;", NULL, NULL, NULL);
+
     // Optimize for continuous writes
-    sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
-    sqlite3_exec(db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
-    sqlite3_exec(db, "PRAGMA cache_size=-64000;", NULL, NULL, NULL);
-    sqlite3_exec(db, "PRAGMA temp_store=MEMORY;", NULL, NULL, NULL);
+    sqlite3_exec(h->db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+    sqlite3_exec(h->db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+    sqlite3_exec(h->db, "PRAGMA cache_size=-64000;", NULL, NULL, NULL);
+    sqlite3_exec(h->db, "PRAGMA temp_store=MEMORY;", NULL, NULL, NULL);
+
+    // Create or upgrade tables
+    rc = db_schema_upgrade(h);
+    if(rc != SQLITE_OK){
+        db_close(h);
+        return rc;
+    }
+
+    // Statements used on every batch are prepared once for the handle lifetime
+    if((rc = db_prepare(h, "BEGIN IMMEDIATE;", &h->stmt_begin)) != SQLITE_OK ||
+       (rc = db_prepare(h, "COMMIT;", &h->stmt_commit)) != SQLITE_OK ||
+       (rc = db_prepare(h, "ROLLBACK;", &h->stmt_rollback)) != SQLITE_OK ||
+       (rc = db_prepare(h, "SELECT version FROM schema_version LIMIT 1;", &h->stmt_health)) != SQLITE_OK ||
+       (rc = db_prepare(h,
+            "SELECT MAX(ts) FROM (SELECT MAX(ts) AS ts FROM sensor_data WHERE id = ?1 AND type = ?2 "
+            "UNION ALL SELECT MAX(ts) FROM sensor_data_recent WHERE id = ?1 AND type = ?2);", &h->stmt_newest)) != SQLITE_OK ||
+       (rc = db_prepare(h,
+            "SELECT rowid, id, type, ts, value FROM sensor_data_recent ORDER BY rowid LIMIT ?1;", &h->stmt_fold_read)) != SQLITE_OK ||
+       (rc = db_prepare(h, "DELETE FROM sensor_data_recent WHERE rowid <= ?1;", &h->stmt_fold_clear)) != SQLITE_OK ||
+       (rc = db_prepare(h, range_sql, &h->stmt_range)) != SQLITE_OK ||
+       (rc = db_prepare(h, staged_range_sql, &h->stmt_staged_range)) != SQLITE_OK){
+        db_close(h);
+        return rc;
+    }
+    for(int r = 0; r < DB_ROLLUP_COUNT; r++){
+        char sql[512];
+        snprintf(sql, sizeof(sql), rollup_upsert_sql, rollup_tables[r].name);
+        if((rc = db_prepare(h, sql, &h->stmt_rollup_upsert[r])) != SQLITE_OK){
+            db_close(h);
+            return rc;
+        }
+        snprintf(sql, sizeof(sql), rollup_range_sql, rollup_tables[r].name);
+        if((rc = db_prepare(h, sql, &h->stmt_rollup_range[r])) != SQLITE_OK){
+            db_close(h);
+            return rc;
+        }
+    }
+    if(!db_insert_stmt(h, 1, 0) || !db_insert_stmt(h, DB_MULTI_ROW_MAX, 0) ||
+       !db_insert_stmt(h, 1, 1) || !db_insert_stmt(h, DB_MULTI_ROW_MAX, 1)){
+        db_close(h);
+        return SQLITE_ERROR;
+    }
+
+    // Rows left staged by an earlier run count towards the next fold
+    sqlite3_stmt *stmt = NULL;
+    if(sqlite3_prepare_v2(h->db, "SELECT COUNT(*) FROM sensor_data_recent;", -1, &stmt, NULL) == SQLITE_OK){
+        if(sqlite3_step(stmt) == SQLITE_ROW) h->staged = (size_t)sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
     
-    *out_db = db;
+    *out_db = h;
     return SQLITE_OK;
 }
 
-int db_insert_measure(sqlite3 *db, sensor_packet_t *pkt){
-    if(!db || !pkt) return SQLITE_ERROR;
-    
-    static const char *sql = 
-        "INSERT INTO sensor_data(id, type, value, ts) "
-        "VALUES (?1, ?2, ?3, datetime(?4, 'unixepoch'));";
-    
-    sqlite3_stmt *stmt = NULL;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+// Query-side handle: read-only connection, no schema changes, only the
+// read statements. In WAL mode it never blocks the writer.
+int db_open_readonly(db_handle_t **out_db, const char *path){
+    if(!out_db || !path) return SQLITE_ERROR;
+
+    db_handle_t *h = calloc(1, sizeof(*h));
+    if(!h) return SQLITE_NOMEM;
+
+    int rc = sqlite3_open_v2(path, &h->db, SQLITE_OPEN_READONLY, NULL);
     if(rc != SQLITE_OK){
+        db_close(h);
         return rc;
     }
-    
-    sqlite3_bind_int(stmt, 1, pkt->id);
-    sqlite3_bind_int(stmt, 2, pkt->type);
-    sqlite3_bind_double(stmt, 3, pkt->value);
-    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)pkt->ts);
+    sqlite3_busy_timeout(h->db, DB_BUSY_TIMEOUT_MS);
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+    rc = db_prepare(h, range_sql, &h->stmt_range);
+    if(rc == SQLITE_OK) rc = db_prepare(h, staged_range_sql, &h->stmt_staged_range);
+    for(int r = 0; r < DB_ROLLUP_COUNT && rc == SQLITE_OK; r++){
+        char sql[512];
+        snprintf(sql, sizeof(sql), rollup_range_sql, rollup_tables[r].name);
+        rc = db_prepare(h, sql, &h->stmt_rollup_range[r]);
+    }
+    if(rc != SQLITE_OK){
+        db_close(h);
+        return rc;
+    }
+
+    *out_db = h;
+    return SQLITE_OK;
 }
 
-int db_insert_measures_batch(sqlite3 *db, sensor_packet_t *packets, size_t count){
-    if(!db || !packets || count == 0) return SQLITE_ERROR;
-    
-    // Begin transaction
-    char *errmsg = NULL;
-    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg);
+// Maintenance-side handle: read-write connection to a database the writer
+// already created, no schema creation or migration and no cached statements.
+// Fails unless the schema is at DB_SCHEMA_VERSION.
+int db_open_maintenance(db_handle_t **out_db, const char *path){
+    if(!out_db || !path) return SQLITE_ERROR;
+
+    db_handle_t *h = calloc(1, sizeof(*h));
+    if(!h) return SQLITE_NOMEM;
+
+    int rc = sqlite3_open_v2(path, &h->db, SQLITE_OPEN_READWRITE, NULL);
     if(rc != SQLITE_OK){
-        log_event("[SQL] Failed to begin transaction: %s", errmsg ? errmsg : "unknown");
-        sqlite3_free(errmsg);
+        LOG_ERROR(SQL, "Failed to open database: %s", sqlite3_errstr(rc));
+        db_close(h);
+        return rc;
+    }
+    sqlite3_busy_timeout(h->db, DB_BUSY_TIMEOUT_MS);
+
+    int version = db_schema_version(h->db);
+    if(version != DB_SCHEMA_VERSION){
+        LOG_WARN(SQL, "%s has schema v%d, expected v%d", path, version, DB_SCHEMA_VERSION);
+        db_close(h);
+        return SQLITE_ERROR;
+    }
+
+    *out_db = h;
+    return SQLITE_OK;
+}
+
+void db_close(db_handle_t *h){
+    if(!h) return;
+
+    // Leave sensor_data complete on a clean shutdown
+    if(h->stmt_fold_read && h->staged > 0 && db_fold_staged(h) != SQLITE_OK){
+        LOG_WARN(SQL, "%zu rows left staged", h->staged);
+    }
+
+    sqlite3_finalize(h->stmt_begin);
+    sqlite3_finalize(h->stmt_commit);
+    sqlite3_finalize(h->stmt_rollback);
+    sqlite3_finalize(h->stmt_health);
+    sqlite3_finalize(h->stmt_range);
+    sqlite3_finalize(h->stmt_newest);
+    sqlite3_finalize(h->stmt_fold_read);
+    sqlite3_finalize(h->stmt_fold_clear);
+    sqlite3_finalize(h->stmt_staged_range);
+    sqlite3_finalize(h->stmt_downsample);
+    for(int r = 0; r < DB_ROLLUP_COUNT; r++){
+        sqlite3_finalize(h->stmt_rollup_upsert[r]);
+        sqlite3_finalize(h->stmt_rollup_range[r]);
+        sqlite3_finalize(h->stmt_rollup_rebuild[r]);
+    }
+    for(size_t i = 0; i <= DB_MULTI_ROW_MAX; i++){
+        sqlite3_finalize(h->insert_rows[i]);
+        sqlite3_finalize(h->insert_staged[i]);
+    }
+
+    if(h->db) sqlite3_close(h->db);
+    free(h->row_state);
+    free(h->fold_buf);
+    free(h);
+}
+
+// A one-row batch, so its rollups go in the same transaction
+int db_insert_measure(db_handle_t *h, sensor_packet_t *pkt){
+    if(!h || !pkt) return SQLITE_ERROR;
+    return db_insert_measures_batch(h, pkt, 1);
+}
+
+// Packets are reordered in place by (id, type, ts)
+int db_insert_measures_batch(db_handle_t *h, sensor_packet_t *packets, size_t count){
+    if(!h || !packets || count == 0) return SQLITE_ERROR;
+
+    // Key order keeps consecutive inserts on the same b-tree leaf
+    qsort(packets, count, sizeof(*packets), db_cmp_key);
+
+    // Live rows are appended to the staging table. Replayed or late rows
+    // are checked against sensor_data, once the staged rows are in it.
+    int stage = h->stage_rows && db_rows_stageable(h, packets, count);
+    int rc;
+    if(!stage && h->staged > 0 && (rc = db_fold_staged(h)) != SQLITE_OK){
         return rc;
     }
     
-    // Prepare statement once
-    static const char *sql = 
-        "INSERT INTO sensor_data(id, type, value, ts) "
-        "VALUES (?1, ?2, ?3, datetime(?4, 'unixepoch'));";
-    
-    sqlite3_stmt *stmt = NULL;
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    // Begin transaction
+    rc = db_step_reset(h->stmt_begin);
     if(rc != SQLITE_OK){
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        LOG_ERROR(SQL, "Failed to begin transaction: %s", sqlite3_errmsg(h->db));
         return rc;
     }
     
-    // Insert all packets
-    size_t success_count = 0;
-    for(size_t i = 0; i < count; i++){
-        sqlite3_bind_int(stmt, 1, packets[i].id);
-        sqlite3_bind_int(stmt, 2, packets[i].type);
-        sqlite3_bind_double(stmt, 3, packets[i].value);
-        sqlite3_bind_int64(stmt, 4, (sqlite3_int64)packets[i].ts);
-
-        rc = sqlite3_step(stmt);
-        if(rc == SQLITE_DONE){
-            success_count++;
-        }
-        
-        sqlite3_reset(stmt);
-        sqlite3_clear_bindings(stmt);
+    rc = stage ? db_write_staged(h, packets, count) : db_write_rows(h, packets, count);
+    if(rc != SQLITE_OK){
+        db_step_reset(h->stmt_rollback);
+        return rc;
     }
     
-    sqlite3_finalize(stmt);
-    
     // Commit transaction
-    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, &errmsg);
+    rc = db_step_reset(h->stmt_commit);
     if(rc != SQLITE_OK){
-        log_event("[SQL] Failed to commit: %s", errmsg ? errmsg : "unknown");
-        sqlite3_free(errmsg);
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        LOG_ERROR(SQL, "Failed to commit: %s", sqlite3_errmsg(h->db));
+        db_step_reset(h->stmt_rollback);
         return rc;
     }
     
+    h->rows_written += count;
+    if(stage) h->staged += count;
+    db_fold_if_due(h);
     return SQLITE_OK;
 }
-int db_health_check(sqlite3 *db){
-    if(!db) return -1;
-    
-    // Test 1: Simple query
-    const char *sql = "SELECT COUNT(*) FROM sensor_data;";
-    sqlite3_stmt *stmt = NULL;
-    
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+
+// Move up to max_rows of the oldest staged rows into sensor_data and the
+// rollups, in one transaction of its own. Sorted by key, a chunk turns the
+// per-sensor leaf updates of many small commits into one pass; staged rows
+// are new by construction, so the rollups count every one of them.
+// Returns rows moved, 0 once nothing is staged, negative on error.
+int db_fold_step(db_handle_t *h, size_t max_rows){
+    if(!h || !h->stmt_fold_read) return -1;
+    if(max_rows == 0 || max_rows > DB_FOLD_CHUNK) max_rows = DB_FOLD_CHUNK;
+    if(!h->fold_buf && (h->fold_buf = malloc(DB_FOLD_CHUNK * sizeof(*h->fold_buf))) == NULL) return -1;
+    if(db_row_state_reset(h, max_rows) != SQLITE_OK) return -1;
+
+    int rc = db_step_reset(h->stmt_begin);
+    if(rc != SQLITE_OK) return -1;
+
+    sqlite3_stmt *stmt = h->stmt_fold_read;
+    sqlite3_int64 last_rowid = 0;
+    size_t n = 0;
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)max_rows);
+    while(n < max_rows && (rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        last_rowid = sqlite3_column_int64(stmt, 0);
+        h->fold_buf[n++] = (sensor_packet_t){
+            .id = sqlite3_column_int(stmt, 1),
+            .type = sqlite3_column_int(stmt, 2),
+            .ts_ms = sqlite3_column_int64(stmt, 3),
+            .value = sqlite3_column_double(stmt, 4)
+        };
+    }
+    sqlite3_reset(stmt);
+    rc = (rc == SQLITE_ROW || rc == SQLITE_DONE) ? SQLITE_OK : rc;
+
+    if(rc == SQLITE_OK && n > 0){
+        qsort(h->fold_buf, n, sizeof(*h->fold_buf), db_cmp_key);
+        for(size_t done = 0; done < n && rc == SQLITE_OK;){
+            size_t rows = (n - done < DB_MULTI_ROW_MAX) ? n - done : DB_MULTI_ROW_MAX;
+            rc = db_insert_rows(h, h->fold_buf + done, rows, 0);
+            done += rows;
+        }
+        if(rc == SQLITE_OK) rc = db_write_rollups(h, h->fold_buf, n);
+        if(rc == SQLITE_OK){
+            sqlite3_bind_int64(h->stmt_fold_clear, 1, last_rowid);
+            rc = db_step_reset(h->stmt_fold_clear);
+        }
+    }
+    if(rc == SQLITE_OK) rc = db_step_reset(h->stmt_commit);
     if(rc != SQLITE_OK){
-        log_event("[SQL] Health check failed: prepare error %s", sqlite3_errstr(rc));
+        LOG_ERROR(SQL, "Failed to fold staged rows: %s", sqlite3_errmsg(h->db));
+        db_step_reset(h->stmt_rollback);
         return -1;
     }
+
+    h->staged = (n > 0 && h->staged > n) ? h->staged - n : 0;
+    return (int)n;
+}
+
+// Move every staged row into sensor_data, a chunk per transaction
+int db_fold_staged(db_handle_t *h){
+    int n;
+    while((n = db_fold_step(h, DB_FOLD_CHUNK)) > 0);
+    return (n == 0) ? SQLITE_OK : SQLITE_ERROR;
+}
+
+// rows = 0 writes sensor_data directly (after folding what is staged)
+void db_set_stage_rows(db_handle_t *h, size_t rows){
+    if(!h) return;
+
+    if(rows == 0 && h->staged > 0 && db_fold_staged(h) != SQLITE_OK){
+        LOG_WARN(SQL, "Folding %zu staged rows failed, staging stays on", h->staged);
+        return;
+    }
+    h->stage_rows = rows;
+}
+
+int db_health_check(db_handle_t *h){
+    if(!h) return -1;
     
-    rc = sqlite3_step(stmt);
+    // Constant-time probe: one row, no table scan
+    int rc = sqlite3_step(h->stmt_health);
     if(rc != SQLITE_ROW){
-        log_event("[SQL] Health check failed: step error %s", sqlite3_errstr(rc));
-        sqlite3_finalize(stmt);
+        LOG_ERROR(SQL, "Health check failed: step error %s", sqlite3_errstr(rc));
+        sqlite3_reset(h->stmt_health);
         return -1;
     }
     
-    int count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    int version = sqlite3_column_int(h->stmt_health, 0);
+    sqlite3_reset(h->stmt_health);
     
-    log_event("[SQL] Health check passed: %d records in database", count);
+    LOG_DEBUG(SQL, "Health check passed: schema v%d, %llu records written", version, h->rows_written);
     return 0;
-}
\ No newline at end of file
+}
+
+// Move up to max_rows v1 rows into the v2 table.
+// Returns rows moved, 0 once migration is complete, negative on error.
+int db_migrate_step(db_handle_t *h, size_t max_rows){
+    if(!h || !h->migrate_pending) return 0;
+    if(max_rows == 0 || max_rows > DB_MIGRATE_CHUNK) max_rows = DB_MIGRATE_CHUNK;
+
+    // v1 stored text datetimes (or epoch seconds) at second resolution.
+    // Rows within one second are spread by rowid so they keep distinct keys.
+    static const char *select_sql =
+        "SELECT rowid, id, type, value, "
+        "COALESCE(CASE WHEN typeof(ts) = 'integer' THEN ts "
+        "ELSE CAST(strftime('%s', ts) AS INTEGER) END, 0) * 1000 + rowid % 1000 "
+        "FROM sensor_data_v1 ORDER BY rowid LIMIT ?1;";
+
+    sensor_packet_t rows[DB_MIGRATE_CHUNK];
+    sqlite3_int64 last_rowid = 0;
+    size_t n = 0;
+
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(h->db, select_sql, -1, &stmt, NULL);
+    if(rc != SQLITE_OK){
+        LOG_ERROR(SQL, "Migration select failed: %s", sqlite3_errmsg(h->db));
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)max_rows);
+    while(n < max_rows && sqlite3_step(stmt) == SQLITE_ROW){
+        last_rowid = sqlite3_column_int64(stmt, 0);
+        rows[n].id = sqlite3_column_int(stmt, 1);
+        rows[n].type = sqlite3_column_int(stmt, 2);
+        rows[n].value = sqlite3_column_double(stmt, 3);
+        rows[n].ts_ms = sqlite3_column_int64(stmt, 4);
+        n++;
+    }
+    sqlite3_finalize(stmt);
+
+    if(n == 0){
+        if(sqlite3_exec(h->db, "DROP TABLE sensor_data_v1;", NULL, NULL, NULL) != SQLITE_OK){
+            LOG_ERROR(SQL, "Failed to drop migrated v1 table: %s", sqlite3_errmsg(h->db));
+            return -1;
+        }
+        h->migrate_pending = 0;
+        LOG_INFO(SQL, "Migration from schema v1 complete");
+        return 0;
+    }
+
+    // Copy and delete in one transaction
+    rc = db_step_reset(h->stmt_begin);
+    if(rc != SQLITE_OK) return -1;
+
+    qsort(rows, n, sizeof(*rows), db_cmp_key);
+    rc = db_write_rows(h, rows, n);
+    if(rc == SQLITE_OK){
+        char sql[96];
+        snprintf(sql, sizeof(sql), "DELETE FROM sensor_data_v1 WHERE rowid <= %lld;", (long long)last_rowid);
+        rc = sqlite3_exec(h->db, sql, NULL, NULL, NULL);
+    }
+    if(rc == SQLITE_OK){
+        rc = db_step_reset(h->stmt_commit);
+    }
+    if(rc != SQLITE_OK){
+        LOG_ERROR(SQL, "Migration step failed: %s", sqlite3_errmsg(h->db));
+        db_step_reset(h->stmt_rollback);
+        return -1;
+    }
+    db_fold_if_due(h);
+
+    return (int)n;
+}
+
+// Rows of one sensor in [from_ms, to_ms], oldest first (index seek on the primary key)
+int db_query_range(db_handle_t *h, int id, int type, int64_t from_ms, int64_t to_ms, db_row_cb cb, void *ctx){
+    if(!h || !cb) return SQLITE_ERROR;
+
+    sqlite3_stmt *stmt = h->stmt_range;
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, type);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)from_ms);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)to_ms);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        sensor_packet_t pkt = {
+            .id = sqlite3_column_int(stmt, 0),
+            .type = sqlite3_column_int(stmt, 1),
+            .ts_ms = sqlite3_column_int64(stmt, 2),
+            .value = sqlite3_column_double(stmt, 3)
+        };
+        if(cb(ctx, &pkt) != 0){
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    sqlite3_reset(stmt);
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+// Helper: next bucket of the staged rows of one sensor, 0 once there are
+// none left. 'row' is the result of the last step, SQLITE_ROW while the
+// statement sits on a row not yet counted.
+static int db_staged_bucket(sqlite3_stmt *stmt, int64_t width, int *row, db_rollup_t *out){
+    if(*row != SQLITE_ROW) return 0;
+
+    int64_t ts = sqlite3_column_int64(stmt, 0);
+    double value = sqlite3_column_double(stmt, 1);
+    out->bucket_ms = ts - ts % width;
+    out->count = 0;
+    out->sum = 0.0;
+    out->min = out->max = value;
+    while(*row == SQLITE_ROW && ts - ts % width == out->bucket_ms){
+        out->count++;
+        out->sum += value;
+        if(value < out->min) out->min = value;
+        if(value > out->max) out->max = value;
+        out->last = value;
+        out->last_ts_ms = ts;
+        if((*row = sqlite3_step(stmt)) == SQLITE_ROW){
+            ts = sqlite3_column_int64(stmt, 0);
+            value = sqlite3_column_double(stmt, 1);
+        }
+    }
+    return 1;
+}
+
+// Rollup buckets of one sensor starting in [from_ms, to_ms], oldest first.
+// Rows still staged are not in the rollup table yet; their buckets are
+// computed here and merged in.
+int db_query_rollup(db_handle_t *h, db_rollup_res_t res, int id, int type, int64_t from_ms, int64_t to_ms, db_rollup_cb cb, void *ctx){
+    if(!h || !cb || res >= DB_ROLLUP_COUNT) return SQLITE_ERROR;
+
+    int64_t width = rollup_tables[res].bucket_ms;
+    sqlite3_stmt *stmt = h->stmt_rollup_range[res];
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, type);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)from_ms);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)to_ms);
+
+    sqlite3_stmt *staged = h->stmt_staged_range;
+    sqlite3_bind_int(staged, 1, id);
+    sqlite3_bind_int(staged, 2, type);
+    sqlite3_bind_int64(staged, 3, (sqlite3_int64)from_ms);
+    sqlite3_bind_int64(staged, 4, (sqlite3_int64)(to_ms - to_ms % width + width - 1));
+
+    int staged_row = sqlite3_step(staged);
+    db_rollup_t s = { .id = id, .type = type };
+    int have_s = db_staged_bucket(staged, width, &staged_row, &s);
+
+    // Both in bucket order: one merge pass
+    int rc = sqlite3_step(stmt);
+    while(rc == SQLITE_ROW || (rc == SQLITE_DONE && have_s)){
+        db_rollup_t out = s;
+        if(rc == SQLITE_ROW && !(have_s && s.bucket_ms < sqlite3_column_int64(stmt, 2))){
+            out = (db_rollup_t){
+                .id = sqlite3_column_int(stmt, 0),
+                .type = sqlite3_column_int(stmt, 1),
+                .bucket_ms = sqlite3_column_int64(stmt, 2),
+                .count = (unsigned long)sqlite3_column_int64(stmt, 3),
+                .sum = sqlite3_column_double(stmt, 4),
+                .min = sqlite3_column_double(stmt, 5),
+                .max = sqlite3_column_double(stmt, 6),
+                .last = sqlite3_column_double(stmt, 7),
+                .last_ts_ms = sqlite3_column_int64(stmt, 8)
+            };
+            if(have_s && s.bucket_ms == out.bucket_ms){
+                out.count += s.count;
+                out.sum += s.sum;
+                if(s.min < out.min) out.min = s.min;
+                if(s.max > out.max) out.max = s.max;
+                if(s.last_ts_ms >= out.last_ts_ms){
+                    out.last = s.last;
+                    out.last_ts_ms = s.last_ts_ms;
+                }
+                have_s = db_staged_bucket(staged, width, &staged_row, &s);
+            }
+            rc = sqlite3_step(stmt);
+        }
+        else{
+            have_s = db_staged_bucket(staged, width, &staged_row, &s);
+            // Staged rows may reach into the buckets around the range
+            if(out.bucket_ms < from_ms || out.bucket_ms > to_ms) continue;
+        }
+        if(cb(ctx, &out) != 0){
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    if(rc == SQLITE_DONE && staged_row != SQLITE_ROW && staged_row != SQLITE_DONE) rc = staged_row;
+    sqlite3_reset(stmt);
+    sqlite3_reset(staged);
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+// Aggregates of one sensor per bucket_ms in [from_ms, to_ms], oldest first.
+// Buckets matching a rollup resolution are read from the rollup table.
+// Computed buckets leave last and last_ts_ms at 0.
+int db_query_downsample(db_handle_t *h, int id, int type, int64_t from_ms, int64_t to_ms, int64_t bucket_ms, db_rollup_cb cb, void *ctx){
+    if(!h || !cb || bucket_ms <= 0) return SQLITE_ERROR;
+
+    for(int r = 0; r < DB_ROLLUP_COUNT; r++){
+        if(bucket_ms == rollup_tables[r].bucket_ms){
+            return db_query_rollup(h, r, id, type, from_ms - from_ms % bucket_ms, to_ms, cb, ctx);
+        }
+    }
+
+    if(!h->stmt_downsample){
+        int rc = db_prepare(h,
+                "SELECT ts - ts % ?5 AS b, COUNT(*), SUM(value), MIN(value), MAX(value) FROM ("
+                "SELECT ts, value FROM sensor_data WHERE id = ?1 AND type = ?2 AND ts BETWEEN ?3 AND ?4 "
+                "UNION ALL SELECT ts, value FROM sensor_data_recent WHERE id = ?1 AND type = ?2 AND ts BETWEEN ?3 AND ?4) "
+                "GROUP BY b ORDER BY b;", &h->stmt_downsample);
+        if(rc != SQLITE_OK) return rc;
+    }
+
+    sqlite3_stmt *stmt = h->stmt_downsample;
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, type);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)from_ms);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)to_ms);
+    sqlite3_bind_int64(stmt, 5, (sqlite3_int64)bucket_ms);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        db_rollup_t r = {
+            .id = id,
+            .type = type,
+            .bucket_ms = sqlite3_column_int64(stmt, 0),
+            .count = (unsigned long)sqlite3_column_int64(stmt, 1),
+            .sum = sqlite3_column_double(stmt, 2),
+            .min = sqlite3_column_double(stmt, 3),
+            .max = sqlite3_column_double(stmt, 4)
+        };
+        if(cb(ctx, &r) != 0){
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    sqlite3_reset(stmt);
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+/* ===========================
+ *   Maintenance
+ * =========================== */
+
+// pages = 0 leaves checkpointing entirely to db_wal_checkpoint.
+// The WAL file is truncated back to limit_bytes after each checkpoint reset.
+void db_set_autocheckpoint(db_handle_t *h, int pages, int64_t limit_bytes){
+    if(!h) return;
+
+    char sql[64];
+    sqlite3_wal_autocheckpoint(h->db, pages);
+    snprintf(sql, sizeof(sql), "PRAGMA journal_size_limit=%lld;", (long long)limit_bytes);
+    sqlite3_exec(h->db, sql, NULL, NULL, NULL);
+}
+
+// Passive checkpoint: copies what it can without waiting on the writer
+int db_wal_checkpoint(db_handle_t *h, int *wal_frames, int *copied_frames){
+    if(!h) return SQLITE_ERROR;
+
+    int rc = sqlite3_wal_checkpoint_v2(h->db, NULL, SQLITE_CHECKPOINT_PASSIVE, wal_frames, copied_frames);
+    if(rc != SQLITE_OK && rc != SQLITE_BUSY){
+        LOG_ERROR(SQL, "WAL checkpoint failed: %s", sqlite3_errmsg(h->db));
+    }
+    return rc;
+}
+
+// Sensors that have rollups, i.e. that ever had data. Returns count filled.
+int db_list_sensors(db_handle_t *h, uint8_t *ids, uint8_t *types, size_t max){
+    if(!h || max == 0) return 0;
+
+    sqlite3_stmt *stmt = NULL;
+    if(sqlite3_prepare_v2(h->db, "SELECT DISTINCT id, type FROM sensor_rollup_1h ORDER BY id, type;", -1, &stmt, NULL) != SQLITE_OK){
+        return -1;
+    }
+
+    size_t n = 0;
+    while(n < max && sqlite3_step(stmt) == SQLITE_ROW){
+        ids[n] = sqlite3_column_int(stmt, 0);
+        types[n] = sqlite3_column_int(stmt, 1);
+        n++;
+    }
+    sqlite3_finalize(stmt);
+    return (int)n;
+}
+
+// Delete up to max_rows raw rows of one sensor older than cutoff_ms, oldest
+// first, in a short transaction of its own. Expired rows still staged go
+// first, so a later fold cannot bring them back. Once the sensor has no
+// more old rows its expired 1-minute rollups go too; hourly rollups are
+// kept. Returns rows deleted, negative on error.
+int db_retention_delete(db_handle_t *h, int id, int type, int64_t cutoff_ms, size_t max_rows){
+    if(!h) return -1;
+
+    // Maintenance-only statements, prepared per call
+    static const char *delete_sql =
+        "DELETE FROM sensor_data WHERE id = ?1 AND type = ?2 AND ts IN "
+        "(SELECT ts FROM sensor_data WHERE id = ?1 AND type = ?2 AND ts < ?3 ORDER BY ts LIMIT ?4);";
+    static const char *delete_rollup_sql =
+        "DELETE FROM sensor_rollup_1m WHERE id = ?1 AND type = ?2 AND bucket < ?3 - 60000;";
+    // The staging table only holds the rows of a few commits
+    static const char *delete_staged_sql =
+        "DELETE FROM sensor_data_recent WHERE ts < ?3 AND id = ?1 AND type = ?2;";
+
+    sqlite3_stmt *stmt = NULL;
+    int staged = 0;
+    int rc = sqlite3_prepare_v2(h->db, delete_staged_sql, -1, &stmt, NULL);
+    if(rc == SQLITE_OK){
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int(stmt, 2, type);
+        sqlite3_bind_int64(stmt, 3, (sqlite3_int64)cutoff_ms);
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    if(rc != SQLITE_DONE){
+        LOG_ERROR(SQL, "Retention delete of staged rows failed: %s", sqlite3_errmsg(h->db));
+        return -1;
+    }
+    staged = sqlite3_changes(h->db);
+
+    rc = sqlite3_prepare_v2(h->db, delete_sql, -1, &stmt, NULL);
+    if(rc != SQLITE_OK){
+        LOG_ERROR(SQL, "Retention prepare failed: %s", sqlite3_errmsg(h->db));
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, type);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)cutoff_ms);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)max_rows);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE){
+        LOG_ERROR(SQL, "Retention delete failed: %s", sqlite3_errmsg(h->db));
+        return -1;
+    }
+
+    int deleted = sqlite3_changes(h->db);
+    if((size_t)deleted < max_rows){
+        if(sqlite3_prepare_v2(h->db, delete_rollup_sql, -1, &stmt, NULL) == SQLITE_OK){
+            sqlite3_bind_int(stmt, 1, id);
+            sqlite3_bind_int(stmt, 2, type);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)cutoff_ms);
+            sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+        }
+    }
+    return deleted + staged;
+}
+
+// Helper: single-integer PRAGMA
+static int64_t db_pragma_int(sqlite3 *db, const char *sql){
+    sqlite3_stmt *stmt = NULL;
+    int64_t v = -1;
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK){
+        if(sqlite3_step(stmt) == SQLITE_ROW) v = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return v;
+}
+
+// Return up to max_pages free pages to the filesystem.
+// Returns bytes reclaimed (0 when the freelist is empty or auto_vacuum is
+// not incremental), negative on error.
+int64_t db_incremental_vacuum(db_handle_t *h, int max_pages){
+    if(!h) return -1;
+    if(db_pragma_int(h->db, "PRAGMA auto_vacuum;") != 2) return 0;
+
+    int64_t page_size = db_pragma_int(h->db, "PRAGMA page_size;");
+    int64_t before = db_pragma_int(h->db, "PRAGMA page_count;");
+
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d);", max_pages);
+    sqlite3_stmt *stmt = NULL;
+    if(sqlite3_prepare_v2(h->db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){}
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE){
+        LOG_ERROR(SQL, "Incremental vacuum failed: %s", sqlite3_errmsg(h->db));
+        return -1;
+    }
+
+    int64_t after = db_pragma_int(h->db, "PRAGMA page_count;");
+    return (before > after) ? (before - after) * page_size : 0;
+}
+
+// Pages on the freelist (reusable, not yet returned to the filesystem)
+int64_t db_freelist_bytes(db_handle_t *h){
+    if(!h) return -1;
+    return db_pragma_int(h->db, "PRAGMA freelist_count;") * db_pragma_int(h->db, "PRAGMA page_size;");
+}
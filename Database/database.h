@@ -3,11 +3,113 @@
 
 #include "main.h"
 
+// Rows per multi-row INSERT statement (4 bound parameters per row)
+#define DB_MULTI_ROW_MAX 64
+
+// Current on-disk schema (see db_schema_upgrade)
+#define DB_SCHEMA_VERSION 5
+
+// Live rows are appended to sensor_data_recent and folded into sensor_data
+// DB_FOLD_CHUNK at a time while the writer is idle. A writer that gets no
+// idle time folds once this many are staged; 0 = write sensor_data
+// directly (see db_set_stage_rows)
+#define DB_STAGE_ROWS_DEFAULT 8192
+#define DB_FOLD_CHUNK 4096
+
+// Rows copied per online migration step
+#define DB_MIGRATE_CHUNK 500
+
+// How long a connection waits on another's write lock
+#define DB_BUSY_TIMEOUT_MS 5000
+
+// Aggregate resolutions kept in rollup tables
+typedef enum{
+    DB_ROLLUP_MINUTE = 0,
+    DB_ROLLUP_HOUR,
+    DB_ROLLUP_COUNT
+} db_rollup_res_t;
+
+// One rollup bucket of one sensor
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    int64_t bucket_ms;      // bucket start, epoch milliseconds
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+    double last;
+    int64_t last_ts_ms;
+} db_rollup_t;
+
+// Sensors whose newest stored timestamp is cached per handle
+#define DB_NEWEST_SLOTS 1024
+
+// Newest timestamp stored for one sensor; rows above it are new
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    uint8_t used;
+    int64_t ts_ms;          // INT64_MIN: no rows
+} db_newest_t;
+
+// Database handle: owns the connection and its prepared statements
+typedef struct{
+    sqlite3 *db;
+    sqlite3_stmt *stmt_begin;
+    sqlite3_stmt *stmt_commit;
+    sqlite3_stmt *stmt_rollback;
+    sqlite3_stmt *stmt_health;
+    sqlite3_stmt *stmt_range;
+    sqlite3_stmt *stmt_rollup_upsert[DB_ROLLUP_COUNT];
+    sqlite3_stmt *stmt_rollup_range[DB_ROLLUP_COUNT];
+    sqlite3_stmt *stmt_newest;
+    sqlite3_stmt *stmt_fold_read;
+    sqlite3_stmt *stmt_fold_clear;
+    sqlite3_stmt *stmt_staged_range;
+    sqlite3_stmt *stmt_downsample;          // prepared on first use
+    sqlite3_stmt *stmt_rollup_rebuild[DB_ROLLUP_COUNT];     // prepared on first use
+    // insert_rows[n] inserts n rows at once into sensor_data, insert_staged[n]
+    // into sensor_data_recent, prepared on first use
+    sqlite3_stmt *insert_rows[DB_MULTI_ROW_MAX + 1];
+    sqlite3_stmt *insert_staged[DB_MULTI_ROW_MAX + 1];
+    size_t stage_rows;            // fold without waiting for idle time, 0 = no staging
+    size_t staged;                // rows in sensor_data_recent
+    sensor_packet_t *fold_buf;    // DB_FOLD_CHUNK rows, allocated on the first fold
+    int migrate_pending;          // v1 rows still waiting in sensor_data_v1
+    // Rows already stored are kept out of the rollups (db_classify_rows)
+    db_newest_t newest[DB_NEWEST_SLOTS];
+    uint8_t *row_state;
+    size_t row_state_cap;
+    unsigned long long rows_written;
+} db_handle_t;
+
+// Range query callback, return non-zero to stop
+typedef int (*db_row_cb)(void *ctx, const sensor_packet_t *pkt);
+typedef int (*db_rollup_cb)(void *ctx, const db_rollup_t *r);
+
 extern sbuffer_t sbuffer;
 
-int db_init_and_open(sqlite3 **out_db);
-int db_insert_measure(sqlite3 *db, sensor_packet_t *pkt);
-int db_insert_measures_batch(sqlite3 *db, sensor_packet_t *packets, size_t count);
-int db_health_check(sqlite3 *db);
+int db_init_and_open(db_handle_t **out_db, const char *path);
+int db_open_readonly(db_handle_t **out_db, const char *path);
+int db_open_maintenance(db_handle_t **out_db, const char *path);
+void db_close(db_handle_t *h);
+int db_insert_measure(db_handle_t *h, sensor_packet_t *pkt);
+int db_insert_measures_batch(db_handle_t *h, sensor_packet_t *packets, size_t count);
+int db_health_check(db_handle_t *h);
+int db_migrate_step(db_handle_t *h, size_t max_rows);
+int db_query_range(db_handle_t *h, int id, int type, int64_t from_ms, int64_t to_ms, db_row_cb cb, void *ctx);
+int db_query_rollup(db_handle_t *h, db_rollup_res_t res, int id, int type, int64_t from_ms, int64_t to_ms, db_rollup_cb cb, void *ctx);
+int db_query_downsample(db_handle_t *h, int id, int type, int64_t from_ms, int64_t to_ms, int64_t bucket_ms, db_rollup_cb cb, void *ctx);
+
+void db_set_stage_rows(db_handle_t *h, size_t rows);
+int db_fold_step(db_handle_t *h, size_t max_rows);
+int db_fold_staged(db_handle_t *h);
+void db_set_autocheckpoint(db_handle_t *h, int pages, int64_t limit_bytes);
+int db_wal_checkpoint(db_handle_t *h, int *wal_frames, int *copied_frames);
+int db_list_sensors(db_handle_t *h, uint8_t *ids, uint8_t *types, size_t max);
+int db_retention_delete(db_handle_t *h, int id, int type, int64_t cutoff_ms, size_t max_rows);
+int64_t db_incremental_vacuum(db_handle_t *h, int max_pages);
+int64_t db_freelist_bytes(db_handle_t *h);
 
-#endif
\ No newline at end of file
+#endif
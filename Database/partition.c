@@ -0,0 +1,282 @@
+#include "partition.h"
+#include "logger.h"
+#include "utilities.h"
+#include <dirent.h>
+
+// Partitions in use by this process, shared by the writer, the query
+// workers and maintenance
+typedef struct{
+    int64_t start_ms;
+    int refs;                   // open handles
+    int evict;                  // retention asked the holders to close it
+    int dropping;               // files being removed, acquire waits
+    int64_t last_write_ms;      // monotonic, 0 if never written
+} partition_use_t;
+
+static struct{
+    partition_use_t use[PARTITION_USE_MAX];
+    size_t count;
+    unsigned long generation;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} reg = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+int64_t partition_span_ms(const char *span){
+    if(strcmp(span, "day") == 0) return 86400LL * 1000;
+    if(strcmp(span, "hour") == 0) return 3600LL * 1000;
+    return 0;
+}
+
+int64_t partition_start(int64_t ts_ms, int64_t span_ms){
+    int64_t r = ts_ms % span_ms;
+    return (r < 0) ? ts_ms - r - span_ms : ts_ms - r;
+}
+
+void partition_path(char *out, size_t len, const char *dir, const char *prefix, const char *suffix,
+                    int64_t start_ms, int64_t span_ms){
+    time_t t = (time_t)(start_ms / 1000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    char stamp[16];
+    strftime(stamp, sizeof(stamp), (span_ms < 86400LL * 1000) ? "%Y%m%d%H" : "%Y%m%d", &tm);
+    snprintf(out, len, "%s/%s_%s%s", dir, prefix, stamp, suffix);
+}
+
+// Helper: partition start from a directory entry name, -1 if it is not one
+static int parse_name(const char *name, const char *prefix, const char *suffix, int64_t span_ms, int64_t *start_ms){
+    size_t plen = strlen(prefix), slen = strlen(suffix), nlen = strlen(name);
+    size_t digits = (span_ms < 86400LL * 1000) ? 10 : 8;
+    if(nlen != plen + 1 + digits + slen) return -1;
+    if(strncmp(name, prefix, plen) != 0 || name[plen] != '_' || strcmp(name + nlen - slen, suffix) != 0) return -1;
+
+    struct tm tm = {0};
+    const char *d = name + plen + 1;
+    for(size_t i = 0; i < digits; i++){
+        if(d[i] < '0' || d[i] > '9') return -1;
+    }
+    tm.tm_year = (d[0] - '0') * 1000 + (d[1] - '0') * 100 + (d[2] - '0') * 10 + (d[3] - '0') - 1900;
+    tm.tm_mon = (d[4] - '0') * 10 + (d[5] - '0') - 1;
+    tm.tm_mday = (d[6] - '0') * 10 + (d[7] - '0');
+    if(digits == 10) tm.tm_hour = (d[8] - '0') * 10 + (d[9] - '0');
+
+    *start_ms = (int64_t)timegm(&tm) * 1000;
+    return 0;
+}
+
+// Helper: bytes used by a partition (file plus WAL, or directory contents)
+static uint64_t partition_bytes(const char *path){
+    struct stat st;
+    if(stat(path, &st) != 0) return 0;
+    if(!S_ISDIR(st.st_mode)){
+        uint64_t total = st.st_size;
+        char wal[PARTITION_PATH_MAX + 8];
+        snprintf(wal, sizeof(wal), "%s-wal", path);
+        if(stat(wal, &st) == 0) total += st.st_size;
+        return total;
+    }
+
+    uint64_t total = 0;
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while(d && (de = readdir(d)) != NULL){
+        char entry[PARTITION_PATH_MAX + 260];
+        snprintf(entry, sizeof(entry), "%s/%s", path, de->d_name);
+        if(de->d_name[0] != '.' && stat(entry, &st) == 0) total += st.st_size;
+    }
+    if(d) closedir(d);
+    return total;
+}
+
+static int cmp_partition(const void *a, const void *b){
+    const partition_info_t *x = a, *y = b;
+    return (x->start_ms > y->start_ms) - (x->start_ms < y->start_ms);
+}
+
+int partition_list(const char *dir, const char *prefix, const char *suffix, int64_t span_ms,
+                   int64_t from_ms, int64_t to_ms, partition_info_t *out, size_t max){
+    DIR *d = opendir(dir);
+    if(!d) return 0;
+
+    size_t n = 0;
+    struct dirent *de;
+    while((de = readdir(d)) != NULL && n < max){
+        int64_t start;
+        if(parse_name(de->d_name, prefix, suffix, span_ms, &start) != 0) continue;
+        if(start > to_ms || start + span_ms <= from_ms) continue;
+
+        char path[PARTITION_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        out[n].start_ms = start;
+        out[n].bytes = partition_bytes(path);
+        n++;
+    }
+    closedir(d);
+
+    qsort(out, n, sizeof(*out), cmp_partition);
+    return (int)n;
+}
+
+/* ===========================
+ *   Open partition registry
+ * =========================== */
+
+// Helper: entry of a partition, created if asked; caller holds the mutex.
+// Entries nobody holds and nobody wrote lately are recycled.
+static partition_use_t *use_find(int64_t start_ms, int create){
+    for(size_t i = 0; i < reg.count; i++){
+        if(reg.use[i].start_ms == start_ms) return &reg.use[i];
+    }
+    if(!create) return NULL;
+
+    if(reg.count == PARTITION_USE_MAX){
+        int64_t now = time_mono_ms();
+        size_t kept = 0;
+        for(size_t i = 0; i < reg.count; i++){
+            partition_use_t *u = &reg.use[i];
+            if(u->refs > 0 || u->dropping || (u->last_write_ms && now - u->last_write_ms < PARTITION_IDLE_MS)){
+                reg.use[kept++] = *u;
+            }
+        }
+        reg.count = kept;
+        if(reg.count == PARTITION_USE_MAX) return NULL;
+    }
+    partition_use_t *u = &reg.use[reg.count++];
+    memset(u, 0, sizeof(*u));
+    u->start_ms = start_ms;
+    return u;
+}
+
+int partition_acquire(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    partition_use_t *u;
+    while((u = use_find(start_ms, 1)) != NULL && u->dropping){
+        pthread_cond_wait(&reg.cond, &reg.mutex);
+    }
+    if(u) u->refs++;
+    pthread_mutex_unlock(&reg.mutex);
+    if(!u) LOG_ERROR(PARTITION, "More than %d partitions in use", PARTITION_USE_MAX);
+    return u ? 0 : -1;
+}
+
+void partition_release(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    partition_use_t *u = use_find(start_ms, 0);
+    if(u && u->refs > 0 && --u->refs == 0) u->evict = 0;
+    pthread_mutex_unlock(&reg.mutex);
+}
+
+void partition_touch(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    partition_use_t *u = use_find(start_ms, 1);
+    if(u) u->last_write_ms = time_mono_ms();
+    pthread_mutex_unlock(&reg.mutex);
+}
+
+int partition_evict_requested(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    partition_use_t *u = use_find(start_ms, 0);
+    int evict = u && u->evict;
+    pthread_mutex_unlock(&reg.mutex);
+    return evict;
+}
+
+unsigned long partition_generation(void){
+    pthread_mutex_lock(&reg.mutex);
+    unsigned long g = reg.generation;
+    pthread_mutex_unlock(&reg.mutex);
+    return g;
+}
+
+// Helper: claim a partition for removal, 0 if it is free to go
+static int use_begin_drop(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    int rc = -1;
+    partition_use_t *u = use_find(start_ms, 1);
+    if(u && u->refs > 0){
+        u->evict = 1;
+    }
+    else if(u && !(u->last_write_ms && time_mono_ms() - u->last_write_ms < PARTITION_IDLE_MS)){
+        u->dropping = 1;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&reg.mutex);
+    return rc;
+}
+
+static void use_end_drop(int64_t start_ms){
+    pthread_mutex_lock(&reg.mutex);
+    partition_use_t *u = use_find(start_ms, 0);
+    if(u) *u = reg.use[--reg.count];
+    reg.generation++;
+    pthread_cond_broadcast(&reg.cond);
+    pthread_mutex_unlock(&reg.mutex);
+}
+
+/* ===========================
+ *   Removal
+ * =========================== */
+
+// Helper: delete one partition file with its SQLite side files, or a directory
+static int partition_remove(const char *path){
+    struct stat st;
+    if(stat(path, &st) != 0) return -1;
+
+    if(S_ISDIR(st.st_mode)){
+        DIR *d = opendir(path);
+        struct dirent *de;
+        while(d && (de = readdir(d)) != NULL){
+            if(de->d_name[0] == '.') continue;
+            char entry[PARTITION_PATH_MAX + 260];
+            snprintf(entry, sizeof(entry), "%s/%s", path, de->d_name);
+            unlink(entry);
+        }
+        if(d) closedir(d);
+        return rmdir(path);
+    }
+
+    static const char *side[] = { "-wal", "-shm", "-journal" };
+    for(size_t i = 0; i < sizeof(side) / sizeof(side[0]); i++){
+        char extra[PARTITION_PATH_MAX + 16];
+        snprintf(extra, sizeof(extra), "%s%s", path, side[i]);
+        unlink(extra);
+    }
+    return unlink(path);
+}
+
+int partition_drop_before(const char *dir, const char *prefix, const char *suffix, int64_t span_ms,
+                          int64_t cutoff_ms, uint64_t *bytes_freed){
+    *bytes_freed = 0;
+    partition_info_t *parts = malloc(PARTITION_MAX * sizeof(*parts));
+    if(!parts) return -1;
+    int n = partition_list(dir, prefix, suffix, span_ms, INT64_MIN / 2, cutoff_ms, parts, PARTITION_MAX);
+
+    int dropped = 0, busy = 0;
+    for(int i = 0; i < n; i++){
+        if(parts[i].start_ms + span_ms > cutoff_ms) continue;
+
+        // Open or lately written partitions wait for a later pass
+        if(use_begin_drop(parts[i].start_ms) != 0){
+            busy++;
+            continue;
+        }
+        char path[PARTITION_PATH_MAX];
+        partition_path(path, sizeof(path), dir, prefix, suffix, parts[i].start_ms, span_ms);
+        if(partition_remove(path) == 0){
+            dropped++;
+            *bytes_freed += parts[i].bytes;
+        }
+        else{
+            LOG_ERROR(PARTITION, "Unable to remove %s: %s", path, strerror(errno));
+        }
+        use_end_drop(parts[i].start_ms);
+    }
+    if(busy > 0){
+        LOG_INFO(PARTITION, "%d expired partitions still open or recently written, kept for now", busy);
+    }
+    free(parts);
+    return dropped;
+}
@@ -0,0 +1,48 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "main.h"
+
+// Time partitions: one store per UTC day or hour, named
+// <prefix>_<YYYYMMDD>[HH]<suffix> inside one directory. A partition is a
+// file (SQLite, plus its -wal/-shm) or a directory (native store), and
+// retention removes whole partitions.
+
+#define PARTITION_DIR "../Database/parts"
+#define PARTITION_MAX 4096          // partitions listed at once
+#define PARTITION_OPEN_MAX 4        // partitions the writer keeps open
+#define PARTITION_PATH_MAX 300
+#define PARTITION_USE_MAX 256           // partitions tracked as open or recently written
+#define PARTITION_IDLE_MS (5 * 60 * 1000)   // retention keeps partitions written more recently
+
+typedef struct{
+    int64_t start_ms;
+    uint64_t bytes;
+} partition_info_t;
+
+// "day" or "hour" to a span in milliseconds, 0 for anything else
+int64_t partition_span_ms(const char *span);
+int64_t partition_start(int64_t ts_ms, int64_t span_ms);
+void partition_path(char *out, size_t len, const char *dir, const char *prefix, const char *suffix,
+                    int64_t start_ms, int64_t span_ms);
+// Partitions overlapping [from_ms, to_ms], oldest first; returns the count
+int partition_list(const char *dir, const char *prefix, const char *suffix, int64_t span_ms,
+                   int64_t from_ms, int64_t to_ms, partition_info_t *out, size_t max);
+// Handles on a partition pin it for as long as they stay open, so
+// retention never unlinks files under them. acquire waits while the
+// partition is being removed; 0 on success, -1 if the table is full.
+int partition_acquire(int64_t start_ms);
+void partition_release(int64_t start_ms);
+// The writer notes every write; retention skips recently written partitions
+void partition_touch(int64_t start_ms);
+// Retention wants this pinned partition closed; holders check before use
+int partition_evict_requested(int64_t start_ms);
+// Bumped after every removal, so cached handles can be dropped
+unsigned long partition_generation(void);
+
+// Remove partitions that end at or before cutoff_ms and are neither pinned
+// nor recently written; pinned ones are asked to close. Returns the count
+int partition_drop_before(const char *dir, const char *prefix, const char *suffix, int64_t span_ms,
+                          int64_t cutoff_ms, uint64_t *bytes_freed);
+
+#endif
@@ -0,0 +1,571 @@
+#include "storage_backend.h"
+#include "database.h"
+#include "tsdb.h"
+#include "applog.h"
+#include "partition.h"
+#include "logger.h"
+#include "utilities.h"
+#include "config.h"
+
+/* ===========================
+ *   SQLite
+ * =========================== */
+
+typedef struct{
+    db_handle_t *db;
+    char path[256];
+} sqlite_backend_t;
+
+static int sqlite_open(void **ctx, const char *path){
+    sqlite_backend_t *b = calloc(1, sizeof(*b));
+    if(!b) return -1;
+
+    if(db_init_and_open(&b->db, path) != SQLITE_OK){
+        free(b);
+        return -1;
+    }
+    // Checkpoints run on the maintenance thread instead of inside COMMIT
+    if(g_config.maint_checkpoint_s > 0){
+        db_set_autocheckpoint(b->db, 0, (int64_t)g_config.maint_wal_max_kb * 1024);
+    }
+    db_set_stage_rows(b->db, (size_t)g_config.db_stage_rows);
+    snprintf(b->path, sizeof(b->path), "%s", path);
+    *ctx = b;
+    return 0;
+}
+
+// Falls back to row-by-row inserts so one bad row cannot sink the batch
+static int sqlite_write_batch(void *ctx, sensor_packet_t *packets, size_t count){
+    sqlite_backend_t *b = ctx;
+    if(db_insert_measures_batch(b->db, packets, count) == SQLITE_OK){
+        return 0;
+    }
+
+    LOG_WARN(SQL, "Batch insert failed. Inserting individually...");
+    size_t success = 0;
+    for(size_t i = 0; i < count; i++){
+        if(db_insert_measure(b->db, &packets[i]) == SQLITE_OK){
+            success++;
+        }
+    }
+    if(success > 0){
+        LOG_INFO(SQL, "Individual insert: %zu/%zu successful", success, count);
+    }
+    return (success == count) ? 0 : -1;
+}
+
+static int sqlite_health(void *ctx){
+    sqlite_backend_t *b = ctx;
+    return db_health_check(b->db);
+}
+
+// Online schema migration, then folding of staged rows, one chunk per call
+static int sqlite_idle(void *ctx){
+    sqlite_backend_t *b = ctx;
+    if(b->db->migrate_pending){
+        return (db_migrate_step(b->db, DB_MIGRATE_CHUNK) < 0) ? -1 : 1;
+    }
+    if(b->db->staged < DB_FOLD_CHUNK) return 0;
+    return (db_fold_step(b->db, DB_FOLD_CHUNK) < 0) ? -1 : 1;
+}
+
+static void sqlite_close(void *ctx){
+    sqlite_backend_t *b = ctx;
+    db_close(b->db);
+    free(b);
+}
+
+static void sqlite_stats(void *ctx, storage_stats_t *out){
+    sqlite_backend_t *b = ctx;
+    char wal[300];
+    struct stat st;
+
+    out->disk_bytes = 0;
+    if(stat(b->path, &st) == 0) out->disk_bytes += st.st_size;
+    snprintf(wal, sizeof(wal), "%s-wal", b->path);
+    if(stat(wal, &st) == 0) out->disk_bytes += st.st_size;
+}
+
+static const storage_backend_ops_t sqlite_ops = {
+    .name = "sqlite",
+    .default_path = DB_FILE,
+    .partition_suffix = ".db",
+    .open = sqlite_open,
+    .write_batch = sqlite_write_batch,
+    .flush = NULL,
+    .health = sqlite_health,
+    .idle = sqlite_idle,
+    .close = sqlite_close,
+    .stats = sqlite_stats,
+};
+
+/* ===========================
+ *   Native time-series store
+ * =========================== */
+
+static int tsdb_backend_open(void **ctx, const char *path){
+    return tsdb_open((tsdb_t **)ctx, path);
+}
+
+static int tsdb_backend_write(void *ctx, sensor_packet_t *packets, size_t count){
+    return tsdb_write_batch(ctx, packets, count);
+}
+
+static int tsdb_backend_flush(void *ctx){
+    return tsdb_flush(ctx);
+}
+
+static int tsdb_backend_health(void *ctx){
+    return tsdb_health_check(ctx);
+}
+
+static void tsdb_backend_close(void *ctx){
+    tsdb_close(ctx);
+}
+
+static void tsdb_backend_stats(void *ctx, storage_stats_t *out){
+    out->disk_bytes = tsdb_disk_bytes(ctx);
+}
+
+static const storage_backend_ops_t tsdb_ops = {
+    .name = "tsdb",
+    .default_path = TSDB_DIR,
+    .partition_suffix = "",
+    .open = tsdb_backend_open,
+    .write_batch = tsdb_backend_write,
+    .flush = tsdb_backend_flush,
+    .health = tsdb_backend_health,
+    .idle = NULL,
+    .close = tsdb_backend_close,
+    .stats = tsdb_backend_stats,
+};
+
+/* ===========================
+ *   Binary append-log
+ * =========================== */
+
+static int log_backend_open(void **ctx, const char *path){
+    return applog_open((applog_t **)ctx, path);
+}
+
+static int log_backend_write(void *ctx, sensor_packet_t *packets, size_t count){
+    return applog_write_batch(ctx, packets, count);
+}
+
+static int log_backend_flush(void *ctx){
+    return applog_flush(ctx);
+}
+
+static int log_backend_health(void *ctx){
+    LOG_INFO(APPLOG, "Health check passed: %llu records on disk", (unsigned long long)applog_rows(ctx));
+    return 0;
+}
+
+static void log_backend_close(void *ctx){
+    applog_close(ctx);
+}
+
+static void log_backend_stats(void *ctx, storage_stats_t *out){
+    out->disk_bytes = applog_disk_bytes(ctx);
+}
+
+static const storage_backend_ops_t log_ops = {
+    .name = "log",
+    .default_path = APPLOG_FILE,
+    .open = log_backend_open,
+    .write_batch = log_backend_write,
+    .flush = log_backend_flush,
+    .health = log_backend_health,
+    .idle = NULL,
+    .close = log_backend_close,
+    .stats = log_backend_stats,
+};
+
+/* ===========================
+ *   Null sink (pipeline benchmarking)
+ * =========================== */
+
+static int null_open(void **ctx, const char *path){
+    (void)path;
+    *ctx = NULL;
+    return 0;
+}
+
+static int null_write(void *ctx, sensor_packet_t *packets, size_t count){
+    (void)ctx;
+    (void)packets;
+    (void)count;
+    return 0;
+}
+
+static int null_health(void *ctx){
+    (void)ctx;
+    return 0;
+}
+
+static void null_close(void *ctx){
+    (void)ctx;
+}
+
+static const storage_backend_ops_t null_ops = {
+    .name = "null",
+    .default_path = "",
+    .open = null_open,
+    .write_batch = null_write,
+    .flush = NULL,
+    .health = null_health,
+    .idle = NULL,
+    .close = null_close,
+    .stats = NULL,
+};
+
+/* ===========================
+ *   Time partitions
+ * =========================== */
+
+// Wraps the configured backend: each packet goes to the partition of its
+// timestamp, the last few partitions stay open
+typedef struct{
+    int64_t start_ms;
+    void *ctx;
+    unsigned long long last_use;
+} part_slot_t;
+
+typedef struct{
+    const storage_backend_ops_t *inner;
+    char dir[256];
+    int64_t span_ms;
+    part_slot_t slots[PARTITION_OPEN_MAX];
+    size_t num_open;
+    unsigned long long tick;
+    int64_t newest_ms;
+} part_backend_t;
+
+static int part_open(void **ctx, const char *path){
+    part_backend_t *p = calloc(1, sizeof(*p));
+    if(!p) return -1;
+    p->inner = storage_backend_find(g_config.storage_backend);
+    p->span_ms = partition_span_ms(g_config.partition_span);
+    p->newest_ms = INT64_MIN;
+    snprintf(p->dir, sizeof(p->dir), "%s", path);
+
+    if(mkdir(p->dir, 0755) != 0 && errno != EEXIST){
+        LOG_ERROR(STORAGE, "Cannot create partition directory %s: %s", p->dir, strerror(errno));
+        free(p);
+        return -1;
+    }
+    *ctx = p;
+    return 0;
+}
+
+static void part_close_slot(part_backend_t *p, part_slot_t *slot){
+    if(p->inner->flush) p->inner->flush(slot->ctx);
+    p->inner->close(slot->ctx);
+    partition_release(slot->start_ms);
+    *slot = p->slots[--p->num_open];
+}
+
+// Helper: close the partitions retention is waiting for
+static void part_close_evicted(part_backend_t *p){
+    for(size_t i = p->num_open; i-- > 0;){
+        if(partition_evict_requested(p->slots[i].start_ms)) part_close_slot(p, &p->slots[i]);
+    }
+}
+
+// Helper: open partition holding start_ms, closing the least recently used one if needed
+static void *part_get(part_backend_t *p, int64_t start_ms){
+    for(size_t i = 0; i < p->num_open; i++){
+        if(p->slots[i].start_ms == start_ms){
+            p->slots[i].last_use = ++p->tick;
+            return p->slots[i].ctx;
+        }
+    }
+
+    if(p->num_open == PARTITION_OPEN_MAX){
+        size_t lru = 0;
+        for(size_t i = 1; i < p->num_open; i++){
+            if(p->slots[i].last_use < p->slots[lru].last_use) lru = i;
+        }
+        part_close_slot(p, &p->slots[lru]);
+    }
+
+    // Pinned before opening, so retention cannot unlink it under the slot
+    if(partition_acquire(start_ms) != 0) return NULL;
+    char path[PARTITION_PATH_MAX];
+    partition_path(path, sizeof(path), p->dir, p->inner->name, p->inner->partition_suffix, start_ms, p->span_ms);
+    void *ctx = NULL;
+    if(p->inner->open(&ctx, path) != 0){
+        LOG_ERROR(STORAGE, "Unable to open partition %s", path);
+        partition_release(start_ms);
+        return NULL;
+    }
+
+    if(start_ms > p->newest_ms){
+        LOG_INFO(STORAGE, "%s partition %s", (p->newest_ms == INT64_MIN) ? "Writing to" : "Rolled over to", path);
+        p->newest_ms = start_ms;
+    }
+    else{
+        LOG_INFO(STORAGE, "Reopened partition %s for late data", path);
+    }
+
+    p->slots[p->num_open++] = (part_slot_t){ start_ms, ctx, ++p->tick };
+    return ctx;
+}
+
+static int cmp_packet_ts(const void *a, const void *b){
+    const sensor_packet_t *x = a, *y = b;
+    return (x->ts_ms > y->ts_ms) - (x->ts_ms < y->ts_ms);
+}
+
+// One write per partition touched by the batch. Partitions commit on
+// their own, so a failure reports the packets of those already written.
+static int part_write(void *ctx, sensor_packet_t *packets, size_t count){
+    part_backend_t *p = ctx;
+    qsort(packets, count, sizeof(*packets), cmp_packet_ts);
+    part_close_evicted(p);
+
+    for(size_t i = 0; i < count;){
+        int64_t start = partition_start(packets[i].ts_ms, p->span_ms);
+        size_t j = i + 1;
+        while(j < count && packets[j].ts_ms < start + p->span_ms) j++;
+
+        partition_touch(start);
+        void *part = part_get(p, start);
+        if(!part || p->inner->write_batch(part, packets + i, j - i) != 0) return (i > 0) ? (int)i : -1;
+        i = j;
+    }
+    return 0;
+}
+
+static int part_flush(void *ctx){
+    part_backend_t *p = ctx;
+    if(!p->inner->flush) return 0;
+
+    int rc = 0;
+    for(size_t i = 0; i < p->num_open; i++){
+        if(p->inner->flush(p->slots[i].ctx) != 0) rc = -1;
+    }
+    return rc;
+}
+
+static int part_health(void *ctx){
+    part_backend_t *p = ctx;
+    for(size_t i = 0; i < p->num_open; i++){
+        if(p->slots[i].start_ms == p->newest_ms) return p->inner->health(p->slots[i].ctx);
+    }
+    return 0;
+}
+
+static int part_idle(void *ctx){
+    part_backend_t *p = ctx;
+    part_close_evicted(p);
+    if(!p->inner->idle) return 0;
+
+    int more = 0;
+    for(size_t i = 0; i < p->num_open; i++){
+        int rc = p->inner->idle(p->slots[i].ctx);
+        if(rc < 0) return rc;
+        if(rc > more) more = rc;
+    }
+    return more;
+}
+
+static void part_close(void *ctx){
+    part_backend_t *p = ctx;
+    while(p->num_open > 0){
+        part_close_slot(p, &p->slots[p->num_open - 1]);
+    }
+    free(p);
+}
+
+static void part_stats(void *ctx, storage_stats_t *out){
+    part_backend_t *p = ctx;
+    partition_info_t *parts = malloc(PARTITION_MAX * sizeof(*parts));
+    if(!parts) return;
+
+    int n = partition_list(p->dir, p->inner->name, p->inner->partition_suffix, p->span_ms,
+                           INT64_MIN / 2, INT64_MAX / 2, parts, PARTITION_MAX);
+    out->disk_bytes = 0;
+    for(int i = 0; i < n; i++) out->disk_bytes += parts[i].bytes;
+    free(parts);
+}
+
+static const storage_backend_ops_t part_ops = {
+    .name = "partitioned",
+    .default_path = PARTITION_DIR,
+    .partition_suffix = NULL,
+    .open = part_open,
+    .write_batch = part_write,
+    .flush = part_flush,
+    .health = part_health,
+    .idle = part_idle,
+    .close = part_close,
+    .stats = part_stats,
+};
+
+int storage_partition_layout(const char **dir, const char **prefix, const char **suffix, int64_t *span_ms){
+    const storage_backend_ops_t *ops = storage_backend_find(g_config.storage_backend);
+    int64_t span = partition_span_ms(g_config.partition_span);
+    if(!ops || !ops->partition_suffix || span == 0) return 0;
+
+    *dir = g_config.storage_path[0] ? g_config.storage_path : PARTITION_DIR;
+    *prefix = ops->name;
+    *suffix = ops->partition_suffix;
+    *span_ms = span;
+    return 1;
+}
+
+/* ===========================
+ *   Registry and timed wrappers
+ * =========================== */
+
+static const storage_backend_ops_t *backends[] = {
+    &sqlite_ops,
+    &tsdb_ops,
+    &log_ops,
+    &null_ops,
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const char *op_names[STORAGE_OP_COUNT] = {
+    "open", "write", "flush", "health", "idle"
+};
+
+const storage_backend_ops_t *storage_backend_find(const char *name){
+    for(size_t i = 0; i < NUM_BACKENDS; i++){
+        if(strcmp(backends[i]->name, name) == 0) return backends[i];
+    }
+    return NULL;
+}
+
+// Helper: account one finished call
+static void op_record(storage_backend_t *sb, storage_op_t op, unsigned long long start, int failed){
+    storage_op_stats_t *s = &sb->stats.op[op];
+    unsigned long long us = time_mono_us() - start;
+
+    s->calls++;
+    s->total_us += us;
+    if(us > s->max_us) s->max_us = us;
+    if(us >= STORAGE_STALL_US) s->stalls++;
+    if(failed) s->errors++;
+}
+
+int storage_backend_open(storage_backend_t **out, const char *name, const char *path){
+    const storage_backend_ops_t *ops = storage_backend_find(name);
+    if(!ops){
+        LOG_WARN(STORAGE, "Unknown storage backend '%s'", name);
+        return -1;
+    }
+    if(strcmp(g_config.partition_span, "none") != 0 && partition_span_ms(g_config.partition_span) == 0){
+        LOG_WARN(STORAGE, "Unknown partition span '%s'", g_config.partition_span);
+        return -1;
+    }
+    if(partition_span_ms(g_config.partition_span) > 0){
+        if(!ops->partition_suffix){
+            LOG_WARN(STORAGE, "Backend '%s' cannot be partitioned, writing one store", name);
+        }
+        else{
+            LOG_INFO(STORAGE, "Partitioning '%s' by %s", name, g_config.partition_span);
+            ops = &part_ops;
+        }
+    }
+
+    storage_backend_t *sb = calloc(1, sizeof(*sb));
+    if(!sb) return -1;
+    sb->ops = ops;
+    snprintf(sb->path, sizeof(sb->path), "%s", (path && *path) ? path : ops->default_path);
+
+    unsigned long long start = time_mono_us();
+    int rc = ops->open(&sb->ctx, sb->path);
+    op_record(sb, STORAGE_OP_OPEN, start, rc != 0);
+    if(rc != 0){
+        free(sb);
+        return -1;
+    }
+    sb->connected = 1;
+
+    LOG_INFO(STORAGE, "Backend '%s' opened (%s)", ops->name, *sb->path ? sb->path : "no path");
+    *out = sb;
+    return 0;
+}
+
+int storage_backend_write(storage_backend_t *sb, sensor_packet_t *packets, size_t count){
+    if(!sb->connected) return -1;
+
+    unsigned long long start = time_mono_us();
+    int rc = sb->ops->write_batch(sb->ctx, packets, count);
+    op_record(sb, STORAGE_OP_WRITE, start, rc != 0);
+    if(rc == 0) sb->stats.rows_written += count;
+    else if(rc > 0) sb->stats.rows_written += rc;
+    return rc;
+}
+
+int storage_backend_flush(storage_backend_t *sb){
+    if(!sb->connected) return -1;
+    if(!sb->ops->flush) return 0;
+
+    unsigned long long start = time_mono_us();
+    int rc = sb->ops->flush(sb->ctx);
+    op_record(sb, STORAGE_OP_FLUSH, start, rc != 0);
+    return rc;
+}
+
+int storage_backend_health(storage_backend_t *sb){
+    if(!sb->connected) return -1;
+
+    unsigned long long start = time_mono_us();
+    int rc = sb->ops->health(sb->ctx);
+    op_record(sb, STORAGE_OP_HEALTH, start, rc != 0);
+    return rc;
+}
+
+int storage_backend_idle(storage_backend_t *sb){
+    if(!sb->connected || !sb->ops->idle) return 0;
+
+    unsigned long long start = time_mono_us();
+    int rc = sb->ops->idle(sb->ctx);
+    op_record(sb, STORAGE_OP_IDLE, start, rc < 0);
+    return rc;
+}
+
+// Drop and re-establish the backend connection, keeping the counters
+int storage_backend_reopen(storage_backend_t *sb){
+    if(sb->connected){
+        sb->ops->close(sb->ctx);
+        sb->ctx = NULL;
+        sb->connected = 0;
+    }
+
+    unsigned long long start = time_mono_us();
+    int rc = sb->ops->open(&sb->ctx, sb->path);
+    op_record(sb, STORAGE_OP_OPEN, start, rc != 0);
+    sb->connected = (rc == 0);
+    return rc;
+}
+
+void storage_backend_close(storage_backend_t *sb){
+    if(!sb) return;
+    if(sb->connected) sb->ops->close(sb->ctx);
+    free(sb);
+}
+
+void storage_backend_stats(storage_backend_t *sb, storage_stats_t *out){
+    *out = sb->stats;
+    out->disk_bytes = 0;
+    if(sb->connected && sb->ops->stats) sb->ops->stats(sb->ctx, out);
+}
+
+void storage_backend_log_stats(storage_backend_t *sb){
+    storage_stats_t st;
+    storage_backend_stats(sb, &st);
+
+    LOG_INFO(STORAGE, "Backend '%s': %llu rows written, %llu bytes on disk",
+              sb->ops->name, st.rows_written, (unsigned long long)st.disk_bytes);
+    for(int i = 0; i < STORAGE_OP_COUNT; i++){
+        const storage_op_stats_t *s = &st.op[i];
+        if(s->calls == 0) continue;
+        LOG_INFO(STORAGE, "  %-6s calls=%llu errors=%llu avg=%lluus max=%lluus stalls=%llu",
+                  op_names[i], s->calls, s->errors, s->total_us / s->calls, s->max_us, s->stalls);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include "main.h"
+
+// Storage backend interface. Each backend fills a storage_backend_ops_t;
+// callers go through storage_backend_*(), which time every call.
+
+typedef enum{
+    STORAGE_OP_OPEN = 0,
+    STORAGE_OP_WRITE,
+    STORAGE_OP_FLUSH,
+    STORAGE_OP_HEALTH,
+    STORAGE_OP_IDLE,
+    STORAGE_OP_COUNT
+} storage_op_t;
+
+// Calls at least this slow count as stalls
+#define STORAGE_STALL_US 100000
+
+// Latency counters of one operation
+typedef struct{
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long total_us;
+    unsigned long long max_us;
+    unsigned long long stalls;
+} storage_op_stats_t;
+
+typedef struct{
+    storage_op_stats_t op[STORAGE_OP_COUNT];
+    unsigned long long rows_written;    // through this handle
+    uint64_t disk_bytes;                // backend footprint, 0 if none
+} storage_stats_t;
+
+typedef struct{
+    const char *name;
+    const char *default_path;
+    // Name suffix of one time partition ("" = directory), NULL if the
+    // backend cannot be partitioned
+    const char *partition_suffix;
+    int (*open)(void **ctx, const char *path);
+    // May reorder packets in place; 0 on success, -1 on failure. A backend
+    // that commits in parts returns how many leading packets it stored
+    // before failing, so only the rest is written again
+    int (*write_batch)(void *ctx, sensor_packet_t *packets, size_t count);
+    // Make written batches durable; NULL if write_batch already is
+    int (*flush)(void *ctx);
+    int (*health)(void *ctx);
+    // Background work while no batch is waiting: >0 more to do, 0 done, <0 error. May be NULL
+    int (*idle)(void *ctx);
+    void (*close)(void *ctx);
+    // Backend specific fields of storage_stats_t. May be NULL
+    void (*stats)(void *ctx, storage_stats_t *out);
+} storage_backend_ops_t;
+
+typedef struct{
+    const storage_backend_ops_t *ops;
+    void *ctx;
+    int connected;
+    char path[256];
+    storage_stats_t stats;
+} storage_backend_t;
+
+const storage_backend_ops_t *storage_backend_find(const char *name);
+int storage_backend_open(storage_backend_t **out, const char *name, const char *path);
+int storage_backend_write(storage_backend_t *sb, sensor_packet_t *packets, size_t count);
+int storage_backend_flush(storage_backend_t *sb);
+int storage_backend_health(storage_backend_t *sb);
+int storage_backend_idle(storage_backend_t *sb);
+int storage_backend_reopen(storage_backend_t *sb);
+void storage_backend_close(storage_backend_t *sb);
+void storage_backend_stats(storage_backend_t *sb, storage_stats_t *out);
+void storage_backend_log_stats(storage_backend_t *sb);
+
+// Partition layout of the configured backend; 0 if it is not partitioned
+int storage_partition_layout(const char **dir, const char **prefix, const char **suffix, int64_t *span_ms);
+
+#endif
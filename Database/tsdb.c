@@ -0,0 +1,922 @@
+#include "tsdb.h"
+#include "logger.h"
+#include "utilities.h"
+#include <dirent.h>
+#include <sys/mman.h>
+
+// Helper: header checksum, chained onto the payload checksum
+static uint32_t header_crc(const tsdb_block_hdr_t *hdr, uint32_t payload_crc){
+    tsdb_block_hdr_t h = *hdr;
+    h.crc = 0;
+    return crc32_update(payload_crc, &h, sizeof(h));
+}
+
+/* ===========================
+ *   Bit I/O (msb first)
+ * =========================== */
+
+// Whole bytes go to out, up to 7 pending bits stay in acc
+typedef struct{
+    uint8_t *out;
+    size_t len;
+    uint64_t acc;
+    int nacc;
+} bitw_t;
+
+typedef struct{
+    const uint8_t *buf;
+    size_t nbits;
+    size_t bit;
+    int err;
+} bitr_t;
+
+static void bw_put(bitw_t *w, uint64_t v, int n){
+    if(n > 56){
+        bw_put(w, v >> 32, n - 32);
+        n = 32;
+    }
+    w->acc = (w->acc << n) | (v & ((1ULL << n) - 1));
+    w->nacc += n;
+    while(w->nacc >= 8){
+        w->nacc -= 8;
+        w->out[w->len++] = (uint8_t)(w->acc >> w->nacc);
+    }
+}
+
+static uint64_t br_get(bitr_t *r, int n){
+    if(r->bit + (size_t)n > r->nbits){
+        r->err = 1;
+        return 0;
+    }
+    uint64_t v = 0;
+    while(n > 0){
+        size_t byte = r->bit >> 3;
+        int room = 8 - (int)(r->bit & 7);
+        int take = (n < room) ? n : room;
+
+        v = (v << take) | ((r->buf[byte] >> (room - take)) & ((1u << take) - 1));
+        r->bit += take;
+        n -= take;
+    }
+    return v;
+}
+
+// Helper: sign-extend the low n bits
+static int64_t sign_extend(uint64_t v, int n){
+    return (int64_t)(v << (64 - n)) >> (64 - n);
+}
+
+/* ===========================
+ *   Block codec
+ * =========================== */
+
+// Encoder state of one open block, carried across batches
+typedef struct{
+    uint16_t count;
+    int64_t prev_ts;
+    int64_t prev_delta;
+    uint64_t prev_bits;
+    int prev_lead;          // -1 until the first XOR window
+    int prev_trail;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint64_t acc;           // pending bits not yet a whole byte
+    int nacc;
+} tsdb_enc_t;
+
+static void enc_add(tsdb_enc_t *e, bitw_t *w, int64_t ts, double value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if(e->count == 0){
+        bw_put(w, (uint64_t)ts, 64);
+        bw_put(w, bits, 64);
+        e->prev_ts = ts;
+        e->prev_delta = 0;
+        e->prev_bits = bits;
+        e->prev_lead = -1;
+        e->min_ts = e->max_ts = ts;
+        e->count = 1;
+        return;
+    }
+
+    // Timestamp: delta-of-delta in the smallest fitting bucket
+    int64_t delta = ts - e->prev_ts;
+    int64_t dod = delta - e->prev_delta;
+    if(dod == 0){
+        bw_put(w, 0x0, 1);
+    }
+    else if(dod >= -64 && dod <= 63){
+        bw_put(w, 0x2, 2);
+        bw_put(w, (uint64_t)dod, 7);
+    }
+    else if(dod >= -256 && dod <= 255){
+        bw_put(w, 0x6, 3);
+        bw_put(w, (uint64_t)dod, 9);
+    }
+    else if(dod >= -2048 && dod <= 2047){
+        bw_put(w, 0xE, 4);
+        bw_put(w, (uint64_t)dod, 12);
+    }
+    else{
+        bw_put(w, 0xF, 4);
+        bw_put(w, (uint64_t)dod, 64);
+    }
+    e->prev_delta = delta;
+    e->prev_ts = ts;
+
+    // Value: XOR with previous, reuse the previous bit window when it fits
+    uint64_t x = bits ^ e->prev_bits;
+    if(x == 0){
+        bw_put(w, 0x0, 1);
+    }
+    else{
+        int lead = __builtin_clzll(x);
+        int trail = __builtin_ctzll(x);
+        if(lead > 31) lead = 31;
+
+        if(e->prev_lead >= 0 && lead >= e->prev_lead && trail >= e->prev_trail){
+            bw_put(w, 0x2, 2);
+            bw_put(w, x >> e->prev_trail, 64 - e->prev_lead - e->prev_trail);
+        }
+        else{
+            int len = 64 - lead - trail;
+            bw_put(w, 0x3, 2);
+            bw_put(w, (uint64_t)lead, 5);
+            bw_put(w, (uint64_t)(len - 1), 6);
+            bw_put(w, x >> trail, len);
+            e->prev_lead = lead;
+            e->prev_trail = trail;
+        }
+    }
+    e->prev_bits = bits;
+
+    if(ts < e->min_ts) e->min_ts = ts;
+    if(ts > e->max_ts) e->max_ts = ts;
+    e->count++;
+}
+
+// Decode a block into hdr->count samples, 0 on success.
+// payload must have one spare byte after payload_len for the tail.
+static int decode_block(const tsdb_block_hdr_t *hdr, uint8_t *payload, tsdb_sample_t *out){
+    payload[hdr->payload_len] = hdr->tail;
+    bitr_t r = { payload, (size_t)hdr->payload_len * 8 + hdr->tail_bits, 0, 0 };
+    if(hdr->count == 0) return -1;
+
+    int64_t ts = (int64_t)br_get(&r, 64);
+    uint64_t bits = br_get(&r, 64);
+    int64_t delta = 0;
+    int lead = -1, trail = 0;
+
+    out[0].ts_ms = ts;
+    memcpy(&out[0].value, &bits, sizeof(bits));
+
+    for(uint16_t i = 1; i < hdr->count && !r.err; i++){
+        int64_t dod;
+        if(br_get(&r, 1) == 0)      dod = 0;
+        else if(br_get(&r, 1) == 0) dod = sign_extend(br_get(&r, 7), 7);
+        else if(br_get(&r, 1) == 0) dod = sign_extend(br_get(&r, 9), 9);
+        else if(br_get(&r, 1) == 0) dod = sign_extend(br_get(&r, 12), 12);
+        else                        dod = (int64_t)br_get(&r, 64);
+        delta += dod;
+        ts += delta;
+
+        if(br_get(&r, 1) != 0){
+            if(br_get(&r, 1) != 0){
+                lead = (int)br_get(&r, 5);
+                int len = (int)br_get(&r, 6) + 1;
+                trail = 64 - lead - len;
+                if(trail < 0){
+                    r.err = 1;
+                    break;
+                }
+            }
+            else if(lead < 0){
+                r.err = 1;
+                break;
+            }
+            bits ^= br_get(&r, 64 - lead - trail) << trail;
+        }
+
+        out[i].ts_ms = ts;
+        memcpy(&out[i].value, &bits, sizeof(bits));
+    }
+    return r.err ? -1 : 0;
+}
+
+/* ===========================
+ *   Store state
+ * =========================== */
+
+// Per-series writer state, open addressing on (id, type)
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    uint8_t used;
+    uint8_t dirty;          // written since last flush
+    int fd;                 // active segment, -1 if none
+    int entry;              // index slot of the active segment
+    uint64_t last_seq;      // highest journal sequence on disk
+    // Open block (enc.count > 0)
+    uint64_t block_off;
+    uint32_t payload_len;
+    uint32_t payload_crc;
+    uint32_t commit;
+    tsdb_enc_t enc;
+} tsdb_series_t;
+
+struct tsdb{
+    char dir[256];
+    int index_fd;
+    tsdb_index_t *index;
+    size_t index_size;
+    int readonly;           // query-side view of a store another handle writes
+    tsdb_series_t series[TSDB_MAX_SERIES];
+    uint8_t stage[TSDB_BLOCK_OVERHEAD + TSDB_BLOCK_BUF_SIZE];
+    unsigned long long rows_written;
+};
+
+/* ===========================
+ *   Segment files
+ * =========================== */
+
+static void segment_path(const char *dir, uint8_t id, uint8_t type, uint32_t seq, char *out, size_t len){
+    snprintf(out, len, "%s/s%u_%u_%06u.seg", dir, id, type, seq);
+}
+
+// Helper: positional write of exactly len bytes, 0 on success
+static int pwrite_full(int fd, const void *buf, size_t len, uint64_t off){
+    const uint8_t *p = buf;
+    while(len > 0){
+        ssize_t w = pwrite(fd, p, len, (off_t)off);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0) return -1;
+        p += w;
+        off += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// Helper: header slot looks like a block of this store
+static int slot_sane(const tsdb_block_hdr_t *h){
+    return h->magic == TSDB_BLOCK_MAGIC && h->count > 0 && h->count <= TSDB_BLOCK_MAX_SAMPLES &&
+           h->payload_len <= TSDB_BLOCK_BUF_SIZE && h->tail_bits < 8;
+}
+
+// Helper: read the block at 'off', picking the newest header slot whose checksum holds.
+// Returns 1 for a valid block, 0 at end of file, -1 for a torn or corrupt block.
+static int read_block(int fd, uint64_t off, tsdb_block_hdr_t *hdr, uint8_t *payload){
+    tsdb_block_hdr_t slots[2];
+    ssize_t r = pread(fd, slots, sizeof(slots), (off_t)off);
+    if(r == 0) return 0;
+    if(r != (ssize_t)sizeof(slots)) return -1;
+
+    int order[2] = {0, 1};
+    if(slots[1].commit > slots[0].commit){
+        order[0] = 1;
+        order[1] = 0;
+    }
+
+    for(int k = 0; k < 2; k++){
+        tsdb_block_hdr_t *h = &slots[order[k]];
+        if(!slot_sane(h)) continue;
+        if(pread(fd, payload, h->payload_len, (off_t)(off + TSDB_BLOCK_OVERHEAD)) != (ssize_t)h->payload_len) continue;
+        if(header_crc(h, crc32_update(0, payload, h->payload_len)) != h->crc) continue;
+        *hdr = *h;
+        return 1;
+    }
+    return -1;
+}
+
+// Walk valid blocks of a segment from offset 0 up to 'limit' (0 = whole file).
+// Stops at the first torn or corrupt block; *valid_bytes is the end of the last good one.
+// Returns 0 when clean, 1 when stopped at a bad block, -1 on allocation failure.
+static int scan_segment(int fd, uint64_t limit, tsdb_index_entry_t *entry, tsdb_block_cb cb, void *ctx, uint64_t *valid_bytes){
+    uint8_t *payload = malloc(TSDB_BLOCK_BUF_SIZE + 1);
+    tsdb_sample_t *samples = cb ? malloc(TSDB_BLOCK_MAX_SAMPLES * sizeof(*samples)) : NULL;
+    if(!payload || (cb && !samples)){
+        free(payload);
+        free(samples);
+        return -1;
+    }
+
+    uint64_t off = 0;
+    int rc = 0;
+    tsdb_block_hdr_t hdr;
+    while(limit == 0 || off < limit){
+        int status = read_block(fd, off, &hdr, payload);
+        if(status == 0) break;
+        if(status < 0){
+            rc = 1;
+            break;
+        }
+        if(cb){
+            if(decode_block(&hdr, payload, samples) != 0){
+                rc = 1;
+                break;
+            }
+            if(cb(ctx, &hdr, samples) != 0) break;
+        }
+        if(entry){
+            if(entry->rows == 0 || hdr.min_ts < entry->min_ts) entry->min_ts = hdr.min_ts;
+            if(entry->rows == 0 || hdr.max_ts > entry->max_ts) entry->max_ts = hdr.max_ts;
+            entry->rows += hdr.count;
+        }
+        off += TSDB_BLOCK_OVERHEAD + hdr.payload_len;
+    }
+
+    if(valid_bytes) *valid_bytes = off;
+    free(payload);
+    free(samples);
+    return rc;
+}
+
+/* ===========================
+ *   Index
+ * =========================== */
+
+static int index_alloc(tsdb_t *t){
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        if(!t->index->entries[i].in_use) return (int)i;
+    }
+    return -1;
+}
+
+// Helper: recount an entry from its segment file, truncating a torn tail
+static int index_recover_entry(tsdb_t *t, tsdb_index_entry_t *e){
+    char path[320];
+    segment_path(t->dir, e->id, e->type, e->seq, path, sizeof(path));
+
+    int fd = open(path, O_RDWR);
+    if(fd < 0){
+        LOG_WARN(TSDB, "Segment %s missing, dropping from index", path);
+        memset(e, 0, sizeof(*e));
+        return 0;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    e->rows = 0;
+    uint64_t valid = 0;
+    if(scan_segment(fd, 0, e, NULL, NULL, &valid) < 0){
+        close(fd);
+        return -1;
+    }
+    if(valid < (uint64_t)st.st_size){
+        LOG_WARN(TSDB, "Truncating %llu torn bytes from %s", (unsigned long long)(st.st_size - valid), path);
+        if(ftruncate(fd, (off_t)valid) != 0){
+            LOG_ERROR(TSDB, "ftruncate %s failed: %s", path, strerror(errno));
+        }
+    }
+    e->bytes = valid;
+    close(fd);
+    return 0;
+}
+
+// Helper: rebuild the index from segment files in the directory
+static int index_rebuild(tsdb_t *t){
+    DIR *d = opendir(t->dir);
+    if(!d) return -1;
+
+    LOG_WARN(TSDB, "Rebuilding segment index in %s", t->dir);
+
+    struct dirent *de;
+    while((de = readdir(d)) != NULL){
+        unsigned id, type, seq;
+        if(sscanf(de->d_name, "s%u_%u_%u.seg", &id, &type, &seq) != 3) continue;
+
+        int slot = index_alloc(t);
+        if(slot < 0){
+            LOG_ERROR(TSDB, "Index full while rebuilding");
+            break;
+        }
+        tsdb_index_entry_t *e = &t->index->entries[slot];
+        memset(e, 0, sizeof(*e));
+        e->id = (uint8_t)id;
+        e->type = (uint8_t)type;
+        e->seq = seq;
+        e->in_use = 1;
+        e->sealed = 1;
+        index_recover_entry(t, e);
+    }
+    closedir(d);
+
+    // The newest segment of each series stays open for appends
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        tsdb_index_entry_t *e = &t->index->entries[i];
+        if(!e->in_use) continue;
+        int newest = 1;
+        for(uint32_t j = 0; j < t->index->capacity && newest; j++){
+            tsdb_index_entry_t *o = &t->index->entries[j];
+            if(o->in_use && o->id == e->id && o->type == e->type && o->seq > e->seq) newest = 0;
+        }
+        if(newest) e->sealed = 0;
+    }
+    return 0;
+}
+
+static int index_open(tsdb_t *t){
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", t->dir, TSDB_INDEX_FILE);
+
+    t->index_size = sizeof(tsdb_index_t) + TSDB_INDEX_MAX_SEGMENTS * sizeof(tsdb_index_entry_t);
+    t->index_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(t->index_fd < 0){
+        LOG_ERROR(TSDB, "Failed to open index %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    fstat(t->index_fd, &st);
+    int fresh = ((size_t)st.st_size != t->index_size);
+    if(fresh && ftruncate(t->index_fd, (off_t)t->index_size) != 0){
+        LOG_ERROR(TSDB, "Failed to size index: %s", strerror(errno));
+        return -1;
+    }
+
+    t->index = mmap(NULL, t->index_size, PROT_READ | PROT_WRITE, MAP_SHARED, t->index_fd, 0);
+    if(t->index == MAP_FAILED){
+        t->index = NULL;
+        LOG_ERROR(TSDB, "Failed to map index: %s", strerror(errno));
+        return -1;
+    }
+
+    if(fresh || t->index->magic != TSDB_INDEX_MAGIC || t->index->version != TSDB_INDEX_VERSION ||
+       t->index->capacity != TSDB_INDEX_MAX_SEGMENTS){
+        memset(t->index, 0, t->index_size);
+        t->index->magic = TSDB_INDEX_MAGIC;
+        t->index->version = TSDB_INDEX_VERSION;
+        t->index->capacity = TSDB_INDEX_MAX_SEGMENTS;
+        return index_rebuild(t);
+    }
+
+    // Index is updated after data, so only segments whose size disagrees
+    // (crash or power loss mid-append) need a rescan
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        tsdb_index_entry_t *e = &t->index->entries[i];
+        if(!e->in_use) continue;
+
+        char seg[320];
+        struct stat sst;
+        segment_path(t->dir, e->id, e->type, e->seq, seg, sizeof(seg));
+        if(stat(seg, &sst) != 0 || (uint64_t)sst.st_size != e->bytes){
+            index_recover_entry(t, e);
+        }
+    }
+    return 0;
+}
+
+/* ===========================
+ *   Series
+ * =========================== */
+
+// Helper: highest journal sequence stored for a series, read from the
+// blocks of its newest non-empty segment (headers carry the running maximum)
+static uint64_t series_load_seq(tsdb_t *t, uint8_t id, uint8_t type){
+    tsdb_index_entry_t *newest = NULL;
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        tsdb_index_entry_t *e = &t->index->entries[i];
+        if(!e->in_use || e->id != id || e->type != type || e->rows == 0) continue;
+        if(!newest || e->seq > newest->seq) newest = e;
+    }
+    if(!newest) return 0;
+
+    char path[320];
+    segment_path(t->dir, id, type, newest->seq, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    uint8_t *payload = malloc(TSDB_BLOCK_BUF_SIZE + 1);
+    uint64_t seq = 0;
+    if(fd >= 0 && payload){
+        tsdb_block_hdr_t hdr;
+        uint64_t off = 0;
+        while(off < newest->bytes && read_block(fd, off, &hdr, payload) == 1){
+            if(hdr.last_seq > seq) seq = hdr.last_seq;
+            off += TSDB_BLOCK_OVERHEAD + hdr.payload_len;
+        }
+    }
+    if(fd >= 0) close(fd);
+    free(payload);
+    return seq;
+}
+
+static tsdb_series_t *series_get(tsdb_t *t, uint8_t id, uint8_t type){
+    size_t h = ((size_t)id * 31 + type) % TSDB_MAX_SERIES;
+    for(size_t n = 0; n < TSDB_MAX_SERIES; n++){
+        tsdb_series_t *s = &t->series[(h + n) % TSDB_MAX_SERIES];
+        if(!s->used){
+            memset(s, 0, sizeof(*s));
+            s->used = 1;
+            s->id = id;
+            s->type = type;
+            s->fd = -1;
+            s->entry = -1;
+            s->last_seq = series_load_seq(t, id, type);
+            return s;
+        }
+        if(s->id == id && s->type == type) return s;
+    }
+    return NULL;
+}
+
+// Helper: open (or create) the active segment of a series.
+// Blocks left from an earlier run are treated as closed.
+static int series_open_segment(tsdb_t *t, tsdb_series_t *s){
+    int slot = -1;
+    uint32_t next_seq = 0;
+
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        tsdb_index_entry_t *e = &t->index->entries[i];
+        if(!e->in_use || e->id != s->id || e->type != s->type) continue;
+        if(!e->sealed) slot = (int)i;
+        if(e->seq >= next_seq) next_seq = e->seq + 1;
+    }
+
+    if(slot < 0){
+        slot = index_alloc(t);
+        if(slot < 0){
+            LOG_ERROR(TSDB, "Segment index full (%d entries)", TSDB_INDEX_MAX_SEGMENTS);
+            return -1;
+        }
+        tsdb_index_entry_t *e = &t->index->entries[slot];
+        memset(e, 0, sizeof(*e));
+        e->id = s->id;
+        e->type = s->type;
+        e->seq = next_seq;
+        e->in_use = 1;
+    }
+
+    tsdb_index_entry_t *e = &t->index->entries[slot];
+    char path[320];
+    segment_path(t->dir, e->id, e->type, e->seq, path, sizeof(path));
+
+    s->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(s->fd < 0){
+        LOG_ERROR(TSDB, "Failed to open segment %s: %s", path, strerror(errno));
+        memset(e, 0, sizeof(*e));
+        return -1;
+    }
+    s->entry = slot;
+    s->enc.count = 0;
+    return 0;
+}
+
+// Helper: close the active segment once it is full
+static void series_seal(tsdb_series_t *s, tsdb_index_entry_t *e){
+    fdatasync(s->fd);
+    close(s->fd);
+    s->fd = -1;
+    s->entry = -1;
+    s->dirty = 0;
+    s->enc.count = 0;
+    e->sealed = 1;
+}
+
+// Helper: append samples [i, n) of one series to its open block.
+// New whole bytes go after the payload, then the older header slot is
+// rewritten. Returns samples consumed, or -1 on write failure.
+static int series_append(tsdb_t *t, tsdb_series_t *s, const sensor_packet_t *pkts, size_t n){
+    if(s->fd < 0 && series_open_segment(t, s) != 0) return -1;
+    tsdb_index_entry_t *e = &t->index->entries[s->entry];
+
+    int new_block = (s->enc.count == 0);
+    if(new_block){
+        s->block_off = e->bytes;
+        s->payload_len = 0;
+        s->payload_crc = 0;
+        s->commit = 0;
+        memset(&s->enc, 0, sizeof(s->enc));
+    }
+
+    // Stage [slot0][slot1] for a new block, then the new payload bytes
+    uint8_t *bytes = t->stage + TSDB_BLOCK_OVERHEAD;
+    bitw_t w = { bytes, 0, s->enc.acc, s->enc.nacc };
+    uint16_t before = s->enc.count;
+    uint64_t last_seq = s->last_seq;
+    size_t used = 0;
+    while(used < n && s->enc.count < TSDB_BLOCK_MAX_SAMPLES){
+        enc_add(&s->enc, &w, pkts[used].ts_ms, pkts[used].value);
+        if(pkts[used].seq > last_seq) last_seq = pkts[used].seq;
+        used++;
+    }
+
+    tsdb_block_hdr_t hdr = {
+        .magic = TSDB_BLOCK_MAGIC,
+        .commit = s->commit + 1,
+        .payload_len = s->payload_len + (uint32_t)w.len,
+        .id = s->id,
+        .type = s->type,
+        .count = s->enc.count,
+        .tail = (uint8_t)((w.acc << (8 - w.nacc)) & 0xFF),
+        .tail_bits = (uint8_t)w.nacc,
+        .min_ts = s->enc.min_ts,
+        .max_ts = s->enc.max_ts,
+        .last_seq = last_seq
+    };
+    uint32_t payload_crc = crc32_update(s->payload_crc, bytes, w.len);
+    hdr.crc = header_crc(&hdr, payload_crc);
+
+    // Every commit goes to slot commit % 2, the first one included, so the
+    // second append lands in the other slot and never over the only valid one
+    int rc;
+    if(new_block){
+        memset(t->stage, 0, TSDB_BLOCK_OVERHEAD);
+        memcpy(t->stage + (hdr.commit % 2) * sizeof(hdr), &hdr, sizeof(hdr));
+        rc = pwrite_full(s->fd, t->stage, TSDB_BLOCK_OVERHEAD + w.len, s->block_off);
+    }
+    else{
+        uint64_t slot_off = s->block_off + (hdr.commit % 2) * sizeof(hdr);
+        rc = pwrite_full(s->fd, bytes, w.len, s->block_off + TSDB_BLOCK_OVERHEAD + s->payload_len);
+        if(rc == 0) rc = pwrite_full(s->fd, &hdr, sizeof(hdr), slot_off);
+    }
+    if(rc != 0){
+        // Drop the uncommitted part, the previous slot still describes the block
+        LOG_ERROR(TSDB, "Segment write failed: %s", strerror(errno));
+        if(ftruncate(s->fd, (off_t)(new_block ? s->block_off : s->block_off + TSDB_BLOCK_OVERHEAD + s->payload_len)) != 0){
+            LOG_ERROR(TSDB, "ftruncate after failed write: %s", strerror(errno));
+        }
+        s->enc.count = 0;
+        return -1;
+    }
+
+    s->enc.acc = w.acc;
+    s->enc.nacc = w.nacc;
+    s->payload_len = hdr.payload_len;
+    s->payload_crc = payload_crc;
+    s->commit = hdr.commit;
+    s->last_seq = last_seq;
+    s->dirty = 1;
+
+    // Index follows data
+    if(e->rows == 0 || hdr.min_ts < e->min_ts) e->min_ts = hdr.min_ts;
+    if(e->rows == 0 || hdr.max_ts > e->max_ts) e->max_ts = hdr.max_ts;
+    e->rows += (uint64_t)(s->enc.count - before);
+    e->bytes = s->block_off + TSDB_BLOCK_OVERHEAD + s->payload_len;
+
+    if(s->enc.count == TSDB_BLOCK_MAX_SAMPLES){
+        s->enc.count = 0;   // next append starts a new block
+    }
+    if(e->bytes >= TSDB_SEGMENT_MAX_BYTES){
+        series_seal(s, e);
+    }
+    return (int)used;
+}
+
+/* ===========================
+ *   Public API
+ * =========================== */
+
+int tsdb_open(tsdb_t **out, const char *dir){
+    if(!out || !dir) return -1;
+
+    tsdb_t *t = calloc(1, sizeof(*t));
+    if(!t){
+        LOG_ERROR(TSDB, "Failed to allocate store");
+        return -1;
+    }
+    snprintf(t->dir, sizeof(t->dir), "%s", dir);
+    t->index_fd = -1;
+
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+        LOG_ERROR(TSDB, "Failed to create %s: %s", dir, strerror(errno));
+        free(t);
+        return -1;
+    }
+
+    if(index_open(t) != 0){
+        tsdb_close(t);
+        return -1;
+    }
+
+    *out = t;
+    return 0;
+}
+
+// Read-only view for queries while the writer owns the store: maps the live
+// index, never recovers or truncates. Queries stop at each segment's
+// committed length, so in-flight appends are invisible.
+int tsdb_open_readonly(tsdb_t **out, const char *dir){
+    if(!out || !dir) return -1;
+
+    tsdb_t *t = calloc(1, sizeof(*t));
+    if(!t) return -1;
+    snprintf(t->dir, sizeof(t->dir), "%s", dir);
+    t->readonly = 1;
+
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", dir, TSDB_INDEX_FILE);
+    t->index_size = sizeof(tsdb_index_t) + TSDB_INDEX_MAX_SEGMENTS * sizeof(tsdb_index_entry_t);
+    t->index_fd = open(path, O_RDONLY);
+
+    struct stat st;
+    if(t->index_fd < 0 || fstat(t->index_fd, &st) != 0 || (size_t)st.st_size != t->index_size){
+        tsdb_close(t);
+        return -1;
+    }
+    t->index = mmap(NULL, t->index_size, PROT_READ, MAP_SHARED, t->index_fd, 0);
+    if(t->index == MAP_FAILED || t->index->magic != TSDB_INDEX_MAGIC){
+        if(t->index == MAP_FAILED) t->index = NULL;
+        tsdb_close(t);
+        return -1;
+    }
+
+    *out = t;
+    return 0;
+}
+
+void tsdb_close(tsdb_t *t){
+    if(!t) return;
+
+    if(t->index && !t->readonly) tsdb_flush(t);
+    for(size_t i = 0; i < TSDB_MAX_SERIES; i++){
+        if(t->series[i].used && t->series[i].fd >= 0){
+            close(t->series[i].fd);
+        }
+    }
+    if(t->index) munmap(t->index, t->index_size);
+    if(t->index_fd >= 0) close(t->index_fd);
+    free(t);
+}
+
+// Helper: order packets by series, then journal sequence, then time.
+// Appending in sequence order keeps each block's last_seq an exact watermark.
+static int tsdb_cmp_key(const void *a, const void *b){
+    const sensor_packet_t *x = a, *y = b;
+    if(x->id != y->id) return (x->id < y->id) ? -1 : 1;
+    if(x->type != y->type) return (x->type < y->type) ? -1 : 1;
+    if(x->seq != y->seq) return (x->seq < y->seq) ? -1 : 1;
+    if(x->ts_ms != y->ts_ms) return (x->ts_ms < y->ts_ms) ? -1 : 1;
+    return 0;
+}
+
+// Packets are reordered in place by (id, type, seq, ts). Packets whose
+// journal sequence is already on disk (replays, retries) are skipped.
+int tsdb_write_batch(tsdb_t *t, sensor_packet_t *packets, size_t count){
+    if(!t || t->readonly || !packets || count == 0) return -1;
+
+    qsort(packets, count, sizeof(*packets), tsdb_cmp_key);
+
+    size_t i = 0;
+    int rc = 0;
+    while(i < count){
+        uint8_t id = packets[i].id;
+        uint8_t type = packets[i].type;
+        size_t end = i;
+        while(end < count && packets[end].id == id && packets[end].type == type) end++;
+
+        tsdb_series_t *s = series_get(t, id, type);
+        if(!s){
+            LOG_ERROR(TSDB, "Series table full (%d), dropping sensor %d type %d", TSDB_MAX_SERIES, id, type);
+            rc = -1;
+            i = end;
+            continue;
+        }
+
+        size_t first = i;
+        while(i < end && packets[i].seq != 0 && packets[i].seq <= s->last_seq) i++;
+        if(i > first){
+            LOG_DEBUG(TSDB, "Skipped %zu stored packets of sensor %d type %d", i - first, id, type);
+        }
+
+        while(i < end){
+            int used = series_append(t, s, packets + i, end - i);
+            if(used < 0){
+                rc = -1;
+                i = end;
+                break;
+            }
+            t->rows_written += used;
+            i += used;
+        }
+    }
+    return rc;
+}
+
+// Make everything written so far durable: segment data first, then the index
+int tsdb_flush(tsdb_t *t){
+    if(!t || t->readonly) return -1;
+
+    int rc = 0;
+    for(size_t i = 0; i < TSDB_MAX_SERIES; i++){
+        tsdb_series_t *s = &t->series[i];
+        if(s->used && s->dirty && s->fd >= 0){
+            if(fdatasync(s->fd) != 0) rc = -1;
+            s->dirty = 0;
+        }
+    }
+    if(msync(t->index, t->index_size, MS_SYNC) != 0) rc = -1;
+    return rc;
+}
+
+int tsdb_health_check(tsdb_t *t){
+    if(!t || !t->index || t->index->magic != TSDB_INDEX_MAGIC){
+        LOG_ERROR(TSDB, "Health check failed: index not mapped");
+        return -1;
+    }
+
+    size_t segments = 0;
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        if(t->index->entries[i].in_use) segments++;
+    }
+    LOG_INFO(TSDB, "Health check passed: %zu segments, %llu records written", segments, t->rows_written);
+    return 0;
+}
+
+typedef struct{
+    int64_t from_ms;
+    int64_t to_ms;
+    tsdb_row_cb cb;
+    void *ctx;
+    int stopped;
+} query_ctx_t;
+
+static int query_block_cb(void *ctx, const tsdb_block_hdr_t *hdr, const tsdb_sample_t *samples){
+    query_ctx_t *q = ctx;
+    if(hdr->max_ts < q->from_ms || hdr->min_ts > q->to_ms) return 0;
+
+    for(uint16_t i = 0; i < hdr->count; i++){
+        if(samples[i].ts_ms < q->from_ms || samples[i].ts_ms > q->to_ms) continue;
+        sensor_packet_t pkt = {
+            .id = hdr->id,
+            .type = hdr->type,
+            .value = samples[i].value,
+            .ts_ms = samples[i].ts_ms
+        };
+        if(q->cb(q->ctx, &pkt) != 0){
+            q->stopped = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Samples of one sensor in [from_ms, to_ms], in write order (segment by segment).
+// Segments outside the range are skipped through the index.
+int tsdb_query_range(tsdb_t *t, int id, int type, int64_t from_ms, int64_t to_ms, tsdb_row_cb cb, void *ctx){
+    if(!t || !cb) return -1;
+
+    query_ctx_t q = { from_ms, to_ms, cb, ctx, 0 };
+
+    // Visit matching segments in sequence order
+    uint32_t last_seq = 0;
+    int first = 1;
+    while(!q.stopped){
+        tsdb_index_entry_t seg = {0};
+        int found = 0;
+        for(uint32_t i = 0; i < t->index->capacity; i++){
+            tsdb_index_entry_t *e = &t->index->entries[i];
+            if(!e->in_use || e->id != id || e->type != type || e->rows == 0) continue;
+            if(!first && e->seq <= last_seq) continue;
+            if(!found || e->seq < seg.seq){
+                seg = *e;
+                found = 1;
+            }
+        }
+        if(!found) break;
+        first = 0;
+        last_seq = seg.seq;
+        if(seg.max_ts < from_ms || seg.min_ts > to_ms) continue;
+
+        char path[320];
+        segment_path(t->dir, seg.id, seg.type, seg.seq, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if(fd < 0) continue;
+
+        // Only blocks committed when the index was read
+        if(scan_segment(fd, seg.bytes, NULL, query_block_cb, &q, NULL) > 0){
+            LOG_ERROR(TSDB, "Corrupt block in %s", path);
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+uint64_t tsdb_disk_bytes(tsdb_t *t){
+    if(!t) return 0;
+
+    uint64_t total = t->index_size;
+    for(uint32_t i = 0; i < t->index->capacity; i++){
+        if(t->index->entries[i].in_use) total += t->index->entries[i].bytes;
+    }
+    return total;
+}
+
+// Verify and decode every block of one segment file (offline tools).
+// Returns 0 if the whole file is valid, 1 if it ends in a bad block, -1 on I/O error.
+int tsdb_scan_file(const char *path, tsdb_block_cb cb, void *ctx, uint64_t *valid_bytes){
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return -1;
+
+    struct stat st;
+    fstat(fd, &st);
+
+    uint64_t valid = 0;
+    int rc = scan_segment(fd, 0, NULL, cb, ctx, &valid);
+    close(fd);
+
+    if(valid_bytes) *valid_bytes = valid;
+    if(rc == 0 && valid < (uint64_t)st.st_size) rc = 1;
+    return rc;
+}
@@ -0,0 +1,99 @@
+#ifndef TSDB_H
+#define TSDB_H
+
+#include "main.h"
+
+// Native append-only time-series store.
+// One directory holds per-sensor segment files (s<id>_<type>_<seq>.seg) of
+// checksummed blocks plus a memory-mapped index of segment time ranges.
+// All on-disk integers are in host byte order.
+// Each block records the highest journal sequence of its series, so
+// replayed or retried packets already on disk are skipped on write.
+
+#define TSDB_DIR "../Database/tsdb"
+#define TSDB_INDEX_FILE "index.map"
+
+#define TSDB_BLOCK_MAGIC 0x32425354u   // "TSB2"
+#define TSDB_INDEX_MAGIC 0x31495354u   // "TSI1"
+#define TSDB_INDEX_VERSION 2
+
+#define TSDB_BLOCK_MAX_SAMPLES 1024
+#ifndef TSDB_SEGMENT_MAX_BYTES
+#define TSDB_SEGMENT_MAX_BYTES (1024 * 1024)
+#endif
+#define TSDB_INDEX_MAX_SEGMENTS 4096
+#define TSDB_MAX_SERIES 1024
+
+// Worst case encoded size of one full block payload:
+// 2 x 64 bits for the first sample, then at most 68 + 77 bits per sample
+#define TSDB_BLOCK_BUF_SIZE (16 + TSDB_BLOCK_MAX_SAMPLES * 19)
+
+// Block layout: two header slots, then payload_len bytes of bit-packed
+// samples (first timestamp and value raw, then delta-of-delta timestamps
+// and XOR-compressed values). The trailing partial byte lives in the
+// header. A block stays open across batches: new whole bytes are appended
+// after the payload, then the older header slot is overwritten, so a torn
+// write always leaves the other slot describing a valid prefix.
+typedef struct{
+    uint32_t magic;
+    uint32_t crc;           // CRC-32 of payload, then this header with crc = 0
+    uint32_t commit;        // bumped on every append, newest valid slot wins
+    uint32_t payload_len;   // whole payload bytes
+    uint8_t id;
+    uint8_t type;
+    uint16_t count;
+    uint8_t tail;           // trailing partial byte, msb aligned
+    uint8_t tail_bits;
+    uint16_t reserved;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint64_t last_seq;      // highest journal sequence of the series, 0 without journal
+} tsdb_block_hdr_t;
+
+#define TSDB_BLOCK_OVERHEAD (2 * sizeof(tsdb_block_hdr_t))
+
+// One segment in the index
+typedef struct{
+    uint8_t id;
+    uint8_t type;
+    uint8_t in_use;
+    uint8_t sealed;         // no longer appended to
+    uint32_t seq;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint64_t rows;
+    uint64_t bytes;         // valid length of the segment file
+} tsdb_index_entry_t;
+
+typedef struct{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    tsdb_index_entry_t entries[];
+} tsdb_index_t;
+
+typedef struct{
+    int64_t ts_ms;
+    double value;
+} tsdb_sample_t;
+
+typedef struct tsdb tsdb_t;
+
+// Range query callback, return non-zero to stop
+typedef int (*tsdb_row_cb)(void *ctx, const sensor_packet_t *pkt);
+// Segment scan callback, called once per valid block
+typedef int (*tsdb_block_cb)(void *ctx, const tsdb_block_hdr_t *hdr, const tsdb_sample_t *samples);
+
+int tsdb_open(tsdb_t **out, const char *dir);
+int tsdb_open_readonly(tsdb_t **out, const char *dir);
+void tsdb_close(tsdb_t *t);
+int tsdb_write_batch(tsdb_t *t, sensor_packet_t *packets, size_t count);
+int tsdb_flush(tsdb_t *t);
+int tsdb_health_check(tsdb_t *t);
+int tsdb_query_range(tsdb_t *t, int id, int type, int64_t from_ms, int64_t to_ms, tsdb_row_cb cb, void *ctx);
+uint64_t tsdb_disk_bytes(tsdb_t *t);
+
+int tsdb_scan_file(const char *path, tsdb_block_cb cb, void *ctx, uint64_t *valid_bytes);
+
+#endif
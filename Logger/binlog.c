@@ -0,0 +1,370 @@
+#include "binlog.h"
+#include <ctype.h>
+#include <stddef.h>
+
+// One printf conversion, from its '%' up to and including the conversion character
+typedef struct{
+    const char *start;
+    size_t len;
+    int star_width;
+    int star_prec;
+    int arg;                            // BINLOG_ARG_*, 0 for %%
+} binlog_spec_t;
+
+// Helper: parse the conversion starting at p ('%'); -1 if binary mode cannot carry it
+static int spec_parse(const char *p, binlog_spec_t *s){
+    const char *q = p + 1;
+    memset(s, 0, sizeof(*s));
+    s->start = p;
+
+    if(*q == '%'){
+        s->len = 2;
+        return 0;
+    }
+    while(*q && strchr("-+ #0'", *q)) q++;
+    if(*q == '*'){
+        s->star_width = 1;
+        q++;
+    }
+    else{
+        while(isdigit((unsigned char)*q)) q++;
+    }
+    if(*q == '.'){
+        q++;
+        if(*q == '*'){
+            s->star_prec = 1;
+            q++;
+        }
+        else{
+            while(isdigit((unsigned char)*q)) q++;
+        }
+    }
+
+    int size = BINLOG_ARG_INT;
+    if(q[0] == 'h' && q[1] == 'h'){ size = BINLOG_ARG_CHAR; q += 2; }
+    else if(q[0] == 'l' && q[1] == 'l'){ size = BINLOG_ARG_LLONG; q += 2; }
+    else if(*q == 'h'){ size = BINLOG_ARG_SHORT; q++; }
+    else if(*q == 'l'){ size = BINLOG_ARG_LONG; q++; }
+    else if(*q == 'q'){ size = BINLOG_ARG_LLONG; q++; }
+    else if(*q == 'z'){ size = BINLOG_ARG_SIZE; q++; }
+    else if(*q == 'j'){ size = BINLOG_ARG_INTMAX; q++; }
+    else if(*q == 't'){ size = BINLOG_ARG_PTRDIFF; q++; }
+    else if(*q == 'L') return -1;       // long double
+
+    switch(*q){
+        case 'd': case 'i':
+            s->arg = size;
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            s->arg = size | BINLOG_ARG_UNSIGNED;
+            break;
+        case 'c':
+            if(size != BINLOG_ARG_INT) return -1;       // %lc
+            s->arg = BINLOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            s->arg = BINLOG_ARG_DOUBLE;
+            break;
+        case 's':
+            if(size != BINLOG_ARG_INT) return -1;       // %ls
+            s->arg = BINLOG_ARG_STR;
+            break;
+        case 'p':
+            s->arg = BINLOG_ARG_PTR;
+            break;
+        default:
+            return -1;                  // %n, %m, %C, end of string
+    }
+    s->len = (size_t)(q + 1 - p);
+    return 0;
+}
+
+int binlog_parse(const char *fmt, binlog_format_t *f){
+    f->fmt = fmt;
+    f->nargs = 0;
+
+    for(const char *p = strchr(fmt, '%'); p; p = strchr(p, '%')){
+        binlog_spec_t s;
+        if(spec_parse(p, &s) != 0){
+            f->nargs = -1;
+            return -1;
+        }
+        p += s.len;
+        if(s.arg == 0) continue;
+
+        int need = 1 + s.star_width + s.star_prec;
+        if(f->nargs + need > BINLOG_MAX_ARGS){
+            f->nargs = -1;
+            return -1;
+        }
+        if(s.star_width) f->types[f->nargs++] = BINLOG_ARG_INT;
+        if(s.star_prec) f->types[f->nargs++] = BINLOG_ARG_INT;
+        f->types[f->nargs++] = (uint8_t)s.arg;
+    }
+    return 0;
+}
+
+/* ===========================
+ *   Writer
+ * =========================== */
+
+static void put_header(uint8_t *out, size_t len, binlog_kind_t kind){
+    uint16_t l = (uint16_t)len;
+    memcpy(out, &l, 2);
+    out[2] = (uint8_t)kind;
+    out[3] = 0;
+}
+
+size_t binlog_session(uint8_t *out, uint32_t pid, int64_t start_us){
+    uint32_t magic = BINLOG_MAGIC;
+    size_t at = BINLOG_HEADER_SIZE;
+    memcpy(out + at, &magic, 4); at += 4;
+    memcpy(out + at, &pid, 4); at += 4;
+    memcpy(out + at, &start_us, 8); at += 8;
+    put_header(out, at, BINLOG_SESSION);
+    return at;
+}
+
+size_t binlog_format_record(uint8_t *out, uint16_t id, const char *fmt){
+    size_t flen = strlen(fmt);
+    size_t at = BINLOG_HEADER_SIZE;
+    if(at + 2 + flen > BINLOG_RECORD_MAX) return 0;
+    memcpy(out + at, &id, 2); at += 2;
+    memcpy(out + at, fmt, flen); at += flen;
+    put_header(out, at, BINLOG_FORMAT);
+    return at;
+}
+
+size_t binlog_event(uint8_t *out, uint16_t id, uint32_t tid, int64_t ts_us, const binlog_format_t *f, va_list ap){
+    size_t at = BINLOG_HEADER_SIZE;
+    memcpy(out + at, &id, 2); at += 2;
+    memcpy(out + at, &tid, 4); at += 4;
+    memcpy(out + at, &ts_us, 8); at += 8;
+
+    for(int i = 0; i < f->nargs; i++){
+        int type = f->types[i] & ~BINLOG_ARG_UNSIGNED;
+        int is_unsigned = f->types[i] & BINLOG_ARG_UNSIGNED;
+        if(at + 8 > BINLOG_RECORD_MAX) return 0;
+
+        // Same truncation printf applies, so the rendered text matches
+        uint64_t v = 0;
+        switch(type){
+            case BINLOG_ARG_INT:
+                v = is_unsigned ? (uint64_t)va_arg(ap, unsigned int) : (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            case BINLOG_ARG_CHAR:
+                v = is_unsigned ? (uint64_t)(unsigned char)va_arg(ap, int) : (uint64_t)(int64_t)(signed char)va_arg(ap, int);
+                break;
+            case BINLOG_ARG_SHORT:
+                v = is_unsigned ? (uint64_t)(unsigned short)va_arg(ap, int) : (uint64_t)(int64_t)(short)va_arg(ap, int);
+                break;
+            case BINLOG_ARG_LONG:
+                v = is_unsigned ? (uint64_t)va_arg(ap, unsigned long) : (uint64_t)(int64_t)va_arg(ap, long);
+                break;
+            case BINLOG_ARG_LLONG:
+                v = is_unsigned ? (uint64_t)va_arg(ap, unsigned long long) : (uint64_t)(int64_t)va_arg(ap, long long);
+                break;
+            case BINLOG_ARG_SIZE:
+                v = is_unsigned ? (uint64_t)va_arg(ap, size_t) : (uint64_t)(int64_t)va_arg(ap, ssize_t);
+                break;
+            case BINLOG_ARG_INTMAX:
+                v = is_unsigned ? (uint64_t)va_arg(ap, uintmax_t) : (uint64_t)(int64_t)va_arg(ap, intmax_t);
+                break;
+            case BINLOG_ARG_PTRDIFF:
+                v = (uint64_t)(int64_t)va_arg(ap, ptrdiff_t);
+                break;
+            case BINLOG_ARG_DOUBLE:{
+                double d = va_arg(ap, double);
+                memcpy(&v, &d, 8);
+                break;
+            }
+            case BINLOG_ARG_PTR:
+                v = (uint64_t)(uintptr_t)va_arg(ap, void *);
+                break;
+            case BINLOG_ARG_STR:{
+                const char *str = va_arg(ap, const char *);
+                if(!str) str = "(null)";
+                size_t slen = strnlen(str, BINLOG_STR_MAX);
+                if(at + 2 + slen > BINLOG_RECORD_MAX) return 0;
+                uint16_t l = (uint16_t)slen;
+                memcpy(out + at, &l, 2); at += 2;
+                memcpy(out + at, str, slen); at += slen;
+                continue;
+            }
+            default:
+                return 0;
+        }
+        memcpy(out + at, &v, 8);
+        at += 8;
+    }
+    put_header(out, at, BINLOG_EVENT);
+    return at;
+}
+
+/* ===========================
+ *   Reader
+ * =========================== */
+
+static binlog_format_t raw_format = {
+    .fmt = "%s",
+    .types = { BINLOG_ARG_STR },
+    .nargs = 1,
+};
+
+void binlog_table_reset(binlog_table_t *t){
+    for(int i = 0; i < BINLOG_MAX_FORMATS; i++){
+        free(t->fmts[i]);
+        t->fmts[i] = NULL;
+        t->parsed[i].nargs = -1;
+    }
+    t->parsed[BINLOG_RAW_ID] = raw_format;
+}
+
+int binlog_record_length(const uint8_t *buf, size_t len){
+    if(len < BINLOG_HEADER_SIZE) return 0;
+    uint16_t rlen;
+    memcpy(&rlen, buf, 2);
+    if(rlen < BINLOG_HEADER_SIZE || rlen > BINLOG_RECORD_MAX) return -1;
+    if(buf[2] < BINLOG_SESSION || buf[2] > BINLOG_EVENT || buf[3] != 0) return -1;
+    if(len < rlen) return 0;
+    return rlen;
+}
+
+// Helper: render one event's arguments; -1 if they do not match the format
+static int render(const binlog_format_t *f, const uint8_t *a, size_t alen, char *out, size_t cap){
+    size_t used = 0, at = 0;
+    int argi = 0;
+    const char *p = f->fmt;
+
+    // The writer widened every integer, so specs are rebuilt with ll
+    while(*p && used + 1 < cap){
+        if(*p != '%'){
+            out[used++] = *p++;
+            continue;
+        }
+        binlog_spec_t s;
+        if(spec_parse(p, &s) != 0) return -1;
+        if(s.arg == 0){
+            out[used++] = '%';
+            p += s.len;
+            continue;
+        }
+
+        char spec[64];
+        size_t sl = 0;
+        const char *q = p;
+        const char *conv = p + s.len - 1;
+        spec[sl++] = *q++;
+        while(q < conv && sl < sizeof(spec) - 24){
+            if(*q == '*'){
+                // Replaced by its value, a negative precision is no precision
+                int64_t v;
+                if(argi >= f->nargs || at + 8 > alen) return -1;
+                memcpy(&v, a + at, 8);
+                at += 8;
+                argi++;
+                if(q > p && q[-1] == '.' && v < 0){
+                    sl--;
+                }
+                else{
+                    sl += snprintf(spec + sl, sizeof(spec) - sl, "%lld", (long long)v);
+                }
+                q++;
+                continue;
+            }
+            if(strchr("hlqzjt", *q)){
+                q++;
+                continue;
+            }
+            spec[sl++] = *q++;
+        }
+        if(argi >= f->nargs) return -1;
+        int type = f->types[argi++] & ~BINLOG_ARG_UNSIGNED;
+        int is_int = (type != BINLOG_ARG_DOUBLE && type != BINLOG_ARG_STR && type != BINLOG_ARG_PTR);
+        if(is_int && *conv != 'c'){
+            spec[sl++] = 'l';
+            spec[sl++] = 'l';
+        }
+        spec[sl++] = *conv;
+        spec[sl] = '\0';
+
+        int n;
+        if(type == BINLOG_ARG_STR){
+            uint16_t l;
+            char str[BINLOG_STR_MAX + 1];
+            if(at + 2 > alen) return -1;
+            memcpy(&l, a + at, 2);
+            at += 2;
+            if(l > BINLOG_STR_MAX || at + l > alen) return -1;
+            memcpy(str, a + at, l);
+            str[l] = '\0';
+            at += l;
+            n = snprintf(out + used, cap - used, spec, str);
+        }
+        else{
+            uint64_t v;
+            if(at + 8 > alen) return -1;
+            memcpy(&v, a + at, 8);
+            at += 8;
+            if(type == BINLOG_ARG_DOUBLE){
+                double d;
+                memcpy(&d, &v, 8);
+                n = snprintf(out + used, cap - used, spec, d);
+            }
+            else if(type == BINLOG_ARG_PTR){
+                n = snprintf(out + used, cap - used, spec, (void *)(uintptr_t)v);
+            }
+            else if(*conv == 'c'){
+                n = snprintf(out + used, cap - used, spec, (int)v);
+            }
+            else{
+                n = snprintf(out + used, cap - used, spec, (unsigned long long)v);
+            }
+        }
+        if(n > 0) used += ((size_t)n < cap - used) ? (size_t)n : cap - used - 1;
+        p += s.len;
+    }
+    out[used] = '\0';
+    return (at == alen) ? 0 : -1;
+}
+
+int binlog_apply(binlog_table_t *t, const uint8_t *rec, size_t len, binlog_entry_t *e){
+    e->kind = rec[2];
+    const uint8_t *b = rec + BINLOG_HEADER_SIZE;
+    size_t blen = len - BINLOG_HEADER_SIZE;
+    uint16_t id;
+
+    switch(e->kind){
+        case BINLOG_SESSION:{
+            uint32_t magic;
+            if(blen != 16) return -1;
+            memcpy(&magic, b, 4);
+            if(magic != BINLOG_MAGIC) return -1;
+            memcpy(&e->pid, b + 4, 4);
+            memcpy(&e->ts_us, b + 8, 8);
+            binlog_table_reset(t);
+            return 0;
+        }
+        case BINLOG_FORMAT:{
+            if(blen < 2) return -1;
+            memcpy(&id, b, 2);
+            if(id == BINLOG_RAW_ID || id >= BINLOG_MAX_FORMATS) return -1;
+            free(t->fmts[id]);
+            t->fmts[id] = strndup((const char *)b + 2, blen - 2);
+            if(!t->fmts[id]) return -1;
+            binlog_parse(t->fmts[id], &t->parsed[id]);
+            snprintf(e->text, sizeof(e->text), "%s", t->fmts[id]);
+            return 0;
+        }
+        case BINLOG_EVENT:{
+            if(blen < 14) return -1;
+            memcpy(&id, b, 2);
+            memcpy(&e->tid, b + 2, 4);
+            memcpy(&e->ts_us, b + 6, 8);
+            if(id >= BINLOG_MAX_FORMATS || t->parsed[id].nargs < 0) return -1;
+            return render(&t->parsed[id], b + 14, blen - 14, e->text, sizeof(e->text));
+        }
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include "main.h"
+
+// Binary log records.
+// In binary mode log_event does not format: it sends the id of its
+// format string, a timestamp, the thread id and the raw arguments, and
+// the logger process (or log_decode, offline) renders the text. A format
+// is sent once, as a FORMAT record, before the first event that uses it;
+// a SESSION record starts a new id space (one per gateway run).
+//
+//   record:  u16 length (whole record), u8 kind, u8 reserved, body
+//   SESSION: u32 magic, u32 pid, i64 start_us
+//   FORMAT:  u16 id, format bytes (no NUL)
+//   EVENT:   u16 id, u32 tid, i64 ts_us, arguments in format order:
+//            integers and pointers 8 bytes, doubles 8 bytes,
+//            strings u16 length then the bytes
+//
+// Fields are in host byte order; files are read on the machine that wrote
+// them or one of the same endianness.
+
+#define BINLOG_MAGIC 0x31474C42u        // "BLG1"
+#define BINLOG_RECORD_MAX 2048
+#define BINLOG_HEADER_SIZE 4
+#define BINLOG_MAX_ARGS 16
+#define BINLOG_MAX_FORMATS 1024         // distinct format strings per run
+#define BINLOG_STR_MAX 512              // longer %s arguments are cut
+#define BINLOG_RAW_ID 0                 // "%s", preformatted text, never sent as FORMAT
+
+typedef enum{
+    BINLOG_SESSION = 1,
+    BINLOG_FORMAT = 2,
+    BINLOG_EVENT = 3
+} binlog_kind_t;
+
+// How an argument is fetched from the va_list; integers are widened to
+// 8 bytes on the writer side, unsigned ones flagged with BINLOG_ARG_UNSIGNED
+typedef enum{
+    BINLOG_ARG_INT = 1,                 // int, also %c and * widths
+    BINLOG_ARG_CHAR,                    // hh
+    BINLOG_ARG_SHORT,                   // h
+    BINLOG_ARG_LONG,                    // l
+    BINLOG_ARG_LLONG,                   // ll, q
+    BINLOG_ARG_SIZE,                    // z
+    BINLOG_ARG_INTMAX,                  // j
+    BINLOG_ARG_PTRDIFF,                 // t
+    BINLOG_ARG_DOUBLE,
+    BINLOG_ARG_STR,
+    BINLOG_ARG_PTR
+} binlog_arg_t;
+
+#define BINLOG_ARG_UNSIGNED 0x80
+
+// Argument types of a format, * widths and precisions included
+typedef struct{
+    const char *fmt;
+    uint8_t types[BINLOG_MAX_ARGS];
+    int nargs;                          // -1 if the format cannot be sent in binary (%n, %Lf, too many args)
+} binlog_format_t;
+
+int binlog_parse(const char *fmt, binlog_format_t *f);
+
+// Writers fill out (BINLOG_RECORD_MAX bytes) and return the record length, 0 if it does not fit
+size_t binlog_session(uint8_t *out, uint32_t pid, int64_t start_us);
+size_t binlog_format_record(uint8_t *out, uint16_t id, const char *fmt);
+size_t binlog_event(uint8_t *out, uint16_t id, uint32_t tid, int64_t ts_us, const binlog_format_t *f, va_list ap);
+
+// Reader side: one table per session, BINLOG_RAW_ID is always known
+typedef struct{
+    char *fmts[BINLOG_MAX_FORMATS];
+    binlog_format_t parsed[BINLOG_MAX_FORMATS];
+} binlog_table_t;
+
+typedef struct{
+    binlog_kind_t kind;
+    uint32_t pid;                       // SESSION
+    uint32_t tid;                       // EVENT
+    int64_t ts_us;                      // SESSION start, EVENT time
+    char text[BINLOG_RECORD_MAX];       // EVENT message, rendered
+} binlog_entry_t;
+
+void binlog_table_reset(binlog_table_t *t);
+// Length of the complete record at the front of buf, 0 if more bytes are
+// needed, -1 if buf does not start with a valid record
+int binlog_record_length(const uint8_t *buf, size_t len);
+// Apply one complete record: SESSION resets the table, FORMAT registers,
+// EVENT is rendered into e->text. 0 on success, -1 for an unknown id or a
+// malformed record
+int binlog_apply(binlog_table_t *t, const uint8_t *rec, size_t len, binlog_entry_t *e);
+
+#endif
@@ -1,60 +1,630 @@
 #include "logger.h"
+#include "binlog.h"
 #include "utilities.h"
+#include <sys/uio.h>
 
 static int log_fd = -1;
+static int log_binary = 0;
 
-void log_event(const char *fmt, ...){
-    char buf[1024];
-    va_list ap;
+static void log_direct(const char *fmt, ...);
 
-    va_start(ap, fmt);
-    int len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
-    va_end(ap);
+// Helper: FIFO write end, -1 while no logger holds the read end (ENXIO)
+static int logger_open_fifo(void){
+    int fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
+    if(fd >= 0){
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    return fd;
+}
 
-    if(len <= 0) return;
-    
-    // Ensure we have space for newline
-    if(len >= (int)sizeof(buf) - 1) len = sizeof(buf) - 2;
-    buf[len++] = '\n';
+int logger_wait_ready(int ready_fd, int timeout_ms){
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // One byte once the log file is open, EOF if the logger exited first
+    struct pollfd p = { .fd = ready_fd, .events = POLLIN };
+    char ok = 0;
+    int rc = poll(&p, 1, timeout_ms);
+    if(rc <= 0 || read(ready_fd, &ok, 1) != 1 || ok != LOGGER_READY_BYTE){
+        close(ready_fd);
+        return -1;
+    }
+    close(ready_fd);
+
+    // It opens the FIFO right after, the read end counts once its open() runs
+    for(;;){
+        int err = 0;
+        pthread_mutex_lock(&log_mutex);
+        if(log_fd == -1){
+            log_fd = logger_open_fifo();
+            err = errno;
+        }
+        int opened = (log_fd != -1);
+        pthread_mutex_unlock(&log_mutex);
+        if(opened) return 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if(err != ENXIO || elapsed >= timeout_ms) return -1;
+        usleep(1000);
+    }
+}
 
+// Helper: write to the FIFO, or to stderr while no logger is there
+static void log_write(const struct iovec *iov, int n){
     pthread_mutex_lock(&log_mutex);
 
-    // Lazy open FIFO
+    // Lazy open FIFO; never waits for a logger that is gone
     if(log_fd == -1){
-        log_fd = open(fifo_path, O_WRONLY);
-        if(log_fd == -1){
+        log_fd = logger_open_fifo();
+    }
+    if(log_fd != -1){
+        size_t total = 0;
+        for(int i = 0; i < n; i++) total += iov[i].iov_len;
+
+        // A blocking FIFO takes it all unless the reader is gone
+        ssize_t w = writev(log_fd, iov, n);
+        if(w >= 0 && (size_t)w == total){
             pthread_mutex_unlock(&log_mutex);
-            write(STDERR_FILENO, "log fallback: ", 14);
-            write(STDERR_FILENO, buf, len);
             return;
         }
+        if(w < 0 && (errno == EPIPE || errno == ENXIO)){
+            close(log_fd);
+            log_fd = -1;
+        }
     }
+    pthread_mutex_unlock(&log_mutex);
 
-    ssize_t w = write(log_fd, buf, len);
-    if(w < 0 && (errno == EPIPE || errno == ENXIO)){
-        close(log_fd);
-        log_fd = -1;
-        pthread_mutex_unlock(&log_mutex);
-        write(STDERR_FILENO, "log fallback: ", 14);
-        write(STDERR_FILENO, buf, len);
+    if(log_binary){
+        static const char msg[] = "log fallback: binary log records lost, logger gone\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
         return;
     }
+    write(STDERR_FILENO, "log fallback: ", 14);
+    writev(STDERR_FILENO, iov, n);
+}
 
-    pthread_mutex_unlock(&log_mutex);
+/* ===========================
+ *   Levels
+ * =========================== */
+
+unsigned char log_threshold[LOG_MOD_COUNT] = { [0 ... LOG_MOD_COUNT - 1] = LOG_LVL_INFO };
+
+static const char *log_module_names[LOG_MOD_COUNT] = {
+    "MAIN", "CONFIG", "STARTUP", "LOGGER",
+    "CONNECTION", "CLIENT", "SBUFFER", "STATS",
+    "DATA", "TEMP", "HUMID", "LIGHT",
+    "STORAGE", "SQL", "TSDB", "APPLOG", "PARTITION",
+    "JOURNAL", "HOTCACHE", "MAINT", "QUERY",
+    "CLOUD", "MQTT", "SCHED", "OUTBOX", "REGISTRY"
+};
+
+static const char *log_level_names[] = { "off", "error", "warn", "info", "debug", "trace" };
+
+int log_level_parse(const char *name){
+    for(int i = LOG_LVL_OFF; i <= LOG_LVL_TRACE; i++){
+        if(strcasecmp(name, log_level_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char *log_level_name(int level){
+    return (level >= LOG_LVL_OFF && level <= LOG_LVL_TRACE) ? log_level_names[level] : "?";
+}
+
+// Helper: one "MODULE=level", "*=level" or bare level entry
+static int log_level_entry(const char *entry){
+    const char *eq = strchr(entry, '=');
+    int level = log_level_parse(eq ? eq + 1 : entry);
+    if(level < 0) return -1;
+
+    size_t mlen = eq ? (size_t)(eq - entry) : 0;
+    if(!eq || (mlen == 1 && entry[0] == '*')){
+        for(int m = 0; m < LOG_MOD_COUNT; m++){
+            __atomic_store_n(&log_threshold[m], (unsigned char)level, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+    for(int m = 0; m < LOG_MOD_COUNT; m++){
+        if(strlen(log_module_names[m]) == mlen && strncasecmp(entry, log_module_names[m], mlen) == 0){
+            __atomic_store_n(&log_threshold[m], (unsigned char)level, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int log_levels_apply(const char *spec){
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", spec);
+    char *save = NULL;
+    for(char *tok = strtok_r(copy, " ,\t", &save); tok; tok = strtok_r(NULL, " ,\t", &save)){
+        if(log_level_entry(tok) != 0) return -1;
+    }
+    return 0;
+}
+
+size_t log_levels_format(char *out, size_t len){
+    size_t used = 0;
+    for(int m = 0; m < LOG_MOD_COUNT && used < len; m++){
+        int level = __atomic_load_n(&log_threshold[m], __ATOMIC_RELAXED);
+        used += snprintf(out + used, len - used, "%s=%s ", log_module_names[m], log_level_name(level));
+    }
+    if(used < len){
+        used += snprintf(out + used, len - used, "floor=%s\n", log_level_name(LOG_COMPILE_LEVEL));
+    }
+    return (used < len) ? used : len - 1;
+}
+
+/* ===========================
+ *   Binary records
+ * =========================== */
+
+// Format strings are told apart by address (they are all literals); the
+// table is read without a lock, a slot is published only after its FORMAT
+// record went out, so no event can reach the logger ahead of its format.
+static struct{
+    const char *key[LOG_FORMAT_SLOTS];  // published with release
+    uint16_t id[LOG_FORMAT_SLOTS];
+    binlog_format_t parsed[BINLOG_MAX_FORMATS];
+    int next_id;
+    int used;
+    pthread_mutex_t lock;
+} formats = {
+    .next_id = BINLOG_RAW_ID + 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const binlog_format_t raw_format = {
+    .fmt = "%s",
+    .types = { BINLOG_ARG_STR },
+    .nargs = 1,
+};
+
+static __thread uint32_t my_tid = 0;
+
+void log_set_binary(int on){
+    log_binary = on;
+}
+
+static size_t format_slot(const char *fmt){
+    uintptr_t a = (uintptr_t)fmt;
+    return (size_t)((a >> 3) ^ (a >> 13)) & (LOG_FORMAT_SLOTS - 1);
+}
+
+// Helper: parsed format and id of fmt, registering it on first use; NULL
+// when it has to go as preformatted text
+static const binlog_format_t *format_lookup(const char *fmt, uint16_t *id){
+    size_t h = format_slot(fmt);
+    for(const char *k; (k = __atomic_load_n(&formats.key[h], __ATOMIC_ACQUIRE)) != NULL; h = (h + 1) & (LOG_FORMAT_SLOTS - 1)){
+        if(k == fmt){
+            *id = formats.id[h];
+            return (*id == LOG_FORMAT_TEXT_ID) ? NULL : &formats.parsed[*id];
+        }
+    }
+
+    pthread_mutex_lock(&formats.lock);
+    h = format_slot(fmt);
+    while(formats.key[h] && formats.key[h] != fmt) h = (h + 1) & (LOG_FORMAT_SLOTS - 1);
+    if(formats.key[h] == fmt){
+        *id = formats.id[h];
+        pthread_mutex_unlock(&formats.lock);
+        return (*id == LOG_FORMAT_TEXT_ID) ? NULL : &formats.parsed[*id];
+    }
+    // Kept at most half full so probes stay short
+    if(formats.used >= LOG_FORMAT_SLOTS / 2){
+        pthread_mutex_unlock(&formats.lock);
+        return NULL;
+    }
+
+    uint16_t new_id = LOG_FORMAT_TEXT_ID;
+    if(formats.next_id < BINLOG_MAX_FORMATS && binlog_parse(fmt, &formats.parsed[formats.next_id]) == 0){
+        uint8_t rec[BINLOG_RECORD_MAX];
+        size_t len = binlog_format_record(rec, (uint16_t)formats.next_id, fmt);
+        if(len > 0){
+            struct iovec v = { .iov_base = rec, .iov_len = len };
+            log_write(&v, 1);
+            new_id = (uint16_t)formats.next_id++;
+        }
+    }
+    formats.id[h] = new_id;
+    formats.used++;
+    __atomic_store_n(&formats.key[h], fmt, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&formats.lock);
+
+    *id = new_id;
+    return (new_id == LOG_FORMAT_TEXT_ID) ? NULL : &formats.parsed[new_id];
+}
+
+// Helper: BINLOG_RAW_ID event carrying already formatted text
+static size_t encode_raw(uint8_t *out, uint32_t tid, int64_t ts_us, ...){
+    va_list ap;
+    va_start(ap, ts_us);
+    size_t len = binlog_event(out, BINLOG_RAW_ID, tid, ts_us, &raw_format, ap);
+    va_end(ap);
+    return len;
+}
+
+// Helper: one EVENT record, the arguments copied as they are
+static size_t encode_event(uint8_t *out, const char *fmt, va_list ap){
+    if(my_tid == 0) my_tid = (uint32_t)syscall(SYS_gettid);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t ts_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    uint16_t id;
+    const binlog_format_t *f = format_lookup(fmt, &id);
+    if(f){
+        va_list copy;
+        va_copy(copy, ap);
+        size_t len = binlog_event(out, id, my_tid, ts_us, f, copy);
+        va_end(copy);
+        if(len > 0) return len;
+    }
+
+    // Formats binary mode cannot carry, and events too large for a record
+    char text[LOG_LINE_MAX];
+    if(vsnprintf(text, sizeof(text), fmt, ap) < 0) return 0;
+    return encode_raw(out, my_tid, ts_us, text);
+}
+
+/* ===========================
+ *   Per-thread rings
+ * =========================== */
+
+// Single producer (the owning thread), single consumer (the drain).
+// head and tail count bytes ever written and forwarded; a line becomes
+// visible to the drain only when head moves past its last byte.
+typedef struct log_ring{
+    char *buf;
+    size_t mask;                        // size - 1, size is a power of two
+    size_t head;                        // owner only, published with release
+    size_t tail;                        // drain only, published with release
+    unsigned long long dropped;
+    int orphaned;                       // owner exited, freed once drained
+    struct log_ring *next;
+} log_ring_t;
+
+static struct{
+    int running;                        // log_event uses the rings
+    int stopping;
+    int block;                          // wait for room instead of dropping
+    size_t ring_bytes;
+    pthread_t thread;
+    pthread_mutex_t lock;               // ring list
+    pthread_cond_t cond;                // drain wakeup
+    log_ring_t *rings;
+    pthread_key_t key;                  // orphans the ring at thread exit
+    int key_created;
+    unsigned long long freed_dropped;   // drops counted by rings already freed
+} drain = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread log_ring_t *my_ring = NULL;
+
+static void ring_orphan(void *arg){
+    log_ring_t *r = arg;
+    __atomic_store_n(&r->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+// Helper: the calling thread's ring, created on its first line
+static log_ring_t *ring_attach(void){
+    log_ring_t *r = calloc(1, sizeof(*r));
+    if(!r) return NULL;
+    r->buf = malloc(drain.ring_bytes);
+    if(!r->buf){
+        free(r);
+        return NULL;
+    }
+    r->mask = drain.ring_bytes - 1;
+    pthread_setspecific(drain.key, r);
+
+    pthread_mutex_lock(&drain.lock);
+    r->next = drain.rings;
+    drain.rings = r;
+    pthread_mutex_unlock(&drain.lock);
+
+    my_ring = r;
+    return r;
 }
 
-void run_logger_process(){
+// Helper: copy one line in; 0 when queued, -1 when dropped (ring full),
+// 1 when the drain is gone and the caller must write it itself
+static int ring_put(log_ring_t *r, const char *line, size_t len){
+    size_t size = r->mask + 1;
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    while(size - (head - tail) < len){
+        if(!drain.block){
+            __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if(!__atomic_load_n(&drain.running, __ATOMIC_ACQUIRE)) return 1;
+        pthread_cond_signal(&drain.cond);
+        usleep(LOG_RING_BLOCK_WAIT_US);
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    }
+
+    size_t at = head & r->mask;
+    size_t first = (len < size - at) ? len : size - at;
+    memcpy(r->buf + at, line, first);
+    memcpy(r->buf, line + first, len - first);
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+
+    // Wake the drain early only when the ring crosses half full
+    if(head - tail < size / 2 && head + len - tail >= size / 2){
+        pthread_cond_signal(&drain.cond);
+    }
+    return 0;
+}
+
+// Helper: forward what the rings hold, free drained orphans; bytes moved,
+// more set when rings were left for the next pass
+static size_t drain_pass(int *more){
+    struct iovec iov[LOG_DRAIN_IOV_MAX];
+    log_ring_t *owner[LOG_DRAIN_IOV_MAX];
+    int n = 0;
+
+    pthread_mutex_lock(&drain.lock);
+    log_ring_t **link = &drain.rings;
+    while(*link && n + 2 <= LOG_DRAIN_IOV_MAX){
+        log_ring_t *r = *link;
+        int orphaned = __atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        size_t tail = r->tail;
+
+        if(head == tail){
+            if(orphaned){
+                *link = r->next;
+                drain.freed_dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+                free(r->buf);
+                free(r);
+                continue;
+            }
+            link = &r->next;
+            continue;
+        }
+
+        // The used part may wrap around the end of the buffer
+        size_t at = tail & r->mask;
+        size_t len = head - tail;
+        size_t first = (len < r->mask + 1 - at) ? len : r->mask + 1 - at;
+        iov[n] = (struct iovec){ .iov_base = r->buf + at, .iov_len = first };
+        owner[n++] = r;
+        if(len > first){
+            iov[n] = (struct iovec){ .iov_base = r->buf, .iov_len = len - first };
+            owner[n++] = r;
+        }
+        link = &r->next;
+    }
+    *more = (*link != NULL);
+    pthread_mutex_unlock(&drain.lock);
+
+    // Rings are freed only here, so they stay valid without the lock
+    if(n == 0) return 0;
+    log_write(iov, n);
+
+    size_t moved = 0;
+    for(int i = 0; i < n; i++){
+        log_ring_t *r = owner[i];
+        __atomic_store_n(&r->tail, r->tail + iov[i].iov_len, __ATOMIC_RELEASE);
+        moved += iov[i].iov_len;
+    }
+    return moved;
+}
+
+unsigned long long log_ring_dropped(void){
+    pthread_mutex_lock(&drain.lock);
+    unsigned long long total = drain.freed_dropped;
+    for(log_ring_t *r = drain.rings; r; r = r->next){
+        total += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&drain.lock);
+    return total;
+}
+
+static void *log_drain_thread(void *arg){
+    (void)arg;
+    unsigned long long reported = log_ring_dropped();
+    time_t last_report = time(NULL);
+
+    for(;;){
+        int stopping = __atomic_load_n(&drain.stopping, __ATOMIC_ACQUIRE);
+        int more = 0;
+        size_t moved = drain_pass(&more);
+        if(stopping && moved == 0 && !more) break;
+
+        // Dropped lines are reported in the log itself, at most every
+        // LOG_DROP_REPORT_SEC
+        if(time(NULL) - last_report >= LOG_DROP_REPORT_SEC || stopping){
+            unsigned long long dropped = log_ring_dropped();
+            if(dropped > reported){
+                if(__atomic_load_n(&log_threshold[LOG_MOD_LOGGER], __ATOMIC_RELAXED) >= LOG_LVL_WARN){
+                    log_direct("[LOGGER] %llu log lines dropped, thread log buffer full (%llu total)",
+                               dropped - reported, dropped);
+                }
+                reported = dropped;
+            }
+            last_report = time(NULL);
+        }
+        if(stopping || more) continue;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_mutex_lock(&drain.lock);
+        pthread_cond_timedwait(&drain.cond, &drain.lock, &ts);
+        pthread_mutex_unlock(&drain.lock);
+    }
+    return NULL;
+}
+
+int log_ring_start(size_t ring_bytes, int block_when_full){
+    if(__atomic_load_n(&drain.running, __ATOMIC_ACQUIRE)) return 0;
+
+    // Power of two, with room for a few full lines or records
+    size_t size = 2 * BINLOG_RECORD_MAX;
+    while(size < ring_bytes) size *= 2;
+    drain.ring_bytes = size;
+    drain.block = block_when_full;
+    drain.stopping = 0;
+
+    if(!drain.key_created){
+        if(pthread_key_create(&drain.key, ring_orphan) != 0) return -1;
+        drain.key_created = 1;
+    }
+    if(pthread_create(&drain.thread, NULL, log_drain_thread, NULL) != 0) return -1;
+    __atomic_store_n(&drain.running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_ring_stop(void){
+    if(!__atomic_load_n(&drain.running, __ATOMIC_ACQUIRE)) return;
+
+    // New lines go straight to the FIFO from here, the drain empties the rings
+    __atomic_store_n(&drain.running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&drain.stopping, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&drain.cond);
+    pthread_join(drain.thread, NULL);
+}
+
+// Helper: format (or encode) one line, into the caller's ring unless direct
+static void log_emit(int direct, const char *fmt, va_list ap){
+    char buf[BINLOG_RECORD_MAX];
+    size_t len;
+
+    if(log_binary){
+        len = encode_event((uint8_t *)buf, fmt, ap);
+        if(len == 0) return;
+    }
+    else{
+        int n = vsnprintf(buf, LOG_LINE_MAX - 1, fmt, ap);
+        if(n <= 0) return;
+
+        // Ensure we have space for newline
+        if(n >= LOG_LINE_MAX - 1) n = LOG_LINE_MAX - 2;
+        buf[n++] = '\n';
+        len = (size_t)n;
+    }
+
+    // Own ring, no lock and no syscall
+    if(!direct && __atomic_load_n(&drain.running, __ATOMIC_ACQUIRE)){
+        log_ring_t *r = my_ring ? my_ring : ring_attach();
+        if(r && ring_put(r, buf, len) <= 0) return;
+    }
+
+    struct iovec v = { .iov_base = buf, .iov_len = len };
+    log_write(&v, 1);
+}
+
+static void log_direct(const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    log_emit(1, fmt, ap);
+    va_end(ap);
+}
+
+void log_event(const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    log_emit(0, fmt, ap);
+    va_end(ap);
+}
+
+// Helper: binary stream from the FIFO; rendered into logf, or appended
+// as it is to binf for log_decode. Returns the last read() result
+static ssize_t logger_read_binary(int fd, FILE *logf, FILE *binf){
+    static uint8_t buf[LOGGER_READ_MAX + BINLOG_RECORD_MAX];
+    static binlog_table_t table;
+    static binlog_entry_t entry;
+    size_t have = 0;
+    int seq = 0;
+    time_t last_sec = -1;
+    char timestr[32] = "";
+
+    binlog_table_reset(&table);
+    if(binf){
+        uint8_t rec[BINLOG_RECORD_MAX];
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        size_t len = binlog_session(rec, (uint32_t)getppid(), (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+        fwrite(rec, 1, len, binf);
+    }
+
+    ssize_t r;
+    while((r = read(fd, buf + have, LOGGER_READ_MAX)) > 0){
+        have += (size_t)r;
+        size_t at = 0;
+        int len;
+
+        // Whole records only, a partial one waits for the next read
+        while((len = binlog_record_length(buf + at, have - at)) > 0){
+            if(binf){
+                fwrite(buf + at, 1, (size_t)len, binf);
+            }
+            else if(binlog_apply(&table, buf + at, (size_t)len, &entry) != 0){
+                fprintf(logf, "%d %s [LOGGER] Undecodable log record (kind %d, %d bytes)\n",
+                        seq++, timestr, buf[at + 2], len);
+            }
+            else if(entry.kind == BINLOG_EVENT){
+                time_t sec = (time_t)(entry.ts_us / 1000000);
+                if(sec != last_sec){
+                    struct tm tm;
+                    localtime_r(&sec, &tm);
+                    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+                    last_sec = sec;
+                }
+                fprintf(logf, "%d %s %s\n", seq++, timestr, entry.text);
+            }
+            at += (size_t)len;
+        }
+        if(len < 0){
+            // Only one writer and whole records, so this is not expected
+            fprintf(logf, "%d %s [LOGGER] Binary log stream out of sync, %zu bytes skipped\n",
+                    seq++, timestr, have - at);
+            at = have;
+        }
+        memmove(buf, buf + at, have - at);
+        have -= at;
+    }
+    if(binf) fflush(binf);
+    binlog_table_reset(&table);
+    return r;
+}
+
+void run_logger_process(int ready_fd, log_format_t mode){
     FILE *logf = fopen(LOG_FILE, "a");
     if(!logf){
         perror("fopen gateway.log");
         exit(EXIT_FAILURE);
     }
+    FILE *binf = NULL;
+    if(mode == LOG_FORMAT_BINFILE){
+        binf = fopen(LOG_BIN_FILE, "ab");
+        if(!binf){
+            perror("fopen gateway.binlog");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(logf, "[LOGGER] Binary log, decode %s with log_decode\n", LOG_BIN_FILE);
+    }
     
     setvbuf(logf, NULL, _IOLBF, 0);
+
+    // Tell the gateway to open its end of the FIFO
+    char ok = LOGGER_READY_BYTE;
+    if(write(ready_fd, &ok, 1) != 1){
+        perror("logger ready");
+    }
+    close(ready_fd);
     
     int seq = 0;
-    char buf[4096];
-    static char leftover[256] = {0}; // Buffer for incomplete lines
+    static char buf[LOGGER_READ_MAX];   // the drain writes in batches
+    static char leftover[LOG_LINE_MAX] = {0}; // Buffer for incomplete lines
     size_t leftover_len = 0;
     
     int fd = open(fifo_path, O_RDONLY);
@@ -65,6 +635,20 @@ void run_logger_process(){
     }
 
     ssize_t r;
+    if(mode != LOG_FORMAT_TEXT){
+        r = logger_read_binary(fd, logf, binf);
+        if(binf) fclose(binf);
+        if(r == 0){
+            printf("[LOGGER] Logger shutdowns completely\n");
+        }
+        else{
+            perror("read fifo");
+        }
+        close(fd);
+        fflush(logf);
+        fclose(logf);
+        exit(0);
+    }
     // while(!stop_flag){
         // int fd = open(fifo_path, O_RDONLY);
         // if(fd == -1){
@@ -161,6 +745,9 @@ void run_logger_process(){
 }
 
 void close_logger_process(void){
+    // Rings first, their lines go out before the EOF
+    log_ring_stop();
+
     pthread_mutex_lock(&log_mutex);
     if(log_fd != -1){
         close(log_fd); // EOF
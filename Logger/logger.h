@@ -7,13 +7,123 @@
 
 #define MAX_LOG_SIZE   (5 * 1024 * 1024)
 #define FLUSH_INTERVAL 50
+#define LOGGER_READY_TIMEOUT_MS 2000
+#define LOGGER_READY_BYTE 'R'
+#define LOGGER_READ_MAX 65536
+#define LOG_LINE_MAX 1024               // longer lines are cut
+#define LOG_DRAIN_INTERVAL_MS 20        // or earlier once a ring is half full
+#define LOG_DRAIN_IOV_MAX 64            // per writev
+#define LOG_RING_BLOCK_WAIT_US 200      // block policy poll
+#define LOG_DROP_REPORT_SEC 10
+#define LOG_FORMAT_SLOTS 2048           // format registry, power of two
+#define LOG_FORMAT_TEXT_ID 0xFFFF       // registry: format sent preformatted
+
+/* ===========================
+ *   Levels and modules
+ * =========================== */
+
+#define LOG_LVL_OFF   0
+#define LOG_LVL_ERROR 1
+#define LOG_LVL_WARN  2
+#define LOG_LVL_INFO  3
+#define LOG_LVL_DEBUG 4                 // per round / per upload
+#define LOG_LVL_TRACE 5                 // per packet
+
+// Build-time floor: calls above it are compiled out, arguments included
+// (MakefileBBB builds with LOG_LVL_INFO)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LVL_TRACE
+#endif
+
+// One per "[MODULE]" prefix; keep log_module_names in logger.c in the same order
+typedef enum{
+    LOG_MOD_MAIN, LOG_MOD_CONFIG, LOG_MOD_STARTUP, LOG_MOD_LOGGER,
+    LOG_MOD_CONNECTION, LOG_MOD_CLIENT, LOG_MOD_SBUFFER, LOG_MOD_STATS,
+    LOG_MOD_DATA, LOG_MOD_TEMP, LOG_MOD_HUMID, LOG_MOD_LIGHT,
+    LOG_MOD_STORAGE, LOG_MOD_SQL, LOG_MOD_TSDB, LOG_MOD_APPLOG, LOG_MOD_PARTITION,
+    LOG_MOD_JOURNAL, LOG_MOD_HOTCACHE, LOG_MOD_MAINT, LOG_MOD_QUERY,
+    LOG_MOD_CLOUD, LOG_MOD_MQTT, LOG_MOD_SCHED, LOG_MOD_OUTBOX, LOG_MOD_REGISTRY,
+    LOG_MOD_COUNT
+} log_module_t;
+
+// Runtime threshold per module, LOG_LVL_INFO until changed
+extern unsigned char log_threshold[LOG_MOD_COUNT];
+
+// LOG_INFO(CLIENT, "fmt", ...) logs "[CLIENT] fmt". Below the module's
+// threshold it costs one load and one branch, the arguments are not
+// evaluated; above LOG_COMPILE_LEVEL it is not compiled at all.
+#define LOG_AT(level, mod, fmt, ...) \
+    do{ \
+        if(__builtin_expect(__atomic_load_n(&log_threshold[LOG_MOD_##mod], __ATOMIC_RELAXED) >= (level), \
+                            (level) <= LOG_LVL_INFO)){ \
+            log_event("[" #mod "] " fmt, ##__VA_ARGS__); \
+        } \
+    }while(0)
+
+// Still type-checked, never emitted
+#define LOG_ELIDED(mod, fmt, ...) \
+    do{ \
+        if(0) log_event("[" #mod "] " fmt, ##__VA_ARGS__); \
+    }while(0)
+
+#define LOG_ERROR(mod, fmt, ...) LOG_AT(LOG_LVL_ERROR, mod, fmt, ##__VA_ARGS__)
+#define LOG_WARN(mod, fmt, ...)  LOG_AT(LOG_LVL_WARN, mod, fmt, ##__VA_ARGS__)
+#define LOG_INFO(mod, fmt, ...)  LOG_AT(LOG_LVL_INFO, mod, fmt, ##__VA_ARGS__)
+#if LOG_COMPILE_LEVEL >= LOG_LVL_DEBUG
+#define LOG_DEBUG(mod, fmt, ...) LOG_AT(LOG_LVL_DEBUG, mod, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(mod, fmt, ...) LOG_ELIDED(mod, fmt, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LVL_TRACE
+#define LOG_TRACE(mod, fmt, ...) LOG_AT(LOG_LVL_TRACE, mod, fmt, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(mod, fmt, ...) LOG_ELIDED(mod, fmt, ##__VA_ARGS__)
+#endif
+
+// "off" ... "trace", -1 if unknown
+int log_level_parse(const char *name);
+const char *log_level_name(int level);
+// Space or comma separated "MODULE=level" entries, a bare level or
+// "*=level" sets every module; -1 at the first bad entry (earlier ones stay)
+int log_levels_apply(const char *spec);
+// "MAIN=info CONFIG=info ... floor=trace\n"
+size_t log_levels_format(char *out, size_t len);
 
 extern pthread_mutex_t log_mutex;
 extern const char *fifo_path;
 extern volatile sig_atomic_t stop_flag;
 
+// Per-thread log rings.
+// Once log_ring_start ran, log_event formats into a buffer owned by the
+// calling thread, without a lock or a syscall, and one drain thread
+// forwards all buffers to the FIFO with writev. A full buffer drops the
+// line (counted and reported in the log) or, with block_when_full, makes
+// the thread wait. Before the start and after the stop, and in the
+// benchmarks, log_event writes to the FIFO itself.
+int log_ring_start(size_t ring_bytes, int block_when_full);
+void log_ring_stop(void);
+unsigned long long log_ring_dropped(void);
+
+// What goes through the FIFO and where the logger process puts it
+typedef enum{
+    LOG_FORMAT_TEXT,                    // formatted lines, gateway.log
+    LOG_FORMAT_BINARY,                  // binlog records, rendered into gateway.log
+    LOG_FORMAT_BINFILE                  // binlog records, kept as they are in LOG_BIN_FILE
+} log_format_t;
+
+// Binary records (binlog.h).
+// log_event then skips formatting: it sends the id of its format string,
+// registered on first use, a timestamp, the thread id and the raw
+// arguments. fmt must be a string literal, formats are told apart by
+// address. Turned on once the logger process is ready, before other threads log.
+void log_set_binary(int on);
+
 void log_event(const char *fmt, ...);
-void run_logger_process();
+// Logger process; writes LOGGER_READY_BYTE to ready_fd once the log file is open
+void run_logger_process(int ready_fd, log_format_t mode);
+// Gateway side of that handshake, opens the FIFO; 0 when ready, -1 if the
+// logger exited or did not answer in time (log_event then writes to stderr)
+int logger_wait_ready(int ready_fd, int timeout_ms);
 void close_logger_process(void);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,13 @@
 #include "data_manager.h"
 #include "storage_manager.h"
 #include "cloud_manager.h"
+#include "maintenance_manager.h"
+#include "query_service.h"
+#include "config.h"
+#include "journal.h"
+#include "hot_cache.h"
+#include "upload_scheduler.h"
+#include "startup.h"
 
 pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER; // For sensor_stats
 pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER; // For logger process
@@ -17,18 +24,48 @@ sensor_stat_t *stats_head = NULL;
 pid_t logger_pid = 0;
 struct mosquitto *mosq = NULL;
 
+// Helper: journal replay target
+static void replay_packet(void *ctx, sensor_packet_t *pkt){
+    (void)ctx;
+    sbuffer_insert(&sbuffer, pkt);
+}
+
 int main(int argc, char **argv){
-    if(argc != 2){
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    if(argc != 2 && argc != 3){
+        fprintf(stderr, "Usage: %s <port> [config_file]\n", argv[0]);
         return 1;
     }
     int port = atoi(argv[1]);
+    startup_begin();
+
+    const char *config_path = (argc == 3) ? argv[2] : CONFIG_FILE;
+    if(config_load(config_path) != 0){
+        fprintf(stderr, "Invalid configuration in %s\n", config_path);
+        return 1;
+    }
 
     signal(SIGINT, sigint_handler);
     signal(SIGPIPE, SIG_IGN);  // Prevent SIGPIPE crashes
+    signal(SIGHUP, sighup_handler);  // Reload device registry
     
     ensure_fifo_exists();
 
+    // The logger process needs the format before it reads anything
+    log_format_t log_mode = LOG_FORMAT_TEXT;
+    if(strcmp(g_config.log_format, "binary") == 0){
+        log_mode = LOG_FORMAT_BINARY;
+    }
+    else if(strcmp(g_config.log_format, "binfile") == 0){
+        log_mode = LOG_FORMAT_BINFILE;
+    }
+
+    // Logger readiness handshake
+    int ready_pipe[2];
+    if(pipe(ready_pipe) != 0){
+        perror("pipe");
+        return 1;
+    }
+
     // Fork logger
     logger_pid = fork();
     
@@ -40,18 +77,51 @@ int main(int argc, char **argv){
     if(logger_pid == 0){
         // Child: logger process
         signal(SIGINT, SIG_IGN);  // Logger ignores SIGINT
-        run_logger_process();
+        signal(SIGHUP, SIG_IGN);
+        close(ready_pipe[0]);
+        run_logger_process(ready_pipe[1], log_mode);
         exit(0);
     }
 
     // Parent: main process
-    usleep(50000); // Wait 50ms for logger to initialize
+    close(ready_pipe[1]);
+    if(logger_wait_ready(ready_pipe[0], LOGGER_READY_TIMEOUT_MS) != 0){
+        fprintf(stderr, "[MAIN] Logger process not ready, logging to stderr\n");
+    }
+    else if(log_mode != LOG_FORMAT_TEXT){
+        log_set_binary(1);
+    }
+    startup_ready(STARTUP_LOGGER);
+
+    // Threads log into their own rings from here, drained in batches
+    int log_block = (strcmp(g_config.log_ring_full, "block") == 0);
+    if(!log_block && strcmp(g_config.log_ring_full, "drop") != 0){
+        LOG_WARN(MAIN, "Unknown log_ring_full '%s', dropping lines when full", g_config.log_ring_full);
+    }
+    if(log_ring_start((size_t)g_config.log_ring_kb * 1024, log_block) != 0){
+        LOG_ERROR(MAIN, "Log drain thread failed to start, logging directly");
+    }
+    if(log_mode == LOG_FORMAT_TEXT && strcmp(g_config.log_format, "text") != 0){
+        LOG_WARN(MAIN, "Unknown log_format '%s', logging text", g_config.log_format);
+    }
+    if(log_levels_apply(g_config.log_level) != 0){
+        LOG_WARN(MAIN, "Unknown log_level '%s', keeping info", g_config.log_level);
+    }
+    if(log_levels_apply(g_config.log_levels) != 0){
+        LOG_WARN(MAIN, "Bad entry in log_levels '%s', later entries ignored", g_config.log_levels);
+    }
     
     sbuffer_init(&sbuffer);
-    log_event("[MAIN] Gateway system started on port %d", port);
+    LOG_INFO(MAIN, "Gateway system started on port %d", port);
+    config_log();
+    hot_cache_init(g_config.hot_cache_sensors, g_config.hot_cache_samples);
+    upload_sched_init();
     
+    // All threads start at once: storage and cloud connect in the
+    // background, the sensor port listens right away and accepts as soon
+    // as STARTUP_BUFFER is ready below
     int temp;
-    pthread_t connection_thread, data_thread, storage_thread, cloud_thread;
+    pthread_t connection_thread, data_thread, storage_thread, cloud_thread, maintenance_thread, query_thread;
     
     temp = pthread_create(&connection_thread, NULL, connection_manager_thread, &port);
     if(temp != 0){
@@ -77,11 +147,41 @@ int main(int argc, char **argv){
         printf("ERROR\n");
     }
 
+    temp = pthread_create(&maintenance_thread, NULL, maintenance_manager_thread, NULL);
+    if(temp != 0){
+        perror("pthread_create error");
+        printf("ERROR\n");
+    }
+
+    temp = pthread_create(&query_thread, NULL, query_service_thread, NULL);
+    if(temp != 0){
+        perror("pthread_create error");
+        printf("ERROR\n");
+    }
+
+    // Journal first, so packets left over from a crash re-enter the pipeline
+    // ahead of new ones
+    if(g_config.journal_enabled){
+        if(journal_open(g_config.journal_dir, g_config.journal_sync_ms) == 0){
+            journal_replay(replay_packet, NULL);
+        }
+        else{
+            LOG_WARN(MAIN, "Ingest journal unavailable, running without crash protection");
+        }
+    }
+    // Raw uploads read every packet accepted from here on (ignored if the
+    // cloud thread already failed to start them)
+    if(strcmp(g_config.cloud_upload, "stats") != 0){
+        sbuffer_enable_cloud(&sbuffer);
+    }
+    startup_ready(STARTUP_BUFFER);
+
     temp = pthread_join(connection_thread, NULL);
     if(temp != 0){
         perror("pthread_join error");
         printf("ERROR\n");
     }
+    LOG_INFO(MAIN, "Stop requested, shutting down");
 
     temp = pthread_join(data_thread, NULL);
     if(temp != 0){
@@ -100,9 +200,24 @@ int main(int argc, char **argv){
         perror("pthread_join error");
         printf("ERROR\n");
     }
+
+    temp = pthread_join(maintenance_thread, NULL);
+    if(temp != 0){
+        perror("pthread_join error");
+        printf("ERROR\n");
+    }
+
+    temp = pthread_join(query_thread, NULL);
+    if(temp != 0){
+        perror("pthread_join error");
+        printf("ERROR\n");
+    }
     
     sbuffer_free_all(&sbuffer);
     stats_free_all();
+    journal_close();
+    hot_cache_free();
+    upload_sched_free();
 
     // Log BEFORE shutting down logger
     // printf("[MAIN] Gateway shutdown complete");
@@ -157,7 +272,7 @@ int main(int argc, char **argv){
     // }
 
     printf("[MAIN] Gateway shutdowns completely\n");
-    log_event("[MAIN] Gateway shutdowns completely");
+    LOG_INFO(MAIN, "Gateway shutdowns completely");
 
     // Close FIFO writer → EOF
     close_logger_process();
@@ -26,6 +26,7 @@
 
 #define FIFO_PATH "../Logger/logFifo"
 #define LOG_FILE  "../Record/gateway.log"
+#define LOG_BIN_FILE "../Record/gateway.binlog"
 #define DB_FILE   "../Database/sensors.db"
 #define MAX_LINE 256
 
@@ -33,7 +34,8 @@ typedef struct{
     uint8_t id;
     uint8_t type;
     double value;
-    time_t ts;
+    int64_t ts_ms;  // epoch milliseconds
+    uint64_t seq;   // ingest journal sequence, 0 if not journaled
 } sensor_packet_t;
 
 typedef struct sbuffer_node{
@@ -41,7 +43,7 @@ typedef struct sbuffer_node{
     uint8_t refcount; 
     uint8_t processed_by_data;
     uint8_t processed_by_storage;
-    //uint8_t processed_by_cloud;
+    uint8_t processed_by_cloud;     // set on insert when raw uploads are off
     struct sbuffer_node *next;
 } sbuffer_node_t;
 
@@ -50,6 +52,8 @@ typedef struct{
     sbuffer_node_t *tail;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    uint8_t cloud_consumer;         // raw uploads read every packet too
+    uint8_t cloud_off;              // cloud thread gave up, enable is ignored
 } sbuffer_t;
 
 // Per-sensor running average table
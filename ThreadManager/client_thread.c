@@ -1,6 +1,19 @@
 #include "client_thread.h"
 #include "sbuffer.h"
 #include "logger.h"
+#include "utilities.h"
+#include "startup.h"
+
+// Helper: packet timestamp, strictly increasing per connection so that
+// two readings within the same millisecond keep distinct (id, type, ts) keys
+static int64_t next_packet_ts(int64_t *last_ts){
+    int64_t ts = time_now_ms();
+    if(ts <= *last_ts){
+        ts = *last_ts + 1;
+    }
+    *last_ts = ts;
+    return ts;
+}
 
 void *client_thread_func(void *arg){
     client_info_t *client_info = (client_info_t*)arg;
@@ -9,7 +22,7 @@ void *client_thread_func(void *arg){
     // Set timeout
     struct timeval timeout = {.tv_sec = 5, .tv_usec = 0};
     if(setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0){
-        log_event("[CLIENT] Failed to set timeout: %s", strerror(errno));
+        LOG_ERROR(CLIENT, "Failed to set timeout: %s", strerror(errno));
         close(client_fd);
         free(client_info);
         return NULL;
@@ -22,6 +35,7 @@ void *client_thread_func(void *arg){
     char read_buffer[READ_BUFFER_SIZE];
     size_t buffer_len = 0;
     size_t packets_received = 0;
+    int64_t last_ts = 0;
     
     // Main read loop
     while(!stop_flag){
@@ -32,11 +46,11 @@ void *client_thread_func(void *arg){
             // Error happens
             if(errno == EAGAIN || errno == EWOULDBLOCK){
                 // Timeout for 5s, client connected to server but does not send any data    
-                log_event("[CLIENT] Connection timeout for %s:%d", client_ip, client_port);
+                LOG_INFO(CLIENT, "Connection timeout for %s:%d", client_ip, client_port);
             } 
             else{
                 // (Network error, etc)
-                log_event("[CLIENT] Read error for %s:%d: %s", client_ip, client_port, strerror(errno));
+                LOG_ERROR(CLIENT, "Read error for %s:%d: %s", client_ip, client_port, strerror(errno));
             }
             break;
         }
@@ -71,20 +85,21 @@ void *client_thread_func(void *arg){
                     if(parsed == 3){
                         if(first_sensor_id == -1){
                             first_sensor_id = sensor_id;
-                            log_event("[CLIENT] Sensor node ID %d from %s:%d opened new connection", first_sensor_id, client_ip, client_port);
+                            LOG_INFO(CLIENT, "Sensor node ID %d from %s:%d opened new connection", first_sensor_id, client_ip, client_port);
                         }
                         
                         sensor_packet_t packet = {
                             .id = sensor_id,
                             .type = sensor_type,
                             .value = sensor_value,
-                            .ts = time(NULL)
+                            .ts_ms = next_packet_ts(&last_ts)
                         };
                         
                         sbuffer_insert(&sbuffer, &packet);
+                        startup_packet_accepted();
                         packets_received++;
 
-                        log_event("[CLIENT] Received data ID %d type %d value %.2f from %s:%d", sensor_id, sensor_type, sensor_value, client_ip, client_port);
+                        LOG_TRACE(CLIENT, "Received data ID %d type %d value %.2f from %s:%d", sensor_id, sensor_type, sensor_value, client_ip, client_port);
                     }
                     
                     if(newline){
@@ -107,13 +122,13 @@ void *client_thread_func(void *arg){
             } 
             else{
                 // No newline found - truly a line too long
-                log_event("[CLIENT] Protocol violation: line exceeds buffer size from %s:%d", client_ip, client_port);
+                LOG_WARN(CLIENT, "Protocol violation: line exceeds buffer size from %s:%d", client_ip, client_port);
                 buffer_len = 0;
             }
             
             // Check again after cleanup
             if(buffer_len + bytes_read >= sizeof(read_buffer)){
-                log_event("[CLIENT] Still overflow after cleanup, dropping data from %s:%d", client_ip, client_port);
+                LOG_WARN(CLIENT, "Still overflow after cleanup, dropping data from %s:%d", client_ip, client_port);
                 continue;  // Skip this chunk
             }
         }
@@ -138,23 +153,24 @@ void *client_thread_func(void *arg){
             if(parsed == 3){
                 if(first_sensor_id == -1){
                     first_sensor_id = sensor_id;
-                    log_event("[CLIENT] Sensor node ID %d from %s:%d opened new connection", first_sensor_id, client_ip, client_port);
+                    LOG_INFO(CLIENT, "Sensor node ID %d from %s:%d opened new connection", first_sensor_id, client_ip, client_port);
                 }
                 
                 sensor_packet_t packet = {
                     .id = sensor_id,
                     .type = sensor_type,
                     .value = sensor_value,
-                    .ts = time(NULL)
+                    .ts_ms = next_packet_ts(&last_ts)
                 };
                 
                 sbuffer_insert(&sbuffer, &packet);
+                startup_packet_accepted();
                 packets_received++;
                 
-                log_event("[CLIENT] Received data ID %d type %d value %.2f from %s:%d", sensor_id, sensor_type, sensor_value, client_ip, client_port);
+                LOG_TRACE(CLIENT, "Received data ID %d type %d value %.2f from %s:%d", sensor_id, sensor_type, sensor_value, client_ip, client_port);
             } 
             else{
-                log_event("[CLIENT] Invalid data format from %s:%d: '%s'", client_ip, client_port, line_start);
+                LOG_WARN(CLIENT, "Invalid data format from %s:%d: '%s'", client_ip, client_port, line_start);
             }
             
             line_start = newline + 1;
@@ -170,10 +186,10 @@ void *client_thread_func(void *arg){
     
     // Log disconnection
     if(first_sensor_id != -1){
-        log_event("[CLIENT] Sensor node ID %d from %s:%d closed connection (%zu packets received)", first_sensor_id, client_ip, client_port, packets_received);
+        LOG_INFO(CLIENT, "Sensor node ID %d from %s:%d closed connection (%zu packets received)", first_sensor_id, client_ip, client_port, packets_received);
     } 
     else{
-        log_event("[CLIENT] Unknown sensor from %s:%d closed connection (no valid data)", client_ip, client_port);
+        LOG_WARN(CLIENT, "Unknown sensor from %s:%d closed connection (no valid data)", client_ip, client_port);
     }
     
     close(client_fd);
@@ -227,7 +243,7 @@ void *client_thread_func(void *arg){
 //     pthread_mutex_unlock(&stats_mutex);
 // }
 
-void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_avgs){
+void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_avgs, unsigned long *out_counts){
     if(!updates || count == 0) return;
     
     pthread_mutex_lock(&stats_mutex);
@@ -246,8 +262,9 @@ void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_
         if(!stat){
             stat = malloc(sizeof(sensor_stat_t));
             if(!stat){
-                log_event("[STATS] Memory allocation failed for sensor %d type %d", updates[i].id, updates[i].type);
+                LOG_ERROR(STATS, "Memory allocation failed for sensor %d type %d", updates[i].id, updates[i].type);
                 if(out_avgs) out_avgs[i] = 0.0;
+                if(out_counts) out_counts[i] = 0;
                 continue;
             }
             
@@ -268,6 +285,9 @@ void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_
         if(out_avgs){
             out_avgs[i] = stat->avg;
         }
+        if(out_counts){
+            out_counts[i] = stat->count;
+        }
     }
     
     pthread_mutex_unlock(&stats_mutex);
@@ -290,5 +310,5 @@ void stats_free_all(void){
     
     pthread_mutex_unlock(&stats_mutex);
     
-    log_event("[STATS] Freed %zu sensor statistics entries", freed_count);
+    LOG_INFO(STATS, "Freed %zu sensor statistics entries", freed_count);
 }
\ No newline at end of file
@@ -26,6 +26,6 @@ extern volatile sig_atomic_t active_clients;
 void *client_thread_func(void *arg);
 //void update_running_avg(int id, int type, double val, double *out_avg);
 void stats_free_all();
-void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_avgs);
+void update_running_avg_batch(stat_update_t *updates, size_t count, double *out_avgs, unsigned long *out_counts);
 
 #endif
\ No newline at end of file
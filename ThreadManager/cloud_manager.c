@@ -1,69 +1,127 @@
 #include "cloud_manager.h"
 #include "logger.h"
 #include "sbuffer.h"
+#include "hot_cache.h"
+#include "utilities.h"
+#include "config.h"
+#include "data_manager.h"
+#include "upload_scheduler.h"
+#include "payload.h"
+#include "raw_window.h"
+#include "startup.h"
 
-cloud_client_t clients[] = {
-    {1, "bcVWopy6l9cfHxDQBXd4", NULL, 0},
-    {2, "H1KOvekgc0xEYacv3DyI", NULL, 0},
-    {3, "rIDas8QcUC7Oc1nAqfQw", NULL, 0},
-};
-
-// Helper: Find client by sensor ID
-cloud_client_t *find_client_by_id(int id){
-    for(size_t i = 0; i < NUM_CLIENTS; i++){
-        if(clients[i].id == id){
-            return &clients[i];
-        }
+// Snapshot buffer for recent-window summaries, NULL if the hot-tail cache is off
+static hot_sample_t *recent_buf = NULL;
+
+// Helper: min/max/last of the recent window from the hot-tail cache;
+// 0 when the cache does not hold the whole window
+static int recent_stats(sensor_stat_t *stat, size_t *n, double *min, double *max, double *last){
+    int64_t from = time_now_ms() - (int64_t)CLOUD_RECENT_WINDOW_SEC * 1000;
+    if(!recent_buf || !hot_cache_snapshot(stat->id, stat->type, from, recent_buf, n) || *n == 0) return 0;
+
+    *min = *max = recent_buf[0].value;
+    for(size_t i = 1; i < *n; i++){
+        if(recent_buf[i].value < *min) *min = recent_buf[i].value;
+        if(recent_buf[i].value > *max) *max = recent_buf[i].value;
     }
-    return NULL;
+    *last = recent_buf[*n - 1].value;
+    return 1;
 }
 
-// Helper: Upload sensor data to cloud
-static int upload_sensor_data(cloud_client_t *client, sensor_stat_t *stat){
-    if(!client || !stat) return -1;
-    
-    // Build JSON payload
-    char payload[256];
-    int len = snprintf(payload, sizeof(payload), 
-        "{\"sensor_id\":%d,\"type\":%d,\"avg\":%.2f,\"count\":%lu,\"timestamp\":%ld,\"last_upload\":%ld}", 
-        stat->id, stat->type, stat->avg, stat->count, time(NULL), stat->last_uploaded);
-
-    if(len < 0 || len >= (int)sizeof(payload)){
-        log_event("[CLOUD] Payload too large for sensor %d", stat->id);
+// Sensors per outcome in one upload round
+enum{ ROUND_SENT, ROUND_FAILED, ROUND_BUSY, ROUND_SPOOLED, ROUND_OUTCOMES };
+
+// Reusable encode buffers, cloud thread only
+static payload_buf_t out_buf;
+static payload_buf_t zip_buf;
+static payload_format_t out_format = PAYLOAD_JSON;
+
+// Helper: deflate a finished payload when configured; -1 if it is unusable
+static int payload_finish(int id){
+    if(out_buf.oom){
+        LOG_ERROR(CLOUD, "Payload allocation failed for sensor %d", id);
         return -1;
     }
-    
-    // Publish to MQTT broker
-    int rc = mosquitto_publish(client->mosq, NULL, MQTT_TOPIC, len, payload, MQTT_QOS, false);
-    
-    if(rc == MOSQ_ERR_SUCCESS){
-        log_event("[CLOUD] Uploaded sensor %d (type=%d, avg=%.2f, count=%lu)", stat->id, stat->type, stat->avg, stat->count);
-        return 0;
-    } 
-    else{
-        log_event("[CLOUD] Publish failed for sensor %d: %s", stat->id, mosquitto_strerror(rc));
-        return -1;
+    if(payload_compress(&out_buf, (size_t)g_config.cloud_compress_min, &zip_buf) < 0){
+        LOG_WARN(CLOUD, "Payload compression failed for sensor %d, sending uncompressed", id);
     }
+    return 0;
 }
-// Try to reconnect disconnected client
-static int try_reconnect_client(cloud_client_t *client){
-    if(!client || !client->mosq) return -1;
-    if(client->connected) return 0;  // Already connected
-    
-    log_event("[MQTT] Attempting reconnect for sensor %d", client->id);
-    
-    int rc = mosquitto_reconnect(client->mosq);
-    if(rc == MOSQ_ERR_SUCCESS){
-        // Don't set connected=1 yet, wait for on_connect callback
-        log_event("[MQTT] Reconnect initiated for sensor %d", client->id);
-        return 0;
-    } 
-    else{
-        log_event("[MQTT] Reconnect failed for sensor %d: %s", client->id, mosquitto_strerror(rc));
-        return -1;
+
+// Helper: "recent":{...} member from the hot-tail cache, if available
+static void write_recent(payload_writer_t *w, sensor_stat_t *stat){
+    size_t n;
+    double min, max, last;
+    if(!recent_stats(stat, &n, &min, &max, &last)) return;
+
+    payload_key(w, "recent");
+    payload_map_open(w);
+    payload_key(w, "window_s");
+    payload_int(w, CLOUD_RECENT_WINDOW_SEC);
+    payload_key(w, "n");
+    payload_int(w, (int64_t)n);
+    payload_key(w, "min");
+    payload_fixed2(w, min);
+    payload_key(w, "max");
+    payload_fixed2(w, max);
+    payload_key(w, "last");
+    payload_fixed2(w, last);
+    payload_map_close(w);
+}
+
+// Helper: keep the finished payload in out_buf for later delivery;
+// CLOUD_SPOOLED, or -1 if the outbox is off or full
+static int spool_payload(outbox_route_t route, int device){
+    if(outbox_append(route, device, out_buf.data, out_buf.len) != 0) return -1;
+    return CLOUD_SPOOLED;
+}
+
+// Helper: one sensor's payload into out_buf
+static int encode_sensor_data(sensor_stat_t *stat){
+    payload_writer_t w;
+    payload_buf_reset(&out_buf);
+    payload_begin(&w, &out_buf, out_format);
+    payload_map_open(&w);
+    payload_key(&w, "sensor_id");
+    payload_int(&w, stat->id);
+    payload_key(&w, "type");
+    payload_int(&w, stat->type);
+    payload_key(&w, "avg");
+    payload_fixed2(&w, stat->avg);
+    payload_key(&w, "count");
+    payload_int(&w, (int64_t)stat->count);
+    payload_key(&w, "timestamp");
+    payload_int(&w, (int64_t)time(NULL));
+    payload_key(&w, "last_upload");
+    payload_int(&w, (int64_t)stat->last_uploaded);
+    write_recent(&w, stat);
+    payload_map_close(&w);
+    return payload_finish(stat->id);
+}
+
+// Helper: Upload sensor data to cloud; 0 = sent, awaiting PUBACK
+static int upload_sensor_data(cloud_client_t *client, upload_due_t *d){
+    if(!client || !d) return -1;
+    sensor_stat_t *stat = &d->stat;
+
+    if(encode_sensor_data(stat) != 0) return -1;
+
+    // Publish to MQTT broker
+    int rc = cloud_client_publish(client, MQTT_TOPIC, (const char *)out_buf.data, (int)out_buf.len, d, 1);
+    if(rc == 0){
+        LOG_DEBUG(CLOUD, "Uploaded sensor %d (type=%d, avg=%.2f, count=%lu)", stat->id, stat->type, stat->avg, stat->count);
+    }
+    else if(rc < 0){
+        rc = spool_payload(OUTBOX_ROUTE_DEVICE, stat->id);
     }
+    return rc;
 }
 
+// Helper: sensor whose connection is down goes to the outbox
+static int device_spool(sensor_stat_t *stat){
+    if(encode_sensor_data(stat) != 0) return -1;
+    return spool_payload(OUTBOX_ROUTE_DEVICE, stat->id);
+}
 // // Helper: Process network loop for client
 // static void process_mqtt_loop(cloud_client_t *client){
 //     if(!client || !client->mosq) return;
@@ -82,188 +140,544 @@ static int try_reconnect_client(cloud_client_t *client){
 //     }
 // }
 
-// Helper: Check if sensor has new data since last upload
-static int has_new_data(sensor_stat_t *sensor){
-    // No data yet
-    if(sensor->count == 0){
-        return 0;
+/* ===========================
+ *   Gateway mode
+ * =========================== */
+
+static const char *type_key(int type){
+    switch(type){
+        case SENSOR_TEMPERATURE: return "temperature";
+        case SENSOR_HUMIDITY:    return "humidity";
+        case SENSOR_LIGHT:       return "light";
+        default:                 return NULL;
     }
-    
-    // Never uploaded before - upload now
-    if(sensor->last_uploaded == 0){
-        return 1;
+}
+
+static int cmp_due_id(const void *a, const void *b){
+    const sensor_stat_t *x = &((const upload_due_t *)a)->stat, *y = &((const upload_due_t *)b)->stat;
+    if(x->id != y->id) return (x->id < y->id) ? -1 : 1;
+    return (x->type > y->type) - (x->type < y->type);
+}
+
+// Helper: registry name of the device, "Sensor <id>" if unregistered
+static void device_name(int id, char *name, size_t len){
+    device_entry_t *dev = cloud_device_find(id);
+    if(dev) snprintf(name, len, "%s", dev->name);
+    else snprintf(name, len, "Sensor %d", id);
+}
+
+// Helper: one device entry, "<device name>":[{"ts":..,"values":{..}}], covering
+// every due type of that id
+static void gateway_device_entry(payload_writer_t *w, upload_due_t *due, size_t first, size_t end, int64_t ts_ms){
+    char name[DEVICE_NAME_MAX];
+    device_name(due[first].stat.id, name, sizeof(name));
+
+    payload_key(w, name);
+    payload_array_open(w);
+    payload_map_open(w);
+    payload_key(w, "ts");
+    payload_int(w, ts_ms);
+    payload_key(w, "values");
+    payload_map_open(w);
+    for(size_t i = first; i < end; i++){
+        sensor_stat_t *stat = &due[i].stat;
+        char fallback[16];
+        const char *key = type_key(stat->type);
+        if(!key){
+            snprintf(fallback, sizeof(fallback), "type%d", stat->type);
+            key = fallback;
+        }
+        char field[32];
+        payload_key(w, key);
+        payload_fixed2(w, stat->avg);
+        snprintf(field, sizeof(field), "%s_count", key);
+        payload_key(w, field);
+        payload_int(w, (int64_t)stat->count);
+
+        size_t n;
+        double min, max, last;
+        if(recent_stats(stat, &n, &min, &max, &last)){
+            snprintf(field, sizeof(field), "%s_min", key);
+            payload_key(w, field);
+            payload_fixed2(w, min);
+            snprintf(field, sizeof(field), "%s_max", key);
+            payload_key(w, field);
+            payload_fixed2(w, max);
+            snprintf(field, sizeof(field), "%s_last", key);
+            payload_key(w, field);
+            payload_fixed2(w, last);
+        }
     }
-    
-    // Has count increased since last upload?
-    if(sensor->count > sensor->last_uploaded_count){
-        // Check if enough time has passed
-        time_t now = time(NULL);
-        if((now - sensor->last_uploaded) >= UPLOAD_INTERVAL_SEC){
-            return 1;  // New data + enough time passed
+    payload_map_close(w);
+    payload_map_close(w);
+    payload_array_close(w);
+}
+
+// Helper: close and publish one batched message; its sensors go to the
+// session's tracker, the outbox when no session can take it, or back to
+// the scheduler. Adds to the round's sent, failed, busy or spooled count.
+static void gateway_publish(payload_writer_t *w, upload_due_t *due, size_t first, size_t end, size_t *counts){
+    payload_map_close(w);
+
+    if(payload_finish(due[first].stat.id) != 0){
+        for(size_t i = first; i < end; i++){
+            upload_sched_done(&due[i], UPLOAD_FAILED);
+        }
+        counts[ROUND_FAILED] += end - first;
+        return;
+    }
+
+    int rc = -1;
+    cloud_session_t *session = cloud_session_next();
+    if(session){
+        rc = cloud_session_publish(session, MQTT_GATEWAY_TOPIC, (const char *)out_buf.data, (int)out_buf.len,
+                                   &due[first], end - first);
+    }
+    if(rc == 0){
+        counts[ROUND_SENT] += end - first;
+        return;
+    }
+    if(rc < 0){
+        rc = spool_payload(OUTBOX_ROUTE_GATEWAY, 0);
+    }
+
+    upload_result_t result = UPLOAD_FAILED;
+    int outcome = ROUND_FAILED;
+    if(rc == CLOUD_PUBLISH_BUSY){
+        result = UPLOAD_BUSY;
+        outcome = ROUND_BUSY;
+    }
+    else if(rc == CLOUD_SPOOLED){
+        result = UPLOAD_SPOOLED;
+        outcome = ROUND_SPOOLED;
+    }
+    for(size_t i = first; i < end; i++){
+        upload_sched_done(&due[i], result);
+    }
+    counts[outcome] += end - first;
+}
+
+// All due sensors, many devices per message, messages spread over the
+// session pool
+static void gateway_upload(upload_due_t *due, size_t count, size_t *counts){
+    qsort(due, count, sizeof(*due), cmp_due_id);
+
+    payload_writer_t w;
+    int64_t ts_ms = time_now_ms();
+    int devices = 0;
+    size_t msg_first = 0;
+    for(size_t i = 0; i < count;){
+        // Group all types of one id into one device entry
+        size_t end = i + 1;
+        while(end < count && due[end].stat.id == due[i].stat.id) end++;
+
+        if(devices == 0){
+            payload_buf_reset(&out_buf);
+            payload_begin(&w, &out_buf, out_format);
+            payload_map_open(&w);
+            msg_first = i;
+        }
+        gateway_device_entry(&w, due, i, end, ts_ms);
+        devices++;
+        i = end;
+
+        // Message full
+        if(devices == g_config.cloud_batch_max || out_buf.len >= CLOUD_GATEWAY_PAYLOAD_MAX){
+            gateway_publish(&w, due, msg_first, i, counts);
+            devices = 0;
         }
     }
-    return 0;  // No new data or too soon
+    if(devices > 0){
+        gateway_publish(&w, due, msg_first, count, counts);
+    }
+}
+
+/* ===========================
+ *   Device mode
+ * =========================== */
+
+// Helper: one message per sensor on the device's own connection; 0 = sent,
+// -1 = failed, CLOUD_PUBLISH_BUSY = window full, CLOUD_SPOOLED = in the outbox
+static int device_upload(upload_due_t *d){
+    sensor_stat_t *stat = &d->stat;
+
+    // Find and validate client
+    cloud_client_t *client = find_client_by_id(stat->id);
+
+    if(!client){
+        LOG_WARN(CLOUD, "No client found for sensor ID %d", stat->id);
+        return -1;
+    }
+
+    if(!client->token[0]){
+        LOG_WARN(CLOUD, "No token for sensor ID %d", stat->id);
+        return -1;
+    }
+
+    // Its loop thread is reconnecting; the data waits in the outbox meanwhile
+    if(!client->connected){
+        LOG_WARN(CLOUD, "Sensor %d not connected, reconnect in progress", stat->id);
+        return device_spool(stat);
+    }
+
+    // Attempt upload
+    return upload_sensor_data(client, d);
+}
+
+/* ===========================
+ *   Raw windows
+ * =========================== */
+
+// Per-device sample windows, cloud thread only
+static raw_windows_t raw;
+
+// Windows per outcome, and the samples they carried
+enum{ RAW_SENT, RAW_SPOOLED, RAW_FAILED, RAW_SAMPLES, RAW_COUNTERS };
+
+// Helper: one window into out_buf as ThingsBoard telemetry whose "raw" value
+// is the window: {"ts":t0,"values":{"raw":{..}}}, under the device name
+// for the gateway API
+static int encode_raw_window(raw_window_t *win, int gateway){
+    payload_writer_t w;
+    payload_buf_reset(&out_buf);
+    payload_begin(&w, &out_buf, out_format);
+    if(gateway){
+        char name[DEVICE_NAME_MAX];
+        device_name(win->id, name, sizeof(name));
+        payload_map_open(&w);
+        payload_key(&w, name);
+        payload_array_open(&w);
+    }
+    payload_map_open(&w);
+    payload_key(&w, "ts");
+    payload_int(&w, win->t0_ms);
+    payload_key(&w, "values");
+    payload_map_open(&w);
+    payload_key(&w, "raw");
+    raw_window_encode(win, raw.scale, &w);
+    payload_map_close(&w);
+    payload_map_close(&w);
+    if(gateway){
+        payload_array_close(&w);
+        payload_map_close(&w);
+    }
+    return payload_finish(win->id);
+}
+
+// Helper: publish a closed window, or spool it when no connection can take
+// it now; windows are never held back, the next one is already filling.
+// spool_only at shutdown, when acknowledgements would not be waited for.
+static void raw_publish(raw_window_t *win, int gateway, int spool_only, size_t *counters){
+    size_t samples = win->samples;
+    device_entry_t *dev = cloud_device_find(win->id);
+    if(dev && dev->rule.policy == UPLOAD_OFF){
+        raw_window_reset(&raw, win);
+        return;
+    }
+
+    int rc = -1;
+    cloud_client_t *client = gateway ? NULL : find_client_by_id(win->id);
+    if(!gateway && !client){
+        LOG_WARN(CLOUD, "No client found for sensor ID %d, raw window of %zu samples dropped", win->id, samples);
+    }
+    else if(encode_raw_window(win, gateway) == 0){
+        if(!spool_only && gateway){
+            cloud_session_t *session = cloud_session_next();
+            if(session){
+                rc = cloud_session_publish(session, MQTT_GATEWAY_TOPIC, (const char *)out_buf.data,
+                                           (int)out_buf.len, NULL, 0);
+            }
+        }
+        else if(!spool_only && client->connected){
+            rc = cloud_client_publish(client, MQTT_TOPIC, (const char *)out_buf.data, (int)out_buf.len, NULL, 0);
+        }
+
+        if(rc == 0){
+            LOG_DEBUG(CLOUD, "Uploaded raw window for sensor %d (%zu samples, %zu bytes)",
+                      win->id, samples, out_buf.len);
+        }
+        else{
+            rc = spool_payload(gateway ? OUTBOX_ROUTE_GATEWAY : OUTBOX_ROUTE_DEVICE, win->id);
+        }
+    }
+
+    if(rc == 0) counters[RAW_SENT]++;
+    else if(rc == CLOUD_SPOOLED) counters[RAW_SPOOLED]++;
+    else counters[RAW_FAILED]++;
+    counters[RAW_SAMPLES] += samples;
+    raw_window_reset(&raw, win);
+}
+
+// Helper: every packet not seen yet into its device's window; full windows
+// go out at once
+static void raw_collect(int gateway, size_t *counters){
+    int64_t now = time_now_ms();
+    sbuffer_node_t *node;
+    while((node = sbuffer_find_for_cloud(&sbuffer)) != NULL){
+        sensor_packet_t pkt = node->pkt;
+        sbuffer_mark_upcloud_done(&sbuffer, node);
+
+        raw_window_t *full = raw_windows_add(&raw, &pkt, now);
+        if(full) raw_publish(full, gateway, 0, counters);
+    }
+}
+
+// Helper: publish the windows that are due, all of them when force
+static void raw_flush(int gateway, int force, size_t *counters){
+    int64_t now = time_now_ms();
+    raw_window_t *win;
+    while((win = raw_windows_next_due(&raw, now, force)) != NULL){
+        raw_publish(win, gateway, force, counters);
+    }
+}
+
+/* ===========================
+ *   Upload rules
+ * =========================== */
+
+// Configured deadband per sensor type, index = type; resolved at start
+static struct{
+    double band;
+    uint8_t pct;
+} type_band[4];
+
+static void type_bands_init(void){
+    const char *text[4] = {
+        [0] = "0",
+        [SENSOR_TEMPERATURE] = g_config.cloud_deadband_temperature,
+        [SENSOR_HUMIDITY] = g_config.cloud_deadband_humidity,
+        [SENSOR_LIGHT] = g_config.cloud_deadband_light,
+    };
+    for(int t = 0; t < 4; t++){
+        if(deadband_parse(text[t], &type_band[t].band, &type_band[t].pct) != 0){
+            LOG_WARN(CLOUD, "Invalid deadband '%s' for sensor type %d, using 0", text[t], t);
+            type_band[t].band = 0;
+            type_band[t].pct = 0;
+        }
+    }
+}
+
+// Helper: the device's rule, or the default one, with type defaults filled in
+static void resolve_rule(device_entry_t *dev, int type, upload_rule_t *rule){
+    if(dev) *rule = dev->rule;
+    else upload_rule_default(rule);
+    if(rule->policy != UPLOAD_DEADBAND) return;
+
+    if(rule->deadband < 0){
+        int t = (type >= 0 && type < 4) ? type : 0;
+        rule->deadband = type_band[t].band;
+        rule->deadband_pct = type_band[t].pct;
+    }
+    if(rule->max_interval_s == 0) rule->max_interval_s = g_config.cloud_report_max_s;
+    if(rule->max_interval_s < rule->min_interval_s) rule->max_interval_s = rule->min_interval_s;
+}
+
+/* ===========================
+ *   Outbox drain
+ * =========================== */
+
+// Catch-up: spooled payloads at up to outbox_drain_rate per second next to
+// live uploads, oldest first; stops at a connection that cannot take more
+static void outbox_drain(double *tokens, int64_t *last_ms){
+    int64_t now = time_now_ms();
+    double rate = g_config.outbox_drain_rate;
+    *tokens += (double)(now - *last_ms) * rate / 1000.0;
+    if(*tokens > rate) *tokens = rate;      // at most one second of burst
+    *last_ms = now;
+
+    outbox_msg_t msg;
+    while(*tokens >= 1.0 && outbox_peek(&msg)){
+        outbox_taken(msg.seq);
+        int rc = cloud_outbox_publish(&msg);
+        if(rc == 0){
+            *tokens -= 1.0;
+            continue;
+        }
+        outbox_untake(msg.seq);
+        if(rc == CLOUD_PUBLISH_BUSY) break;
+
+        LOG_WARN(OUTBOX, "Payload %llu has no connection in %s mode, discarded",
+                  (unsigned long long)msg.seq, g_config.cloud_mode);
+        outbox_discard(msg.seq);
+    }
 }
 
 void *cloud_manager_thread(void *arg){
     (void)arg;
     
-    log_event("[CLOUD] Cloud uploader thread started");
+    LOG_INFO(CLOUD, "Cloud uploader thread started");
     
-    cloud_clients_init();
+    int gateway = (strcmp(g_config.cloud_mode, "gateway") == 0);
+    int stats_upload = (strcmp(g_config.cloud_upload, "raw") != 0);
+    int raw_upload = (strcmp(g_config.cloud_upload, "stats") != 0);
+    outbox_open(g_config.outbox_dir, (size_t)g_config.outbox_max_mb * 1024 * 1024,
+                strcmp(g_config.outbox_evict, "newest") != 0);
+    if(hot_cache_capacity() > 0){
+        recent_buf = malloc(hot_cache_capacity() * sizeof(hot_sample_t));
+    }
+    out_format = payload_format_parse(g_config.cloud_encoding);
+    type_bands_init();
+    upload_rule_t probe;
+    if(upload_rule_parse(g_config.cloud_default_policy, &probe) != 0){
+        LOG_WARN(CLOUD, "Invalid cloud_default_policy '%s', using every %d s",
+                  g_config.cloud_default_policy, UPLOAD_INTERVAL_SEC);
+    }
+    payload_buf_init(&out_buf);
+    payload_buf_init(&zip_buf);
+    upload_due_t *due = malloc(CLOUD_DUE_MAX * sizeof(*due));
+    if(!due){
+        LOG_ERROR(CLOUD, "Failed to allocate due list, uploads disabled");
+        // Nothing will collect raw packets, so the sbuffer must not hold them
+        sbuffer_disable_cloud(&sbuffer);
+    }
+    else if(raw_upload){
+        // From here on every packet waits in the sbuffer until collected
+        raw_windows_init(&raw, g_config.cloud_raw_window_s, (size_t)g_config.cloud_raw_max_samples,
+                         g_config.cloud_raw_scale);
+        LOG_INFO(CLOUD, "Raw uploads: %d s windows, at most %d samples, values x%d",
+                  g_config.cloud_raw_window_s, g_config.cloud_raw_max_samples, g_config.cloud_raw_scale);
+    }
+
+    // Connections last: they only start here and come up in the background,
+    // until then uploads go to the outbox
+    if(gateway){
+        cloud_sessions_init();
+    }
+    else{
+        cloud_clients_init();
+    }
+    startup_ready(STARTUP_CLOUD);
     
-    size_t total_uploaded = 0;
+    size_t total_sent = 0;
     size_t total_failed = 0;
-    size_t upload_cycles = 0;
-
-    // Main upload loop
-    while(!stop_flag){
-        upload_cycles++;
-
-        pthread_mutex_lock(&stats_mutex);
-        
-        // Count sensors numbers
-        size_t sensor_count = 0;
-        sensor_stat_t *stat = stats_head;
-        while(stat){
-            sensor_count++;
-            stat = stat->next;
-        }
-        
-        // Handle empty stats
-        if(sensor_count == 0){
-            pthread_mutex_unlock(&stats_mutex);
-            log_event("[CLOUD] No sensors registered yet (cycle %zu)", upload_cycles);
-            sleep(UPLOAD_INTERVAL_SEC);
-            continue;
-        }
+    size_t total_spooled = 0;
+    size_t upload_rounds = 0;
+    size_t raw_counters[RAW_COUNTERS] = { 0 };
+    sig_atomic_t seen_reload = reload_generation;
+    time_t last_stats = time(NULL);
+    double drain_tokens = 0;
+    int64_t drain_last_ms = time_now_ms();
 
-        // Allocate local buffer
-        sensor_stat_t *local_stats = malloc(sensor_count * sizeof(sensor_stat_t));
-        if(!local_stats){
-            pthread_mutex_unlock(&stats_mutex);
-            log_event("[CLOUD] Failed to allocate local buffer");
-            sleep(UPLOAD_INTERVAL_SEC);
-            continue;
+    // Sleeps until the earliest upload deadline or a data update that
+    // creates an earlier one; CLOUD_IDLE_WAIT_MS bounds reload and
+    // reaping latency, CLOUD_DRAIN_TICK_MS paces the outbox drain and
+    // CLOUD_RAW_POLL_MS bounds how long packets wait for raw collection
+    while(!stop_flag && due){
+        // SIGHUP: pick up registry edits between rounds
+        if(reload_generation != seen_reload){
+            seen_reload = reload_generation;
+            if(cloud_registry_reload() == 0){
+                upload_sched_invalidate();
+            }
         }
-        
-        // Copy data
-        stat = stats_head;
-        size_t idx = 0;
-        while(stat && idx < sensor_count){
-            // Atomic snapshot of critical fields
-            local_stats[idx].id = stat->id;
-            local_stats[idx].type = stat->type;
-            local_stats[idx].avg = stat->avg;
-            
-            // Snapshot count and last_uploaded atomically
-            local_stats[idx].count = stat->count;
-            local_stats[idx].last_uploaded = stat->last_uploaded;
-            local_stats[idx].last_uploaded_count = stat->last_uploaded_count;
-            
-            stat = stat->next;
-            idx++;
+        cloud_clients_reap(0);
+        pub_tracker_expire_all(g_config.cloud_ack_timeout_ms);
+        if(time(NULL) - last_stats >= CLOUD_STATS_INTERVAL_SEC){
+            last_stats = time(NULL);
+            cloud_publish_stats_log();
         }
-        
-        // Unlock
-        pthread_mutex_unlock(&stats_mutex);
-        
-        // Upload from local buffer
-        size_t batch_uploaded = 0;
-        size_t batch_failed = 0;
-        size_t batch_skipped = 0;
-        
-        time_t now = time(NULL);
-        
-        for(size_t i = 0; i < sensor_count; i++){
-            // Check if this sensor has new data
-            if(!has_new_data(&local_stats[i])){
-                batch_skipped++;
-                continue;
-            }
-            
-            // Find and validate client
-            cloud_client_t *client = find_client_by_id(local_stats[i].id);
-            
-            if(!client){
-                log_event("[CLOUD] No client found for sensor ID %d", local_stats[i].id);
-                batch_failed++;
-                continue;
+        if(raw_upload){
+            raw_collect(gateway, raw_counters);
+            raw_flush(gateway, 0, raw_counters);
+        }
+        outbox_drain(&drain_tokens, &drain_last_ms);
+        outbox_sync();
+
+        int wait_ms = (outbox_backlog() > 0) ? CLOUD_DRAIN_TICK_MS : CLOUD_IDLE_WAIT_MS;
+        if(raw_upload && wait_ms > CLOUD_RAW_POLL_MS) wait_ms = CLOUD_RAW_POLL_MS;
+        size_t n = upload_sched_wait(due, CLOUD_DUE_MAX, wait_ms);
+        if(n == 0) continue;
+        upload_rounds++;
+
+        // Device policies; sensors not due yet go back to the scheduler
+        size_t admitted = 0, deferred = 0;
+        for(size_t i = 0; i < n; i++){
+            upload_rule_t rule;
+            resolve_rule(cloud_device_find(due[i].stat.id), due[i].stat.type, &rule);
+            if(!stats_upload) rule.policy = UPLOAD_OFF;
+            if(upload_sched_admit(&due[i], &rule)){
+                due[admitted++] = due[i];
             }
-            
-            if(!client->token){
-                log_event("[CLOUD] No token for sensor ID %d", local_stats[i].id);
-                batch_failed++;
-                continue;
+            else{
+                deferred++;
             }
-            
-            if(!client->connected){
-                // Try reconnect once before giving up
-                if(try_reconnect_client(client) == 0){
-                    // Wait briefly for connection
-                    usleep(100000);
-                    
-                    if(!client->connected){
-                        log_event("[CLOUD] Sensor %d not connected, reconnect in progress", local_stats[i].id);
-                        batch_failed++;
-                        continue;
-                    }
-                } 
-                else{
-                    log_event("[CLOUD] Sensor %d not connected and reconnect failed", local_stats[i].id);
-                    batch_failed++;
-                    continue;
+        }
+        if(admitted == 0) continue;
+
+        // Sent sensors are reported to the scheduler when acknowledged,
+        // spooled ones count as uploaded
+        size_t counts[ROUND_OUTCOMES] = { 0 };
+
+        if(gateway){
+            gateway_upload(due, admitted, counts);
+        }
+        else{
+            for(size_t i = 0; i < admitted; i++){
+                int rc = device_upload(&due[i]);
+                if(rc == 0){
+                    counts[ROUND_SENT]++;
                 }
-            }
-            
-            // Attempt upload
-            if(upload_sensor_data(client, &local_stats[i]) == 0){
-                // Update both timestamp AND count
-                pthread_mutex_lock(&stats_mutex);
-                
-                sensor_stat_t *stat = stats_head;
-                while(stat){
-                    if(stat->id == local_stats[i].id && stat->type == local_stats[i].type){
-                        stat->last_uploaded = now;
-                        stat->last_uploaded_count = stat->count; 
-                        break;
-                    }
-                    stat = stat->next;
+                else if(rc == CLOUD_PUBLISH_BUSY){
+                    upload_sched_done(&due[i], UPLOAD_BUSY);
+                    counts[ROUND_BUSY]++;
+                }
+                else if(rc == CLOUD_SPOOLED){
+                    upload_sched_done(&due[i], UPLOAD_SPOOLED);
+                    counts[ROUND_SPOOLED]++;
+                }
+                else{
+                    upload_sched_done(&due[i], UPLOAD_FAILED);
+                    counts[ROUND_FAILED]++;
                 }
-                
-                pthread_mutex_unlock(&stats_mutex);
-                
-                batch_uploaded++;
-
-                //printf("Hi from Cloud Manager\n");
-            } 
-            else{
-                batch_failed++;
             }
         }
-        
-        // Cleanup local buffer
-        free(local_stats);
-        
-        // Update statistics
-        total_uploaded += batch_uploaded;
-        total_failed += batch_failed;
-        
-        if(batch_uploaded > 0 || batch_failed > 0){
-            log_event("[CLOUD] Cycle %zu complete: %zu uploaded, %zu failed, %zu skipped", upload_cycles, batch_uploaded, batch_failed, batch_skipped);
-        } 
-        else if(batch_skipped > 0){
-            log_event("[CLOUD] Cycle %zu: All %zu sensors skipped (no new data or too soon)", upload_cycles, batch_skipped);
-        }
 
-        // Wait before next upload cycle
-        sleep(UPLOAD_INTERVAL_SEC);
+        total_sent += counts[ROUND_SENT];
+        total_failed += counts[ROUND_FAILED];
+        total_spooled += counts[ROUND_SPOOLED];
+
+        size_t sensors, scheduled;
+        upload_sched_stats(&sensors, &scheduled);
+        LOG_DEBUG(CLOUD, "Round %zu: %zu sent, %zu failed, %zu busy, %zu spooled, %zu deferred (%zu sensors, %zu scheduled)",
+                  upload_rounds, counts[ROUND_SENT], counts[ROUND_FAILED], counts[ROUND_BUSY],
+                  counts[ROUND_SPOOLED], deferred, sensors, scheduled);
     }
     
-    // Cleanup
-    cloud_clients_cleanup();
+    // Open windows go to the outbox rather than out on closing connections
+    if(raw_upload && due){
+        raw_collect(gateway, raw_counters);
+        raw_flush(gateway, 1, raw_counters);
+        outbox_sync();
+    }
+
+    // Cleanup; publishes still unacknowledged are logged with each connection
+    if(gateway){
+        cloud_sessions_cleanup();
+    }
+    else{
+        cloud_clients_cleanup();
+    }
+    outbox_close();
+    free(due);
+    payload_buf_free(&out_buf);
+    payload_buf_free(&zip_buf);
+    free(recent_buf);
+    recent_buf = NULL;
     
-    log_event("[CLOUD] Cloud uploader thread exiting. Total: %zu uploaded, %zu failed", total_uploaded, total_failed);
+    LOG_INFO(CLOUD, "Cloud uploader thread exiting. Total: %zu sent, %zu failed, %zu spooled",
+              total_sent, total_failed, total_spooled);
+    unsigned long long changed, alarms, heartbeats, suppressed;
+    upload_sched_band_stats(&changed, &alarms, &heartbeats, &suppressed);
+    if(changed + alarms + heartbeats + suppressed > 0){
+        LOG_INFO(CLOUD, "Deadband uploads: %llu changed, %llu alarm, %llu heartbeat; %llu updates inside the deadband",
+                  changed, alarms, heartbeats, suppressed);
+    }
+    if(raw_upload){
+        LOG_INFO(CLOUD, "Raw windows: %zu sent, %zu spooled, %zu failed, %zu samples, %llu dropped",
+                  raw_counters[RAW_SENT], raw_counters[RAW_SPOOLED], raw_counters[RAW_FAILED],
+                  raw_counters[RAW_SAMPLES], raw.dropped);
+        raw_windows_free(&raw);
+    }
     
     return NULL;
-}
\ No newline at end of file
+}
@@ -2,34 +2,80 @@
 #define CLOUD_MANAGER_H
 
 #include "main.h"
+#include "device_registry.h"
+#include "publish_tracker.h"
+#include "outbox.h"
 
-#define NUM_CLIENTS 3
-#define MQTT_BROKER "demo.thingsboard.io"
+#define MQTT_BROKER "demo.thingsboard.io"   // defaults for mqtt_host, mqtt_port, mqtt_keepalive
 #define MQTT_PORT 1883
 #define MQTT_KEEPALIVE 60
+#define MQTT_RECONNECT_DELAY_SEC 1           // library reconnects back off from here
+#define MQTT_RECONNECT_DELAY_MAX_SEC 30
 #define MQTT_TOPIC "v1/devices/me/telemetry"
 #define MQTT_QOS 1
-#define UPLOAD_INTERVAL_SEC 5
+#define UPLOAD_INTERVAL_SEC 5           // default spacing per sensor
+#define CLOUD_DUE_MAX 1024              // sensors taken per scheduler wakeup
+#define CLOUD_IDLE_WAIT_MS 1000         // reload and reaping latency when idle
+#define CLOUD_RECENT_WINDOW_SEC 300     // summarised from the hot-tail cache
 #define LOOP_ITERATIONS 5
 #define LOOP_DELAY_MS 100
+#define CLOUD_RETIRE_GRACE_SEC 30      // longest wait for in-flight publishes of a replaced client
+#define CLOUD_STATS_INTERVAL_SEC 300    // publish window and ack latency summary
+#define CLOUD_PUBLISH_BUSY 1            // cloud_*_publish: window full, nothing sent
+#define CLOUD_SPOOLED 2                 // not published, kept in the outbox instead
+#define CLOUD_DRAIN_TICK_MS 100         // scheduler wait while the outbox has a backlog
+#define CLOUD_RAW_POLL_MS 200           // raw uploads: sbuffer collection interval
+
+// Gateway mode: a fixed pool of sessions publishes every device through
+// the ThingsBoard gateway API, device names inside the payload
+#define MQTT_GATEWAY_TOPIC "v1/gateway/telemetry"
+#define CLOUD_MAX_SESSIONS 4
+#define CLOUD_GATEWAY_PAYLOAD_MAX 16384 // start a new message past this size
+
+// Device mode connection, one per registered device. A reload that keeps
+// the device's token keeps its client; replaced clients are retired and
+// destroyed once their QoS 1 publishes are acknowledged.
+struct cloud_client{
+    int id;
+    char token[DEVICE_TOKEN_MAX];
+    struct mosquitto *mosq;
+    volatile uint8_t connected;
+    pub_tracker_t tracker;          // publishes awaiting PUBACK
+    time_t retired_at;
+    struct cloud_client *next;      // retiring list
+};
 
 typedef struct{
-    uint8_t id;
-    const char *token;
+    int index;
     struct mosquitto *mosq;
-    uint8_t connected;
-} cloud_client_t;
+    volatile int connected;
+    pub_tracker_t tracker;
+    unsigned long long failed;
+} cloud_session_t;
 
 extern volatile sig_atomic_t stop_flag;
 extern pthread_mutex_t stats_mutex;
 extern sbuffer_t sbuffer;
 extern sensor_stat_t *stats_head;
 extern struct mosquitto *mosq;
-extern cloud_client_t clients[];
 
+device_entry_t *cloud_device_find(int id);
 cloud_client_t *find_client_by_id(int id);
 void cloud_clients_init(void);
 void cloud_clients_cleanup(void);
+int cloud_registry_reload(void);
+void cloud_clients_reap(int force);
+// Publishes take the sensors they carry: 0 = sent, their result comes with
+// the PUBACK; -1 or CLOUD_PUBLISH_BUSY = not sent, the caller reports them
+int cloud_client_publish(cloud_client_t *client, const char *topic, const char *payload, int len,
+                         const upload_due_t *items, size_t n);
+int cloud_sessions_init(void);
+void cloud_sessions_cleanup(void);
+cloud_session_t *cloud_session_next(void);
+int cloud_session_publish(cloud_session_t *s, const char *topic, const char *payload, int len,
+                          const upload_due_t *items, size_t n);
+int cloud_outbox_publish(const outbox_msg_t *msg);
+void cloud_publish_stats_log(void);
 void *cloud_manager_thread(void *arg);
 
 #endif
\ No newline at end of file
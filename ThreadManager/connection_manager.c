@@ -1,25 +1,26 @@
 #include "connection_manager.h"
 #include "client_thread.h"
 #include "logger.h"
+#include "startup.h"
 
 volatile sig_atomic_t active_clients = 0;
 
 void *connection_manager_thread(void *arg){
     int port = *(int*)arg;
     
-    log_event("[CONNECTION] Connection manager thread started");
+    LOG_INFO(CONNECTION, "Connection manager thread started");
     
     // Create socket
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if(server_fd < 0){
-        log_event("[CONNECTION] Socket creation failed: %s", strerror(errno));
+        LOG_ERROR(CONNECTION, "Socket creation failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
     
     // Set socket options
     int opt = 1;
     if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0){
-        log_event("[CONNECTION] setsockopt failed: %s", strerror(errno));
+        LOG_ERROR(CONNECTION, "setsockopt failed: %s", strerror(errno));
         close(server_fd);
         exit(EXIT_FAILURE);
     }
@@ -32,19 +33,27 @@ void *connection_manager_thread(void *arg){
     server.sin_port = htons(port);
     
     if(bind(server_fd, (struct sockaddr*)&server, sizeof(server)) < 0){
-        log_event("[CONNECTION] Bind failed on port %d: %s", port, strerror(errno));
+        LOG_ERROR(CONNECTION, "Bind failed on port %d: %s", port, strerror(errno));
         close(server_fd);
         exit(EXIT_FAILURE);
     }
     
     // Listen for connections
     if(listen(server_fd, LISTEN_BACKLOG) < 0){
-        log_event("[CONNECTION] Listen failed: %s", strerror(errno));
+        LOG_ERROR(CONNECTION, "Listen failed: %s", strerror(errno));
         close(server_fd);
         exit(EXIT_FAILURE);
     }
     
-    log_event("[CONNECTION] Listening on port %d", port);
+    // Sensors already queue in the listen backlog; accepting waits until
+    // packets can be buffered (journal replayed), whatever storage and cloud do
+    if(startup_wait(STARTUP_BUFFER, -1) != 0){
+        close(server_fd);
+        LOG_WARN(CONNECTION, "Connection manager thread exiting before startup completed");
+        return NULL;
+    }
+    startup_ready(STARTUP_INGEST);
+    LOG_INFO(CONNECTION, "Listening on port %d", port);
     
     size_t total_connections = 0;
     
@@ -59,7 +68,7 @@ void *connection_manager_thread(void *arg){
         
         if(ret < 0){
             if(errno == EINTR) continue;
-            log_event("[CONNECTION] select() error: %s", strerror(errno));
+            LOG_ERROR(CONNECTION, "select() error: %s", strerror(errno));
             break;
         }
         
@@ -75,21 +84,21 @@ void *connection_manager_thread(void *arg){
         
         if(client_fd < 0){
             if(errno == EINTR) continue;
-            log_event("[CONNECTION] accept() error: %s", strerror(errno));
+            LOG_ERROR(CONNECTION, "accept() error: %s", strerror(errno));
             continue; // Try to accept next connection
         }
         
         // Allocate client info
         client_info_t *client_info = malloc(sizeof(client_info_t));
         if(!client_info){
-            log_event("[CONNECTION] malloc failed for client info");
+            LOG_ERROR(CONNECTION, "malloc failed for client info");
             close(client_fd);
             continue;
         }
 
         // Check connection limit
         if(active_clients >= MAX_CONCURRENT_CLIENTS){
-            log_event("[CONNECTION] Max clients reached (%d), rejecting %s:%d", MAX_CONCURRENT_CLIENTS, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            LOG_WARN(CONNECTION, "Max clients reached (%d), rejecting %s:%d", MAX_CONCURRENT_CLIENTS, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
             
             // Send rejection message
             const char *reject_msg = "ERROR: Server full\n";
@@ -108,7 +117,7 @@ void *connection_manager_thread(void *arg){
         pthread_t client_tid;
         int rc = pthread_create(&client_tid, NULL, client_thread_func, client_info);
         if(rc != 0){
-            log_event("[CONNECTION] pthread_create failed: %s", strerror(rc));
+            LOG_ERROR(CONNECTION, "pthread_create failed: %s", strerror(rc));
 
             // Decrement on failure
             __sync_fetch_and_sub(&active_clients, 1);
@@ -121,13 +130,13 @@ void *connection_manager_thread(void *arg){
         pthread_detach(client_tid);
         total_connections++;
         
-        log_event("[CONNECTION] New client connected from %s:%d (total: %zu)", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),total_connections);
+        LOG_INFO(CONNECTION, "New client connected from %s:%d (total: %zu)", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),total_connections);
     }
     
     // Cleanup
     close(server_fd);
     
-    log_event("[CONNECTION] Connection manager thread exiting. Total connections: %zu", total_connections);
+    LOG_INFO(CONNECTION, "Connection manager thread exiting. Total connections: %zu", total_connections);
     
     return NULL;
 }
\ No newline at end of file
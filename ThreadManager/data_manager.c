@@ -2,44 +2,55 @@
 #include "data_manager.h"
 #include "logger.h"
 #include "client_thread.h"
+#include "hot_cache.h"
+#include "upload_scheduler.h"
 
-// Helper: process temperature sensor
-static void process_temperature(int sensor_id, double avg){
+// Helper: process temperature sensor, 1 when a threshold alarm fires
+static int process_temperature(int sensor_id, double avg){
     if(avg >= TEMP_HOT){
-        log_event("[TEMP] Sensor %d reports it's too hot (avg = %.2f°C)", sensor_id, avg);
+        LOG_WARN(TEMP, "Sensor %d reports it's too hot (avg = %.2f°C)", sensor_id, avg);
+        return 1;
     } 
     else if (avg < TEMP_COLD){
-        log_event("[TEMP] Sensor %d reports it's too cold (avg = %.2f°C)", sensor_id, avg);
+        LOG_WARN(TEMP, "Sensor %d reports it's too cold (avg = %.2f°C)", sensor_id, avg);
+        return 1;
     } 
     else{
-        log_event("[TEMP] Sensor %d temperature normal (avg = %.2f°C)", sensor_id, avg);
+        LOG_DEBUG(TEMP, "Sensor %d temperature normal (avg = %.2f°C)", sensor_id, avg);
     }
+    return 0;
 }
 
-// Helper: process humidity sensor
-static void process_humidity(int sensor_id, double avg){
+// Helper: process humidity sensor, 1 when a threshold alarm fires
+static int process_humidity(int sensor_id, double avg){
     if(avg >= HUMID_HIGH){
-        log_event("[HUMID] Sensor %d reports high humidity (avg = %.2f%%)", sensor_id, avg);
+        LOG_WARN(HUMID, "Sensor %d reports high humidity (avg = %.2f%%)", sensor_id, avg);
+        return 1;
     } 
     else if(avg < HUMID_LOW){
-        log_event("[HUMID] Sensor %d reports low humidity (avg = %.2f%%)", sensor_id, avg);
+        LOG_WARN(HUMID, "Sensor %d reports low humidity (avg = %.2f%%)", sensor_id, avg);
+        return 1;
     } 
     else{
-        log_event("[HUMID] Sensor %d humidity normal (avg = %.2f%%)", sensor_id, avg);
+        LOG_DEBUG(HUMID, "Sensor %d humidity normal (avg = %.2f%%)", sensor_id, avg);
     }
+    return 0;
 }
 
-// Helper: process light sensor
-static void process_light(int sensor_id, double avg){
+// Helper: process light sensor, 1 when a threshold alarm fires
+static int process_light(int sensor_id, double avg){
     if(avg >= LIGHT_BRIGHT){
-        log_event("[LIGHT] Sensor %d reports bright light (avg = %.2f lux)", sensor_id, avg);
+        LOG_WARN(LIGHT, "Sensor %d reports bright light (avg = %.2f lux)", sensor_id, avg);
+        return 1;
     } 
     else if(avg < LIGHT_DIM){
-        log_event("[LIGHT] Sensor %d reports low light (avg = %.2f lux)", sensor_id, avg);
+        LOG_WARN(LIGHT, "Sensor %d reports low light (avg = %.2f lux)", sensor_id, avg);
+        return 1;
     } 
     else{
-        log_event("[LIGHT] Sensor %d light normal (avg = %.2f lux)", sensor_id, avg);
+        LOG_DEBUG(LIGHT, "Sensor %d light normal (avg = %.2f lux)", sensor_id, avg);
     }
+    return 0;
 }
 
 // // Helper: process single sensor packet
@@ -72,11 +83,12 @@ static void process_light(int sensor_id, double avg){
 void *data_manager_thread(void *arg){
     (void)arg;
     
-    log_event("[DATA] Data manager thread started");
+    LOG_INFO(DATA, "Data manager thread started");
     
     sensor_packet_t local_buf[LOCAL_BUFFER_SIZE];
     stat_update_t stat_updates[LOCAL_BUFFER_SIZE];  // Batch buffer
     double stat_avgs[LOCAL_BUFFER_SIZE];            // Output buffer
+    unsigned long stat_counts[LOCAL_BUFFER_SIZE];
 
     size_t total_processed = 0;
     size_t local_count = 0;
@@ -89,6 +101,7 @@ void *data_manager_thread(void *arg){
             if(local_count < LOCAL_BUFFER_SIZE){
                 local_buf[local_count] = node->pkt;
                 sbuffer_mark_data_done(&sbuffer, node);
+                hot_cache_append(&local_buf[local_count]);
 
                 // Prepare batch update
                 stat_updates[local_count].id = node->pkt.id;
@@ -107,29 +120,31 @@ void *data_manager_thread(void *arg){
         // Process all collected packets
         if(local_count > 0){
             // Single lock for entire batch
-            update_running_avg_batch(stat_updates, local_count, stat_avgs);
+            update_running_avg_batch(stat_updates, local_count, stat_avgs, stat_counts);
             
             // Process with updated averages
             for(size_t i = 0; i < local_count; i++){
                 double avg = stat_avgs[i];
+                int alarm = 0;
                 
                 switch(local_buf[i].type){
                     case SENSOR_TEMPERATURE:
-                        process_temperature(local_buf[i].id, avg);
+                        alarm = process_temperature(local_buf[i].id, avg);
                         break;
                         
                     case SENSOR_HUMIDITY:
-                        process_humidity(local_buf[i].id, avg);
+                        alarm = process_humidity(local_buf[i].id, avg);
                         break;
                         
                     case SENSOR_LIGHT:
-                        process_light(local_buf[i].id, avg);
+                        alarm = process_light(local_buf[i].id, avg);
                         break;
                         
                     default:
-                        log_event("[UNKNOWN] Sensor %d has unknown type %d (avg = %.2f)", local_buf[i].id, local_buf[i].type, avg);
+                        LOG_WARN(DATA, "Sensor %d has unknown type %d (avg = %.2f)", local_buf[i].id, local_buf[i].type, avg);
                         break;
                 }
+                upload_sched_notify(local_buf[i].id, local_buf[i].type, avg, stat_counts[i], alarm);
             }
             total_processed += local_count;
             local_count = 0;
@@ -139,7 +154,9 @@ void *data_manager_thread(void *arg){
         }
     }
     
-    log_event("[DATA] Data manager thread exiting. Total processed: %zu measurements", total_processed);
+    // No more updates, let the cloud thread finish now
+    upload_sched_close();
+    LOG_INFO(DATA, "Data manager thread exiting. Total processed: %zu measurements", total_processed);
     
     return NULL;
 }
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "maintenance_manager.h"
+#include "database.h"
+#include "logger.h"
+#include "config.h"
+#include "utilities.h"
+#include "partition.h"
+#include "storage_backend.h"
+#include "startup.h"
+
+// Maintenance metrics
+typedef struct{
+    unsigned long long checkpoints;
+    unsigned long long checkpoints_busy;
+    unsigned long long frames_copied;
+    unsigned long long max_checkpoint_us;
+    int64_t max_wal_bytes;
+    unsigned long long rows_deleted;
+    int64_t bytes_reclaimed;
+    unsigned long long retention_passes;
+    unsigned long long partitions_dropped;
+} maint_stats_t;
+
+static maint_stats_t stats;
+
+// Helper: current WAL file size, 0 if there is none
+static int64_t maint_wal_bytes(const char *db_path){
+    char wal[300];
+    struct stat st;
+    snprintf(wal, sizeof(wal), "%s-wal", db_path);
+    return (stat(wal, &st) == 0) ? (int64_t)st.st_size : 0;
+}
+
+static void maint_checkpoint(db_handle_t *db){
+    int wal_frames = 0, copied = 0;
+    unsigned long long start = time_mono_us();
+    int rc = db_wal_checkpoint(db, &wal_frames, &copied);
+    unsigned long long us = time_mono_us() - start;
+
+    stats.checkpoints++;
+    if(rc == SQLITE_BUSY) stats.checkpoints_busy++;
+    if(copied > 0) stats.frames_copied += copied;
+    if(us > stats.max_checkpoint_us) stats.max_checkpoint_us = us;
+}
+
+// Helper: one pass over all sensors, small delete transactions with pauses
+// so the writer never waits long for the lock
+static void maint_retention_pass(db_handle_t *db){
+    static uint8_t ids[MAINT_MAX_SENSORS], types[MAINT_MAX_SENSORS];
+    int64_t cutoff = time_now_ms() - (int64_t)g_config.retention_days * 86400LL * 1000;
+    unsigned long long deleted = 0;
+
+    int n = db_list_sensors(db, ids, types, MAINT_MAX_SENSORS);
+    for(int i = 0; i < n && !stop_flag; i++){
+        int rc;
+        do{
+            rc = db_retention_delete(db, ids[i], types[i], cutoff, g_config.retention_chunk);
+            if(rc > 0){
+                deleted += rc;
+                usleep(MAINT_CHUNK_PAUSE_MS * 1000);
+            }
+        } while(rc >= (int)g_config.retention_chunk && !stop_flag);
+    }
+
+    // Freed pages go back to the filesystem a step at a time
+    int64_t reclaimed = 0, step;
+    while(!stop_flag && (step = db_incremental_vacuum(db, g_config.vacuum_pages)) > 0){
+        reclaimed += step;
+        usleep(MAINT_CHUNK_PAUSE_MS * 1000);
+    }
+
+    stats.retention_passes++;
+    stats.rows_deleted += deleted;
+    stats.bytes_reclaimed += reclaimed;
+    if(deleted > 0 || reclaimed > 0){
+        LOG_INFO(MAINT, "Retention (%d days): %llu rows deleted, %lld bytes reclaimed, %lld bytes still on freelist",
+                  g_config.retention_days, deleted, (long long)reclaimed, (long long)db_freelist_bytes(db));
+    }
+}
+
+static void maint_log_stats(void){
+    LOG_INFO(MAINT, "Checkpoints: %llu (%llu busy), %llu frames copied, max %llu us, max WAL %lld bytes",
+              stats.checkpoints, stats.checkpoints_busy, stats.frames_copied, stats.max_checkpoint_us,
+              (long long)stats.max_wal_bytes);
+    LOG_INFO(MAINT, "Retention: %llu passes, %llu rows deleted, %llu partitions dropped, %lld bytes reclaimed",
+              stats.retention_passes, stats.rows_deleted, stats.partitions_dropped, (long long)stats.bytes_reclaimed);
+}
+
+// Partitioned storage: retention unlinks expired partitions, checkpoints
+// only concern the partition of the current time (older ones are
+// checkpointed when the writer closes them)
+static void maint_partition_loop(const char *dir, const char *prefix, const char *suffix, int64_t span_ms){
+    int sqlite = (strcmp(prefix, "sqlite") == 0);
+    int checkpoints = sqlite && g_config.maint_checkpoint_s > 0;
+    if(!checkpoints && g_config.retention_days == 0){
+        LOG_INFO(MAINT, "Maintenance disabled by configuration");
+        return;
+    }
+
+    LOG_INFO(MAINT, "Maintenance thread started (partitions in %s)", dir);
+
+    int64_t wal_limit = (int64_t)g_config.maint_wal_max_kb * 1024;
+    db_handle_t *db = NULL;
+    int64_t db_start = INT64_MIN;
+    char db_path[PARTITION_PATH_MAX] = "";
+
+    time_t last_checkpoint = time(NULL);
+    time_t last_stats = last_checkpoint;
+    time_t last_retention = last_checkpoint - g_config.retention_interval_s + 10;
+
+    while(!stop_flag){
+        usleep(MAINT_TICK_MS * 1000);
+        time_t now = time(NULL);
+
+        if(checkpoints){
+            // Follow the active partition once the writer has created it
+            int64_t start = partition_start(time_now_ms(), span_ms);
+            if(start != db_start){
+                char path[PARTITION_PATH_MAX];
+                struct stat st;
+                partition_path(path, sizeof(path), dir, prefix, suffix, start, span_ms);
+                if(stat(path, &st) == 0){
+                    if(db){
+                        maint_checkpoint(db);
+                        db_close(db);
+                        partition_release(db_start);
+                        db = NULL;
+                    }
+                    // Pinned so retention never removes it under the handle
+                    if(partition_acquire(start) == 0){
+                        if(db_open_maintenance(&db, path) == SQLITE_OK){
+                            db_set_autocheckpoint(db, 0, wal_limit);
+                            db_start = start;
+                            snprintf(db_path, sizeof(db_path), "%s", path);
+                        }
+                        else{
+                            partition_release(start);
+                            db = NULL;
+                        }
+                    }
+                }
+            }
+
+            int64_t wal = db ? maint_wal_bytes(db_path) : 0;
+            if(wal > stats.max_wal_bytes) stats.max_wal_bytes = wal;
+            if(db && (now - last_checkpoint >= g_config.maint_checkpoint_s || wal >= wal_limit)){
+                maint_checkpoint(db);
+                last_checkpoint = now;
+            }
+        }
+
+        if(g_config.retention_days > 0 && now - last_retention >= g_config.retention_interval_s){
+            int64_t cutoff = time_now_ms() - (int64_t)g_config.retention_days * 86400LL * 1000;
+            uint64_t freed = 0;
+            int dropped = partition_drop_before(dir, prefix, suffix, span_ms, cutoff, &freed);
+            stats.retention_passes++;
+            if(dropped > 0){
+                stats.partitions_dropped += dropped;
+                stats.bytes_reclaimed += freed;
+                LOG_INFO(MAINT, "Retention (%d days): %d partitions dropped, %llu bytes freed",
+                          g_config.retention_days, dropped, (unsigned long long)freed);
+            }
+            last_retention = time(NULL);
+        }
+
+        if(now - last_stats >= MAINT_STATS_INTERVAL_SEC){
+            maint_log_stats();
+            last_stats = now;
+        }
+    }
+
+    if(db){
+        maint_checkpoint(db);
+        db_close(db);
+        partition_release(db_start);
+    }
+    maint_log_stats();
+    LOG_INFO(MAINT, "Maintenance thread exiting");
+}
+
+void *maintenance_manager_thread(void *arg){
+    (void)arg;
+
+    const char *dir, *prefix, *suffix;
+    int64_t span_ms;
+    if(storage_partition_layout(&dir, &prefix, &suffix, &span_ms)){
+        maint_partition_loop(dir, prefix, suffix, span_ms);
+        return NULL;
+    }
+
+    // Only the SQLite backend needs checkpoints and vacuum
+    if(strcmp(g_config.storage_backend, "sqlite") != 0){
+        return NULL;
+    }
+    if(g_config.maint_checkpoint_s == 0 && g_config.retention_days == 0){
+        LOG_INFO(MAINT, "Maintenance disabled by configuration");
+        return NULL;
+    }
+
+    LOG_INFO(MAINT, "Maintenance thread started");
+
+    const char *path = g_config.storage_path[0] ? g_config.storage_path : DB_FILE;
+    int64_t wal_limit = (int64_t)g_config.maint_wal_max_kb * 1024;
+
+    // The storage writer creates or upgrades the schema before it is ready
+    if(startup_wait(STARTUP_STORAGE, -1) != 0){
+        LOG_INFO(MAINT, "Maintenance thread exiting before storage was ready");
+        return NULL;
+    }
+
+    db_handle_t *db = NULL;
+    if(db_open_maintenance(&db, path) != SQLITE_OK){
+        LOG_ERROR(MAINT, "Unable to open %s, maintenance disabled", path);
+        return NULL;
+    }
+    db_set_autocheckpoint(db, 0, wal_limit);
+
+    time_t last_checkpoint = time(NULL);
+    time_t last_stats = last_checkpoint;
+    // First retention pass shortly after startup
+    time_t last_retention = last_checkpoint - g_config.retention_interval_s + 10;
+
+    while(!stop_flag){
+        usleep(MAINT_TICK_MS * 1000);
+        time_t now = time(NULL);
+
+        int64_t wal = maint_wal_bytes(path);
+        if(wal > stats.max_wal_bytes) stats.max_wal_bytes = wal;
+
+        if(g_config.maint_checkpoint_s > 0 &&
+           (now - last_checkpoint >= g_config.maint_checkpoint_s || wal >= wal_limit)){
+            maint_checkpoint(db);
+            last_checkpoint = now;
+        }
+
+        if(g_config.retention_days > 0 && now - last_retention >= g_config.retention_interval_s){
+            maint_retention_pass(db);
+            last_retention = time(NULL);
+        }
+
+        if(now - last_stats >= MAINT_STATS_INTERVAL_SEC){
+            maint_log_stats();
+            last_stats = now;
+        }
+    }
+
+    // Leave a short WAL behind for the next start
+    if(g_config.maint_checkpoint_s > 0){
+        maint_checkpoint(db);
+    }
+    maint_log_stats();
+    db_close(db);
+
+    LOG_INFO(MAINT, "Maintenance thread exiting");
+    return NULL;
+}
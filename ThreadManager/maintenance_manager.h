@@ -0,0 +1,15 @@
+#ifndef MAINTENANCE_MANAGER_H
+#define MAINTENANCE_MANAGER_H
+
+#include "main.h"
+
+#define MAINT_TICK_MS 1000
+#define MAINT_STATS_INTERVAL_SEC 300
+#define MAINT_CHUNK_PAUSE_MS 10     // yield to the writer between deletes
+#define MAINT_MAX_SENSORS 1024
+
+extern volatile sig_atomic_t stop_flag;
+
+void *maintenance_manager_thread(void *arg);
+
+#endif
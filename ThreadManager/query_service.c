@@ -0,0 +1,611 @@
+#include "query_service.h"
+#include "database.h"
+#include "tsdb.h"
+#include "logger.h"
+#include "config.h"
+#include "hot_cache.h"
+#include "storage_manager.h"
+#include "outbox.h"
+#include "storage_backend.h"
+#include "partition.h"
+#include "startup.h"
+#include <sys/un.h>
+
+// Read-only handle on the store, or on one time partition of it
+typedef struct{
+    int64_t start_ms;           // partition start, INT64_MIN for an unpartitioned store
+    db_handle_t *db;
+    tsdb_t *tsdb;
+    unsigned long long last_use;
+} query_reader_t;
+
+// Per-worker state: a few read-only backend handles and a fixed output
+// buffer, so memory stays bounded whatever the query returns
+typedef struct{
+    int id;
+    int fd;
+    query_reader_t readers[QUERY_READERS_MAX];
+    size_t num_readers;
+    unsigned long long tick;
+    partition_info_t *parts;    // partition listing, NULL if unpartitioned
+    unsigned long parts_gen;    // partition removals seen by the cached readers
+    hot_sample_t *hot;          // hot-tail snapshot, NULL if the cache is off
+    int binary;
+    int failed;                 // peer gone or send error
+    uint32_t frame_rows;
+    unsigned long long rows;
+    // Streaming aggregation for backends without GROUP BY
+    int agg_open;
+    int64_t bucket_ms;
+    query_agg_rec_t agg;
+    size_t out_len;
+    uint8_t out[QUERY_OUT_BUF_SIZE];
+} query_worker_t;
+
+// Accepted connections waiting for a worker
+static struct{
+    int fds[QUERY_QUEUE_MAX];
+    size_t head;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} pending = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Service statistics
+static unsigned long long total_queries = 0;
+static unsigned long long total_rows = 0;
+static unsigned long long total_rejected = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ===========================
+ *   Output
+ * =========================== */
+
+// Helper: send everything or mark the worker failed
+static void query_send(query_worker_t *w, const void *buf, size_t len){
+    const uint8_t *p = buf;
+    while(len > 0 && !w->failed){
+        ssize_t n = send(w->fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            w->failed = 1;
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// Helper: push buffered output; in binary mode the buffer is one frame
+static void query_flush(query_worker_t *w){
+    if(w->binary){
+        if(w->frame_rows == 0) return;
+        memcpy(w->out, &w->frame_rows, sizeof(uint32_t));
+        query_send(w, w->out, w->out_len);
+        w->out_len = sizeof(uint32_t);
+        w->frame_rows = 0;
+    }
+    else if(w->out_len > 0){
+        query_send(w, w->out, w->out_len);
+        w->out_len = 0;
+    }
+}
+
+static void query_emit(query_worker_t *w, const void *rec, size_t len){
+    if(w->out_len + len > sizeof(w->out)) query_flush(w);
+    memcpy(w->out + w->out_len, rec, len);
+    w->out_len += len;
+    w->frame_rows++;
+    w->rows++;
+}
+
+static void query_printf(query_worker_t *w, const char *fmt, ...){
+    char line[160];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if(len <= 0) return;
+    if(len >= (int)sizeof(line)) len = sizeof(line) - 1;
+
+    if(w->out_len + len > sizeof(w->out)) query_flush(w);
+    memcpy(w->out + w->out_len, line, len);
+    w->out_len += len;
+}
+
+/* ===========================
+ *   Row callbacks
+ * =========================== */
+
+static int emit_raw(void *ctx, const sensor_packet_t *pkt){
+    query_worker_t *w = ctx;
+    if(w->binary){
+        query_raw_rec_t r = { pkt->ts_ms, pkt->value };
+        query_emit(w, &r, sizeof(r));
+    }
+    else{
+        query_printf(w, "%lld,%.10g\n", (long long)pkt->ts_ms, pkt->value);
+        w->rows++;
+    }
+    return w->failed;
+}
+
+static void emit_agg(query_worker_t *w, const query_agg_rec_t *a){
+    if(w->binary){
+        query_emit(w, a, sizeof(*a));
+    }
+    else{
+        query_printf(w, "%lld,%u,%.10g,%.10g,%.10g\n", (long long)a->bucket_ms, a->count, a->min, a->max, a->mean);
+        w->rows++;
+    }
+}
+
+// Helper: merge into the pending bucket; a bucket is emitted once rows
+// move past it, so buckets split across partitions come out whole
+static void agg_add(query_worker_t *w, int64_t bucket, uint32_t count, double sum, double min, double max){
+    if(w->agg_open && bucket != w->agg.bucket_ms){
+        w->agg.mean /= w->agg.count;
+        emit_agg(w, &w->agg);
+        w->agg_open = 0;
+    }
+    if(!w->agg_open){
+        w->agg = (query_agg_rec_t){ .bucket_ms = bucket, .min = min, .max = max };
+        w->agg_open = 1;
+    }
+    w->agg.count += count;
+    w->agg.mean += sum;             // running sum until emitted
+    if(min < w->agg.min) w->agg.min = min;
+    if(max > w->agg.max) w->agg.max = max;
+}
+
+static int emit_rollup(void *ctx, const db_rollup_t *r){
+    query_worker_t *w = ctx;
+    agg_add(w, r->bucket_ms, (uint32_t)r->count, r->sum, r->min, r->max);
+    return w->failed;
+}
+
+// Raw rows folded into buckets as they stream past (rows arrive in time order)
+static int fold_raw(void *ctx, const sensor_packet_t *pkt){
+    query_worker_t *w = ctx;
+    int64_t b = pkt->ts_ms - pkt->ts_ms % w->bucket_ms;
+    agg_add(w, b, 1, pkt->value, pkt->value, pkt->value);
+    return w->failed;
+}
+
+/* ===========================
+ *   Commands
+ * =========================== */
+
+static void query_reader_close(query_reader_t *r){
+    db_close(r->db);
+    tsdb_close(r->tsdb);
+    r->db = NULL;
+    r->tsdb = NULL;
+}
+
+// Helper: reader for the store (start_ms = INT64_MIN) or one of its
+// partitions, reusing an open handle or replacing the least recently used
+static query_reader_t *query_reader_get(query_worker_t *w, int64_t start_ms){
+    for(size_t i = 0; i < w->num_readers; i++){
+        if(w->readers[i].start_ms == start_ms){
+            w->readers[i].last_use = ++w->tick;
+            return &w->readers[i];
+        }
+    }
+
+    query_reader_t *r;
+    if(w->num_readers < QUERY_READERS_MAX){
+        r = &w->readers[w->num_readers++];
+    }
+    else{
+        r = &w->readers[0];
+        for(size_t i = 1; i < w->num_readers; i++){
+            if(w->readers[i].last_use < r->last_use) r = &w->readers[i];
+        }
+        query_reader_close(r);
+    }
+
+    const char *backend = g_config.storage_backend;
+    char path[PARTITION_PATH_MAX];
+    const char *dir, *prefix, *suffix;
+    int64_t span_ms;
+    if(storage_partition_layout(&dir, &prefix, &suffix, &span_ms)){
+        partition_path(path, sizeof(path), dir, prefix, suffix, start_ms, span_ms);
+    }
+    else{
+        const char *def = (strcmp(backend, "tsdb") == 0) ? TSDB_DIR : DB_FILE;
+        snprintf(path, sizeof(path), "%s", g_config.storage_path[0] ? g_config.storage_path : def);
+    }
+
+    int rc = -1;
+    if(strcmp(backend, "sqlite") == 0){
+        rc = (db_open_readonly(&r->db, path) == SQLITE_OK) ? 0 : -1;
+    }
+    else if(strcmp(backend, "tsdb") == 0){
+        rc = tsdb_open_readonly(&r->tsdb, path);
+    }
+    if(rc != 0){
+        query_reader_close(r);
+        *r = w->readers[--w->num_readers];
+        return NULL;
+    }
+    r->start_ms = start_ms;
+    r->last_use = ++w->tick;
+    return r;
+}
+
+// Helper: one store or partition into the output stream
+static int query_reader_run(query_worker_t *w, query_reader_t *r, int id, int type, int64_t from, int64_t to){
+    int64_t bucket = w->bucket_ms;
+    if(r->db){
+        return bucket ? db_query_downsample(r->db, id, type, from, to, bucket, emit_rollup, w)
+                      : db_query_range(r->db, id, type, from, to, emit_raw, w);
+    }
+    return tsdb_query_range(r->tsdb, id, type, from, to, bucket ? fold_raw : emit_raw, w);
+}
+
+// Helper: partitions overlapping the range, oldest first
+static int query_partitions(query_worker_t *w, int id, int type, int64_t from, int64_t to){
+    const char *dir, *prefix, *suffix;
+    int64_t span_ms;
+    storage_partition_layout(&dir, &prefix, &suffix, &span_ms);
+
+    int n = partition_list(dir, prefix, suffix, span_ms, from, to, w->parts, PARTITION_MAX);
+    for(int i = 0; i < n && !w->failed; i++){
+        // Pinned while it is read; cached readers may predate a removal
+        int64_t start = w->parts[i].start_ms;
+        if(partition_acquire(start) != 0) return -1;
+        unsigned long gen = partition_generation();
+        if(gen != w->parts_gen){
+            for(size_t j = 0; j < w->num_readers; j++){
+                query_reader_close(&w->readers[j]);
+            }
+            w->num_readers = 0;
+            w->parts_gen = gen;
+        }
+
+        query_reader_t *r = query_reader_get(w, start);
+        int rc = r ? query_reader_run(w, r, id, type, from, to) : -1;
+        if(r && rc != 0){
+            query_reader_close(r);
+            *r = w->readers[--w->num_readers];
+        }
+        partition_release(start);
+        if(rc != 0) return -1;
+    }
+    return 0;
+}
+
+static void cmd_range(query_worker_t *w, char **argv, int argc){
+    if(argc < 5){
+        query_printf(w, "ERR usage: RANGE <id> <type> <from_ms> <to_ms> [bucket_ms] [csv|bin]\n");
+        return;
+    }
+    int id = atoi(argv[1]);
+    int type = atoi(argv[2]);
+    int64_t from = strtoll(argv[3], NULL, 10);
+    int64_t to = strtoll(argv[4], NULL, 10);
+    int64_t bucket = 0;
+    int binary = 0;
+    for(int i = 5; i < argc; i++){
+        if(strcmp(argv[i], "bin") == 0) binary = 1;
+        else if(strcmp(argv[i], "csv") == 0) binary = 0;
+        else bucket = strtoll(argv[i], NULL, 10);
+    }
+    if(bucket < 0 || from > to){
+        query_printf(w, "ERR bad range\n");
+        return;
+    }
+    // Recent windows come straight from the hot-tail cache
+    size_t hot_count = 0;
+    int hot = w->hot && hot_cache_snapshot(id, type, from, w->hot, &hot_count);
+    query_reader_t *reader = NULL;
+    if(!hot && !w->parts && (reader = query_reader_get(w, INT64_MIN)) == NULL){
+        query_printf(w, "ERR backend '%s' not readable\n", g_config.storage_backend);
+        return;
+    }
+
+    query_printf(w, "OK\n");
+    query_flush(w);
+    w->binary = binary;
+    w->rows = 0;
+    w->frame_rows = 0;
+    w->agg_open = 0;
+    w->bucket_ms = bucket;
+    if(binary) w->out_len = sizeof(uint32_t);
+
+    int rc = 0;
+    if(hot){
+        tsdb_row_cb cb = bucket ? fold_raw : emit_raw;
+        sensor_packet_t pkt = { .id = id, .type = type };
+        for(size_t i = 0; i < hot_count && !w->failed; i++){
+            if(w->hot[i].ts_ms > to) continue;
+            pkt.ts_ms = w->hot[i].ts_ms;
+            pkt.value = w->hot[i].value;
+            cb(w, &pkt);
+        }
+    }
+    else if(w->parts){
+        rc = query_partitions(w, id, type, from, to);
+    }
+    else if(query_reader_run(w, reader, id, type, from, to) != 0){
+        query_reader_close(reader);
+        w->num_readers = 0;
+        rc = -1;
+    }
+    if(bucket && w->agg_open){
+        w->agg.mean /= w->agg.count;
+        emit_agg(w, &w->agg);
+    }
+
+    // Headers already went out, so a failure just ends the stream early
+    if(rc != 0){
+        LOG_ERROR(QUERY, "Worker %d: query failed, reader closed", w->id);
+    }
+
+    query_flush(w);
+    if(binary){
+        uint32_t end = 0;
+        query_send(w, &end, sizeof(end));
+        w->out_len = 0;
+        w->binary = 0;
+    }
+    else{
+        query_printf(w, "END %llu\n", w->rows);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    total_queries++;
+    total_rows += w->rows;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void cmd_ping(query_worker_t *w, char **argv, int argc){
+    (void)argv;
+    (void)argc;
+    query_printf(w, "OK\n");
+}
+
+// Storage batching histograms, hot-cache counters, cloud outbox and
+// startup times, then "END"
+static void cmd_stats(query_worker_t *w, char **argv, int argc){
+    (void)argv;
+    (void)argc;
+    char buf[1024];
+    storage_batch_stats_format(buf, sizeof(buf));
+    unsigned long long hits, misses;
+    hot_cache_stats(&hits, &misses);
+
+    query_printf(w, "OK\n");
+    query_flush(w);
+    query_send(w, buf, strlen(buf));
+    query_printf(w, "hot_cache hits=%llu misses=%llu\n", hits, misses);
+    outbox_stats_format(buf, sizeof(buf));
+    query_flush(w);
+    query_send(w, buf, strlen(buf));
+    startup_format(buf, sizeof(buf));
+    query_send(w, buf, strlen(buf));
+    query_printf(w, "END\n");
+}
+
+// LOGLEVEL [MODULE=level | level ...]: applies the entries, then lists
+// every module's threshold
+static void cmd_loglevel(query_worker_t *w, char **argv, int argc){
+    for(int i = 1; i < argc; i++){
+        if(log_levels_apply(argv[i]) != 0){
+            query_printf(w, "ERR bad entry '%s'\n", argv[i]);
+            return;
+        }
+        LOG_INFO(QUERY, "Worker %d: log level %s", w->id, argv[i]);
+    }
+    char buf[1024];
+    log_levels_format(buf, sizeof(buf));
+    query_printf(w, "OK\n");
+    query_flush(w);
+    query_send(w, buf, strlen(buf));
+    query_printf(w, "END\n");
+}
+
+typedef struct{
+    const char *name;
+    void (*handler)(query_worker_t *w, char **argv, int argc);
+} query_cmd_t;
+
+static const query_cmd_t query_cmds[] = {
+    { "PING",  cmd_ping },
+    { "RANGE", cmd_range },
+    { "STATS", cmd_stats },
+    { "LOGLEVEL", cmd_loglevel },
+};
+
+#define QUERY_NUM_CMDS (sizeof(query_cmds) / sizeof(query_cmds[0]))
+
+static void query_dispatch(query_worker_t *w, char *line){
+    char *argv[16];
+    int argc = 0;
+    char *save = NULL;
+    for(char *tok = strtok_r(line, " \t\r", &save); tok && argc < 16; tok = strtok_r(NULL, " \t\r", &save)){
+        argv[argc++] = tok;
+    }
+    if(argc == 0) return;
+
+    for(size_t i = 0; i < QUERY_NUM_CMDS; i++){
+        if(strcasecmp(argv[0], query_cmds[i].name) == 0){
+            query_cmds[i].handler(w, argv, argc);
+            query_flush(w);
+            return;
+        }
+    }
+    query_printf(w, "ERR unknown command '%s'\n", argv[0]);
+    query_flush(w);
+}
+
+/* ===========================
+ *   Workers
+ * =========================== */
+
+// Helper: serve request lines until the peer closes
+static void query_serve(query_worker_t *w){
+    char buf[QUERY_LINE_MAX];
+    size_t len = 0;
+
+    struct timeval tv = { .tv_sec = QUERY_IO_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(w->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    w->failed = 0;
+
+    while(!stop_flag && !w->failed){
+        ssize_t n = recv(w->fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        len += n;
+        buf[len] = '\0';
+
+        char *start = buf, *nl;
+        while((nl = memchr(start, '\n', buf + len - start)) != NULL && !w->failed){
+            *nl = '\0';
+            query_dispatch(w, start);
+            start = nl + 1;
+        }
+        len = buf + len - start;
+        memmove(buf, start, len);
+
+        if(len == sizeof(buf) - 1){
+            query_printf(w, "ERR request too long\n");
+            query_flush(w);
+            break;
+        }
+    }
+    close(w->fd);
+}
+
+static void *query_worker_thread(void *arg){
+    query_worker_t *w = arg;
+    if(hot_cache_capacity() > 0){
+        w->hot = malloc(hot_cache_capacity() * sizeof(hot_sample_t));
+    }
+    const char *dir, *prefix, *suffix;
+    int64_t span_ms;
+    if(storage_partition_layout(&dir, &prefix, &suffix, &span_ms)){
+        w->parts = malloc(PARTITION_MAX * sizeof(partition_info_t));
+    }
+
+    while(1){
+        pthread_mutex_lock(&pending.mutex);
+        while(pending.count == 0 && !stop_flag){
+            pthread_cond_wait(&pending.cond, &pending.mutex);
+        }
+        if(pending.count == 0){
+            pthread_mutex_unlock(&pending.mutex);
+            break;
+        }
+        w->fd = pending.fds[pending.head];
+        pending.head = (pending.head + 1) % QUERY_QUEUE_MAX;
+        pending.count--;
+        pthread_mutex_unlock(&pending.mutex);
+
+        query_serve(w);
+    }
+
+    for(size_t i = 0; i < w->num_readers; i++){
+        query_reader_close(&w->readers[i]);
+    }
+    free(w->hot);
+    free(w->parts);
+    return NULL;
+}
+
+/* ===========================
+ *   Acceptor thread
+ * =========================== */
+
+void *query_service_thread(void *arg){
+    (void)arg;
+
+    const char *path = g_config.query_socket;
+    if(path[0] == '\0'){
+        LOG_INFO(QUERY, "Query service disabled by configuration");
+        return NULL;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        LOG_INFO(QUERY, "Socket path too long: %s", path);
+        return NULL;
+    }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, QUERY_QUEUE_MAX) != 0){
+        LOG_ERROR(QUERY, "Unable to listen on %s: %s", path, strerror(errno));
+        if(lfd >= 0) close(lfd);
+        return NULL;
+    }
+
+    int num_workers = g_config.query_workers;
+    static query_worker_t *workers[QUERY_MAX_WORKERS];
+    pthread_t threads[QUERY_MAX_WORKERS];
+    int started = 0;
+    for(int i = 0; i < num_workers; i++){
+        workers[i] = calloc(1, sizeof(query_worker_t));
+        if(!workers[i]) break;
+        workers[i]->id = i;
+        if(pthread_create(&threads[i], NULL, query_worker_thread, workers[i]) != 0){
+            free(workers[i]);
+            break;
+        }
+        started++;
+    }
+    LOG_INFO(QUERY, "Query service listening on %s with %d workers", path, started);
+
+    struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+    while(!stop_flag){
+        if(poll(&pfd, 1, QUERY_ACCEPT_POLL_MS) <= 0) continue;
+
+        int cfd = accept(lfd, NULL, NULL);
+        if(cfd < 0) continue;
+
+        pthread_mutex_lock(&pending.mutex);
+        int queued = (pending.count < QUERY_QUEUE_MAX);
+        if(queued){
+            pending.fds[(pending.head + pending.count) % QUERY_QUEUE_MAX] = cfd;
+            pending.count++;
+            pthread_cond_signal(&pending.cond);
+        }
+        pthread_mutex_unlock(&pending.mutex);
+
+        if(!queued){
+            static const char busy[] = "ERR busy\n";
+            send(cfd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+            close(cfd);
+            pthread_mutex_lock(&stats_lock);
+            total_rejected++;
+            pthread_mutex_unlock(&stats_lock);
+        }
+    }
+
+    close(lfd);
+    unlink(path);
+
+    pthread_mutex_lock(&pending.mutex);
+    pthread_cond_broadcast(&pending.cond);
+    pthread_mutex_unlock(&pending.mutex);
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+        free(workers[i]);
+    }
+    // Connections nobody picked up
+    while(pending.count > 0){
+        close(pending.fds[pending.head]);
+        pending.head = (pending.head + 1) % QUERY_QUEUE_MAX;
+        pending.count--;
+    }
+
+    LOG_INFO(QUERY, "Query service stopped: %llu queries, %llu rows, %llu rejected busy",
+              total_queries, total_rows, total_rejected);
+    return NULL;
+}
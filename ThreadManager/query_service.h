@@ -0,0 +1,48 @@
+#ifndef QUERY_SERVICE_H
+#define QUERY_SERVICE_H
+
+#include "main.h"
+
+// Read-side query service on a Unix stream socket.
+// Requests are text lines, one response per request, several requests
+// may share a connection:
+//   PING
+//   RANGE <id> <type> <from_ms> <to_ms> [bucket_ms] [csv|bin]
+//   STATS        storage batch histograms and cache counters
+//   LOGLEVEL [MODULE=level ...]   change log thresholds, list them all
+// Windows still held by the hot-tail cache are answered from memory;
+// partitioned stores are read partition by partition, oldest first.
+// Every response starts with "OK\n" or "ERR <reason>\n".
+//   csv: one "ts,value" (or "bucket,count,min,max,mean") line per row,
+//        then "END <rows>\n"
+//   bin: frames of [uint32 n][n records], terminated by n = 0.
+//        Records are query_raw_rec_t, or query_agg_rec_t with a bucket.
+
+#define QUERY_SOCKET_PATH "../Database/query.sock"
+#define QUERY_MAX_WORKERS 16
+#define QUERY_QUEUE_MAX 16          // accepted connections waiting for a worker
+#define QUERY_OUT_BUF_SIZE (64 * 1024)
+#define QUERY_LINE_MAX 256
+#define QUERY_IO_TIMEOUT_SEC 5
+#define QUERY_ACCEPT_POLL_MS 500
+#define QUERY_READERS_MAX 4         // open read handles per worker (partitions)
+
+typedef struct{
+    int64_t ts_ms;
+    double value;
+} query_raw_rec_t;
+
+typedef struct{
+    int64_t bucket_ms;
+    uint32_t count;
+    uint32_t reserved;
+    double min;
+    double max;
+    double mean;
+} query_agg_rec_t;
+
+extern volatile sig_atomic_t stop_flag;
+
+void *query_service_thread(void *arg);
+
+#endif
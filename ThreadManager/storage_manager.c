@@ -1,21 +1,66 @@
 #include "storage_manager.h"
 #include "sbuffer.h"
 #include "logger.h"
-#include "database.h"
+#include "storage_backend.h"
+#include "config.h"
+#include "journal.h"
+#include "startup.h"
+#include "utilities.h"
+
+// Batch buffer handed between collector and writer
+typedef struct{
+    sensor_packet_t *packets;
+    size_t count;
+    uint64_t last_seq;      // highest journal sequence in the batch
+    int64_t first_ms;       // monotonic time the oldest packet was collected
+} storage_batch_t;
+
+// Bounded hand-off between collector and writer.
+// Batches cycle free -> (collector fills) -> full -> (writer commits) -> free,
+// so a slow commit leaves the collector without a free batch (backpressure).
+typedef struct{
+    storage_batch_t batches[STORAGE_NUM_BATCHES];
+    storage_batch_t *free_list[STORAGE_NUM_BATCHES];
+    size_t free_count;
+    storage_batch_t *full_ring[STORAGE_NUM_BATCHES];
+    size_t full_head;
+    size_t full_count;
+    int closing;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} storage_queue_t;
+
+static storage_queue_t queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Handed to the writer thread
+static storage_backend_t *writer_backend = NULL;
+
+// Writer statistics (read by collector after join)
+static size_t total_inserted = 0;
+static size_t total_failed = 0;
+
+// Current batch size target, moved by the writer, read by the collector
+static size_t batch_target = 0;
+
+// Per-batch histograms, written by the writer, readable at any time
+static log2_hist_t hist_rows;        // rows per batch
+static log2_hist_t hist_commit_ms;   // write + flush time
+static log2_hist_t hist_age_ms;      // oldest packet age when committed
+
+// Helper: open the configured backend with retries
+static storage_backend_t* storage_connect(int max_attempts){
+    storage_backend_t *sb = NULL;
 
-// Helper: connect to database with retries
-static sqlite3* storage_connect_db(int max_attempts){
-    sqlite3 *db = NULL;
-    
     for(int attempt = 1; attempt <= max_attempts && !stop_flag; attempt++){
-        int rc = db_init_and_open(&db);
-        if(rc == SQLITE_OK){
-            log_event("[SQL] Connection to SQL server established");
-            return db;
-        }
-        
-        log_event("[SQL] Unable to connect to SQL server (attempt %d/%d)", attempt, max_attempts);
-        
+        if(storage_backend_open(&sb, g_config.storage_backend, g_config.storage_path) == 0){
+            return sb;
+        }
+
+        LOG_WARN(STORAGE, "Unable to open storage backend '%s' (attempt %d/%d)", g_config.storage_backend, attempt, max_attempts);
+
         if(attempt < max_attempts){
             sleep(RECONNECT_DELAY_SEC);
         }
@@ -23,137 +68,381 @@ static sqlite3* storage_connect_db(int max_attempts){
     return NULL;
 }
 
-// Helper: batch insert with automatic reconnect
-static int storage_batch_insert_with_retry(sqlite3 **db, sensor_packet_t *batch, size_t count){
-    int rc = db_insert_measures_batch(*db, batch, count);
-    
-    if(rc == SQLITE_OK){
-        return SQLITE_OK;
+// Helper: re-establish a lost backend connection with retries
+static int storage_reconnect(storage_backend_t *sb, int max_attempts){
+    for(int attempt = 1; attempt <= max_attempts; attempt++){
+        if(storage_backend_reopen(sb) == 0){
+            LOG_INFO(STORAGE, "Storage backend reconnected");
+            return 0;
+        }
+
+        LOG_WARN(STORAGE, "Unable to reconnect storage backend (attempt %d/%d)", attempt, max_attempts);
+
+        if(attempt < max_attempts){
+            sleep(RECONNECT_DELAY_SEC);
+        }
     }
-    
+    return -1;
+}
+
+// Helper: durable batch write with automatic reconnect
+static int storage_batch_write_with_retry(storage_backend_t *sb, sensor_packet_t *batch, size_t count){
+    int rc = storage_backend_write(sb, batch, count);
+    if(rc == 0 && storage_backend_flush(sb) == 0){
+        return 0;
+    }
+    // Packets a partial write already stored are not written again
+    size_t done = (rc > 0) ? (size_t)rc : 0;
+
     // Connection lost - attempt reconnect
-    log_event("[SQL] Connection to SQL server lost. Attempting reconnect...");
-    sqlite3_close(*db);
-    *db = NULL;
-    
-    *db = storage_connect_db(MAX_RECONNECT_ATTEMPTS);
-    if(!*db){
-        log_event("[SQL] Unable to reconnect to SQL server after %d attempts", MAX_RECONNECT_ATTEMPTS);
-        return SQLITE_ERROR;
+    LOG_WARN(STORAGE, "Storage backend write failed. Attempting reconnect...");
+    if(storage_reconnect(sb, MAX_RECONNECT_ATTEMPTS) != 0){
+        LOG_ERROR(STORAGE, "Unable to reconnect storage backend after %d attempts", MAX_RECONNECT_ATTEMPTS);
+        return -1;
     }
-    
-    // Retry batch insert after reconnect
-    rc = db_insert_measures_batch(*db, batch, count);
-    if(rc == SQLITE_OK){
-        log_event("[SQL] Recovered and stored %zu measurements", count);
-        return SQLITE_OK;
+
+    // Retry the rest of the batch after reconnect
+    if(storage_backend_write(sb, batch + done, count - done) == 0 && storage_backend_flush(sb) == 0){
+        LOG_INFO(STORAGE, "Recovered and stored %zu measurements", count - done);
+        return 0;
     }
-    
-    // Batch still failed - try individual inserts as fallback
-    log_event("[SQL] Batch insert failed after reconnect. Inserting individually...");
 
-    size_t success = 0;
-    for(size_t i = 0; i < count; i++){
-        if(db_insert_measure(*db, &batch[i]) == SQLITE_OK){
-            success++;
+    LOG_ERROR(STORAGE, "Unable to store %zu measurements after reconnect", count - done);
+    return -1;
+}
+
+/* ===========================
+ *   Batch queue
+ * =========================== */
+
+static int storage_queue_init(void){
+    for(size_t i = 0; i < STORAGE_NUM_BATCHES; i++){
+        queue.batches[i].packets = malloc((size_t)g_config.batch_max * sizeof(sensor_packet_t));
+        if(!queue.batches[i].packets){
+            return -1;
         }
+        queue.batches[i].count = 0;
+        queue.free_list[i] = &queue.batches[i];
     }
-    
-    if(success > 0){
-        log_event("[SQL] Individual insert: %zu/%zu successful", success, count);
-    } 
-    if(success < count){
-        log_event("[SQL][ERROR] Lost %zu measurements", count - success);
+    queue.free_count = STORAGE_NUM_BATCHES;
+    queue.full_head = 0;
+    queue.full_count = 0;
+    queue.closing = 0;
+    return 0;
+}
+
+static void storage_queue_free(void){
+    for(size_t i = 0; i < STORAGE_NUM_BATCHES; i++){
+        free(queue.batches[i].packets);
+        queue.batches[i].packets = NULL;
+    }
+}
+
+// Collector: take an empty batch, blocking while all batches are in flight
+static storage_batch_t *storage_queue_get_free(void){
+    pthread_mutex_lock(&queue.mutex);
+    while(queue.free_count == 0){
+        pthread_cond_wait(&queue.cond, &queue.mutex);
     }
-    return (success == count) ? SQLITE_OK : SQLITE_ERROR;
+    storage_batch_t *batch = queue.free_list[--queue.free_count];
+    pthread_mutex_unlock(&queue.mutex);
+
+    batch->count = 0;
+    batch->last_seq = 0;
+    return batch;
+}
+
+// Collector: hand a filled batch to the writer
+static void storage_queue_put_full(storage_batch_t *batch){
+    pthread_mutex_lock(&queue.mutex);
+    queue.full_ring[(queue.full_head + queue.full_count) % STORAGE_NUM_BATCHES] = batch;
+    queue.full_count++;
+    pthread_cond_broadcast(&queue.cond);
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+// Collector: no more batches will be queued
+static void storage_queue_close(void){
+    pthread_mutex_lock(&queue.mutex);
+    queue.closing = 1;
+    pthread_cond_broadcast(&queue.cond);
+    pthread_mutex_unlock(&queue.mutex);
 }
 
+// Writer: take the oldest filled batch.
+// Returns 1 with a batch, 0 if none is queued and wait == 0, -1 once closed and drained.
+static int storage_queue_get_full(storage_batch_t **out, int wait){
+    pthread_mutex_lock(&queue.mutex);
+    while(wait && queue.full_count == 0 && !queue.closing){
+        pthread_cond_wait(&queue.cond, &queue.mutex);
+    }
+
+    int rc;
+    if(queue.full_count > 0){
+        *out = queue.full_ring[queue.full_head];
+        queue.full_head = (queue.full_head + 1) % STORAGE_NUM_BATCHES;
+        queue.full_count--;
+        rc = 1;
+    }
+    else{
+        rc = queue.closing ? -1 : 0;
+    }
+    pthread_mutex_unlock(&queue.mutex);
+    return rc;
+}
+
+// Writer: return a committed batch to the collector
+static void storage_queue_put_free(storage_batch_t *batch){
+    pthread_mutex_lock(&queue.mutex);
+    queue.free_list[queue.free_count++] = batch;
+    pthread_cond_broadcast(&queue.cond);
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+/* ===========================
+ *   Batch sizing and histograms
+ * =========================== */
+
+// Batch target and histograms, one line each
+size_t storage_batch_stats_format(char *out, size_t len){
+    size_t used = snprintf(out, len, "batch_target %zu (min %d, max %d, goal %d ms, max latency %d ms)\n",
+                           __atomic_load_n(&batch_target, __ATOMIC_RELAXED), g_config.batch_min,
+                           g_config.batch_max, g_config.batch_commit_goal_ms, g_config.batch_max_latency_ms);
+    if(used >= len) return len - 1;
+    const log2_hist_t *hists[] = { &hist_rows, &hist_commit_ms, &hist_age_ms };
+    const char *names[] = { "batch_rows", "commit_ms", "age_ms" };
+    for(size_t i = 0; i < sizeof(hists) / sizeof(hists[0]) && used < len - 1; i++){
+        used += log2_hist_format(hists[i], names[i], out + used, len - used);
+        if(used < len - 1) used += snprintf(out + used, len - used, "\n");
+    }
+    return used;
+}
+
+static void storage_log_batch_stats(void){
+    char buf[1024];
+    storage_batch_stats_format(buf, sizeof(buf));
+    char *save = NULL;
+    for(char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)){
+        LOG_INFO(STORAGE, "%s", line);
+    }
+}
+
+// Helper: move the target toward the commit-time goal.
+// Only full-size batches count, so light load (deadline-driven batches)
+// leaves the target alone. A long commit scales the rows it actually
+// wrote down to the goal; a quick one grows the target by a quarter.
+static void storage_adapt_target(size_t rows, unsigned long long commit_us){
+    size_t target = __atomic_load_n(&batch_target, __ATOMIC_RELAXED);
+    unsigned long long goal_us = (unsigned long long)g_config.batch_commit_goal_ms * 1000;
+    if(rows < target) return;
+
+    if(commit_us > goal_us){
+        target = (size_t)((double)rows * goal_us / commit_us);
+    }
+    else if(commit_us < goal_us * 3 / 4){
+        target += target / 4 + 1;
+    }
+
+    if(target < (size_t)g_config.batch_min) target = g_config.batch_min;
+    if(target > (size_t)g_config.batch_max) target = g_config.batch_max;
+    __atomic_store_n(&batch_target, target, __ATOMIC_RELAXED);
+}
+
+/* ===========================
+ *   Writer thread
+ * =========================== */
+
+static void *storage_writer_thread(void *arg){
+    (void)arg;
+
+    LOG_INFO(STORAGE, "Storage writer thread started");
+
+    storage_backend_t *sb = writer_backend;
+    size_t health_check_counter = 0;
+    int idle_pending = 1;
+    int checkpoint_frozen = 0;          // set only when stopping with a batch unstored
+    time_t last_stats = time(NULL);
+    storage_batch_t *batch;
+    int rc;
+
+    // Keeps committing after stop_flag until the collector closes the queue
+    while(1){
+        // Backend background work (e.g. schema migration) runs in small
+        // steps only while no batch is waiting
+        rc = storage_queue_get_full(&batch, !(idle_pending && !stop_flag));
+        if(rc < 0){
+            break;
+        }
+        if(rc == 0){
+            int step = storage_backend_idle(sb);
+            if(step < 0){
+                LOG_WARN(STORAGE, "Backend background step failed, will retry");
+                usleep(POLL_DELAY_MS * 1000);
+            }
+            else if(step == 0){
+                idle_pending = 0;
+            }
+            continue;
+        }
+
+        if(checkpoint_frozen){
+            // Shutting down after a batch could not be stored: the rest
+            // stays in the journal behind it and is replayed on next start
+            total_failed += batch->count;
+            storage_queue_put_free(batch);
+            continue;
+        }
+
+        // A failed batch is held and retried so the checkpoint never passes
+        // it: until the backend comes back while it is unreachable, or up to
+        // STORAGE_BATCH_ATTEMPTS times while it is up but rejects the rows
+        unsigned long long start = time_mono_us();
+        int attempts = 0;
+        while((rc = storage_batch_write_with_retry(sb, batch->packets, batch->count)) != 0 && !stop_flag){
+            if(sb->connected && ++attempts >= STORAGE_BATCH_ATTEMPTS) break;
+            LOG_WARN(STORAGE, "Holding %zu measurements, retrying in %d s", batch->count, RECONNECT_DELAY_SEC);
+            sleep(RECONNECT_DELAY_SEC);
+        }
+
+        if(rc == 0){
+            unsigned long long commit_us = time_mono_us() - start;
+            total_inserted += batch->count;
+            // New rows may leave the backend background work (e.g. folding)
+            idle_pending = 1;
+
+            log2_hist_add(&hist_rows, batch->count);
+            log2_hist_add(&hist_commit_ms, commit_us / 1000);
+            log2_hist_add(&hist_age_ms, time_mono_ms() - batch->first_ms);
+            storage_adapt_target(batch->count, commit_us);
+
+            // Batches commit in sequence order
+            if(batch->last_seq > 0){
+                journal_checkpoint(batch->last_seq);
+            }
+            
+            // Health check
+            health_check_counter += batch->count;
+            if(health_check_counter >= 1000){
+                if(storage_backend_health(sb) != 0){
+                    LOG_WARN(STORAGE, "Storage health check failed, attempting reconnect");
+                    if(storage_reconnect(sb, MAX_RECONNECT_ATTEMPTS) != 0){
+                        LOG_ERROR(STORAGE, "Fatal: unable to reconnect storage backend");
+                    }
+                }
+                health_check_counter = 0;
+            }
+        }
+        else if(stop_flag){
+            LOG_ERROR(STORAGE, "Stopping with %zu measurements unstored, left for journal replay", batch->count);
+            total_failed += batch->count;
+            checkpoint_frozen = 1;
+        }
+        else{
+            // The backend is up but keeps rejecting these rows; a replay
+            // would fail the same way, so the checkpoint moves past them
+            LOG_ERROR(STORAGE, "Lost %zu measurements rejected %d times by the backend", batch->count, attempts);
+            total_failed += batch->count;
+            if(batch->last_seq > 0){
+                journal_checkpoint(batch->last_seq);
+            }
+        }
+
+        // Periodic latency report, stalls show up here
+        if(time(NULL) - last_stats >= STORAGE_STATS_INTERVAL_SEC){
+            storage_backend_log_stats(sb);
+            storage_log_batch_stats();
+            last_stats = time(NULL);
+        }
+
+        storage_queue_put_free(batch);
+    }
+
+    storage_backend_log_stats(sb);
+    storage_log_batch_stats();
+    storage_backend_close(sb);
+    LOG_INFO(STORAGE, "Storage backend closed");
+
+    LOG_INFO(STORAGE, "Storage writer thread exiting");
+    return NULL;
+}
+
+/* ===========================
+ *   Collector thread
+ * =========================== */
+
 void *storage_manager_thread(void *arg){
     (void)arg;
     
-    log_event("[STORAGE] Storage manager thread started");
+    LOG_INFO(STORAGE, "Storage manager thread started");
     
     // Validate configuration
-    if(BATCH_SIZE > 1000){
-        log_event("[STORAGE] WARNING: BATCH_SIZE=%d exceeds recommended max (1000)", BATCH_SIZE);
-    }
-    if(BATCH_SIZE < 10){
-        log_event("[STORAGE] WARNING: BATCH_SIZE=%d too small, performance will suffer", BATCH_SIZE);
+    if(g_config.batch_min > g_config.batch_max){
+        LOG_WARN(STORAGE, "WARNING: batch_min=%d above batch_max=%d, using %d", g_config.batch_min, g_config.batch_max, g_config.batch_max);
+        g_config.batch_min = g_config.batch_max;
     }
+    batch_target = g_config.batch_min;
     
     // Calculate memory footprint
-    size_t batch_memory = BATCH_SIZE * sizeof(sensor_packet_t);
-    log_event("[STORAGE] Batch buffer size: %zu bytes (%zu packets)", batch_memory, (size_t)BATCH_SIZE);
+    size_t batch_memory = STORAGE_NUM_BATCHES * (size_t)g_config.batch_max * sizeof(sensor_packet_t);
+    LOG_INFO(STORAGE, "Batch buffer size: %zu bytes (%d x %d packets), max latency %d ms, commit goal %d ms",
+              batch_memory, STORAGE_NUM_BATCHES, g_config.batch_max, g_config.batch_max_latency_ms, g_config.batch_commit_goal_ms);
     
     // Initial connection
-    sqlite3 *db = storage_connect_db(MAX_RECONNECT_ATTEMPTS);
-    if(!db){
-        log_event("[SQL] Unable to connect to SQL server. Exiting gateway");
+    writer_backend = storage_connect(MAX_RECONNECT_ATTEMPTS);
+    if(!writer_backend){
+        LOG_ERROR(STORAGE, "Unable to open storage backend '%s'. Exiting gateway", g_config.storage_backend);
         exit(EXIT_FAILURE);
     }
+    startup_ready(STARTUP_STORAGE);
     
-    // Allocate batch buffer
-    sensor_packet_t *batch = malloc(BATCH_SIZE * sizeof(sensor_packet_t));
-    if(!batch){
-        log_event("[STORAGE] Failed to allocate batch buffer");
-        sqlite3_close(db);
+    // Allocate batch buffers
+    if(storage_queue_init() != 0){
+        LOG_ERROR(STORAGE, "Failed to allocate batch buffers");
+        storage_queue_free();
+        storage_backend_close(writer_backend);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t writer_thread;
+    int rc = pthread_create(&writer_thread, NULL, storage_writer_thread, NULL);
+    if(rc != 0){
+        LOG_ERROR(STORAGE, "Failed to start writer thread: %s", strerror(rc));
+        storage_queue_free();
+        storage_backend_close(writer_backend);
         exit(EXIT_FAILURE);
     }
     
-    size_t batch_count = 0;
-    size_t total_inserted = 0;
-    size_t total_failed = 0;
-    size_t health_check_counter = 0;
+    storage_batch_t *batch = storage_queue_get_free();
 
-    // Main processing loop
+    // Main collection loop
     while(!stop_flag){
-        // //Flush for the last packet
-        // if(batch_count > 0){
-        //     // flush batch
-        //     if(storage_batch_insert_with_retry(&db, batch, batch_count) == SQLITE_OK){
-        //         total_inserted += batch_count;
-        //     }
-        //     batch_count = 0;
-        // }
+        size_t target = __atomic_load_n(&batch_target, __ATOMIC_RELAXED);
+        int64_t max_latency = g_config.batch_max_latency_ms;
+
+        // Never wait past the deadline of the partial batch
+        int wait_ms = POLL_DELAY_MS;
+        if(batch->count > 0){
+            int64_t left = batch->first_ms + max_latency - time_mono_ms();
+            wait_ms = (left <= 0) ? 0 : (left < POLL_DELAY_MS ? (int)left : POLL_DELAY_MS);
+        }
 
         sbuffer_node_t *node;
-        while((node = sbuffer_find_for_storage(&sbuffer)) != NULL){
-            // Collect batch
-            if(batch_count < BATCH_SIZE){
-                batch[batch_count++] = node->pkt;
-                sbuffer_mark_storage_done(&sbuffer, node);
-            }
-            else{
-                // Buffer full, will process this node in next iteration
-                // Don't mark this node
-                break;
-            }
+        while(batch->count < target && (node = sbuffer_find_for_storage(&sbuffer, wait_ms)) != NULL){
+            if(batch->count == 0) batch->first_ms = time_mono_ms();
+            batch->packets[batch->count++] = node->pkt;
+            if(node->pkt.seq > batch->last_seq) batch->last_seq = node->pkt.seq;
+            sbuffer_mark_storage_done(&sbuffer, node);
         }
-        // Flush when batch is full
-        if(batch_count > 0){
-            if(storage_batch_insert_with_retry(&db, batch, batch_count) == SQLITE_OK){
-                total_inserted += batch_count;
-                
-                // Health check
-                health_check_counter += batch_count;
-                if(health_check_counter >= 1000){
-                    if(db_health_check(db) != 0){
-                        log_event("[STORAGE] Database health check failed, attempting reconnect");
-                        sqlite3_close(db);
-                        db = storage_connect_db(MAX_RECONNECT_ATTEMPTS);
-                        if(!db){
-                            log_event("[STORAGE] Fatal: unable to reconnect to database");
-                            break;
-                        }
-                    }
-                    health_check_counter = 0;
-                }
-                batch_count = 0;
-            }
-            else{
-                total_failed += batch_count;
-                batch_count = 0;
-            }
+
+        // Hand over at the target size or once the oldest packet is due
+        int64_t age = batch->count ? time_mono_ms() - batch->first_ms : 0;
+        if(batch->count >= target || (batch->count > 0 && age >= max_latency)){
+            storage_queue_put_full(batch);
+            batch = storage_queue_get_free();
+        }
+        else if(batch->count > 0){
+            int64_t left = max_latency - age;
+            usleep((left < STORAGE_COLLECT_POLL_MS ? left : STORAGE_COLLECT_POLL_MS) * 1000);
         }
         else{
             // No data available, sleep to avoid busy-waiting
@@ -162,27 +451,16 @@ void *storage_manager_thread(void *arg){
     }
     
     // Final flush
-    if(batch_count > 0){
-        log_event("[STORAGE] Flushing final batch of %zu measurements", batch_count);
-        int rc = storage_batch_insert_with_retry(&db, batch, batch_count);
-        if(rc == SQLITE_OK){
-            total_inserted += batch_count;
-        }
-        else{
-            total_failed += batch_count;
-        }
-        batch_count = 0;
-    }
-    
-    // Cleanup
-    free(batch);
-    
-    if(db){
-        sqlite3_close(db);
-        log_event("[SQL] Database connection closed");
+    if(batch->count > 0){
+        LOG_INFO(STORAGE, "Flushing final batch of %zu measurements", batch->count);
+        storage_queue_put_full(batch);
     }
+    storage_queue_close();
+
+    pthread_join(writer_thread, NULL);
+    storage_queue_free();
     
-    log_event("[STORAGE] Storage manager thread exiting. Stats: %zu inserted, %zu failed", total_inserted, total_failed);
+    LOG_INFO(STORAGE, "Storage manager thread exiting. Stats: %zu inserted, %zu failed", total_inserted, total_failed);
     
     return NULL;
-}
\ No newline at end of file
+}
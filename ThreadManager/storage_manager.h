@@ -5,12 +5,20 @@
 
 #define MAX_RECONNECT_ATTEMPTS 3
 #define RECONNECT_DELAY_SEC 1
-#define BATCH_SIZE 100
+#define STORAGE_BATCH_ATTEMPTS 3    // writes of a batch the open backend rejects before it is dropped
+#define STORAGE_NUM_BATCHES 2   // Batch buffers in flight between collector and writer
 #define POLL_DELAY_MS 100
+#define STORAGE_COLLECT_POLL_MS 10  // while a partial batch waits for its deadline
+#define STORAGE_STATS_INTERVAL_SEC 300
+
+// Batch sizing: the collector hands a batch over once it reaches the
+// current target size or its oldest packet has waited batch_max_latency_ms.
+// After every commit the writer moves the target toward batch_commit_goal_ms.
 
 extern volatile sig_atomic_t stop_flag;
 extern sbuffer_t sbuffer;
 
 void *storage_manager_thread(void *arg);
+size_t storage_batch_stats_format(char *out, size_t len);
 
 #endif
\ No newline at end of file